@@ -200,8 +200,10 @@ UsdImagingContourAdapter::UpdateForTime(UsdPrim const& prim,
     }
 
     _ContourData* contourData = _GetContourData(prim.GetPath());
-    std::vector<_ContourAdapterComputeDatas> datas(contourSurfaces.size());
-    UsdNprStrokeGraphList strokeGraphs(contourSurfaces.size());
+    std::vector<_ContourAdapterComputeDatas>& datas = contourData->datas;
+    UsdNprStrokeGraphList& strokeGraphs = contourData->graphs;
+    datas.resize(contourSurfaces.size());
+    strokeGraphs.resize(contourSurfaces.size());
     UsdNprStrokeParams strokeParams;
 
     size_t index = 0;
@@ -233,6 +235,12 @@ UsdImagingContourAdapter::UpdateForTime(UsdPrim const& prim,
 
         threadData->halfEdgeMesh = halfEdgeMesh.get();
         threadData->viewPointMatrix = viewMatrix;
+      } else {
+        // no mesh, the graph from a previous frame must not output strokes
+        strokeGraphs[index].Init(NULL, 
+          GfMatrix4f(viewMatrix), 
+          GfMatrix4f(projMatrix));
+        datas[index].graph = &strokeGraphs[index];
       }
       
       index++;
@@ -297,6 +305,10 @@ UsdImagingContourAdapter::_PopulateStrokeParams(UsdPrim const& prim,
 
 }
 
+// graphs write their strokes in parallel straight into the output arrays
+// at offsets from a prefix sum of their sizes, arrays are only reallocated
+// when they grow (the previous topology is released first so they aren't
+// shared anymore)
 void
 UsdImagingContourAdapter::_ComputeOutputGeometry(
   _ContourData* contourData, 
@@ -304,79 +316,71 @@ UsdImagingContourAdapter::_ComputeOutputGeometry(
   UsdImagingPrimvarDescCache* primvarDescCache, 
   SdfPath const& cachePath) const
 {
-  size_t numPoints = 0;
-  size_t numCounts = 0;
-  size_t numIndices = 0;
-  for(const auto& strokeGraph: strokeGraphs) {
-    size_t s = strokeGraph.GetNumStrokes();
-    size_t n = strokeGraph.GetNumNodes();
-    if(n>1) {
-      numPoints += n * 2;
-      numCounts += n - s;
-      numIndices += (n-s) * 4;
+  const size_t numGraphs = strokeGraphs.size();
+  std::vector<size_t> pointsOffsets(numGraphs + 1, 0);
+  std::vector<size_t> facesOffsets(numGraphs + 1, 0);
+  for(size_t g = 0; g < numGraphs; ++g) {
+    const UsdNprStrokeGraph& strokeGraph = strokeGraphs[g];
+    size_t numPoints = 0;
+    size_t numFaces = 0;
+    for(size_t s = 0; s < strokeGraph.GetNumStrokes(); ++s) {
+      const size_t numNodes = strokeGraph.GetStroke(s).GetNumNodes();
+      if(numNodes > 1) {
+        numPoints += numNodes * 2;
+        numFaces += numNodes - 1;
+      }
     }
+    pointsOffsets[g + 1] = pointsOffsets[g] + numPoints;
+    facesOffsets[g + 1] = facesOffsets[g] + numFaces;
   }
 
-  VtArray<int> faceVertexCounts(numCounts);
-  for(int i=0;i<numCounts;++i)faceVertexCounts[i] = 4;
-
-  VtArray<int> faceVertexIndices(numIndices);
-  contourData->points.resize(numPoints);
-
-  VtArray<GfVec3f> colors(numIndices);
-
-  size_t pointsIndex = 0;
-  size_t indicesIndex = 0;
-  size_t colorIndex = 0;
-  size_t offsetIndex = 0;
-
-  /*
-  GfVec3f color(
-        (float)rand() / float(RAND_MAX),
-        (float)rand() / float(RAND_MAX),
-        (float)rand() / float(RAND_MAX)
-      );
-  */ 
- //const GfVec3f color(0.1f, 0.1f, .1f);
-  for(const auto& strokeGraph: strokeGraphs) {
-    const UsdNprHalfEdgeMesh* mesh = strokeGraph.GetMesh();
-    GfVec3f viewPoint = strokeGraph.GetViewPoint();
-    for(const auto& stroke: strokeGraph.GetStrokes()) {
-      
-      size_t numNodes = stroke.GetNumNodes();
-      if(numNodes >1) {
-        size_t numPoints =  numNodes * 2;
-        if(numPoints) {
-          stroke.ComputeOutputPoints( mesh, viewPoint, 
-          &contourData->points[pointsIndex]);
-        }
-        pointsIndex += numPoints;
-       
-        size_t numIndices = (numNodes - 1) * 4;
-        if(numIndices) {
-          for(int i=0; i < numNodes - 1; ++i) {
-            faceVertexIndices[indicesIndex++] = offsetIndex + i * 2;
-            faceVertexIndices[indicesIndex++] = offsetIndex + i * 2 + 1;
-            faceVertexIndices[indicesIndex++] = offsetIndex + i * 2 + 3;
-            faceVertexIndices[indicesIndex++] = offsetIndex + i * 2 + 2;
-            const GfVec3f& color = stroke.GetNode(i)->color;
-            colors[colorIndex++] = color;
-            colors[colorIndex++] = color;
-            colors[colorIndex++] = color;
-            colors[colorIndex++] = color;
-          }
+  const size_t numCounts = facesOffsets[numGraphs];
+  const size_t numIndices = numCounts * 4;
+  contourData->topology = HdMeshTopology();
+
+  VtArray<int>& faceVertexCounts = contourData->faceVertexCounts;
+  if(faceVertexCounts.size() != numCounts)
+    faceVertexCounts.assign(numCounts, 4);
+  contourData->faceVertexIndices.resize(numIndices);
+  contourData->points.resize(pointsOffsets[numGraphs]);
+  contourData->colors.resize(numIndices);
+
+  int* faceVertexIndices = contourData->faceVertexIndices.data();
+  GfVec3f* points = contourData->points.data();
+  GfVec3f* colors = contourData->colors.data();
+
+  WorkParallelForN(numGraphs, [&](size_t begin, size_t end) {
+    for(size_t g = begin; g < end; ++g) {
+      const UsdNprStrokeGraph& strokeGraph = strokeGraphs[g];
+      const UsdNprHalfEdgeMesh* mesh = strokeGraph.GetMesh();
+      const GfVec3f viewPoint = strokeGraph.GetViewPoint();
+      size_t offsetIndex = pointsOffsets[g];
+      size_t indicesIndex = facesOffsets[g] * 4;
+
+      for(size_t s = 0; s < strokeGraph.GetNumStrokes(); ++s) {
+        const UsdNprStrokeChain& stroke = strokeGraph.GetStroke(s);
+        const size_t numNodes = stroke.GetNumNodes();
+        if(numNodes < 2) continue;
+
+        stroke.ComputeOutputPoints(mesh, viewPoint, &points[offsetIndex]);
+        for(size_t i = 0; i < numNodes - 1; ++i) {
+          const GfVec3f& color = stroke.GetNode(i)->color;
+          for(size_t c = 0; c < 4; ++c)
+            colors[indicesIndex + c] = color;
+          faceVertexIndices[indicesIndex++] = offsetIndex + i * 2;
+          faceVertexIndices[indicesIndex++] = offsetIndex + i * 2 + 1;
+          faceVertexIndices[indicesIndex++] = offsetIndex + i * 2 + 3;
+          faceVertexIndices[indicesIndex++] = offsetIndex + i * 2 + 2;
         }
         offsetIndex += numNodes * 2;
       }
     }
-  }
+  });
 
   contourData->topology = HdMeshTopology(PxOsdOpenSubdivTokens->none,
                                          UsdGeomTokens->rightHanded,
                                          faceVertexCounts,
-                                         faceVertexIndices);
-
-  contourData->colors = colors;
+                                         contourData->faceVertexIndices);
 }
 
 struct _DebugMesh{
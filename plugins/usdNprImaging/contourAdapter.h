@@ -150,10 +150,16 @@ public:
        
 private:
   /// Data for a contour instance.
+  /// Graphs, compute datas and output arrays are kept from frame to
+  /// frame and only reallocated when they grow.
   struct _ContourData {
     UsdNprHalfEdgeMeshMap           halfEdgeMeshes;
+    std::vector<_ContourAdapterComputeDatas> datas;
+    UsdNprStrokeGraphList           graphs;
     VtArray<GfVec3f>                points;
     VtArray<GfVec3f>                colors;
+    VtArray<int>                    faceVertexCounts;
+    VtArray<int>                    faceVertexIndices;
     HdMeshTopology                  topology;
   };
 
@@ -8,6 +8,9 @@
 #include "mesh.h"
 #include "utils.h"
 #include "stroke.h"
+#include "pxr/base/work/loops.h"
+#include <algorithm>
+#include <cmath>
 #include <iostream>
 
 PXR_NAMESPACE_OPEN_SCOPE
@@ -117,6 +120,9 @@ UsdNprHalfEdgeMesh::UsdNprHalfEdgeMesh(const SdfPath& path,
   const HdDirtyBits& varyingBits)
   :_varyingBits(_ConvertVaryingBits(varyingBits))
   , _sdfPath(path)
+  , _classified(false)
+  , _creaseValue(0.f)
+  , _clustered(false)
 {
 };
     
@@ -150,6 +156,8 @@ void UsdNprHalfEdgeMesh::Init(const UsdGeomMesh& mesh, const UsdTimeCode& timeCo
 
   _numTriangles = triangles.size() / 3;
   _numPolygons = faceVertexCounts.size();
+  _classified = false;
+  _clustered = false;
   
   _halfEdges.resize(faceVertexIndices.size());
 
@@ -228,6 +236,259 @@ void UsdNprHalfEdgeMesh::Update(const UsdGeomMesh& mesh, const UsdTimeCode& time
     _polygonNormals,
     _vertexNormals
   );
+  _classified = false;
+}
+
+void UsdNprHalfEdgeMesh::ClassifyEdges(float creaseValue)
+{
+  if(_classified && creaseValue == _creaseValue) return;
+
+  const GfVec3f* polygonNormals = GetPolygonNormalsPtr();
+  const float threshold = 1.f - creaseValue;
+  _edgeFlags.resize(_halfEdges.size());
+  WorkParallelForN(_halfEdges.size(), [&](size_t begin, size_t end) {
+    for(size_t e = begin; e < end; ++e) {
+      const UsdNprHalfEdge& halfEdge = _halfEdges[e];
+      short flags = 0;
+      if(!halfEdge.twin) flags = EDGE_BOUNDARY;
+      else if(halfEdge.twin->polygon < halfEdge.polygon) flags = EDGE_TWIN;
+      else if(creaseValue >= 0.f && 
+        GfAbs(GfDot(polygonNormals[halfEdge.polygon], 
+                    polygonNormals[halfEdge.twin->polygon])) < threshold)
+        flags = EDGE_CREASE;
+      _edgeFlags[e] = flags;
+    }
+  });
+
+  UsdNprCompactHalfEdges(_halfEdges, _edgeFlags, EDGE_BOUNDARY, _boundaries);
+  UsdNprCompactHalfEdges(_halfEdges, _edgeFlags, EDGE_CREASE, _creases);
+  _creaseValue = creaseValue;
+  _classified = true;
+
+  if(!_clustered) _BuildEdgeClusters();
+  else _RefitEdgeClusters();
+}
+
+static const size_t _CLUSTER_LEAF_SIZE = 64;
+static const size_t _CLUSTER_BRANCH_SIZE = 8;
+static const size_t _CLUSTER_STACK_SIZE = 128;
+static const float _HALF_PI = 1.5707963f;
+static const float _PI = 3.1415927f;
+
+static inline uint32_t
+_ExpandBits(uint32_t v)
+{
+  v = (v * 0x00010001u) & 0xFF0000FFu;
+  v = (v * 0x00000101u) & 0x0F00F00Fu;
+  v = (v * 0x00000011u) & 0xC30C30C3u;
+  v = (v * 0x00000005u) & 0x49249249u;
+  return v;
+}
+
+static inline uint32_t
+_MortonCode(const GfVec3f& p, const GfVec3f& origin, const GfVec3f& scale)
+{
+  uint32_t code = 0;
+  for(size_t d = 0; d < 3; ++d) {
+    const float c = GfClamp((p[d] - origin[d]) * scale[d], 0.f, 1023.f);
+    code |= _ExpandBits((uint32_t)c) << (2 - d);
+  }
+  return code;
+}
+
+// candidate silhouette edges (neither boundary nor twin) sorted along a
+// morton curve of their midpoints so leaves gather neighbouring edges,
+// nodes are stored level after level, the root is the last node
+void UsdNprHalfEdgeMesh::_BuildEdgeClusters()
+{
+  _clusters.clear();
+  _clusterEdges.clear();
+  _clustered = true;
+
+  const GfVec3f* positions = GetPositionsPtr();
+  GfRange3f range;
+  for(size_t p = 0; p < _positions.size(); ++p)
+    range.UnionWith(positions[p]);
+  if(range.IsEmpty()) return;
+
+  const GfVec3f origin = range.GetMin();
+  const GfVec3f size = range.GetSize();
+  const GfVec3f scale(
+    size[0] > 0.f ? 1023.f / size[0] : 0.f,
+    size[1] > 0.f ? 1023.f / size[1] : 0.f,
+    size[2] > 0.f ? 1023.f / size[2] : 0.f);
+
+  std::vector<std::pair<uint32_t, uint32_t>> keys;
+  keys.reserve(_halfEdges.size());
+  for(const UsdNprHalfEdge& halfEdge: _halfEdges) {
+    if(_edgeFlags[halfEdge.index] & (EDGE_BOUNDARY | EDGE_TWIN)) continue;
+    const GfVec3f middle = 
+      (positions[halfEdge.vertex] + positions[halfEdge.next->vertex]) * 0.5f;
+    keys.push_back({_MortonCode(middle, origin, scale), halfEdge.index});
+  }
+  std::sort(keys.begin(), keys.end());
+
+  _clusterEdges.resize(keys.size());
+  for(size_t k = 0; k < keys.size(); ++k)
+    _clusterEdges[k] = keys[k].second;
+
+  for(size_t e = 0; e < _clusterEdges.size(); e += _CLUSTER_LEAF_SIZE) {
+    UsdNprEdgeCluster cluster;
+    cluster.begin = e;
+    cluster.end = std::min(e + _CLUSTER_LEAF_SIZE, _clusterEdges.size());
+    cluster.leaf = true;
+    _clusters.push_back(cluster);
+  }
+
+  size_t levelBegin = 0;
+  size_t levelEnd = _clusters.size();
+  while(levelEnd - levelBegin > 1) {
+    for(size_t c = levelBegin; c < levelEnd; c += _CLUSTER_BRANCH_SIZE) {
+      UsdNprEdgeCluster cluster;
+      cluster.begin = c;
+      cluster.end = std::min(c + _CLUSTER_BRANCH_SIZE, levelEnd);
+      cluster.leaf = false;
+      _clusters.push_back(cluster);
+    }
+    levelBegin = levelEnd;
+    levelEnd = _clusters.size();
+  }
+
+  _RefitEdgeClusters();
+}
+
+// leaves are refit in parallel, children are stored before their parent
+void UsdNprHalfEdgeMesh::_RefitEdgeClusters()
+{
+  const GfVec3f* positions = GetPositionsPtr();
+  const GfVec3f* normals = GetVertexNormalsPtr();
+  const size_t numLeaves = 
+    (_clusterEdges.size() + _CLUSTER_LEAF_SIZE - 1) / _CLUSTER_LEAF_SIZE;
+
+  WorkParallelForN(numLeaves, [&](size_t begin, size_t end) {
+    for(size_t c = begin; c < end; ++c) {
+      UsdNprEdgeCluster& cluster = _clusters[c];
+      cluster.range = GfRange3f();
+      GfVec3f axis(0.f);
+      for(size_t e = cluster.begin; e < cluster.end; ++e) {
+        const UsdNprHalfEdge& halfEdge = _halfEdges[_clusterEdges[e]];
+        cluster.range.UnionWith(positions[halfEdge.vertex]);
+        cluster.range.UnionWith(positions[halfEdge.next->vertex]);
+        axis += normals[halfEdge.vertex] + normals[halfEdge.next->vertex];
+      }
+
+      // degenerate normals, the cone covers every direction
+      cluster.axis = GfVec3f(0.f);
+      cluster.angle = _PI;
+      if(axis.Normalize() < 1e-6f) continue;
+      float minDot = 1.f;
+      for(size_t e = cluster.begin; e < cluster.end; ++e) {
+        const UsdNprHalfEdge& halfEdge = _halfEdges[_clusterEdges[e]];
+        minDot = std::min(minDot, std::min(
+          GfDot(axis, normals[halfEdge.vertex].GetNormalized()), 
+          GfDot(axis, normals[halfEdge.next->vertex].GetNormalized())));
+      }
+      cluster.axis = axis;
+      cluster.angle = std::acos(GfClamp(minDot, -1.f, 1.f));
+    }
+  });
+
+  for(size_t c = numLeaves; c < _clusters.size(); ++c) {
+    UsdNprEdgeCluster& cluster = _clusters[c];
+    cluster.range = GfRange3f();
+    GfVec3f axis(0.f);
+    for(size_t child = cluster.begin; child < cluster.end; ++child) {
+      cluster.range.UnionWith(_clusters[child].range);
+      axis += _clusters[child].axis;
+    }
+
+    cluster.axis = GfVec3f(0.f);
+    cluster.angle = _PI;
+    if(axis.Normalize() < 1e-6f) continue;
+    float angle = 0.f;
+    for(size_t child = cluster.begin; child < cluster.end; ++child) {
+      const UsdNprEdgeCluster& node = _clusters[child];
+      angle = std::max(angle, node.angle + 
+        std::acos(GfClamp(GfDot(axis, node.axis), -1.f, 1.f)));
+    }
+    cluster.axis = axis;
+    cluster.angle = std::min(angle, _PI);
+  }
+}
+
+// the view directions to the cluster bounds lie in a cone around the
+// direction to its center, the cluster is one sided when the angle between
+// any normal and any view direction stays on one side of 90 degrees
+static bool
+_IsOneSided(const UsdNprEdgeCluster& cluster, const GfVec3f& viewPoint)
+{
+  if(cluster.angle >= _HALF_PI) return false;
+
+  const float radius = cluster.range.GetSize().GetLength() * 0.5f;
+  GfVec3f dir = cluster.range.GetMidpoint() - viewPoint;
+  const float distance = dir.Normalize();
+  if(distance <= radius) return false;
+
+  const float spread = cluster.angle + std::asin(radius / distance) + 1e-3f;
+  const float angle = std::acos(GfClamp(GfDot(cluster.axis, dir), -1.f, 1.f));
+  return angle + spread < _HALF_PI || angle - spread > _HALF_PI;
+}
+
+void UsdNprHalfEdgeMesh::CullEdgeClusters(const GfVec3f& viewPoint, 
+  std::vector<uint32_t>& clusters) const
+{
+  clusters.clear();
+  if(_clusters.empty()) return;
+
+  // each level leaves at most branch size - 1 siblings on the stack
+  uint32_t stack[_CLUSTER_STACK_SIZE];
+  size_t top = 0;
+  stack[top++] = _clusters.size() - 1;
+  while(top) {
+    const uint32_t index = stack[--top];
+    const UsdNprEdgeCluster& cluster = _clusters[index];
+    if(_IsOneSided(cluster, viewPoint)) continue;
+
+    if(cluster.leaf) clusters.push_back(index);
+    else for(uint32_t child = cluster.begin; child < cluster.end; ++child)
+      stack[top++] = child;
+  }
+}
+
+static const size_t _COMPACT_BLOCK_SIZE = 4096;
+
+void UsdNprCompactHalfEdges(const std::vector<UsdNprHalfEdge>& halfEdges,
+  const std::vector<short>& flags, short mask,
+  std::vector<const UsdNprHalfEdge*>& result)
+{
+  const size_t numHalfEdges = halfEdges.size();
+  const size_t numBlocks = 
+    (numHalfEdges + _COMPACT_BLOCK_SIZE - 1) / _COMPACT_BLOCK_SIZE;
+  std::vector<size_t> offsets(numBlocks + 1, 0);
+
+  WorkParallelForN(numBlocks, [&](size_t begin, size_t end) {
+    for(size_t b = begin; b < end; ++b) {
+      const size_t last = std::min((b + 1) * _COMPACT_BLOCK_SIZE, numHalfEdges);
+      size_t count = 0;
+      for(size_t e = b * _COMPACT_BLOCK_SIZE; e < last; ++e)
+        count += (flags[e] & mask) != 0;
+      offsets[b + 1] = count;
+    }
+  });
+
+  // exclusive prefix sum, blocks write their matches at their offset
+  for(size_t b = 0; b < numBlocks; ++b)
+    offsets[b + 1] += offsets[b];
+  result.resize(offsets[numBlocks]);
+
+  WorkParallelForN(numBlocks, [&](size_t begin, size_t end) {
+    for(size_t b = begin; b < end; ++b) {
+      const size_t last = std::min((b + 1) * _COMPACT_BLOCK_SIZE, numHalfEdges);
+      size_t offset = offsets[b];
+      for(size_t e = b * _COMPACT_BLOCK_SIZE; e < last; ++e)
+        if(flags[e] & mask) result[offset++] = &halfEdges[e];
+    }
+  });
 }
 
 
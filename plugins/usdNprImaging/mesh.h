@@ -15,6 +15,7 @@
 #include "pxr/base/gf/vec4d.h"
 #include "pxr/base/gf/matrix4f.h"
 #include "pxr/base/gf/matrix4d.h"
+#include "pxr/base/gf/range3f.h"
 #include "pxr/usd/usdGeom/mesh.h"
 #include "pxr/imaging/hd/types.h"
 #include "pxr/imaging/hd/changeTracker.h"
@@ -22,6 +23,7 @@
 
 #include <vector>
 #include <memory>
+#include <mutex>
 
 
 PXR_NAMESPACE_OPEN_SCOPE
@@ -29,6 +31,13 @@ PXR_NAMESPACE_OPEN_SCOPE
 struct UsdNprStrokeNode;
 struct UsdNprStrokeParams;
 struct UsdNprEdgeClassification;
+struct UsdNprHalfEdge;
+
+// gather the half-edges whose flags match the mask, in index order
+// (parallel count per block, prefix sum of the counts, parallel fill)
+void UsdNprCompactHalfEdges(const std::vector<UsdNprHalfEdge>& halfEdges,
+  const std::vector<short>& flags, short mask,
+  std::vector<const UsdNprHalfEdge*>& result);
   
 
 enum UsdHalfEdgeMeshVaryingBits {
@@ -65,6 +74,18 @@ struct UsdNprHalfEdge
     GfVec3f& normal);
 };
 
+// node of the silhouette cone tree, bounds of the edges points and cone of
+// their vertex normals, leaves index the cluster edges, nodes their children
+struct UsdNprEdgeCluster
+{
+  GfRange3f               range;
+  GfVec3f                 axis = GfVec3f(0.f);
+  float                   angle = 3.1415927f;  // cone half angle (radians)
+  uint32_t                begin = 0;
+  uint32_t                end = 0;
+  bool                    leaf = false;
+};
+
 /// \class UsdNprHalfEdgeMesh
 ///
 class UsdNprHalfEdgeMesh
@@ -84,6 +105,20 @@ public:
   size_t GetNumTriangles() const {return _numTriangles;};
   size_t GetNumHalfEdges() const {return _halfEdges.size();};
 
+  // view independent classification (boundary, twin, crease), cached until
+  // the topology or the points change
+  void ClassifyEdges(float creaseValue);
+  const std::vector<short>& GetEdgeFlags() const {return _edgeFlags;};
+  const std::vector<const UsdNprHalfEdge*>& GetBoundaries() const {return _boundaries;};
+  const std::vector<const UsdNprHalfEdge*>& GetCreases() const {return _creases;};
+
+  // leaf clusters that may hold a silhouette seen from the view point,
+  // clusters facing or backing the view entirely are rejected as a whole
+  void CullEdgeClusters(const GfVec3f& viewPoint, 
+    std::vector<uint32_t>& clusters) const;
+  const UsdNprEdgeCluster& GetEdgeCluster(size_t index) const {return _clusters[index];};
+  const uint32_t* GetClusterEdgesPtr() const {return _clusterEdges.data();};
+
   // object
   const SdfPath& GetPath(){return _sdfPath;};
 
@@ -107,6 +142,9 @@ public:
   std::mutex& GetMutex(){return _mutex;};
 
 private:
+  void _BuildEdgeClusters();
+  void _RefitEdgeClusters();
+
   SdfPath                     _sdfPath;
   GfMatrix4f                  _xform;
   size_t                      _numTriangles;
@@ -117,6 +155,18 @@ private:
   VtArray<GfVec3f>            _vertexNormals;
   char                        _varyingBits;
   double                      _lastTime;
+
+  // cached classification
+  bool                        _classified;
+  float                       _creaseValue;
+  std::vector<short>          _edgeFlags;
+  std::vector<const UsdNprHalfEdge*> _boundaries;
+  std::vector<const UsdNprHalfEdge*> _creases;
+
+  // cone tree, built once per topology and refit on deform
+  bool                        _clustered;
+  std::vector<UsdNprEdgeCluster> _clusters;
+  std::vector<uint32_t>       _clusterEdges;
   mutable std::mutex          _mutex;
 
 };
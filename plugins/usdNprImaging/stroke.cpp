@@ -3,6 +3,8 @@
 //
 #include "stroke.h"
 #include "mesh.h"
+#include "pxr/base/work/loops.h"
+#include <cmath>
 #include <iostream>
 
 PXR_NAMESPACE_OPEN_SCOPE
@@ -13,6 +15,7 @@ void UsdNprStrokeChain::FromEdge(UsdNprHalfEdge* edge, float width,
   _start = edge;
   _type = EDGE_SILHOUETTE;
   _width = width;
+  _nodes.clear();
   _nodes.push_back(UsdNprStrokeNode(edge, width, 
     positions[edge->vertex], normals[edge->vertex], color));
   _nodes.push_back(UsdNprStrokeNode(edge->next, width,
@@ -26,20 +29,20 @@ void UsdNprStrokeChain::Init(UsdNprHalfEdge* edge, short type,
   _start = edge;
   _type = type;
   _width = width;
+  _nodes.clear();
   _nodes.push_back(UsdNprStrokeNode(_start, 1.0, position, normal, color));
 }
 
 static UsdNprHalfEdge* 
-_GetNextEdge(UsdNprHalfEdge* edge, const std::vector<short>& classifications, 
-  short type)
+_GetNextEdge(UsdNprHalfEdge* edge, const UsdNprStrokeGraph* graph, short type)
 {
   UsdNprHalfEdge* next = edge->next;
   while(next != edge)
   {
-    if(!(classifications[next->index] & EDGE_CHAINED)) {
-      short flags = classifications[next->index];
+    short flags = graph->GetEdgeFlags(next->index);
+    if(!(flags & EDGE_CHAINED)) {
       if(flags & EDGE_TWIN) {
-        flags = classifications[next->twin->index];
+        flags = graph->GetEdgeFlags(next->twin->index);
       } 
       if(flags & type){
         return next;
@@ -51,10 +54,10 @@ _GetNextEdge(UsdNprHalfEdge* edge, const std::vector<short>& classifications,
     next = edge->twin->next;
     while(next != edge->twin)
     {
-      if(!(classifications[next->index] & EDGE_CHAINED)) {
-        short flags = classifications[next->index];
+      short flags = graph->GetEdgeFlags(next->index);
+      if(!(flags & EDGE_CHAINED)) {
         if(flags & EDGE_TWIN) {
-          flags = classifications[next->twin->index];
+          flags = graph->GetEdgeFlags(next->twin->index);
         }
         if(flags & type) {
           return next;
@@ -66,13 +69,12 @@ _GetNextEdge(UsdNprHalfEdge* edge, const std::vector<short>& classifications,
   return NULL;
 }
 
-void UsdNprStrokeChain::Build(const UsdNprStrokeGraph* graph,
-  std::vector<short>& classifications, short type)
+void UsdNprStrokeChain::Build(UsdNprStrokeGraph* graph, short type)
 {
   UsdNprStrokeNode* node = &_nodes.back();
   UsdNprHalfEdge* edge = node->edge;
-  classifications[edge->index] |= EDGE_CHAINED;
-  if(edge->twin)classifications[edge->twin->index] |= EDGE_CHAINED;
+  graph->MarkEdgeChained(edge->index);
+  if(edge->twin)graph->MarkEdgeChained(edge->twin->index);
   UsdNprHalfEdge* current = edge;
   const UsdNprHalfEdgeMesh* mesh = graph->GetMesh();
   const GfVec3f* positions = mesh->GetPositionsPtr();
@@ -81,13 +83,13 @@ void UsdNprStrokeChain::Build(const UsdNprStrokeGraph* graph,
   while(true)
   {
     UsdNprHalfEdge* last = _nodes.back().edge;
-    UsdNprHalfEdge* next = _GetNextEdge(current, classifications, type);
+    UsdNprHalfEdge* next = _GetNextEdge(current, graph, type);
     GfVec3f position, normal, color;
 
     if(next)
     {
       if(edgesWeighted) {
-        if(classifications[next->index] & EDGE_TWIN){
+        if(graph->GetEdgeFlags(next->index) & EDGE_TWIN){
           float weight = graph->GetSilhouetteWeight(next->twin->index);
           next->twin->GetWeightedPositionAndNormal(positions, normals, 
             weight, position, normal);
@@ -109,8 +111,8 @@ void UsdNprStrokeChain::Build(const UsdNprStrokeGraph* graph,
         _nodes.push_back(UsdNprStrokeNode(next, 5.0,
           positions[next->next->vertex], normals[next->next->vertex], color));
       }
-      classifications[next->index] |= EDGE_CHAINED;
-      if(next->twin)classifications[next->twin->index] |= EDGE_CHAINED;
+      graph->MarkEdgeChained(next->index);
+      if(next->twin)graph->MarkEdgeChained(next->twin->index);
       if(next == edge || next == edge->twin)return;
       else current = next;
     }
@@ -146,63 +148,133 @@ UsdNprStrokeGraph::Init(UsdNprHalfEdgeMesh* mesh, const GfMatrix4f& view, const
   _mesh = mesh;
   _viewMatrix = view;
   _projectionMatrix = proj;
-
-  size_t numHalfEdges = _mesh->GetNumHalfEdges();
-  _allFlags.resize(numHalfEdges);
-  memset(&_allFlags[0], 0, numHalfEdges * sizeof(short));
-
+  _silhouettes.clear();
+  ClearStrokeChains();
 }
 
+static const float _CREASE_VALUE = 0.25f;
+
 void
 UsdNprStrokeGraph::Prepare(const UsdNprStrokeParams& params)
 {
-  // classify edges
+  // boundaries and creases don't depend on the view, cached on the mesh
+  {
+    std::lock_guard<std::mutex> lock(_mesh->GetMutex());
+    _mesh->ClassifyEdges(_CREASE_VALUE);
+  }
+
   const GfVec3f viewPoint = _mesh->GetMatrix().GetInverse().Transform(
     GfVec3f(_viewMatrix[3][0],_viewMatrix[3][1],_viewMatrix[3][2])
   );
 
   const GfVec3f* positions = _mesh->GetPositionsPtr();
   const GfVec3f* vertexNormals = _mesh->GetVertexNormalsPtr();
-  const GfVec3f* polygonNormals = _mesh->GetPolygonNormalsPtr();
-
-  size_t edgeIndex = 0;
   const std::vector<UsdNprHalfEdge>& halfEdges = _mesh->GetHalfEdges();
-  size_t numHalfEdges = halfEdges.size();
-  _silhouetteWeights.resize(numHalfEdges);
-  memset(&_silhouetteWeights[0], 0.f, numHalfEdges * sizeof(float));
-  float weight;
-  for(auto& halfEdge: halfEdges)
-  {
-    short flags = halfEdge.GetFlags(positions, vertexNormals, 
-      polygonNormals, viewPoint, 0.25, &weight);
-    
-    _allFlags[edgeIndex++] = flags;
-    if(flags & EDGE_BOUNDARY)
-      _boundaries.push_back(&halfEdge);
-    else
-    {
-      if(flags & EDGE_TWIN) continue;
-      if(flags & EDGE_CREASE) 
-        _creases.push_back(&halfEdge);
-      if(flags & EDGE_SILHOUETTE) {
-        _silhouettes.push_back(&halfEdge);
-        _silhouetteWeights[halfEdge.index] = weight;
+  const size_t numHalfEdges = halfEdges.size();
+
+  // the cached flags are read from the mesh, the view dependent states are
+  // only reset on the edges marked by the previous call
+  _edgeFlags = _mesh->GetEdgeFlags().data();
+  if(_edgeStates.size() != numHalfEdges) {
+    _edgeStates.assign(numHalfEdges, 0);
+    _silhouetteWeights.resize(numHalfEdges);
+  } else for(uint32_t index: _markedEdges)
+    _edgeStates[index] = 0;
+  _markedEdges.clear();
+
+  // facing is computed once per vertex, an edge is a silhouette when its
+  // two vertices face opposite sides
+  const size_t numPoints = _mesh->GetNumPoints();
+  _facing.resize(numPoints);
+  float* facing = _facing.data();
+  WorkParallelForN(numPoints, [&](size_t begin, size_t end) {
+    for(size_t p = begin; p < end; ++p) {
+      const GfVec3f dir = positions[p] - viewPoint;
+      const float length = dir.GetLength();
+      facing[p] = length > 0.f ? 
+        GfDot(vertexNormals[p], dir) / length : 0.f;
+    }
+  });
+
+  // only edges of the clusters the cone tree can't reject are tested
+  _mesh->CullEdgeClusters(viewPoint, _clusters);
+
+  const uint32_t* clusterEdges = _mesh->GetClusterEdgesPtr();
+  _offsets.resize(_clusters.size() + 1);
+  _offsets[0] = 0;
+  WorkParallelForN(_clusters.size(), [&](size_t begin, size_t end) {
+    for(size_t c = begin; c < end; ++c) {
+      const UsdNprEdgeCluster& cluster = _mesh->GetEdgeCluster(_clusters[c]);
+      size_t count = 0;
+      for(size_t e = cluster.begin; e < cluster.end; ++e) {
+        const UsdNprHalfEdge& halfEdge = halfEdges[clusterEdges[e]];
+        const float weight1 = facing[halfEdge.vertex];
+        const float weight2 = facing[halfEdge.twin->vertex];
+        if((weight1 > 0.f) != (weight2 > 0.f)) {
+          _edgeStates[halfEdge.index] |= EDGE_SILHOUETTE;
+          _silhouetteWeights[halfEdge.index] = 1.f - 
+            std::fabs(weight1) / (std::fabs(weight1) + std::fabs(weight2));
+          count++;
+        }
       }
+      _offsets[c + 1] = count;
     }
-  }
+  });
+
+  // prefix sum of the clusters counts, clusters fill their range
+  for(size_t c = 0; c < _clusters.size(); ++c)
+    _offsets[c + 1] += _offsets[c];
+  _silhouettes.resize(_offsets.back());
+  _markedEdges.resize(_offsets.back());
+
+  WorkParallelForN(_clusters.size(), [&](size_t begin, size_t end) {
+    for(size_t c = begin; c < end; ++c) {
+      const UsdNprEdgeCluster& cluster = _mesh->GetEdgeCluster(_clusters[c]);
+      size_t offset = _offsets[c];
+      for(size_t e = cluster.begin; e < cluster.end; ++e)
+        if(_edgeStates[clusterEdges[e]] & EDGE_SILHOUETTE) {
+          _silhouettes[offset] = &halfEdges[clusterEdges[e]];
+          _markedEdges[offset++] = clusterEdges[e];
+        }
+    }
+  });
+}
+
+const std::vector<const UsdNprHalfEdge*>*
+UsdNprStrokeGraph::_GetEdges(short edgeType) const
+{
+  if(edgeType == EDGE_SILHOUETTE)return &_silhouettes;
+  else if(edgeType == EDGE_BOUNDARY)return &_mesh->GetBoundaries();
+  else if(edgeType == EDGE_CREASE)return &_mesh->GetCreases();
+  else return NULL;
 }
 
 void
 UsdNprStrokeGraph::ResetChainedFlag(const std::vector<const UsdNprHalfEdge*>& edges)
 {
   for(const auto& edge: edges)
-    _allFlags[edge->index] &= ~EDGE_CHAINED;
+    _edgeStates[edge->index] &= ~EDGE_CHAINED;
+}
+
+void
+UsdNprStrokeGraph::MarkEdgeChained(size_t index)
+{
+  if(!_edgeStates[index]) _markedEdges.push_back(index);
+  _edgeStates[index] |= EDGE_CHAINED;
 }
 
 void 
 UsdNprStrokeGraph::ClearStrokeChains()
 {
-  _strokes.clear();
+  _numStrokes = 0;
+}
+
+UsdNprStrokeChain&
+UsdNprStrokeGraph::_NextStroke()
+{
+  if(_numStrokes == _strokes.size())
+    _strokes.emplace_back();
+  return _strokes[_numStrokes++];
 }
 
 void 
@@ -210,11 +282,8 @@ UsdNprStrokeGraph::BuildRawStrokes(short edgeType, const GfVec3f& color)
 {
   const GfVec3f* positions = _mesh->GetPositionsPtr();
   const GfVec3f* normals = _mesh->GetVertexNormalsPtr();
-  std::vector<const UsdNprHalfEdge*>* edges;
-  if(edgeType == EDGE_SILHOUETTE)edges = &_silhouettes;
-  else if(edgeType == EDGE_BOUNDARY)edges = &_boundaries;
-  else if(edgeType == EDGE_CREASE)edges = &_creases;
-  else return;
+  const std::vector<const UsdNprHalfEdge*>* edges = _GetEdges(edgeType);
+  if(!edges) return;
 
   size_t numEdges = (*edges).size();
   
@@ -223,9 +292,7 @@ UsdNprStrokeGraph::BuildRawStrokes(short edgeType, const GfVec3f& color)
     while(startId < numEdges)
     {
       UsdNprHalfEdge* currentEdge = (UsdNprHalfEdge*)(*edges)[startId];
-      UsdNprStrokeChain stroke;
-      stroke.FromEdge(currentEdge, 0.1f, positions, normals, color);
-      _strokes.push_back(stroke);
+      _NextStroke().FromEdge(currentEdge, 0.1f, positions, normals, color);
       startId++;
     }
   }
@@ -236,15 +303,9 @@ UsdNprStrokeGraph::BuildStrokeChains(short edgeType, const GfVec3f& color)
 {
   const GfVec3f* positions = _mesh->GetPositionsPtr();
   const GfVec3f* normals = _mesh->GetVertexNormalsPtr();
-  std::vector<const UsdNprHalfEdge*>* edges;
-  bool edgesWeighted = false;
-  if(edgeType == EDGE_SILHOUETTE) {
-    edges = &_silhouettes;
-    edgesWeighted = true;
-  }
-  else if(edgeType == EDGE_BOUNDARY)edges = &_boundaries;
-  else if(edgeType == EDGE_CREASE)edges = &_creases;
-  else return;
+  const std::vector<const UsdNprHalfEdge*>* edges = _GetEdges(edgeType);
+  if(!edges) return;
+  bool edgesWeighted = (edgeType == EDGE_SILHOUETTE);
 
   ResetChainedFlag(*edges);
   size_t numEdges = (*edges).size();
@@ -254,10 +315,10 @@ UsdNprStrokeGraph::BuildStrokeChains(short edgeType, const GfVec3f& color)
     while(startId < numEdges)
     {
       UsdNprHalfEdge* currentEdge = (UsdNprHalfEdge*)(*edges)[startId];
-      if(!(_allFlags[currentEdge->index] & EDGE_CHAINED)) {
-        UsdNprStrokeChain stroke;
+      if(!(GetEdgeFlags(currentEdge->index) & EDGE_CHAINED)) {
+        UsdNprStrokeChain& stroke = _NextStroke();
         if(edgesWeighted) {
-          if(_allFlags[currentEdge->index] & EDGE_TWIN) {
+          if(GetEdgeFlags(currentEdge->index) & EDGE_TWIN) {
             float weight = _silhouetteWeights[currentEdge->twin->index];
             GfVec3f position, normal;
             currentEdge->twin->GetWeightedPositionAndNormal(positions, normals,
@@ -279,9 +340,9 @@ UsdNprStrokeGraph::BuildStrokeChains(short edgeType, const GfVec3f& color)
         }
           
 
-        stroke.Build(this, _allFlags, edgeType);
-        if(stroke.GetNumNodes()>1)
-          _strokes.push_back(stroke);
+        stroke.Build(this, edgeType);
+        if(stroke.GetNumNodes()<=1)
+          _numStrokes--;
       }
       else startId++;
     }
@@ -298,8 +359,8 @@ size_t
 UsdNprStrokeGraph::GetNumNodes() const
 {
   size_t numNodes = 0;
-  for(const auto& stroke: _strokes)
-      numNodes += stroke.GetNumNodes();
+  for(size_t s = 0; s < _numStrokes; ++s)
+      numNodes += _strokes[s].GetNumNodes();
   return numNodes;
 }
 
@@ -80,10 +80,10 @@ typedef std::vector<UsdNprStrokeNode> UsdNprStrokeNodeList;
 class UsdNprStrokeGraph;
 class UsdNprStrokeChain {
 public:
+  void Clear() {_nodes.clear();};
   void Init(UsdNprHalfEdge* edge, short type, float width,
     const GfVec3f& position, const GfVec3f& normal, const GfVec3f& color);
-  void Build(const UsdNprStrokeGraph* graph, 
-    std::vector<short>& edgeClassification, short type);
+  void Build(UsdNprStrokeGraph* graph, short type);
 
   void FromEdge(UsdNprHalfEdge* edge, float width, const GfVec3f* positions,
     const GfVec3f* normals, const GfVec3f& color);
@@ -92,7 +92,7 @@ public:
     const GfVec3f& viewPoint, GfVec3f* points) const;
 
   size_t GetNumNodes() const {return _nodes.size();};
-  const UsdNprStrokeNodeList GetNodes() const {return _nodes;};
+  const UsdNprStrokeNodeList& GetNodes() const {return _nodes;};
   const UsdNprStrokeNode* GetNode(size_t idx) const {return &_nodes[idx];};
 
 private:
@@ -108,8 +108,11 @@ private:
 
 typedef std::vector<UsdNprStrokeChain> UsdNprStrokeChainList;
 
+// chains are kept between frames and reused (their nodes capacity too),
+// only the first GetNumStrokes() chains are valid
 class UsdNprStrokeGraph {
 public:
+  UsdNprStrokeGraph() : _mesh(NULL), _numStrokes(0), _edgeFlags(NULL) {};
   void Init(UsdNprHalfEdgeMesh* mesh, const GfMatrix4f& view, const GfMatrix4f& proj);
   void Prepare(const UsdNprStrokeParams& params);
   void ResetChainedFlag(const std::vector<const UsdNprHalfEdge*>& edges);
@@ -118,30 +121,42 @@ public:
   void BuildRawStrokes(short edgeType, const GfVec3f& color);
   void ConnectChains(short edgeType);
 
-  const UsdNprStrokeChainList& GetStrokes() const {return _strokes;};
+  const UsdNprStrokeChain& GetStroke(size_t index) const {return _strokes[index];};
   UsdNprHalfEdgeMesh* GetMesh() {return _mesh;};
   const UsdNprHalfEdgeMesh* GetMesh() const {return _mesh;};
   const std::vector<const UsdNprHalfEdge*>& GetSilhouettes(){return _silhouettes;};
   const std::vector<float>& GetSilhouetteWeights(){return _silhouetteWeights;};
 
-  size_t GetNumStrokes() const {return _strokes.size();};
+  size_t GetNumStrokes() const {return _numStrokes;};
   size_t GetNumNodes() const;
   GfVec3f GetViewPoint() const;
 
   float GetSilhouetteWeight(int index) const;
 
+  // cached mesh flags combined with the view dependent states
+  short GetEdgeFlags(size_t index) const {
+    return _edgeFlags[index] | _edgeStates[index];};
+  void MarkEdgeChained(size_t index);
+
 private:
+  const std::vector<const UsdNprHalfEdge*>* _GetEdges(short edgeType) const;
+  UsdNprStrokeChain& _NextStroke();
+
   GfMatrix4f                         _viewMatrix;
   GfMatrix4f                         _projectionMatrix;
   UsdNprHalfEdgeMesh*                _mesh;
 
   UsdNprStrokeChainList              _strokes;
+  size_t                             _numStrokes;
 
   std::vector<const UsdNprHalfEdge*> _silhouettes;
   std::vector<float>                 _silhouetteWeights;
-  std::vector<const UsdNprHalfEdge*> _boundaries;
-  std::vector<const UsdNprHalfEdge*> _creases;
-  std::vector<short>                 _allFlags;
+  std::vector<uint32_t>              _clusters;
+  std::vector<size_t>                _offsets;
+  std::vector<float>                 _facing;
+  const short*                       _edgeFlags;
+  std::vector<short>                 _edgeStates;
+  std::vector<uint32_t>              _markedEdges;
 };
 
 typedef std::vector<UsdNprStrokeGraph> UsdNprStrokeGraphList;
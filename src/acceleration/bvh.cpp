@@ -1,6 +1,10 @@
 #include <algorithm>
+#include <atomic>
+#include <cfloat>
+#include <cmath>
 #include <iostream>
 #include <iterator>
+#include <memory>
 #include <numeric>
 
 #include <pxr/base/gf/vec2i.h>
@@ -8,6 +12,9 @@
 #include <pxr/base/gf/range3d.h>
 #include <pxr/base/gf/bbox3d.h>
 #include <pxr/base/gf/ray.h>
+#include <pxr/base/work/loops.h>
+#include <pxr/base/work/reduce.h>
+#include <pxr/base/work/sort.h>
 #include "../acceleration/bvh.h"
 #include "../acceleration/morton.h"
 #include "../geometry/component.h"
@@ -56,169 +63,571 @@ BVH::Cell::Cell(Component* component, const GfRange3d& range)
   SetMax(range.GetMax());
 }
 
+// local space trees ignore the geometries transform
+static const GfMatrix4d _IDENTITY_MATRIX(1.0);
+
+const GfMatrix4d&
+BVH::_GetMatrix(const Geometry* geometry) const
+{
+  return _localSpace ? _IDENTITY_MATRIX : geometry->GetMatrix();
+}
+
+const GfMatrix4d&
+BVH::_GetInverseMatrix(const Geometry* geometry) const
+{
+  return _localSpace ? _IDENTITY_MATRIX : geometry->GetInverseMatrix();
+}
+
 bool
-BVH::_Raycast(const BVH::Cell* cell, const GfRay& ray, Location* hit,
+BVH::_RaycastLeaf(const BVH::Cell* cell, const GfRay& ray, Location* hit,
   double maxDistance, double* minDistance) const
 {
-  maxDistance = GfMin(maxDistance, hit->GetDistance());
-  if(cell->GetDistanceSquared(ray.GetPoint(0.f)) > maxDistance * maxDistance) return false;
+  size_t geomIdx = GetGeometryIndexFromCell(cell);
+  const Geometry* geometry = GetGeometry(geomIdx);
 
-  if (cell->IsLeaf()) {
-    
-    size_t geomIdx = GetGeometryIndexFromCell(cell);
-    const Geometry* geometry = GetGeometry(geomIdx);
+  GfRay localRay(ray);
 
-    GfRay localRay(ray);
+  localRay.Transform(_GetInverseMatrix(geometry));
+  const GfVec3f* points = ((const Deformable*)geometry)->GetPositionsCPtr();
+  
+  Component* component = (Component*)cell->GetData();
+  Location localHit(*hit);
+  if (component->Raycast(points, localRay, &localHit)) {
 
-    localRay.Transform(geometry->GetInverseMatrix());
-    const GfVec3f* points = ((const Deformable*)geometry)->GetPositionsCPtr();
+    const GfVec3d localPoint(localRay.GetPoint(localHit.GetDistance()));
+    const double distance = (ray.GetStartPoint() - _GetMatrix(geometry).Transform(localPoint)).GetLength();
     
-    Component* component = (Component*)cell->GetData();
-    Location localHit(*hit);
-    if (component->Raycast(points, localRay, &localHit)) {
-
-      const GfVec3d localPoint(localRay.GetPoint(localHit.GetDistance()));
-      const double distance = (ray.GetStartPoint() - geometry->GetMatrix().Transform(localPoint)).GetLength();
-      
-      if ((distance < maxDistance)) {
-        hit->Set(localHit);
-        hit->SetDistance(distance);
-        hit->SetGeometryIndex(geomIdx);
-        if(minDistance)
-          *minDistance = distance;
-        return true;
-      }
+    if ((distance < maxDistance)) {
+      hit->Set(localHit);
+      hit->SetDistance(distance);
+      hit->SetGeometryIndex(geomIdx);
+      if(minDistance)
+        *minDistance = distance;
+      return true;
     }
-    return false;
-  } else {
-    bool leftFound(false), rightFound(false);
-    const BVH::Cell* left = _GetCell(cell->GetLeft());
-    const BVH::Cell* right = _GetCell(cell->GetRight());
+  }
+  return false;
+}
+
+bool 
+BVH::_ClosestLeaf(const BVH::Cell* cell, const GfVec3f& point, Location* hit) const
+{  
+  size_t geomIdx = GetGeometryIndexFromCell(cell);
+  const Geometry* geometry = GetGeometry(geomIdx);
+  const GfMatrix4d& invMatrix = _GetInverseMatrix(geometry);
   
-    double leftDist=maxDistance, rightDist=maxDistance;
-    ray.Intersect(GfBBox3d(*left), &leftDist);
-    bool leftCheck = leftDist < maxDistance;
-    ray.Intersect(GfBBox3d(*right), &rightDist);
-    bool rightCheck = rightDist < maxDistance;
+  const GfVec3f* points = ((const Deformable*)geometry)->GetPositionsCPtr();
+  Component* component = (Component*)cell->GetData();
+  GfVec3f localPoint(invMatrix.Transform(point));
   
-    if(leftCheck && rightCheck) {
-      if(leftDist < rightDist) {
-        if (_Raycast(left, ray, hit, maxDistance, minDistance))leftFound=true;
-        if (_Raycast(right, ray, hit, maxDistance, minDistance))rightFound=true;
-      } else {
-        if (_Raycast(right, ray, hit, maxDistance, minDistance))rightFound=true;
-        if (_Raycast(left, ray, hit, maxDistance, minDistance))leftFound=true;
-      }
-    } else if (leftCheck) {
-      if (_Raycast(left, ray, hit, maxDistance, minDistance))leftFound=true;
-    } else if (rightCheck) {
-      if (_Raycast(right, ray, hit, maxDistance, minDistance))rightFound=true;
-    }
+  Location localHit(*hit);
+  if(hit->IsValid())
+    localHit.ConvertToLocal(invMatrix);
+
+  if (component->Closest(points, localPoint, &localHit)) {
+    localHit.ConvertToWorld(_GetMatrix(geometry));
+    hit->Set(localHit);
+    hit->SetGeometryIndex(geomIdx);
+    return true;
+  }
+
+  return false;
+}
+
+//-------------------------------------------------------
+// Compact nodes
+//-------------------------------------------------------
+static_assert(sizeof(BVH::Node) == 32, "BVH::Node must fit in 32 bytes");
 
-    return leftFound || rightFound;
+static bool
+_NodeContains(const BVH::Node& node, const GfVec3d& point)
+{
+  for(size_t d = 0; d < 3; ++d)
+    if(point[d] < node.min[d] || point[d] > node.max[d]) return false;
+  return true;
+}
 
+static double
+_NodeDistanceSquared(const BVH::Node& node, const GfVec3d& point)
+{
+  double distanceSq = 0.0;
+  for(size_t d = 0; d < 3; ++d) {
+    if(point[d] < node.min[d]) distanceSq += GfSqr(node.min[d] - point[d]);
+    else if(point[d] > node.max[d]) distanceSq += GfSqr(point[d] - node.max[d]);
   }
+  return distanceSq;
+}
 
+// slab test, same conventions as GfRay::Intersect
+static bool
+_NodeIntersect(const BVH::Node& node, const GfVec3d& origin, const GfVec3d& direction,
+  double* enterDistance)
+{
+  double maxStart = -DBL_MAX;
+  double minEnd = DBL_MAX;
+  for(size_t d = 0; d < 3; ++d) {
+    if(direction[d] == 0.0) {
+      if(origin[d] < node.min[d] || origin[d] > node.max[d]) return false;
+      continue;
+    }
+    double t1 = (node.min[d] - origin[d]) / direction[d];
+    double t2 = (node.max[d] - origin[d]) / direction[d];
+    if(t1 > t2) std::swap(t1, t2);
+    if(t1 > maxStart) maxStart = t1;
+    if(t2 < minEnd) minEnd = t2;
+    if(maxStart > minEnd) return false;
+  }
+  if(minEnd < 0.0) return false;
+
+  *enterDistance = maxStart;
+  return true;
 }
 
-bool 
-BVH::_Closest(const BVH::Cell* cell, const GfVec3f& point, Location* hit, 
-  double maxDistanceSq) const
-{  
-  if(!cell->Contains(point)) {
-    const double distanceSq = cell->GetDistanceSquared(point);
-    if(distanceSq > (point - hit->GetPoint()).GetLengthSq() || distanceSq > maxDistanceSq)return false;
+// float bounds rounded outward so the node never shrinks its cell
+static void
+_SetNodeBounds(BVH::Node& node, const GfRange3d& range)
+{
+  for(size_t d = 0; d < 3; ++d) {
+    node.min[d] = static_cast<float>(range.GetMin()[d]);
+    if(node.min[d] > range.GetMin()[d]) node.min[d] = std::nextafter(node.min[d], -FLT_MAX);
+    node.max[d] = static_cast<float>(range.GetMax()[d]);
+    if(node.max[d] < range.GetMax()[d]) node.max[d] = std::nextafter(node.max[d], FLT_MAX);
   }
+}
 
-  if (cell->IsLeaf()) {
+uint32_t
+BVH::_FlattenCell(size_t cellIdx, size_t depth)
+{
+  const uint32_t nodeIdx = static_cast<uint32_t>(_nodes.size());
+  _nodes.push_back(BVH::Node());
+  _nodeCells.push_back(cellIdx);
+  _depth = GfMax(_depth, depth);
+
+  const BVH::Cell* cell = _GetCell(cellIdx);
+  if(cell->IsLeaf()) {
+    _nodes[nodeIdx].index = static_cast<uint32_t>(cellIdx);
+    _nodes[nodeIdx].leaf = 1;
+  } else {
+    // left child is the next node
+    _FlattenCell(cell->GetLeft(), depth + 1);
+    const uint32_t right = _FlattenCell(cell->GetRight(), depth + 1);
+    _nodes[nodeIdx].index = right;
+    _nodes[nodeIdx].leaf = 0;
+  }
+  return nodeIdx;
+}
 
-    size_t geomIdx = GetGeometryIndexFromCell(cell);
-    const Geometry* geometry = GetGeometry(geomIdx);
-    const GfMatrix4d& invMatrix = geometry->GetInverseMatrix();
-    
-    const GfVec3f* points = ((const Deformable*)geometry)->GetPositionsCPtr();
-    Component* component = (Component*)cell->GetData();
-    GfVec3f localPoint(invMatrix.Transform(point));
-    
-    Location localHit(*hit);
-    if(hit->IsValid())
-      localHit.ConvertToLocal(invMatrix);
+void
+BVH::_FlattenCells()
+{
+  _nodes.clear();
+  _nodeCells.clear();
+  _depth = 0;
+  if(!_root) return;
+
+  _nodes.reserve(_cells.size());
+  _nodeCells.reserve(_cells.size());
+  _FlattenCell(_GetIndex(_root), 0);
+}
 
-    if (component->Closest(points, localPoint, &localHit)) {
-      localHit.ConvertToWorld(geometry->GetMatrix());
-      hit->Set(localHit);
-      hit->SetGeometryIndex(geomIdx);
-      return true;
+uint32_t*
+BVH::_GetStack(uint32_t* fixed, std::vector<uint32_t>& deep) const
+{
+  if(_depth < STACK_SIZE) return fixed;
+  deep.resize(_depth + 1);
+  return &deep[0];
+}
+
+void
+BVH::_UpdateNodes()
+{
+  WorkParallelForN(_nodes.size(), [&](size_t begin, size_t end) {
+    for(size_t nodeIdx = begin; nodeIdx < end; ++nodeIdx)
+      _SetNodeBounds(_nodes[nodeIdx], _cells[_nodeCells[nodeIdx]]);
+  });
+}
+
+bool
+BVH::_Raycast(const GfRay& ray, Location* hit,
+  double maxDistance, double* minDistance) const
+{
+  const GfVec3d origin = ray.GetStartPoint();
+  const GfVec3d direction = ray.GetDirection();
+
+  uint32_t fixed[STACK_SIZE];
+  std::vector<uint32_t> deep;
+  uint32_t* stack = _GetStack(fixed, deep);
+  size_t stackSize = 0;
+  stack[stackSize++] = 0;
+
+  bool found = false;
+  while(stackSize) {
+    const uint32_t nodeIdx = stack[--stackSize];
+    const BVH::Node& node = _nodes[nodeIdx];
+    const double distance = GfMin(maxDistance, hit->GetDistance());
+    if(_NodeDistanceSquared(node, origin) > distance * distance) continue;
+
+    if(node.leaf) {
+      if(_RaycastLeaf(_GetCell(node.index), ray, hit, distance, minDistance))
+        found = true;
+      continue;
     }
 
-    return false;
+    // nearest child is pushed last to be traversed first
+    const uint32_t left = nodeIdx + 1;
+    const uint32_t right = node.index;
+    double leftDist, rightDist;
+    const bool leftCheck = _NodeIntersect(_nodes[left], origin, direction, &leftDist) && leftDist < distance;
+    const bool rightCheck = _NodeIntersect(_nodes[right], origin, direction, &rightDist) && rightDist < distance;
+
+    if(leftCheck && rightCheck) {
+      if(leftDist < rightDist) {
+        stack[stackSize++] = right;
+        stack[stackSize++] = left;
+      } else {
+        stack[stackSize++] = left;
+        stack[stackSize++] = right;
+      }
+    } else if(leftCheck) {
+      stack[stackSize++] = left;
+    } else if(rightCheck) {
+      stack[stackSize++] = right;
+    }
   }
-  else {
-    const BVH::Cell* left = _GetCell(cell->GetLeft());
-    const BVH::Cell* right = GetCell(cell->GetRight());
+  return found;
+}
+
+bool
+BVH::_Closest(const GfVec3f& point, Location* hit, double maxDistanceSq) const
+{
+  const GfVec3d position(point);
+
+  uint32_t fixed[STACK_SIZE];
+  std::vector<uint32_t> deep;
+  uint32_t* stack = _GetStack(fixed, deep);
+  size_t stackSize = 0;
+
+  // max distance bounds the root, nodes below are bounded by the current hit
+  const BVH::Node& root = _nodes[0];
+  if(!_NodeContains(root, position) && 
+    (_NodeDistanceSquared(root, position) > maxDistanceSq ||
+     _NodeDistanceSquared(root, position) > (point - hit->GetPoint()).GetLengthSq())) 
+    return false;
+  stack[stackSize++] = 0;
+
+  bool found = false;
+  while(stackSize) {
+    const uint32_t nodeIdx = stack[--stackSize];
+    const BVH::Node& node = _nodes[nodeIdx];
+    const double hitDistSq = hit->IsValid() ? (point - hit->GetPoint()).GetLengthSq() : DBL_MAX;
+    if(!_NodeContains(node, position) && _NodeDistanceSquared(node, position) > hitDistSq) 
+      continue;
+
+    if(node.leaf) {
+      if(_ClosestLeaf(_GetCell(node.index), point, hit))
+        found = true;
+      continue;
+    }
 
-    double hitDistSq = hit->IsValid() ? (point - hit->GetPoint()).GetLengthSq() : DBL_MAX;
-    double leftDistSq = left->GetDistanceSquared(point);
-    double rightDistSq = right->GetDistanceSquared(point);
+    const uint32_t left = nodeIdx + 1;
+    const uint32_t right = node.index;
+    const double leftDistSq = _NodeDistanceSquared(_nodes[left], position);
+    const double rightDistSq = _NodeDistanceSquared(_nodes[right], position);
 
-    if( leftDistSq < hitDistSq && rightDistSq < hitDistSq) {
-      bool leftFound(false), rightFound(false);
+    if(leftDistSq < hitDistSq && rightDistSq < hitDistSq) {
       if(leftDistSq < rightDistSq) {
-        leftFound = _Closest(left, point, hit, hitDistSq);
-        rightFound = _Closest(right, point, hit, hitDistSq);
+        stack[stackSize++] = right;
+        stack[stackSize++] = left;
       } else {
-        rightFound = _Closest(right, point, hit, hitDistSq);
-        leftFound = _Closest(left, point, hit, hitDistSq);
+        stack[stackSize++] = left;
+        stack[stackSize++] = right;
       }
-      return leftFound || rightFound;
+    } else if(leftDistSq < hitDistSq) {
+      stack[stackSize++] = left;
+    } else if(rightDistSq < hitDistSq) {
+      stack[stackSize++] = right;
     }
-    else if( leftDistSq < hitDistSq )
-      return _Closest(left, point, hit, hitDistSq);
-    else if( rightDistSq < hitDistSq )
-      return _Closest(right, point, hit, hitDistSq);
-    else 
-      return false;
   }
+  return found;
 }
 
-GfRange3f 
-BVH::_RecurseUpdateCells(BVH::Cell* cell)
+// a packet visits the union of the nodes its queries need, each node is
+// tested against every query of the packet still able to reach it
+size_t
+BVH::_RaycastPacket(const GfRay* rays, const Morton* queries, size_t numQueries,
+  Location* hits, double maxDistance) const
 {
+  GfVec3d origins[PACKET_SIZE];
+  GfVec3d directions[PACKET_SIZE];
+  Location* packetHits[PACKET_SIZE];
+  bool found[PACKET_SIZE];
+  for(size_t q = 0; q < numQueries; ++q) {
+    const GfRay& ray = rays[queries[q].data];
+    origins[q] = ray.GetStartPoint();
+    directions[q] = ray.GetDirection();
+    packetHits[q] = &hits[queries[q].data];
+    found[q] = false;
+  }
 
-  if (cell->IsLeaf()) {
-    const Geometry* geometry = GetGeometryFromCell(cell);
-    if (geometry->GetType() >= Geometry::POINT) {
-      Component* component = (Component*)cell->GetData();
-      const GfVec3f* positions = ((Deformable*)geometry)->GetPositionsCPtr();
-      const GfMatrix4d& matrix = geometry->GetMatrix();
-      const GfRange3f range = component->GetBoundingBox(positions, matrix);
-      cell->SetMin(range.GetMin());
-      cell->SetMax(range.GetMax());
-      return range;
+  uint32_t fixed[STACK_SIZE];
+  std::vector<uint32_t> deep;
+  uint32_t* stack = _GetStack(fixed, deep);
+  size_t stackSize = 0;
+  stack[stackSize++] = 0;
+
+  while(stackSize) {
+    const uint32_t nodeIdx = stack[--stackSize];
+    const BVH::Node& node = _nodes[nodeIdx];
+
+    uint32_t active = 0;
+    for(size_t q = 0; q < numQueries; ++q) {
+      double enterDistance;
+      if(_NodeIntersect(node, origins[q], directions[q], &enterDistance) &&
+        enterDistance < GfMin(maxDistance, packetHits[q]->GetDistance()))
+        active |= 1 << q;
+    }
+    if(!active) continue;
+
+    if(node.leaf) {
+      const BVH::Cell* cell = _GetCell(node.index);
+      for(size_t q = 0; q < numQueries; ++q)
+        if((active & (1 << q)) && _RaycastLeaf(cell, rays[queries[q].data], packetHits[q],
+          GfMin(maxDistance, packetHits[q]->GetDistance()), NULL))
+          found[q] = true;
+      continue;
+    }
+
+    // children ordered along the first active ray
+    size_t first = 0;
+    while(!(active & (1 << first))) first++;
+    const uint32_t left = nodeIdx + 1;
+    const uint32_t right = node.index;
+    double leftDist, rightDist;
+    if(!_NodeIntersect(_nodes[left], origins[first], directions[first], &leftDist)) 
+      leftDist = DBL_MAX;
+    if(!_NodeIntersect(_nodes[right], origins[first], directions[first], &rightDist)) 
+      rightDist = DBL_MAX;
+
+    if(leftDist < rightDist) {
+      stack[stackSize++] = right;
+      stack[stackSize++] = left;
     } else {
-      // todo handle implicit geometries
-      return GfRange3f();
+      stack[stackSize++] = left;
+      stack[stackSize++] = right;
     }
-   
+  }
+
+  size_t numHits = 0;
+  for(size_t q = 0; q < numQueries; ++q)
+    if(found[q]) numHits++;
+  return numHits;
+}
+
+size_t
+BVH::_ClosestPacket(const GfVec3f* points, const Morton* queries, size_t numQueries,
+  Location* hits, double maxDistanceSq) const
+{
+  GfVec3d positions[PACKET_SIZE];
+  Location* packetHits[PACKET_SIZE];
+  bool found[PACKET_SIZE];
+  for(size_t q = 0; q < numQueries; ++q) {
+    positions[q] = GfVec3d(points[queries[q].data]);
+    packetHits[q] = &hits[queries[q].data];
+    found[q] = false;
+  }
+
+  uint32_t fixed[STACK_SIZE];
+  std::vector<uint32_t> deep;
+  uint32_t* stack = _GetStack(fixed, deep);
+  size_t stackSize = 0;
+  stack[stackSize++] = 0;
+
+  double distancesSq[PACKET_SIZE];
+  while(stackSize) {
+    const uint32_t nodeIdx = stack[--stackSize];
+    const BVH::Node& node = _nodes[nodeIdx];
+
+    // max distance bounds the queries until they get a hit
+    uint32_t active = 0;
+    for(size_t q = 0; q < numQueries; ++q) {
+      distancesSq[q] = packetHits[q]->IsValid() ? 
+        (positions[q] - packetHits[q]->GetPoint()).GetLengthSq() : maxDistanceSq;
+      if(_NodeDistanceSquared(node, positions[q]) <= distancesSq[q])
+        active |= 1 << q;
+    }
+    if(!active) continue;
+
+    if(node.leaf) {
+      const BVH::Cell* cell = _GetCell(node.index);
+      for(size_t q = 0; q < numQueries; ++q)
+        if((active & (1 << q)) && 
+          _ClosestLeaf(cell, points[queries[q].data], packetHits[q]))
+          found[q] = true;
+      continue;
+    }
+
+    size_t first = 0;
+    while(!(active & (1 << first))) first++;
+    const uint32_t left = nodeIdx + 1;
+    const uint32_t right = node.index;
+    if(_NodeDistanceSquared(_nodes[left], positions[first]) < 
+      _NodeDistanceSquared(_nodes[right], positions[first])) {
+      stack[stackSize++] = right;
+      stack[stackSize++] = left;
+    } else {
+      stack[stackSize++] = left;
+      stack[stackSize++] = right;
+    }
+  }
+
+  size_t numHits = 0;
+  for(size_t q = 0; q < numQueries; ++q)
+    if(found[q]) numHits++;
+  return numHits;
+}
+
+void
+BVH::_Overlap(const BVH::Cell* cell, const GfRange3d& range, 
+  std::vector<const Cell*>& leaves) const
+{
+  if(GfRange3d::GetIntersection(*cell, range).IsEmpty()) return;
+
+  if (cell->IsLeaf()) {
+    leaves.push_back(cell);
   } else {
-    GfRange3f range;
-    if (cell->GetLeft() && cell->GetRight()) {
-      range.UnionWith(_RecurseUpdateCells(_GetCell(cell->GetLeft())));
-      range.UnionWith(_RecurseUpdateCells(_GetCell(cell->GetRight())));
-    } 
-    else if(cell->GetLeft()) {
-      range.UnionWith(_RecurseUpdateCells(_GetCell(cell->GetLeft())));
-    } 
-    else if(cell->GetRight()) {
-      range.UnionWith(_RecurseUpdateCells(_GetCell(cell->GetRight())));
-    } 
-
-    cell->SetMin(range.GetMin());
-    cell->SetMax(range.GetMax());
-    return range;
+    const BVH::Cell* left = _GetCell(cell->GetLeft());
+    const BVH::Cell* right = _GetCell(cell->GetRight());
+    if(left)_Overlap(left, range, leaves);
+    if(right)_Overlap(right, range, leaves);
   }
 }
 
+// surface area of a cell, empty cells don't count
+static double
+_SurfaceArea(const GfRange3d& range)
+{
+  if(range.IsEmpty()) return 0.0;
+  const GfVec3d size = range.GetSize();
+  return 2.0 * (size[0] * size[1] + size[1] * size[2] + size[2] * size[0]);
+}
+
+// common prefix length of two sorted morton codes, ties broken by index (karras 2012)
+static int
+_MortonDelta(const Morton* mortons, int numLeaves, int i, int j)
+{
+  if(j < 0 || j >= numLeaves) return -1;
+  if(mortons[i].code == mortons[j].code)
+    return 64 + MortonLeadingZeros(static_cast<uint64_t>(i ^ j));
+  return MortonLeadingZeros(mortons[i].code ^ mortons[j].code);
+}
+
+// every branch of the sorted leaves is built independently, 
+// branch i is stored after the leaves and branch 0 is the root
+void
+BVH::_BuildBranches()
+{
+  const int numLeaves = static_cast<int>(_mortons.size());
+  const int numBranches = numLeaves - 1;
+  _cells.resize(numLeaves + GfMax(numBranches, 0));
+  _parents.assign(_cells.size(), INVALID_INDEX);
+  if(numBranches <= 0) return;
+
+  const Morton* mortons = &_mortons[0];
+  WorkParallelForN(numBranches, [&](size_t begin, size_t end) {
+    for(int i = static_cast<int>(begin); i < static_cast<int>(end); ++i) {
+      // direction and extent of the range covered by the branch
+      const int d = 
+        _MortonDelta(mortons, numLeaves, i, i + 1) > _MortonDelta(mortons, numLeaves, i, i - 1) ? 1 : -1;
+      const int deltaMin = _MortonDelta(mortons, numLeaves, i, i - d);
+      int lengthMax = 2;
+      while(_MortonDelta(mortons, numLeaves, i, i + lengthMax * d) > deltaMin)
+        lengthMax *= 2;
+
+      int length = 0;
+      for(int t = lengthMax / 2; t >= 1; t /= 2)
+        if(_MortonDelta(mortons, numLeaves, i, i + (length + t) * d) > deltaMin)
+          length += t;
+      const int j = i + length * d;
+
+      // split position
+      const int deltaNode = _MortonDelta(mortons, numLeaves, i, j);
+      int split = 0;
+      int t = length;
+      do {
+        t = (t + 1) / 2;
+        if(_MortonDelta(mortons, numLeaves, i, i + (split + t) * d) > deltaNode)
+          split += t;
+      } while(t > 1);
+      const int gamma = i + split * d + GfMin(d, 0);
+
+      const size_t cellIdx = numLeaves + i;
+      const size_t left = GfMin(i, j) == gamma ? 
+        mortons[gamma].data : numLeaves + gamma;
+      const size_t right = GfMax(i, j) == gamma + 1 ? 
+        mortons[gamma + 1].data : numLeaves + gamma + 1;
+
+      BVH::Cell* cell = &_cells[cellIdx];
+      cell->SetLeft(left);
+      cell->SetRight(right);
+      cell->SetData(NULL);
+      cell->SetType(i == 0 ? BVH::Cell::ROOT : BVH::Cell::BRANCH);
+      _parents[left] = cellIdx;
+      _parents[right] = cellIdx;
+    }
+  });
+}
+
+// leaves update their bounds then walk up, the first child reaching a branch 
+// stops there, the second one unions both children and carries on
+void
+BVH::_RefitCells()
+{
+  const size_t numLeaves = _mortons.size();
+  std::unique_ptr<std::atomic<int>[]> visits(new std::atomic<int>[_cells.size()]());
+
+  WorkParallelForN(numLeaves, [&](size_t begin, size_t end) {
+    for(size_t leafIdx = begin; leafIdx < end; ++leafIdx) {
+      BVH::Cell* cell = &_cells[leafIdx];
+      const Geometry* geometry = GetGeometryFromCell(cell);
+      if (geometry->GetType() >= Geometry::POINT) {
+        Component* component = (Component*)cell->GetData();
+        const GfVec3f* positions = ((Deformable*)geometry)->GetPositionsCPtr();
+        const GfRange3f range = component->GetBoundingBox(positions, _GetMatrix(geometry));
+        cell->SetMin(range.GetMin());
+        cell->SetMax(range.GetMax());
+      }
+
+      size_t parent = _parents[leafIdx];
+      while(parent != INVALID_INDEX) {
+        if(visits[parent].fetch_add(1, std::memory_order_acq_rel) == 0) break;
+        BVH::Cell* branch = &_cells[parent];
+        const GfRange3d range = 
+          GfRange3d::GetUnion(_cells[branch->GetLeft()], _cells[branch->GetRight()]);
+        branch->SetMin(range.GetMin());
+        branch->SetMax(range.GetMax());
+        parent = _parents[parent];
+      }
+    }
+  });
+}
+
+double
+BVH::_ComputeCost() const
+{
+  const double rootArea = _root ? _SurfaceArea(*_root) : 0.0;
+  if(rootArea <= 0.0) return 0.0;
+
+  const double area = WorkParallelReduceN(0.0, _cells.size(),
+    [&](size_t begin, size_t end, double area) {
+      for(size_t cellIdx = begin; cellIdx < end; ++cellIdx)
+        area += _SurfaceArea(_cells[cellIdx]);
+      return area;
+    },
+    [](double lhs, double rhs) { return lhs + rhs; });
+
+  return area / rootArea;
+}
+
 uint64_t 
 BVH::_ComputeCode(const GfVec3d& point) const
 {
@@ -303,7 +712,7 @@ BVH::Init(const std::vector<Geometry*>& geometries)
   GfRange3d accum = bbox.GetRange();
   _numComponents = 0;
   for (size_t g = 0; g < GetNumGeometries(); ++g) {
-    const GfBBox3d bbox = GetGeometry(g)->GetBoundingBox(true);
+    const GfBBox3d bbox = GetGeometry(g)->GetBoundingBox(!_localSpace);
     accum.UnionWith(bbox.GetRange());
     _numComponents += ((Mesh*)GetGeometry(g))->GetTrianglePairs().size();
   }
@@ -313,6 +722,7 @@ BVH::Init(const std::vector<Geometry*>& geometries)
 
   if(!_accelerated)return;
 
+  _cells.clear();
   _mortons.clear();
   _mortons.reserve(_numComponents);
   
@@ -329,7 +739,7 @@ BVH::Init(const std::vector<Geometry*>& geometries)
         size_t numTrianglePairs = trianglePairs.size();
 
         const GfVec3f* positions = mesh->GetPositionsCPtr();
-        const GfMatrix4d& matrix = mesh->GetMatrix();
+        const GfMatrix4d& matrix = _GetMatrix(mesh);
         for (size_t t = 0; t < numTrianglePairs; ++t) {
           size_t leafIdx = AddCell(&trianglePairs[t],
             trianglePairs[t].GetBoundingBox(positions, matrix));
@@ -342,73 +752,81 @@ BVH::Init(const std::vector<Geometry*>& geometries)
     SetGeometryCellIndices(g, start, _cells.size());
   }
 
-  size_t numLeaves = _cells.size();
   Morton morton = SortCells();
-  size_t numBranches = _cells.size() - numLeaves;
-
   _root = _GetCell(morton.data);
-  _root->SetType(BVH::Cell::ROOT);
-  
-  _cellToMorton.resize(_cells.size(), Intersector::INVALID_INDEX);
-  for(size_t m = 0; m < _mortons.size(); ++m)
-    _cellToMorton[_mortons[m].data] = m;
-
 }
 
 void
 BVH::Update()
 {
-  if(_accelerated) {
-    
-    GfRange3f newRange = _RecurseUpdateCells(_root);
-    SetMin(newRange.GetMin());
-    SetMax(newRange.GetMax());
-    
-    /*
-   _mortons.clear();
-
-    // first update morton codes
-    for (size_t g = 0; g < GetNumGeometries(); ++g) {
-      size_t start = GetGeometryCellsStartIndex(g);
-      size_t end = GetGeometryCellsStartIndex(g);
-
-      Geometry* geometry = GetGeometry(g);
-      switch(geometry->GetType()) {
-        case Geometry::MESH:
-        {
-          Mesh* mesh = (Mesh*)geometry;
-
-          VtArray<TrianglePair>& trianglePairs = mesh->GetTrianglePairs();
-          size_t numTrianglePairs = trianglePairs.size();
-
-          for(size_t i = 0; i < numTrianglePairs; ++i) {
-            uint64_t code = _ComputeCode(_GetCell(start + i)->GetMidpoint());
-            _mortons.push_back({ code, start + i});
-          }
-          break;
-        }
-      }
-    }
+  if(!_accelerated || !_root) return;
 
-    size_t numLeaves = _cells.size();
-    Morton morton = SortCells();
-    size_t numBranches = _cells.size() - numLeaves;
+  Refit();
+  if(_rebuildRatio > 0.f && GetCostRatio() > _rebuildRatio)
+    Rebuild();
+}
 
-    _root = _GetCell(morton.data);
-    _root->SetType(BVH::Cell::ROOT);
-    
-    _cellToMorton.resize(_cells.size(), Intersector::INVALID_INDEX);
-    for(size_t m = 0; m < _mortons.size(); ++m)
-      _cellToMorton[_mortons[m].data] = m;
-    */
+void
+BVH::Refit()
+{
+  if(!_root) return;
+
+  _RefitCells();
+  _UpdateNodes();
+  SetMin(_root->GetMin());
+  SetMax(_root->GetMax());
+}
+
+void
+BVH::Rebuild()
+{
+  if(!_root) return;
+
+  // morton codes from the refitted leaves
+  WorkParallelForN(_mortons.size(), [&](size_t begin, size_t end) {
+    for(size_t m = begin; m < end; ++m)
+      _mortons[m].code = _ComputeCode(_GetCell(_mortons[m].data)->GetMidpoint());
+  });
+
+  Morton morton = SortCells();
+  _root = _GetCell(morton.data);
+}
+
+double
+BVH::GetCostRatio() const
+{
+  return _buildCost > 0.0 ? _ComputeCost() / _buildCost : 1.0;
+}
+
+// meshes raycast world rays, a local ray hits the triangles 
+// directly so that distances stay in the local space
+static bool
+_RaycastLocalMesh(const Mesh* mesh, const GfRay& ray, Location* hit,
+  double maxDistance, double* minDistance)
+{
+  const GfVec3f* positions = mesh->GetPositionsCPtr();
+  bool found = false;
+  for(auto& pair: ((Mesh*)mesh)->GetTrianglePairs()) {
+    Location localHit(*hit);
+    if(pair.Raycast(positions, ray, &localHit)) {
+      const double distance = 
+        (ray.GetStartPoint() - ray.GetPoint(localHit.GetDistance())).GetLength();
+      if(distance < hit->GetDistance() && distance < maxDistance) {
+        hit->Set(localHit);
+        hit->SetDistance(distance);
+        if(minDistance) *minDistance = distance;
+        found = true;
+      }
+    }
   }
+  return found;
 }
 
 bool BVH::Raycast(const GfRay& ray, Location* hit,
   double maxDistance, double* minDistance) const
 {
   if(_accelerated) 
-    return _Raycast(_root, ray, hit, maxDistance, minDistance);
+    return _nodes.size() ? _Raycast(ray, hit, maxDistance, minDistance) : false;
 
   else {
     bool found = false;
@@ -416,7 +834,9 @@ bool BVH::Raycast(const GfRay& ray, Location* hit,
       const Geometry* geom = GetGeometry(g);
       if(geom->GetType() == Geometry::MESH) {
         const Mesh* mesh = (Mesh*)geom;
-        if(mesh->Raycast(ray, hit, maxDistance, minDistance)) {
+        if(_localSpace ? 
+          _RaycastLocalMesh(mesh, ray, hit, maxDistance, minDistance) :
+          mesh->Raycast(ray, hit, maxDistance, minDistance)) {
           hit->SetGeometryIndex(g);
           found = true;
         }
@@ -444,35 +864,32 @@ BVH::_GetCell(size_t index) const
   return index < _cells.size() ? &_cells[index] : NULL;
 }
 
-size_t
-BVH::_RecurseSortCells(
-  size_t           first,
-  size_t           last)
+Morton 
+BVH::SortCells()
 {
-  if (first == last) {
-    return _mortons[first].data;
-  }
+  const size_t numLeaves = _mortons.size();
+  if(!numLeaves) return { 0, INVALID_INDEX };
+  WorkParallelSort(&_mortons);
 
-  size_t split = MortonFindSplit(&_mortons[0], first, last);
+  _BuildBranches();
+  const size_t rootIdx = numLeaves > 1 ? numLeaves : _mortons[0].data;
+  _root = _GetCell(rootIdx);
+  _RefitCells();
 
-  size_t leftIdx = _RecurseSortCells(first, split);
-  size_t rightIdx = _RecurseSortCells(split + 1, last);
-  return AddCell(_GetCell(leftIdx), _GetCell(rightIdx));
-}
+  _cellToMorton.assign(_cells.size(), Intersector::INVALID_INDEX);
+  for(size_t m = 0; m < numLeaves; ++m)
+    _cellToMorton[_mortons[m].data] = m;
 
-Morton 
-BVH::SortCells()
-{
-  size_t numLeaves = _mortons.size();
-  
-  std::sort(_mortons.begin(), _mortons.end());
+  _buildCost = _ComputeCost();
+  _numBuilds++;
+
+  _FlattenCells();
+  _UpdateNodes();
 
-  size_t topIdx = _RecurseSortCells(0, static_cast<int>(numLeaves) - 1);
-  BVH::Cell* top = _GetCell(topIdx);
   return {
-    _ComputeCode( top->GetMidpoint() ),
-    topIdx
-   };
+    _ComputeCode(_root->GetMidpoint()),
+    rootIdx
+  };
 } 
 
 GfVec3f
@@ -493,7 +910,7 @@ BVH::_ComputeHitPoint(Location* hit) const
       const Triangle* triangle = mesh->GetTriangle(hit->GetComponentIndex());
       const GfVec3f* positions = mesh->GetPositionsCPtr();
 
-      return hit->ComputePosition(positions, &triangle->vertices[0], 3, &geometry->GetMatrix());
+      return hit->ComputePosition(positions, &triangle->vertices[0], 3, &_GetMatrix(geometry));
     }
 
     case Geometry::CURVE:
@@ -502,7 +919,7 @@ BVH::_ComputeHitPoint(Location* hit) const
       const Edge* edge = curve->GetEdge(hit->GetComponentIndex());
       const GfVec3f* positions = curve->GetPositionsCPtr();
 
-      return hit->ComputePosition(positions, &edge->vertices[0], 2, &geometry->GetMatrix());
+      return hit->ComputePosition(positions, &edge->vertices[0], 2, &_GetMatrix(geometry));
     }
   }
   return GfVec3f(0.f);
@@ -513,9 +930,91 @@ bool BVH::Closest(const GfVec3f& point,
   Location* hit, double maxDistance) const
 {
   if(_accelerated)
-    return _Closest(_root, point, hit, 
-      maxDistance < DBL_MAX ? maxDistance * maxDistance : DBL_MAX);
-  return false;
+    return _nodes.size() ? _Closest(point, hit, 
+      maxDistance < DBL_MAX ? maxDistance * maxDistance : DBL_MAX) : false;
+
+  // not accelerated, every triangle of every mesh is tested
+  bool found = false;
+  for(size_t g = 0; g < GetNumGeometries(); ++g) {
+    const Geometry* geom = GetGeometry(g);
+    if(geom->GetType() != Geometry::MESH) continue;
+
+    const Mesh* mesh = (const Mesh*)geom;
+    const GfMatrix4d& invMatrix = _GetInverseMatrix(geom);
+    const GfVec3f* points = mesh->GetPositionsCPtr();
+    const GfVec3f localPoint(invMatrix.Transform(point));
+
+    Location localHit(*hit);
+    if(hit->IsValid())
+      localHit.ConvertToLocal(invMatrix);
+
+    bool closer = false;
+    for(size_t t = 0; t < mesh->GetNumTriangles(); ++t)
+      if(mesh->GetTriangle(t)->Closest(points, localPoint, &localHit))
+        closer = true;
+    if(!closer) continue;
+
+    localHit.ConvertToWorld(_GetMatrix(geom));
+    if((point - localHit.GetPoint()).GetLength() > maxDistance) continue;
+    hit->Set(localHit);
+    hit->SetGeometryIndex(g);
+    found = true;
+  }
+  return found;
+}
+
+size_t BVH::RaycastBatch(const GfRay* rays, size_t numRays, 
+  Location* hits, double maxDistance) const
+{
+  if(!_accelerated || !_nodes.size())
+    return Intersector::RaycastBatch(rays, numRays, hits, maxDistance);
+
+  std::vector<Morton> order;
+  _SortQueries(rays, numRays, order);
+
+  const size_t numPackets = (numRays + PACKET_SIZE - 1) / PACKET_SIZE;
+  std::atomic<size_t> numHits(0);
+  WorkParallelForN(numPackets, [&](size_t begin, size_t end) {
+    size_t found = 0;
+    for(size_t packet = begin; packet < end; ++packet) {
+      const size_t first = packet * PACKET_SIZE;
+      found += _RaycastPacket(rays, &order[first], 
+        GfMin(PACKET_SIZE, numRays - first), hits, maxDistance);
+    }
+    numHits += found;
+  });
+  return numHits;
+}
+
+size_t BVH::ClosestBatch(const GfVec3f* points, size_t numPoints, 
+  Location* hits, double maxDistance) const
+{
+  if(!_accelerated || !_nodes.size())
+    return Intersector::ClosestBatch(points, numPoints, hits, maxDistance);
+
+  std::vector<Morton> order;
+  _SortQueries(points, numPoints, order);
+
+  const double maxDistanceSq = maxDistance < DBL_MAX ? maxDistance * maxDistance : DBL_MAX;
+  const size_t numPackets = (numPoints + PACKET_SIZE - 1) / PACKET_SIZE;
+  std::atomic<size_t> numHits(0);
+  WorkParallelForN(numPackets, [&](size_t begin, size_t end) {
+    size_t found = 0;
+    for(size_t packet = begin; packet < end; ++packet) {
+      const size_t first = packet * PACKET_SIZE;
+      found += _ClosestPacket(points, &order[first], 
+        GfMin(PACKET_SIZE, numPoints - first), hits, maxDistanceSq);
+    }
+    numHits += found;
+  });
+  return numHits;
+}
+
+void BVH::Overlap(const GfRange3d& range, 
+  std::vector<const BVH::Cell*>& leaves) const
+{
+  if(_accelerated)
+    _Overlap(_root, range, leaves);
 }
 
 void BVH::GetCells(VtArray<GfVec3f>& positions,
@@ -558,4 +1057,4 @@ BVH::GetLeaves(const BVH::Cell* cell, std::vector<const BVH::Cell*>& leaves) con
 
 
 
-JVR_NAMESPACE_CLOSE_SCOPE
\ No newline at end of file
+JVR_NAMESPACE_CLOSE_SCOPE
@@ -15,8 +15,12 @@ JVR_NAMESPACE_OPEN_SCOPE
 
 class Geometry;
 
+template<size_t N> class WideBVH;
+
 class BVH : public Intersector
 {
+  template<size_t N> friend class WideBVH;
+
 public:
   static const size_t INVALID_INDEX = std::numeric_limits<size_t>::max();
 
@@ -55,8 +59,20 @@ public:
     uint8_t   _type;
   };
 
+  // compact traversal node, float bounds rounded outward, nodes are stored
+  // depth first so a branch left child is the next node, index is the right 
+  // child node for branches and the leaf cell for leaves
+  struct alignas(32) Node
+  {
+    float     min[3];
+    uint32_t  index;
+    float     max[3];
+    uint32_t  leaf;
+  };
+
 public:
-  BVH() {};
+  BVH() : _root(NULL), _depth(0), _numComponents(0), _numBuilds(0), _buildCost(0.0), _rebuildRatio(1.5f)
+    , _localSpace(false) {};
   ~BVH() {};
 
   Cell* GetRoot() { return _root; };
@@ -74,10 +90,26 @@ public:
   Morton SortCells();
   GfRange3f UpdateCells();
 
+  // refit bounds bottom-up in parallel, rebuild from the leaves morton codes
+  // once the surface area heuristic cost grew over rebuild ratio times the
+  // cost of the last build (Update does both, 0 disables the rebuild)
+  void Refit();
+  void Rebuild();
+  double GetCostRatio() const;
+  void SetRebuildRatio(float ratio) { _rebuildRatio = ratio; };
+  float GetRebuildRatio() const { return _rebuildRatio; };
+
+  // build and query in the geometries local space, set before Init
+  // (bottom level of a two level hierarchy)
+  void SetLocalSpace(bool localSpace) { _localSpace = localSpace; };
+  bool GetLocalSpace() const { return _localSpace; };
+
   // infos
   size_t GetNumComponents(){return _numComponents;};
   size_t GetNumLeaves(){return _mortons.size();};
   size_t GetNumCells(){return _cells.size();};
+  size_t GetNumNodes(){return _nodes.size();};
+  size_t GetNumBuilds() const {return _numBuilds;};
 
    // visual debug
   void GetCells(VtArray<GfVec3f>& positions, VtArray<GfVec3f>& sizes, 
@@ -93,11 +125,22 @@ public:
   virtual bool Closest(const GfVec3f& point, Location* hit,
     double maxDistance) const override;
 
+  // morton sorted queries traversed by packets sharing the node stack
+  virtual size_t RaycastBatch(const GfRay* rays, size_t numRays, Location* hits,
+    double maxDistance = DBL_MAX) const override;
+  virtual size_t ClosestBatch(const GfVec3f* points, size_t numPoints, Location* hits,
+    double maxDistance = DBL_MAX) const override;
+
+  // leaves whose bounds overlap range (e.g. a swept particle box)
+  void Overlap(const GfRange3d& range, std::vector<const Cell*>& leaves) const;
+
   void GetLeaves(const BVH::Cell* cell, std::vector<const Cell*>& leaves) const;
   void GetBranches(const BVH::Cell* cell, std::vector<const Cell*>& branches) const;
   
 protected:
   GfVec3f _ComputeHitPoint(Location* hit) const;
+  const GfMatrix4d& _GetMatrix(const Geometry* geometry) const;
+  const GfMatrix4d& _GetInverseMatrix(const Geometry* geometry) const;
   uint64_t _ComputeCode(const GfVec3d& point) const;
   GfVec3d _ComputeCodeAsColor(const GfVec3d& point) const;
   const Morton& _CellToMorton(size_t  cellIdx) const;
@@ -105,20 +148,49 @@ protected:
   size_t _GetIndex(const BVH::Cell* cell) const;
   BVH::Cell* _GetCell(size_t index);
   const BVH::Cell* _GetCell(size_t index) const;
-  size_t _RecurseSortCells(size_t first, size_t last);
-  GfRange3f _RecurseUpdateCells(BVH::Cell* cell);
-
-  bool _Raycast(const BVH::Cell* cell, const GfRay& ray, Location* hit,
+  void _BuildBranches();
+  void _RefitCells();
+  double _ComputeCost() const;
+
+  bool _RaycastLeaf(const BVH::Cell* cell, const GfRay& ray, Location* hit,
+    double maxDistance, double* minDistance) const;
+  bool _ClosestLeaf(const BVH::Cell* cell, const GfVec3f& point, Location* hit) const;
+
+  uint32_t _FlattenCell(size_t cellIdx, size_t depth);
+  void _FlattenCells();
+  // traversal stack, the fixed one unless the tree is deeper
+  uint32_t* _GetStack(uint32_t* fixed, std::vector<uint32_t>& deep) const;
+  void _UpdateNodes();
+  bool _Raycast(const GfRay& ray, Location* hit,
     double maxDistance = DBL_MAX, double* minDistance = NULL) const;
-  bool _Closest(const BVH::Cell* cell, const GfVec3f& point, Location* hit,
+  bool _Closest(const GfVec3f& point, Location* hit,
     double maxDistanceSq = DBL_MAX) const;
+  void _Overlap(const BVH::Cell* cell, const GfRange3d& range, 
+    std::vector<const Cell*>& leaves) const;
+  size_t _RaycastPacket(const GfRay* rays, const Morton* queries, size_t numQueries,
+    Location* hits, double maxDistance) const;
+  size_t _ClosestPacket(const GfVec3f* points, const Morton* queries, size_t numQueries,
+    Location* hits, double maxDistanceSq) const;
 
 private:
+  // a traversal holds at most one pending sibling per level, lbvh depth is 
+  // bounded by the morton bits plus the ties on equal codes
+  static const size_t             STACK_SIZE = 128;
+  static const size_t             PACKET_SIZE = 8;
+
   Cell*                           _root;
   std::vector<Cell>               _cells;
   std::vector<Morton>             _mortons;
   std::vector<int>                _cellToMorton;
+  std::vector<size_t>             _parents;
+  std::vector<Node>               _nodes;
+  std::vector<size_t>             _nodeCells;
+  size_t                          _depth;
   size_t                          _numComponents;
+  size_t                          _numBuilds;
+  double                          _buildCost;
+  float                           _rebuildRatio;
+  bool                            _localSpace;
 }; 
 
 JVR_NAMESPACE_CLOSE_SCOPE
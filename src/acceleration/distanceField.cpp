@@ -0,0 +1,198 @@
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <pxr/base/gf/math.h>
+#include <pxr/base/work/loops.h>
+#include "../acceleration/distanceField.h"
+#include "../acceleration/bvh.h"
+#include "../geometry/location.h"
+#include "../geometry/triangle.h"
+#include "../geometry/mesh.h"
+
+JVR_NAMESPACE_OPEN_SCOPE
+
+static const size_t _BRICK_VOLUME =
+  DistanceField::BRICK_SAMPLES * DistanceField::BRICK_SAMPLES * DistanceField::BRICK_SAMPLES;
+
+static inline size_t
+_GetSampleIndex(int x, int y, int z)
+{
+  return (size_t(z) * DistanceField::BRICK_SAMPLES + y) * DistanceField::BRICK_SAMPLES + x;
+}
+
+void
+DistanceField::Clear()
+{
+  _grid.clear();
+  _brickCoords.clear();
+  _bricks.clear();
+  _resolution = GfVec3i(0);
+}
+
+void
+DistanceField::Init(Mesh* mesh, float voxelSize, int band)
+{
+  Clear();
+  if(!mesh->GetNumTriangles()) return;
+
+  _voxelSize = GfMax(voxelSize, 1e-6f);
+  _invVoxelSize = 1.f / _voxelSize;
+  _band = GfMax(band, 1);
+
+  // local bounds grown by the band
+  const GfVec3f* positions = mesh->GetPositionsCPtr();
+  _range = GfRange3f();
+  for(size_t p = 0; p < mesh->GetNumPoints(); ++p)
+    _range.UnionWith(positions[p]);
+  const GfVec3f extent(GetBandWidth());
+  _range.SetMin(_range.GetMin() - extent);
+  _range.SetMax(_range.GetMax() + extent);
+
+  const GfVec3f size = _range.GetSize() * _invVoxelSize / (float)BRICK_CELLS;
+  _resolution = GfVec3i(
+    GfMax((int)std::ceil(size[0]), 1),
+    GfMax((int)std::ceil(size[1]), 1),
+    GfMax((int)std::ceil(size[2]), 1));
+
+  _ActivateBricks(mesh);
+  _ComputeBricks(mesh);
+}
+
+// bricks overlapped by a triangle bounds grown by the band
+void
+DistanceField::_ActivateBricks(const Mesh* mesh)
+{
+  _grid.assign(size_t(_resolution[0]) * _resolution[1] * _resolution[2], INVALID_BRICK);
+
+  const GfVec3f* positions = mesh->GetPositionsCPtr();
+  const float band = GetBandWidth();
+  const float scale = _invVoxelSize / (float)BRICK_CELLS;
+  for(size_t t = 0; t < mesh->GetNumTriangles(); ++t) {
+    const Triangle* triangle = mesh->GetTriangle(t);
+    GfRange3f range;
+    for(size_t v = 0; v < 3; ++v)
+      range.UnionWith(positions[triangle->vertices[v]]);
+
+    const GfVec3f lo = (range.GetMin() - GfVec3f(band) - _range.GetMin()) * scale;
+    const GfVec3f hi = (range.GetMax() + GfVec3f(band) - _range.GetMin()) * scale;
+    int minCoords[3], maxCoords[3];
+    for(size_t d = 0; d < 3; ++d) {
+      minCoords[d] = std::min(std::max((int)std::floor(lo[d]), 0), _resolution[d] - 1);
+      maxCoords[d] = std::min(std::max((int)std::floor(hi[d]), 0), _resolution[d] - 1);
+    }
+
+    for(int z = minCoords[2]; z <= maxCoords[2]; ++z)
+      for(int y = minCoords[1]; y <= maxCoords[1]; ++y)
+        for(int x = minCoords[0]; x <= maxCoords[0]; ++x)
+          _grid[_GetBrickIndex(x, y, z)] = 0;
+  }
+
+  // number the active bricks in grid order
+  uint32_t numBricks = 0;
+  for(int z = 0; z < _resolution[2]; ++z)
+    for(int y = 0; y < _resolution[1]; ++y)
+      for(int x = 0; x < _resolution[0]; ++x) {
+        uint32_t& brick = _grid[_GetBrickIndex(x, y, z)];
+        if(brick == INVALID_BRICK) continue;
+        brick = numBricks++;
+        _brickCoords.push_back(GfVec3i(x, y, z));
+      }
+}
+
+// exact closest point per brick sample, sign from the interpolated normal,
+// samples are clamped to the band and a failed query reads as outside
+void
+DistanceField::_ComputeBricks(Mesh* mesh)
+{
+  _bricks.resize(_brickCoords.size() * _BRICK_VOLUME);
+  if(_brickCoords.empty()) return;
+
+  BVH bvh;
+  bvh.SetLocalSpace(true);
+  bvh.Init({ mesh });
+
+  const GfVec3f* normals = mesh->GetNormalsCPtr();
+  const float band = GetBandWidth();
+  WorkParallelForN(_brickCoords.size(), [&](size_t begin, size_t end) {
+    for(size_t b = begin; b < end; ++b) {
+      const GfVec3i origin = _brickCoords[b] * BRICK_CELLS;
+      float* samples = &_bricks[b * _BRICK_VOLUME];
+      for(int z = 0; z < BRICK_SAMPLES; ++z)
+        for(int y = 0; y < BRICK_SAMPLES; ++y)
+          for(int x = 0; x < BRICK_SAMPLES; ++x) {
+            const GfVec3f point = _range.GetMin() + GfVec3f(
+              origin[0] + x, origin[1] + y, origin[2] + z) * _voxelSize;
+
+            Location hit;
+            float& sample = samples[_GetSampleIndex(x, y, z)];
+            if(!bvh.Closest(point, &hit, DBL_MAX)) {
+              sample = band;
+              continue;
+            }
+            const Triangle* triangle = mesh->GetTriangle(hit.GetComponentIndex());
+            const GfVec3f delta = point - GfVec3f(hit.GetPoint());
+            const GfVec3f normal = hit.ComputeNormal(normals, &triangle->vertices[0], 3, NULL);
+            const float distance = GfMin(delta.GetLength(), band);
+            sample = GfDot(delta, normal) < 0.f ? -distance : distance;
+          }
+    }
+  });
+}
+
+bool
+DistanceField::Sample(const GfVec3f& point, float* distance, GfVec3f* gradient) const
+{
+  if(_grid.empty()) return false;
+
+  // voxel coordinates, brick and cell inside the brick
+  const GfVec3f coords = (point - _range.GetMin()) * _invVoxelSize;
+  int cell[3];
+  float weights[3];
+  size_t brickCoords[3];
+  for(size_t d = 0; d < 3; ++d) {
+    if(coords[d] < 0.f) return false;
+    const int voxel = (int)coords[d];
+    const int brick = voxel / BRICK_CELLS;
+    if(brick >= _resolution[d]) return false;
+    brickCoords[d] = brick;
+    cell[d] = GfMin(voxel - brick * BRICK_CELLS, BRICK_CELLS - 1);
+    weights[d] = coords[d] - float(brick * BRICK_CELLS + cell[d]);
+  }
+
+  const uint32_t brick = _grid[_GetBrickIndex(brickCoords[0], brickCoords[1], brickCoords[2])];
+  if(brick == INVALID_BRICK) return false;
+
+  const float* samples = &_bricks[brick * _BRICK_VOLUME];
+  const float c000 = samples[_GetSampleIndex(cell[0],     cell[1],     cell[2])];
+  const float c100 = samples[_GetSampleIndex(cell[0] + 1, cell[1],     cell[2])];
+  const float c010 = samples[_GetSampleIndex(cell[0],     cell[1] + 1, cell[2])];
+  const float c110 = samples[_GetSampleIndex(cell[0] + 1, cell[1] + 1, cell[2])];
+  const float c001 = samples[_GetSampleIndex(cell[0],     cell[1],     cell[2] + 1)];
+  const float c101 = samples[_GetSampleIndex(cell[0] + 1, cell[1],     cell[2] + 1)];
+  const float c011 = samples[_GetSampleIndex(cell[0],     cell[1] + 1, cell[2] + 1)];
+  const float c111 = samples[_GetSampleIndex(cell[0] + 1, cell[1] + 1, cell[2] + 1)];
+
+  const float u = weights[0], v = weights[1], w = weights[2];
+  const float c00 = c000 + (c100 - c000) * u;
+  const float c10 = c010 + (c110 - c010) * u;
+  const float c01 = c001 + (c101 - c001) * u;
+  const float c11 = c011 + (c111 - c011) * u;
+  const float c0 = c00 + (c10 - c00) * v;
+  const float c1 = c01 + (c11 - c01) * v;
+  *distance = c0 + (c1 - c0) * w;
+
+  // analytic derivative of the trilinear interpolation
+  if(gradient) {
+    const float dx0 = (c100 - c000) + ((c110 - c010) - (c100 - c000)) * v;
+    const float dx1 = (c101 - c001) + ((c111 - c011) - (c101 - c001)) * v;
+    const float dy0 = c10 - c00;
+    const float dy1 = c11 - c01;
+    *gradient = GfVec3f(
+      dx0 + (dx1 - dx0) * w,
+      dy0 + (dy1 - dy0) * w,
+      c1 - c0) * _invVoxelSize;
+  }
+  return true;
+}
+
+JVR_NAMESPACE_CLOSE_SCOPE
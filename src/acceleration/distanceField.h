@@ -0,0 +1,63 @@
+#ifndef JVR_ACCELERATION_DISTANCEFIELD_H
+#define JVR_ACCELERATION_DISTANCEFIELD_H
+
+#include <vector>
+#include <pxr/base/gf/vec3f.h>
+#include <pxr/base/gf/vec3i.h>
+#include <pxr/base/gf/range3f.h>
+#include "../common.h"
+
+JVR_NAMESPACE_OPEN_SCOPE
+
+class Mesh;
+
+// sparse narrow band signed distance field of a mesh baked in its local space,
+// a coarse dense grid points to bricks of 8^3 cells allocated only around the
+// triangles, bricks store their border samples so a trilinear lookup never
+// reads across bricks, lookups outside the band fail and the caller falls
+// back to an exact query
+class DistanceField
+{
+public:
+  static const int        BRICK_CELLS = 8;
+  static const int        BRICK_SAMPLES = BRICK_CELLS + 1;
+  static const uint32_t   INVALID_BRICK = 0xFFFFFFFF;
+
+  DistanceField() : _voxelSize(0.f), _invVoxelSize(0.f), _band(0) {};
+  ~DistanceField() {};
+
+  // voxel size in mesh local units, band in voxels around the surface
+  void Init(Mesh* mesh, float voxelSize, int band = 3);
+  void Clear();
+
+  bool IsValid() const { return !_bricks.empty(); };
+  float GetVoxelSize() const { return _voxelSize; };
+  // distance up to which lookups are guaranteed to succeed
+  float GetBandWidth() const { return _band * _voxelSize; };
+  size_t GetNumBricks() const { return _bricks.size() / (BRICK_SAMPLES * BRICK_SAMPLES * BRICK_SAMPLES); };
+  const GfRange3f& GetRange() const { return _range; };
+
+  // trilinear distance and its gradient at a local space point
+  bool Sample(const GfVec3f& point, float* distance, GfVec3f* gradient = NULL) const;
+
+protected:
+  inline size_t _GetBrickIndex(int x, int y, int z) const {
+    return (size_t(z) * _resolution[1] + y) * _resolution[0] + x;
+  };
+  void _ActivateBricks(const Mesh* mesh);
+  void _ComputeBricks(Mesh* mesh);
+
+private:
+  float                   _voxelSize;
+  float                   _invVoxelSize;
+  int                     _band;
+  GfRange3f               _range;
+  GfVec3i                 _resolution;    // bricks per axis
+  std::vector<uint32_t>   _grid;          // brick index per coarse cell
+  std::vector<GfVec3i>    _brickCoords;   // coarse cell of each brick
+  std::vector<float>      _bricks;        // BRICK_SAMPLES^3 floats per brick
+};
+
+JVR_NAMESPACE_CLOSE_SCOPE
+
+#endif // JVR_ACCELERATION_DISTANCEFIELD_H
@@ -1,3 +1,10 @@
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstdlib>
+#include <memory>
+#include <pxr/base/gf/math.h>
+#include <pxr/base/work/loops.h>
 #include "../acceleration/grid3d.h"
 #include "../geometry/point.h"
 #include "../geometry/edge.h"
@@ -5,261 +12,257 @@
 #include "../geometry/geometry.h"
 #include "../geometry/mesh.h"
 #include "../geometry/curve.h"
-#include "../geometry/points.h"
+#include "../geometry/deformable.h"
 
 JVR_NAMESPACE_OPEN_SCOPE
 
-void Grid3D::Cell::Insert(Point* point)
+//-------------------------------------------------------
+// Build
+//-------------------------------------------------------
+// gather the components of every geometry (mesh triangles, curve edges)
+void Grid3D::_GatherComponents()
 {
-  components.push_back((Component*)point);
-}
-
-void Grid3D::Cell::Insert(Edge* edge)
-{
-  components.push_back((Component*)edge);
-}
-
-void Grid3D::Cell::Insert(Triangle* triangle)
-{
-  components.push_back((Component*)triangle);
-}
-
-bool Grid3D::Cell::Raycast(const Geometry* geometry, const GfRay& ray,
-  Location* hit, double maxDistance, double* minDistance) const
-{
-  bool hitSomething = false;
-
-  GfRay localRay(ray);
-  localRay.Transform(geometry->GetInverseMatrix());
-  const GfVec3f* points = ((const Deformable*)geometry)->GetPositionsCPtr();
-
-  Location localHit(*hit);
-  for (Component* component : components) {
-    if (component->Raycast(points, localRay, &localHit)) {
-      const GfVec3f localPoint(localRay.GetPoint(localHit.GetDistance()));
-      const float distance = (ray.GetStartPoint() - geometry->GetMatrix().Transform(localPoint)).GetLength();
-      if (distance < *minDistance && distance < maxDistance) {
-        hit->Set(localHit);
-        hit->SetDistance(distance);
-        hit->SetGeometryIndex(0);
-        *minDistance = distance;
-        hitSomething = true;
+  _components.clear();
+  _componentGeoms.clear();
+  for (size_t g = 0; g < GetNumGeometries(); ++g) {
+    Geometry* geometry = GetGeometry(g);
+    const size_t start = _components.size();
+    switch (geometry->GetType()) {
+      case Geometry::MESH:
+      {
+        Mesh* mesh = (Mesh*)geometry;
+        for (size_t t = 0; t < mesh->GetNumTriangles(); ++t)
+          _components.push_back(mesh->GetTriangle(t));
+        break;
+      }
+      case Geometry::CURVE:
+      {
+        Curve* curve = (Curve*)geometry;
+        for (size_t e = 0; e < curve->GetTotalNumSegments(); ++e)
+          _components.push_back(curve->GetEdge(e));
+        break;
       }
     }
+    _componentGeoms.resize(_components.size(), g);
+    SetGeometryCellIndices(g, start, _components.size());
   }
-
-  return hitSomething;
+  _componentMin.resize(_components.size());
+  _componentMax.resize(_components.size());
 }
 
-// delete all cells
-void Grid3D::DeleteCells()
+// cells count follows the components count (DENSITY per cell), cells are 
+// kept cubic as much as the bounds allow
+void Grid3D::_ComputeResolution()
 {
-  if(!_cells)return;
-
-  for (uint32_t i = 0; i < _numCells; ++i)
-    if (_cells[i] != NULL) delete _cells[i];
-  delete [] _cells;
-  _cells = NULL;
-}
-
-void Grid3D::InsertMesh(Mesh* mesh)
-{
-  size_t numTriangles = mesh->GetNumTriangles();
-  const GfMatrix4d& matrix = mesh->GetMatrix();
-  const GfVec3f* positions = mesh->GetPositionsCPtr();
+  GfRange3d accum;
+  for (size_t g = 0; g < GetNumGeometries(); ++g)
+    accum.UnionWith(GetGeometry(g)->GetBoundingBox(true).GetRange());
+
+  // flat bounds get a thickness so volume and cells stay valid
+  const GfVec3d extent = accum.GetSize();
+  const double padding = 
+    1e-3 * GfMax(GfMax(extent[0], extent[1]), GfMax(extent[2], 1e-3));
+  for (size_t i = 0; i < 3; ++i)
+    if (extent[i] < padding) {
+      GfVec3d minimum(accum.GetMin()), maximum(accum.GetMax());
+      minimum[i] -= 0.5 * padding;
+      maximum[i] += 0.5 * padding;
+      accum = GfRange3d(minimum, maximum);
+    }
+  SetMin(accum.GetMin());
+  SetMax(accum.GetMax());
 
-  GfVec3f invDimensions(1.f / _cellDimension[0], 1.f / _cellDimension[1], 1.f / _cellDimension[2]);
+  const GfVec3d size(GetSize());
+  const double volume = size[0] * size[1] * size[2];
+  const double numCells = 
+    GfMin(double(DENSITY) * GfMax(_components.size(), size_t(1)), double(MAX_CELLS));
+  const double cellsPerUnit = std::cbrt(numCells / volume);
 
-  const GfVec3f bboxMin(GetMin());
-  const GfVec3f bboxMax(GetMax());
+  for (uint8_t i = 0; i < 3; ++i)
+    _resolution[i] = MAX(uint32_t(1), uint32_t(size[i] * cellsPerUnit));
 
-  // insert all the triangles in the cells
-  for(size_t t = 0; t < numTriangles; ++t)
-  {
-    GfVec3f tmin(FLT_MAX,FLT_MAX,FLT_MAX);
-    GfVec3f tmax(-FLT_MAX,-FLT_MAX,-FLT_MAX);
-    Triangle* triangle = mesh->GetTriangle(t);
-    GfVec3f A(matrix.Transform(positions[triangle->vertices[0]]));
-    GfVec3f B(matrix.Transform(positions[triangle->vertices[1]]));
-    GfVec3f C(matrix.Transform(positions[triangle->vertices[2]]));
-
-    for (uint8_t k = 0; k < 3; ++k) {
-      if (A[k] < tmin[k]) tmin[k] = A[k];
-      if (B[k] < tmin[k]) tmin[k] = B[k];
-      if (C[k] < tmin[k]) tmin[k] = C[k];
-      if (A[k] > tmax[k]) tmax[k] = A[k];
-      if (B[k] > tmax[k]) tmax[k] = B[k];
-      if (C[k] > tmax[k]) tmax[k] = C[k];
-    }
-    
-    // convert to cell coordinates
-    tmin[0] = (tmin[0] - bboxMin[0]) * invDimensions[0];
-    tmin[1] = (tmin[1] - bboxMin[1]) * invDimensions[1];
-    tmin[2] = (tmin[2] - bboxMin[2]) * invDimensions[2];
-    
-    tmax[0] = (tmax[0] - bboxMin[0]) * invDimensions[0];
-    tmax[1] = (tmax[1] - bboxMin[1]) * invDimensions[1];
-    tmax[2] = (tmax[2] - bboxMin[2]) * invDimensions[2];
-    
-    uint32_t zmin = CLAMP(floor(tmin[2]), 0, _resolution[2] - 1);
-    uint32_t zmax = CLAMP(floor(tmax[2]), 0, _resolution[2] - 1);
-    uint32_t ymin = CLAMP(floor(tmin[1]), 0, _resolution[1] - 1);
-    uint32_t ymax = CLAMP(floor(tmax[1]), 0, _resolution[1] - 1);
-    uint32_t xmin = CLAMP(floor(tmin[0]), 0, _resolution[0] - 1);
-    uint32_t xmax = CLAMP(floor(tmax[0]), 0, _resolution[0] - 1);
-    
-    // loop over all the cells the triangle overlaps and insert
-    for (uint32_t z = zmin; z <= zmax; ++z)
-      for (uint32_t y = ymin; y <= ymax; ++y)
-        for (uint32_t x = xmin; x <= xmax; ++x) {
-          uint32_t o = z * _resolution[0] * _resolution[1] + y * _resolution[0] + x;
-          if (_cells[o] == NULL) _cells[o] = new Cell(o);
-            _cells[o]->Insert(triangle);
-        }
-  }
+  _cellDimension[0] = size[0] /(float)_resolution[0];
+  _cellDimension[1] = size[1] /(float)_resolution[1];
+  _cellDimension[2] = size[2] /(float)_resolution[2];
+  _numCells = _resolution[0] * _resolution[1] * _resolution[2];
 }
 
-void Grid3D::InsertCurve(Curve* curve)
+// count, scan and scatter component references into the cells
+void Grid3D::_BuildCells()
 {
-  //Curve* curve = (Curve*)_geometries[idx];
-} 
+  const size_t numComponents = _components.size();
+  const GfVec3f bboxMin(GetMin());
+  const GfVec3f invDimensions(1.f / _cellDimension[0], 
+    1.f / _cellDimension[1], 1.f / _cellDimension[2]);
+  const GfVec3i maxCoords(_resolution[0] - 1, _resolution[1] - 1, _resolution[2] - 1);
+
+  std::unique_ptr<std::atomic<uint32_t>[]> counts(new std::atomic<uint32_t>[_numCells]());
+
+  // component cells range and per cell counts
+  WorkParallelForN(numComponents, [&](size_t begin, size_t end) {
+    for (size_t c = begin; c < end; ++c) {
+      const Deformable* geometry = (const Deformable*)GetGeometry(_componentGeoms[c]);
+      const GfRange3f range = _components[c]->GetBoundingBox(
+        geometry->GetPositionsCPtr(), geometry->GetMatrix());
+
+      GfVec3i& cmin = _componentMin[c];
+      GfVec3i& cmax = _componentMax[c];
+      for (size_t k = 0; k < 3; ++k) {
+        cmin[k] = CLAMP(int(floor((range.GetMin()[k] - bboxMin[k]) * invDimensions[k])), 0, maxCoords[k]);
+        cmax[k] = CLAMP(int(floor((range.GetMax()[k] - bboxMin[k]) * invDimensions[k])), 0, maxCoords[k]);
+      }
 
-void Grid3D::InsertPoints(Points* points)
-{
-  //Points* points = (Points*)_geometries[idx];
-}
+      for (int z = cmin[2]; z <= cmax[2]; ++z)
+        for (int y = cmin[1]; y <= cmax[1]; ++y)
+          for (int x = cmin[0]; x <= cmax[0]; ++x)
+            counts[GetCellIndex(x, y, z)].fetch_add(1, std::memory_order_relaxed);
+    }
+  });
 
-size_t _GetGeometryNumComponents(const Geometry* geometry)
-{
-  switch(geometry->GetType()) {
-    case Geometry::POINT:
-      return ((Points*)geometry)->GetNumPoints();
-    case Geometry::CURVE:
-      return ((Curve*)geometry)->GetTotalNumSegments();
-    case Geometry::MESH:
-      return ((Mesh*)geometry)->GetNumTriangles();
+  _cellStart.resize(_numCells + 1);
+  _cellStart[0] = 0;
+  for (size_t cellIdx = 0; cellIdx < _numCells; ++cellIdx) {
+    _cellStart[cellIdx + 1] = _cellStart[cellIdx] + counts[cellIdx].load(std::memory_order_relaxed);
+    counts[cellIdx].store(_cellStart[cellIdx], std::memory_order_relaxed);
   }
-  return 0;
+  _cellEntries.resize(_cellStart[_numCells]);
+
+  // counts now hold each cell write cursor
+  WorkParallelForN(numComponents, [&](size_t begin, size_t end) {
+    for (size_t c = begin; c < end; ++c) {
+      const GfVec3i& cmin = _componentMin[c];
+      const GfVec3i& cmax = _componentMax[c];
+      for (int z = cmin[2]; z <= cmax[2]; ++z)
+        for (int y = cmin[1]; y <= cmax[1]; ++y)
+          for (int x = cmin[0]; x <= cmax[0]; ++x)
+            _cellEntries[counts[GetCellIndex(x, y, z)].fetch_add(1, std::memory_order_relaxed)] = c;
+    }
+  });
+
+  // scatter order depends on threads, sort cells for deterministic traversal
+  WorkParallelForN(_numCells, [&](size_t begin, size_t end) {
+    for (size_t cellIdx = begin; cellIdx < end; ++cellIdx)
+      std::sort(_cellEntries.begin() + _cellStart[cellIdx], 
+        _cellEntries.begin() + _cellStart[cellIdx + 1]);
+  });
 }
 
 // construct the grid from a list of geometries
 void Grid3D::Init(const std::vector<Geometry*>& geometries)
 {
   _Init(geometries);
+  _GatherComponents();
 
   Update();
-
-  
 }
 
 void Grid3D::Update()
 {
-  // delete old cells
-  DeleteCells();
-
   if (!GetNumGeometries())return;
 
-  // compute bound of the grid
-  size_t totalNumComponents = _GetGeometryNumComponents(GetGeometry(0));
-  const GfBBox3d bbox = GetGeometry(0)->GetBoundingBox(true);
-  GfRange3d accum = bbox.GetRange();
-  for (size_t i = 1; i < GetNumGeometries(); ++i) {
-    totalNumComponents += _GetGeometryNumComponents(GetGeometry(i));
-    const GfBBox3d bbox = GetGeometry(i)->GetBoundingBox(true);
-    accum.UnionWith(bbox.GetRange());
-  }
-  SetMin(accum.GetMin());
-  SetMax(accum.GetMax());
-
-  // create the grid
-  GfVec3f size(GetMax() - GetMin());
+  _ComputeResolution();
+  _BuildCells();
+}
 
-  //float desiredCellSize = area*12;
-  float volume = size[0] * size[1] * size[2];
+//-------------------------------------------------------
+// Queries
+//-------------------------------------------------------
+bool Grid3D::_RaycastCell(uint32_t index, const GfRay& ray, Location* hit, 
+  double maxDistance, double* minDistance) const
+{
+  bool hitSomething = false;
 
-  float cubeRoot = sqrt((12*totalNumComponents) / volume);
+  // components are sorted so geometries come in runs, transform once per run
+  size_t geomIdx = INVALID_INDEX;
+  const Geometry* geometry = NULL;
+  const GfVec3f* points = NULL;
+  GfRay localRay;
+
+  for (uint32_t e = _cellStart[index]; e < _cellStart[index + 1]; ++e) {
+    const uint32_t c = _cellEntries[e];
+    if (_componentGeoms[c] != geomIdx) {
+      geomIdx = _componentGeoms[c];
+      geometry = GetGeometry(geomIdx);
+      points = ((const Deformable*)geometry)->GetPositionsCPtr();
+      localRay = ray;
+      localRay.Transform(geometry->GetInverseMatrix());
+    }
 
-  for (uint8_t i = 0; i < 3; ++i) {
-    _resolution[i] = floor(GfPow(size[i], 1/3) * cubeRoot);
-    _resolution[i] = MAX(uint32_t(1), MIN(_resolution[i], uint32_t(128)));
+    Location localHit(*hit);
+    if (_components[c]->Raycast(points, localRay, &localHit)) {
+      const GfVec3d localPoint(localRay.GetPoint(localHit.GetDistance()));
+      const double distance = (ray.GetStartPoint() - geometry->GetMatrix().Transform(localPoint)).GetLength();
+      if (distance < hit->GetDistance() && distance < maxDistance) {
+        hit->Set(localHit);
+        hit->SetDistance(distance);
+        hit->SetGeometryIndex(geomIdx);
+        if (minDistance) *minDistance = distance;
+        hitSomething = true;
+      }
+    }
   }
 
-  _cellDimension[0] = size[0] /(float)_resolution[0];
-  _cellDimension[1] = size[1] /(float)_resolution[1];
-  _cellDimension[2] = size[2] /(float)_resolution[2];
-
-  // allocate memory
-  _numCells = _resolution[0] * _resolution[1] * _resolution[2];
-  _cells = new Grid3D::Cell* [_numCells];
-
-  // set all pointers to NULL
-  memset(_cells, 0x0, sizeof(Grid3D::Cell*) * _numCells);
-
-  // insert all the components in the cells
-  switch (GetGeometry(0)->GetType()) {
-    case Geometry::MESH:
-      InsertMesh((Mesh*)GetGeometry(0));
-      break;
-    case Geometry::CURVE:
-      InsertCurve((Curve*)GetGeometry(0));
-      break;
-    case Geometry::POINT:
-      InsertPoints((Points*)GetGeometry(0));
-      break;
-  }
+  return hitSomething;
 }
 
+// 3d-dda walk, a hit is only final once it lies before the next cell 
+// boundary as components spanning several cells can be hit further away
 bool Grid3D::Raycast(const GfRay& ray, Location* hit,
   double maxDistance, double* minDistance) const
 {
+  if (!_numCells) return false;
+
+  // unit direction so crossing distances compare with the hits ones
+  const GfRay unitRay(ray.GetStartPoint(), ray.GetDirection().GetNormalized());
+
   double enterDistance, exitDistance;
   // if the ray doesn't intersect the grid return
-  if(!ray.Intersect(GfBBox3d(*this), &enterDistance, &exitDistance))
+  if(!unitRay.Intersect(GfBBox3d(*this), &enterDistance, &exitDistance))
   {
     return false;
   }
+  enterDistance = GfMax(enterDistance, 0.0);
+  if (enterDistance > maxDistance) return false;
 
   // initialization step
   int32_t exit[3], step[3], cell[3];
-  GfVec3d deltaT, nextCrossingT;
-  GfVec3d invdir = -1.0 * ray.GetDirection();
+  double deltaT[3], nextCrossingT[3];
+  const GfVec3d& origin = unitRay.GetStartPoint();
+  const GfVec3d& direction = unitRay.GetDirection();
 
   for (uint8_t i = 0; i < 3; ++i) {
-    // convert ray starting point to cell coordinates
-    double rayOrigCell = 
-      ((ray.GetPoint(0.f)[i] + ray.GetDirection()[i] * enterDistance) - GetMin()[i]);
-    cell[i] = CLAMP(floor(rayOrigCell / _cellDimension[i]), 0, _resolution[i] - 1);
-    if(fabs(ray.GetDirection()[i]) < 0.0000001)
+    // convert ray entry point to cell coordinates
+    const double rayOrigCell = origin[i] + direction[i] * enterDistance - GetMin()[i];
+    cell[i] = CLAMP(int32_t(floor(rayOrigCell / _cellDimension[i])), 0, int32_t(_resolution[i]) - 1);
+    if (fabs(direction[i]) < 0.0000001)
     {
       deltaT[i] = 0;
-      nextCrossingT[i] = maxDistance;
+      nextCrossingT[i] = DBL_MAX;
       exit[i] = cell[i];
       step[i] = 0;
     }
-    else if (ray.GetDirection()[i] < 0.0) {
-      deltaT[i] = -_cellDimension[i] * invdir[i];
-      nextCrossingT[i] = enterDistance + (cell[i] * _cellDimension[i] - rayOrigCell) * invdir[i];
+    else if (direction[i] < 0.0) {
+      deltaT[i] = -_cellDimension[i] / direction[i];
+      nextCrossingT[i] = enterDistance + (cell[i] * _cellDimension[i] - rayOrigCell) / direction[i];
       exit[i] = -1;
       step[i] = -1;
     }
     else {
-      deltaT[i] = _cellDimension[i] * invdir[i];
-      nextCrossingT[i] = enterDistance + ((cell[i] + 1)  * _cellDimension[i] - rayOrigCell) * invdir[i];
+      deltaT[i] = _cellDimension[i] / direction[i];
+      nextCrossingT[i] = enterDistance + ((cell[i] + 1) * _cellDimension[i] - rayOrigCell) / direction[i];
       exit[i] = _resolution[i];
       step[i] = 1;
     }
   }
 
-  // start cell
-  uint32_t o = cell[2] * _resolution[0] * _resolution[1] + cell[1] * _resolution[0] + cell[0];
-  bool hitSomething = false;
   // walk through each cell of the grid and test for an intersection if
   // current cell contains geometry
-  while(!hitSomething) {
-    uint32_t o = cell[2] * _resolution[0] * _resolution[1] + cell[1] * _resolution[0] + cell[0];
-    if (_cells[o] != NULL) 
-      if(_cells[o]->Raycast(GetGeometry(0), ray, hit, maxDistance, minDistance))
-        hitSomething=true;
+  bool hitSomething = false;
+  while (true) {
+    const uint32_t o = GetCellIndex(cell[0], cell[1], cell[2]);
+    if (_cellStart[o + 1] > _cellStart[o] &&
+      _RaycastCell(o, unitRay, hit, maxDistance, minDistance))
+        hitSomething = true;
         
     uint8_t k =
       ((nextCrossingT[0] < nextCrossingT[1]) << 2) +
@@ -268,6 +271,7 @@ bool Grid3D::Raycast(const GfRay& ray, Location* hit,
 
     static const uint8_t map[8] = {2, 1, 2, 1, 2, 2, 0, 0};
     uint8_t axis = map[k];
+    if (hitSomething && hit->GetDistance() <= nextCrossingT[axis]) break;
     if (maxDistance <= nextCrossingT[axis]) break;
     cell[axis] += step[axis];
     if (cell[axis] == exit[axis]) break;
@@ -276,9 +280,104 @@ bool Grid3D::Raycast(const GfRay& ray, Location* hit,
   return hitSomething;
 }
 
+bool Grid3D::_ClosestCell(uint32_t index, const GfVec3f& point, Location* hit) const
+{
+  bool hitSomething = false;
+  for (uint32_t e = _cellStart[index]; e < _cellStart[index + 1]; ++e) {
+    const uint32_t c = _cellEntries[e];
+    const Geometry* geometry = GetGeometry(_componentGeoms[c]);
+    const GfMatrix4d& invMatrix = geometry->GetInverseMatrix();
+    const GfVec3f* points = ((const Deformable*)geometry)->GetPositionsCPtr();
+
+    Location localHit(*hit);
+    if (hit->IsValid())
+      localHit.ConvertToLocal(invMatrix);
+
+    if (_components[c]->Closest(points, GfVec3f(invMatrix.Transform(point)), &localHit)) {
+      localHit.ConvertToWorld(geometry->GetMatrix());
+      hit->Set(localHit);
+      hit->SetGeometryIndex(_componentGeoms[c]);
+      hitSomething = true;
+    }
+  }
+  return hitSomething;
+}
+
+// cells are visited in growing shells around the point cell, the walk stops 
+// once the next shell lies farther than the current hit
 bool Grid3D::Closest(const GfVec3f& point, Location* hit, double maxDistance) const
 {
-  return false;
+  if (!_numCells) return false;
+
+  const GfVec3d& bboxMin = GetMin();
+  int32_t center[3], resolution[3];
+  for (uint8_t i = 0; i < 3; ++i) {
+    resolution[i] = int32_t(_resolution[i]);
+    center[i] = CLAMP(int32_t(floor((point[i] - bboxMin[i]) / _cellDimension[i])), 
+      0, resolution[i] - 1);
+  }
+
+  const double maxDistanceSq = maxDistance < DBL_MAX ? maxDistance * maxDistance : DBL_MAX;
+  auto bestDistanceSq = [&]() {
+    return hit->IsValid() ? 
+      GfMin((GfVec3d(point) - hit->GetPoint()).GetLengthSq(), maxDistanceSq) : maxDistanceSq;
+  };
+
+  // squared distance from the point to a cell bounds
+  auto cellDistanceSq = [&](int32_t x, int32_t y, int32_t z) {
+    const int32_t coords[3] = {x, y, z};
+    double distanceSq = 0.0;
+    for (uint8_t i = 0; i < 3; ++i) {
+      const double lo = bboxMin[i] + coords[i] * _cellDimension[i];
+      const double hi = lo + _cellDimension[i];
+      if (point[i] < lo) distanceSq += (lo - point[i]) * (lo - point[i]);
+      else if (point[i] > hi) distanceSq += (point[i] - hi) * (point[i] - hi);
+    }
+    return distanceSq;
+  };
+
+  bool hitSomething = false;
+  for (int32_t shell = 0; ; ++shell) {
+    // cells left lie outside the box of the visited shells, so they are
+    // at least as far as the nearest face of that box inside the grid
+    bool covered = true;
+    double shellDistance = DBL_MAX;
+    for (uint8_t i = 0; i < 3; ++i) {
+      const int32_t lo = center[i] - shell;
+      const int32_t hi = center[i] + shell;
+      if (lo > 0) {
+        covered = false;
+        shellDistance = GfMin(shellDistance, 
+          double(point[i]) - (bboxMin[i] + lo * _cellDimension[i]));
+      }
+      if (hi < resolution[i] - 1) {
+        covered = false;
+        shellDistance = GfMin(shellDistance, 
+          (bboxMin[i] + (hi + 1) * _cellDimension[i]) - double(point[i]));
+      }
+    }
+
+    const int32_t zmin = GfMax(center[2] - shell, 0), zmax = GfMin(center[2] + shell, resolution[2] - 1);
+    const int32_t ymin = GfMax(center[1] - shell, 0), ymax = GfMin(center[1] + shell, resolution[1] - 1);
+    const int32_t xmin = GfMax(center[0] - shell, 0), xmax = GfMin(center[0] + shell, resolution[0] - 1);
+    for (int32_t z = zmin; z <= zmax; ++z)
+      for (int32_t y = ymin; y <= ymax; ++y) {
+        // inside the shell only its two x faces are left
+        const bool inner = std::abs(z - center[2]) < shell && std::abs(y - center[1]) < shell;
+        const int32_t xstep = inner ? 2 * shell : 1;
+        for (int32_t x = inner ? center[0] - shell : xmin; x <= xmax; x += xstep) {
+          if (x < xmin) continue;
+          const uint32_t o = GetCellIndex(x, y, z);
+          if (_cellStart[o + 1] == _cellStart[o]) continue;
+          if (cellDistanceSq(x, y, z) > bestDistanceSq()) continue;
+          if (_ClosestCell(o, point, hit)) hitSomething = true;
+        }
+      }
+
+    if (covered) break;
+    if (shellDistance > 0.0 && shellDistance * shellDistance > bestDistanceSq()) break;
+  }
+  return hitSomething;
 }
 
 GfVec3f Grid3D::GetCellPosition(uint32_t index) {
@@ -302,21 +401,13 @@ GfVec3f Grid3D::GetCellMax(uint32_t index){
 }
 
 
-Grid3D::Cell* Grid3D::GetCell(uint32_t index)
+uint32_t Grid3D::GetCellIndex(uint32_t x, uint32_t y, uint32_t z) const
 {
-    return _cells[MIN(MAX(index, 0), _numCells-1)];
+  return _resolution[0] * _resolution[1] * z + _resolution[0] * y + x;
 }
 
-Grid3D::Cell* Grid3D::GetCell(uint32_t x, uint32_t y, uint32_t z)
+uint32_t Grid3D::GetCellIndex(const GfVec3f& pos) const
 {
-    uint32_t cx = MIN(MAX(x, 0), _resolution[0]);
-    uint32_t cy = MIN(MAX(y, 0), _resolution[1]);
-    uint32_t cz = MIN(MAX(z, 0), _resolution[2]);
-    return 
-      _cells[_resolution[0] * _resolution[1] * cz + _resolution[0] * cy + cx];
-}
-
-Grid3D::Cell* Grid3D::GetCell(const GfVec3f& pos){
   GfVec3f rescale;
   GfVec3f invDimensions(1.f/_cellDimension[0],
                              1.f/_cellDimension[1],
@@ -325,15 +416,14 @@ Grid3D::Cell* Grid3D::GetCell(const GfVec3f& pos){
   // convert to cell coordinates
   const GfVec3d& bboxMin = GetMin();
   rescale[0] = (pos[0] - bboxMin[0]) * invDimensions[0];
-  rescale[0] = (pos[1] - bboxMin[1]) * invDimensions[1];
-  rescale[0] = (pos[2] - bboxMin[2]) * invDimensions[2];
+  rescale[1] = (pos[1] - bboxMin[1]) * invDimensions[1];
+  rescale[2] = (pos[2] - bboxMin[2]) * invDimensions[2];
 
-  uint32_t idz = CLAMP(floor(rescale[2]), 0, _resolution[2] - 1);
-  uint32_t idy = CLAMP(floor(rescale[1]), 0, _resolution[1] - 1);
-  uint32_t idx = CLAMP(floor(rescale[0]), 0, _resolution[0] - 1);
+  uint32_t idz = CLAMP(int(floor(rescale[2])), 0, int(_resolution[2]) - 1);
+  uint32_t idy = CLAMP(int(floor(rescale[1])), 0, int(_resolution[1]) - 1);
+  uint32_t idx = CLAMP(int(floor(rescale[0])), 0, int(_resolution[0]) - 1);
 
-  return 
-    _cells[_resolution[0] * _resolution[1] * idz + _resolution[0] * idy + idx];
+  return GetCellIndex(idx, idy, idz);
 }
 
 
@@ -376,7 +466,7 @@ void Grid3D::GetCells(VtArray<GfVec3f>& positions,
   VtArray<GfVec3f>& scales, VtArray<GfVec3f>& colors, bool branchOrLeaf)
 {
   for(size_t c = 0; c < _numCells; ++c) {
-    if(_cells[c]) {
+    if(_cellStart[c + 1] > _cellStart[c]) {
       const GfVec3f scale(_cellDimension);
       positions.push_back(GetCellPosition(c)+scale*0.5);
       scales.push_back(scale);
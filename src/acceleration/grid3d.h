@@ -4,6 +4,7 @@
 #include <float.h>
 #include <vector>
 #include <pxr/base/gf/vec3f.h>
+#include <pxr/base/gf/vec3i.h>
 #include <pxr/base/gf/range3d.h>
 #include <pxr/base/gf/ray.h>
 #include "../common.h"
@@ -13,58 +14,16 @@
 JVR_NAMESPACE_OPEN_SCOPE
 
 class Geometry;
-class Component;
-class Point;
-class Edge;
-class Triangle;
-class Mesh;
-class Curve;
-class Points;
-struct Triangle;
+struct Component;
 
+// uniform grid stored as compressed sparse rows, cell c references the
+// components _cellEntries[_cellStart[c] .. _cellStart[c+1]), components of 
+// every registered geometry are gathered in a flat list at init
 class Grid3D : public Intersector {
-  enum ElemType {
-    POINT,
-    EDGE,
-    TRIANGLE,
-    NUM_ELEM_TYPES
-  };
-
-  typedef bool (Grid3D::*IntersectFunc)(
-    Geometry* geometry, const GfRay &ray, Location* hit, 
-    double maxDistance, double* minDistance);
-
 public:
+  Grid3D():_numCells(0){};
+  ~Grid3D(){};
 
-  typedef std::vector<Component*> _Components;
-
-  struct Cell
-  {
-    Cell(uint32_t id):index(id){};
-
-    void Insert(Point* point);
-    void Insert(Edge* edge);
-    void Insert(Triangle* triangle);
-
-    bool Raycast(const Geometry* geometry, const GfRay& ray, 
-      Location* hit, double maxDistance=-1, double* minDistance=NULL) const;
-    
-    // data
-    _Components                           components;
-    uint32_t                              index;
-
-  };
-
-  struct Node
-  {
-
-  };
-
-  Grid3D():_cells(NULL),_numCells(0){};
-  ~Grid3D()
-  {
-     DeleteCells();
-  }
   GfVec3f GetCellPosition(uint32_t index);
   GfVec3f GetCellMin(uint32_t index);
   GfVec3f GetCellMax(uint32_t index);
@@ -73,26 +32,25 @@ public:
   inline uint32_t GetResolutionX(){return _resolution[0];};
   inline uint32_t GetResolutionY(){return _resolution[1];};
   inline uint32_t GetResolutionZ(){return _resolution[2];};
-  // delete all cells
-  void DeleteCells();
 
   // geometries
   void Init(const std::vector<Geometry*>& geometries) override;
   void Update() override;
 
-  void InsertMesh(Mesh* mesh);
-  void InsertCurve(Curve* curve);
-  void InsertPoints(Points* points);
-
   // intersect a ray with the grid
   bool Raycast(const GfRay& ray, Location* hitPoint,
     double maxDistance=DBL_MAX, double* minDistance=NULL) const override;
   bool Closest(const GfVec3f& point, Location* hit,
     double maxDistance=DBL_MAX) const override;
 
-  Cell* GetCell(uint32_t index);
-  Cell* GetCell(uint32_t x, uint32_t y, uint32_t z);
-  Cell* GetCell(const GfVec3f& pos);
+  // cell content
+  uint32_t GetCellIndex(uint32_t x, uint32_t y, uint32_t z) const;
+  uint32_t GetCellIndex(const GfVec3f& pos) const;
+  size_t GetNumCellComponents(uint32_t index) const 
+    {return _cellStart[index + 1] - _cellStart[index];};
+  const Component* GetCellComponent(uint32_t index, size_t n) const 
+    {return _components[_cellEntries[_cellStart[index] + n]];};
+  size_t GetNumComponents() const {return _components.size();};
   
   GfVec3f GetCellDimension(){return _cellDimension;};
   void IndexToXYZ(const uint32_t index, uint32_t& x, uint32_t& y, uint32_t& z);
@@ -104,15 +62,31 @@ public:
     VtArray<GfVec3f>& colors, bool branchOrLeaf) override;
 
 protected:
-
+  void _GatherComponents();
+  void _ComputeResolution();
+  void _BuildCells();
+  bool _RaycastCell(uint32_t index, const GfRay& ray, Location* hit,
+    double maxDistance, double* minDistance) const;
+  bool _ClosestCell(uint32_t index, const GfVec3f& point, Location* hit) const;
 
 private:
-  uint32_t                _resolution[3];
-  GfVec3f            _cellDimension;
-  // cells
-  Cell**                  _cells;
-  uint32_t                _numCells;
-
+  // expected components per cell and cells count upper bound
+  static const size_t         DENSITY = 4;
+  static const size_t         MAX_CELLS = 1 << 24;
+
+  uint32_t                    _resolution[3];
+  GfVec3f                     _cellDimension;
+  uint32_t                    _numCells;
+
+  // components and owning geometry, cells range covered by each component
+  std::vector<Component*>     _components;
+  std::vector<uint32_t>       _componentGeoms;
+  std::vector<GfVec3i>        _componentMin;
+  std::vector<GfVec3i>        _componentMax;
+
+  // compressed sparse rows
+  std::vector<uint32_t>       _cellStart;
+  std::vector<uint32_t>       _cellEntries;
 };
 
 class MultiGrid3D : public Intersector
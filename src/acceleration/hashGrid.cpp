@@ -1,4 +1,7 @@
+#include <algorithm>
 #include <pxr/base/arch/timing.h>
+#include <pxr/base/work/loops.h>
+#include <pxr/base/work/threadLimits.h>
 #include "../acceleration/hashGrid.h"
 #include "../utils/color.h"
 #include "../utils/timer.h"
@@ -14,33 +17,120 @@ HashGrid::Init(size_t n, const GfVec3f* points, float spacing)
   _tableSize = 2 * _n;
   _cellStart.resize(_tableSize + 1);
   _cellEntries.resize(_n);
+  _hashes.assign(_n, -1);
 
   Update(points);
 }
 
+// counting sort of the points by hash, each chunk owns a range of points and
+// counts its cached hashes in its own histogram, an exclusive prefix sum over
+// (cell, chunk) gives every chunk its write cursors and the scatter keeps entries
+// sorted by point index inside a cell, the table is left untouched when no point 
+// changed cell since last update
 void 
 HashGrid::Update(const GfVec3f* points)
 {
-  memset(&_cellStart[0], 0, _cellStart.size() * sizeof(int));
-  memset(&_cellEntries[0], 0, _cellEntries.size() * sizeof(int));
-
-  for (size_t pointIdx = 0; pointIdx < _n; ++pointIdx) {
-    int64_t hash = (this->*_HashCoords)(_IntCoords(points[pointIdx]));
-    _cellStart[hash]++;
-  }
-
-  size_t start = 0;
-  for (size_t tableIdx = 0; tableIdx < _tableSize; ++tableIdx) {
-    start += _cellStart[tableIdx];
-    _cellStart[tableIdx] = start;
-  }
-  _cellStart[_tableSize] = start;
-
-  for (size_t pointIdx = 0; pointIdx < _n; ++pointIdx) {
-    int64_t hash = (this->*_HashCoords)(_IntCoords(points[pointIdx]));
-    _cellStart[hash]--;
-    _cellEntries[_cellStart[hash]] = pointIdx;
-  }
+  if(!_n) return;
+
+  const size_t numChunks = std::max(size_t(1), 
+    std::min(_n / MIN_POINTS_PER_CHUNK, size_t(WorkGetConcurrencyLimit())));
+
+  std::vector<char> changed(numChunks, 0);
+  WorkParallelForN(numChunks, [&](size_t begin, size_t end) {
+    for(size_t chunk = begin; chunk < end; ++chunk) {
+      const size_t last = (chunk + 1) * _n / numChunks;
+      for (size_t pointIdx = chunk * _n / numChunks; pointIdx < last; ++pointIdx) {
+        const int hash = (this->*_HashCoords)(_IntCoords(points[pointIdx]));
+        if(hash != _hashes[pointIdx]) {
+          _hashes[pointIdx] = hash;
+          changed[chunk] = 1;
+        }
+      }
+    }
+  });
+  if(std::find(changed.begin(), changed.end(), 1) == changed.end()) return;
+
+  // per chunk histogram over its own points
+  _chunkCounts.assign(numChunks * _tableSize, 0);
+  WorkParallelForN(numChunks, [&](size_t begin, size_t end) {
+    for(size_t chunk = begin; chunk < end; ++chunk) {
+      int* counts = &_chunkCounts[chunk * _tableSize];
+      const size_t last = (chunk + 1) * _n / numChunks;
+      for (size_t pointIdx = chunk * _n / numChunks; pointIdx < last; ++pointIdx)
+        counts[_hashes[pointIdx]]++;
+    }
+  });
+
+  // exclusive prefix sum, table ranges are summed concurrently then offset
+  std::vector<int> offsets(numChunks + 1, 0);
+  WorkParallelForN(numChunks, [&](size_t begin, size_t end) {
+    for(size_t range = begin; range < end; ++range) {
+      const size_t last = (range + 1) * _tableSize / numChunks;
+      int total = 0;
+      for (size_t tableIdx = range * _tableSize / numChunks; tableIdx < last; ++tableIdx)
+        for(size_t chunk = 0; chunk < numChunks; ++chunk)
+          total += _chunkCounts[chunk * _tableSize + tableIdx];
+      offsets[range + 1] = total;
+    }
+  });
+  for(size_t range = 0; range < numChunks; ++range)
+    offsets[range + 1] += offsets[range];
+
+  WorkParallelForN(numChunks, [&](size_t begin, size_t end) {
+    for(size_t range = begin; range < end; ++range) {
+      const size_t last = (range + 1) * _tableSize / numChunks;
+      int start = offsets[range];
+      for (size_t tableIdx = range * _tableSize / numChunks; tableIdx < last; ++tableIdx) {
+        _cellStart[tableIdx] = start;
+        for(size_t chunk = 0; chunk < numChunks; ++chunk) {
+          int& count = _chunkCounts[chunk * _tableSize + tableIdx];
+          const int num = count;
+          count = start;
+          start += num;
+        }
+      }
+    }
+  });
+  _cellStart[_tableSize] = _n;
+
+  // per chunk scatter, chunks and their points come in ascending order
+  WorkParallelForN(numChunks, [&](size_t begin, size_t end) {
+    for(size_t chunk = begin; chunk < end; ++chunk) {
+      int* cursors = &_chunkCounts[chunk * _tableSize];
+      const size_t last = (chunk + 1) * _n / numChunks;
+      for (size_t pointIdx = chunk * _n / numChunks; pointIdx < last; ++pointIdx)
+        _cellEntries[cursors[_hashes[pointIdx]]++] = pointIdx;
+    }
+  });
+}
+
+size_t 
+HashGrid::Closests(size_t index, const GfVec3f* positions,
+  int* closests, size_t capacity, float distance) const
+{
+  const GfVec3f& point = positions[index];
+  const GfVec3i minCoords = _IntCoords(point - GfVec3f(distance));
+  const GfVec3i maxCoords = _IntCoords(point + GfVec3f(distance));
+  const float distance2 = distance * distance;
+
+  size_t numClosests = 0;
+  for (int x = minCoords[0]; x <= maxCoords[0]; ++x)
+    for (int y = minCoords[1]; y <= maxCoords[1]; ++y)
+      for (int z = minCoords[2]; z <= maxCoords[2]; ++z) {
+        int64_t hash = (this->*_HashCoords)(GfVec3i(x, y, z));
+        int start = _cellStart[hash];
+        int end = _cellStart[hash + 1];
+
+        for (int n = start; n < end; ++n) {
+          if(_cellEntries[n] != index && 
+            (point - positions[_cellEntries[n]]).GetLengthSq() < distance2) {
+              if(numClosests >= capacity) return numClosests;
+              closests[numClosests++] = _cellEntries[n];
+          }
+        }
+      }
+
+  return numClosests;
 }
 
 size_t 
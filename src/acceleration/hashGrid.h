@@ -49,7 +49,7 @@ public:
   };
 
   HashGrid(float spacing = 1.f, short hashMethod=MULLER) 
-    : _tableSize(0), _spacing(spacing>1e-6f ? spacing : 1e-6f), _scl(1.f/_spacing), _hashMethod(hashMethod) {
+    : _n(0), _tableSize(0), _spacing(spacing>1e-6f ? spacing : 1e-6f), _scl(1.f/_spacing), _hashMethod(hashMethod) {
     switch (_hashMethod) {
     case MULLER:
       _HashCoords = &HashGrid::_HashCoordsMuller;
@@ -64,6 +64,13 @@ public:
   void Init(size_t n, const GfVec3f* positions, float radius);
   void Update(const GfVec3f* positions);
 
+  // closests written to a caller buffer holding at least capacity entries
+  size_t Closests(size_t index, const GfVec3f* positions,
+    int* closests, size_t capacity, float distance) const;
+  // same with candidates rejected by the filter before they count toward capacity
+  template<typename Filter>
+  size_t Closests(size_t index, const GfVec3f* positions,
+    int* closests, size_t capacity, float distance, const Filter& filter) const;
   size_t Closests(size_t index, const GfVec3f* positions,
     std::vector<int>& closests, float distance) const;
   size_t Closests(size_t index, const GfVec3f* positions, const GfVec3f* velocities, float ft,
@@ -73,16 +80,51 @@ public:
   GfVec3f GetColor(const GfVec3f& point);
 
 private:
+  static const size_t               MIN_POINTS_PER_CHUNK = 4096;
+
   size_t                            _n;
   float                             _spacing;
   float                             _scl;
   size_t                            _tableSize;
   std::vector<int>                  _cellStart;
   std::vector<int>                  _cellEntries;
+  std::vector<int>                  _hashes;        // cached per point
+  std::vector<int>                  _chunkCounts;   // histogram per points chunk
   short                             _hashMethod;
   HashFunc                          _HashCoords;
 }; 
 
+template<typename Filter>
+size_t 
+HashGrid::Closests(size_t index, const GfVec3f* positions,
+  int* closests, size_t capacity, float distance, const Filter& filter) const
+{
+  const GfVec3f& point = positions[index];
+  const GfVec3i minCoords = _IntCoords(point - GfVec3f(distance));
+  const GfVec3i maxCoords = _IntCoords(point + GfVec3f(distance));
+  const float distance2 = distance * distance;
+
+  size_t numClosests = 0;
+  for (int x = minCoords[0]; x <= maxCoords[0]; ++x)
+    for (int y = minCoords[1]; y <= maxCoords[1]; ++y)
+      for (int z = minCoords[2]; z <= maxCoords[2]; ++z) {
+        int64_t hash = (this->*_HashCoords)(GfVec3i(x, y, z));
+        int start = _cellStart[hash];
+        int end = _cellStart[hash + 1];
+
+        for (int n = start; n < end; ++n) {
+          const int entry = _cellEntries[n];
+          if(entry != index && filter(entry) &&
+            (point - positions[entry]).GetLengthSq() < distance2) {
+              if(numClosests >= capacity) return numClosests;
+              closests[numClosests++] = entry;
+          }
+        }
+      }
+
+  return numClosests;
+}
+
 JVR_NAMESPACE_CLOSE_SCOPE
 
 #endif // JVR_ACCELERATION_HASHGRID_H
@@ -1,3 +1,6 @@
+#include <atomic>
+#include <pxr/base/work/loops.h>
+#include <pxr/base/work/sort.h>
 #include "../acceleration/intersector.h"
 #include "../geometry/geometry.h"
 #include "../geometry/deformable.h"
@@ -51,5 +54,89 @@ Intersector::_Init(const std::vector<Geometry*>& geometries)
 
 }
 
+//-------------------------------------------------------
+// Batched queries
+//-------------------------------------------------------
+template<typename GetPoint>
+static void
+_MortonOrder(size_t numQueries, const GetPoint& getPoint, std::vector<Morton>& order)
+{
+  order.clear();
+  if(!numQueries) return;
+
+  GfRange3d range;
+  for(size_t q = 0; q < numQueries; ++q)
+    range.UnionWith(getPoint(q));
+  // flat query sets (e.g. a plane of rays) keep a finite morton scale
+  range.SetMax(range.GetMax() + GfVec3d(1e-6));
+
+  order.resize(numQueries);
+  WorkParallelForN(numQueries, [&](size_t begin, size_t end) {
+    for(size_t q = begin; q < end; ++q)
+      order[q] = { MortonEncode3D(WorldToMorton(range, getPoint(q))), q };
+  });
+}
+
+void
+Intersector::_SortQueries(const GfRay* rays, size_t numRays, std::vector<Morton>& order)
+{
+  _MortonOrder(numRays, [&](size_t q) {return rays[q].GetStartPoint();}, order);
+
+  // direction octant in the top bits so a packet shares its traversal order
+  WorkParallelForN(numRays, [&](size_t begin, size_t end) {
+    for(size_t q = begin; q < end; ++q) {
+      const GfVec3d& direction = rays[q].GetDirection();
+      const uint64_t octant = 
+        (direction[0] < 0.0 ? 1 : 0) | (direction[1] < 0.0 ? 2 : 0) | (direction[2] < 0.0 ? 4 : 0);
+      order[q].code = (octant << 61) | (order[q].code >> 2);
+    }
+  });
+  WorkParallelSort(&order);
+}
+
+void
+Intersector::_SortQueries(const GfVec3f* points, size_t numPoints, std::vector<Morton>& order)
+{
+  _MortonOrder(numPoints, [&](size_t q) {return GfVec3d(points[q]);}, order);
+  WorkParallelSort(&order);
+}
+
+size_t
+Intersector::RaycastBatch(const GfRay* rays, size_t numRays, Location* hits,
+  double maxDistance) const
+{
+  std::vector<Morton> order;
+  _SortQueries(rays, numRays, order);
+
+  std::atomic<size_t> numHits(0);
+  WorkParallelForN(numRays, [&](size_t begin, size_t end) {
+    size_t found = 0;
+    for(size_t q = begin; q < end; ++q) {
+      const size_t index = order[q].data;
+      if(Raycast(rays[index], &hits[index], maxDistance)) found++;
+    }
+    numHits += found;
+  });
+  return numHits;
+}
+
+size_t
+Intersector::ClosestBatch(const GfVec3f* points, size_t numPoints, Location* hits,
+  double maxDistance) const
+{
+  std::vector<Morton> order;
+  _SortQueries(points, numPoints, order);
+
+  std::atomic<size_t> numHits(0);
+  WorkParallelForN(numPoints, [&](size_t begin, size_t end) {
+    size_t found = 0;
+    for(size_t q = begin; q < end; ++q) {
+      const size_t index = order[q].data;
+      if(Closest(points[index], &hits[index], maxDistance)) found++;
+    }
+    numHits += found;
+  });
+  return numHits;
+}
 
 JVR_NAMESPACE_CLOSE_SCOPE
\ No newline at end of file
@@ -11,6 +11,7 @@
 #include <pxr/base/vt/array.h>
 #include "../geometry/location.h"
 #include "../geometry/intersection.h"
+#include "../acceleration/morton.h"
 
 JVR_NAMESPACE_OPEN_SCOPE
 
@@ -57,8 +58,22 @@ public:
   virtual bool Closest(const GfVec3f& point, Location* hit,
     double maxDistance=DBL_MAX) const = 0;
 
+  // batched queries, one result per query written in input order, hits are
+  // expected default constructed (or holding a previous bound), queries are
+  // visited in morton order so neighbouring queries share the same nodes
+  // returns the number of hits
+  virtual size_t RaycastBatch(const GfRay* rays, size_t numRays, Location* hits,
+    double maxDistance=DBL_MAX) const;
+  virtual size_t ClosestBatch(const GfVec3f* points, size_t numPoints, Location* hits,
+    double maxDistance=DBL_MAX) const;
+
 protected:
   virtual void _Init(const std::vector<Geometry*>& geometries);
+
+  // query order sorted by morton code of the ray origins (grouped by direction
+  // octant) or of the points, morton data holds the query index
+  static void _SortQueries(const GfRay* rays, size_t numRays, std::vector<Morton>& order);
+  static void _SortQueries(const GfVec3f* points, size_t numPoints, std::vector<Morton>& order);
    bool _accelerated;
 
 private:
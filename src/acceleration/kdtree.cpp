@@ -1,8 +1,12 @@
 #include <algorithm>
+#include <cfloat>
+#include <cmath>
 #include <iostream>
 #include <iterator>
 #include <numeric>
 
+#include <pxr/base/work/loops.h>
+
 #include "../acceleration/kdtree.h"
 #include "../geometry/deformable.h"
 
@@ -18,6 +22,7 @@ KDTree::AddCell( const KDTree::IndexPoint &point)
 void
 KDTree::Init(const std::vector<Geometry*> &geometries) 
 {
+  delete _distance;
   switch(_distanceType) {
     case DistanceType::CHEBYSHEV:
       _distance = new DistanceChebyshev();
@@ -32,6 +37,7 @@ KDTree::Init(const std::vector<Geometry*> &geometries)
       break;
     
     default:
+      _distance = nullptr;
       std::cerr << "KDTree initialize DistanceMesure fail: invalid type!";
       return;
   }
@@ -47,17 +53,38 @@ KDTree::Init(const std::vector<Geometry*> &geometries)
     SetGeometryCellIndices(g, totalNumPoints, totalNumPoints + numPoints);
     totalNumPoints += numPoints;
   }
-  _points.reserve(totalNumPoints);
   _numComponents = totalNumPoints;
 
-  std::cout << "init kd tree with " << totalNumPoints << " points..." << std::endl;
+  _GatherPoints();
+  _BuildTree();
 
-  GfRange3d range;
-  size_t offset = 0;
-  for(size_t g = 0; g < geometries.size(); ++g) {
-    const Deformable* deformable = static_cast<const Deformable*>(geometries[g]);
+  if (_root == nullptr)
+  {
+      throw std::runtime_error("KDTree is empty.");
+  }
+}
 
-    size_t numPoints = deformable->GetNumPoints();
+// points move so the tree is rebuilt from scratch, the median build is 
+// cheap enough that refitting split planes would not pay off
+void
+KDTree::Update()
+{
+  if(!_numComponents) return;
+  _GatherPoints();
+  _BuildTree();
+}
+
+void
+KDTree::_GatherPoints()
+{
+  _points.clear();
+  _points.reserve(_numComponents);
+
+  GfRange3d range;
+  for(size_t g = 0; g < GetNumGeometries(); ++g) {
+    const Deformable* deformable = static_cast<const Deformable*>(GetGeometry(g));
+    const size_t offset = GetGeometryCellsStartIndex(g);
+    const size_t numPoints = deformable->GetNumPoints();
     
     const GfMatrix4d& matrix = deformable->GetMatrix();
     const GfVec3f* positions = deformable->GetPositionsCPtr();
@@ -67,30 +94,170 @@ KDTree::Init(const std::vector<Geometry*> &geometries)
       range.UnionWith(worldPoint);
       _points.push_back(KDTree::IndexPoint(i + offset, worldPoint));
     }
-    offset += numPoints;
   }
 
   SetMin(range.GetMin());
   SetMax(range.GetMax());
+}
 
-  std::cout << "bbox minimum : " << GetMin() << std::endl;
-  std::cout << "bbox maximum : " << GetMax() << std::endl;
+// balanced median split built level by level, the cell of a segment 
+// [begin, end) is stored at its middle so cells and sorted points share 
+// indices, all segments of a level are split in parallel
+void
+KDTree::_BuildTree()
+{
+  struct _Segment {
+    size_t      begin;
+    size_t      end;
+    GfRange3d   range;
+  };
+
+  const size_t numPoints = _points.size();
+  _cells.assign(numPoints, KDTree::Cell());
+  _root = numPoints ? GetCell(numPoints >> 1) : nullptr;
+  if(!numPoints) return;
+
+  std::vector<_Segment> segments = { { 0, numPoints, *this } };
+  std::vector<_Segment> children;
+  while(segments.size()) {
+    children.resize(segments.size() * 2);
+
+    WorkParallelForN(segments.size(), [&](size_t begin, size_t end) {
+      for(size_t s = begin; s < end; ++s) {
+        const _Segment& segment = segments[s];
+        const size_t middle = (segment.begin + segment.end) >> 1;
+
+        // split the largest extent
+        const GfVec3d size = segment.range.GetSize();
+        short axis = size[1] > size[0] ? 1 : 0;
+        if(size[2] > size[axis]) axis = 2;
+
+        std::nth_element(_points.begin() + segment.begin, _points.begin() + middle,
+          _points.begin() + segment.end, _CompareDimension(axis));
+
+        KDTree::Cell& cell = _cells[middle];
+        cell.SetMin(segment.range.GetMin());
+        cell.SetMax(segment.range.GetMax());
+        cell.axis = axis;
+        cell.point = _points[middle];
+        cell.left = middle > segment.begin ? 
+          (segment.begin + middle) >> 1 : INVALID_INDEX;
+        cell.right = segment.end > middle + 1 ? 
+          (middle + 1 + segment.end) >> 1 : INVALID_INDEX;
+
+        GfVec3d maximum(segment.range.GetMax());
+        maximum[axis] = cell.point.position[axis];
+        children[s * 2] = { segment.begin, middle, 
+          GfRange3d(segment.range.GetMin(), maximum) };
+
+        GfVec3d minimum(segment.range.GetMin());
+        minimum[axis] = cell.point.position[axis];
+        children[s * 2 + 1] = { middle + 1, segment.end, 
+          GfRange3d(minimum, segment.range.GetMax()) };
+      }
+    });
 
-  _cells.reserve(_points.size());
-  _root = GetCell(_BuildTreeRecursively(range, 0, 0, _points.size()));
-  std::cout << "kdtree root : " << (intptr_t)_root << std::endl;
+    segments.clear();
+    for(const _Segment& child: children)
+      if(child.end > child.begin) segments.push_back(child);
+  }
+}
 
-  
+size_t
+KDTree::KNearest(const GfVec3f& point, size_t k, IndexDistance* neighbors,
+  double maxDistance) const
+{
+  if(!_root || !k) return 0;
+
+  _StackEntry stack[STACK_SIZE];
+  size_t stackSize = 0;
+  stack[stackSize++] = { _GetIndex(_root), 0.0 };
+
+  size_t numNeighbors = 0;
+  while(stackSize) {
+    const _StackEntry entry = stack[--stackSize];
+    size_t cellIdx = entry.cell;
+    if(entry.distance > (numNeighbors < k ? maxDistance : neighbors[0].second)) 
+      continue;
+
+    // descend to the leaf on the query side, farther sides are stacked
+    while(cellIdx != INVALID_INDEX) {
+      const KDTree::Cell& cell = _cells[cellIdx];
+      const double distance = _distance->Compute(point, cell.point.position);
+
+      if(numNeighbors < k) {
+        if(distance <= maxDistance) {
+          neighbors[numNeighbors++] = { cell.point.index, distance };
+          std::push_heap(neighbors, neighbors + numNeighbors, _CompareDistances());
+        }
+      } else if(distance < neighbors[0].second) {
+        std::pop_heap(neighbors, neighbors + k, _CompareDistances());
+        neighbors[k - 1] = { cell.point.index, distance };
+        std::push_heap(neighbors, neighbors + k, _CompareDistances());
+      }
 
-  if (_root == nullptr)
-  {
-      throw std::runtime_error("KDTree is empty.");
+      const float split = cell.point.position[cell.axis];
+      const size_t nearIdx = point[cell.axis] < split ? cell.left : cell.right;
+      const size_t farIdx = point[cell.axis] < split ? cell.right : cell.left;
+      if(farIdx != INVALID_INDEX) {
+        const double planeDistance = _distance->Compute1D(point[cell.axis], split, cell.axis);
+        if(planeDistance <= (numNeighbors < k ? maxDistance : neighbors[0].second))
+          stack[stackSize++] = { farIdx, planeDistance };
+      }
+      cellIdx = nearIdx;
+    }
   }
+
+  std::sort_heap(neighbors, neighbors + numNeighbors, _CompareDistances());
+  return numNeighbors;
+}
+
+size_t
+KDTree::RadiusSearch(const GfVec3f& point, float radius, 
+  std::vector<IndexDistance>& neighbors) const
+{
+  neighbors.clear();
+  if(!_root) return 0;
+
+  const double maxDistance = 
+    _distanceType == DistanceType::EUCLIDEAN ? radius * radius : radius;
+
+  size_t stack[STACK_SIZE];
+  size_t stackSize = 0;
+  stack[stackSize++] = _GetIndex(_root);
+
+  while(stackSize) {
+    size_t cellIdx = stack[--stackSize];
+    while(cellIdx != INVALID_INDEX) {
+      const KDTree::Cell& cell = _cells[cellIdx];
+      const double distance = _distance->Compute(point, cell.point.position);
+      if(distance <= maxDistance)
+        neighbors.push_back({ cell.point.index, distance });
+
+      const float split = cell.point.position[cell.axis];
+      const size_t nearIdx = point[cell.axis] < split ? cell.left : cell.right;
+      const size_t farIdx = point[cell.axis] < split ? cell.right : cell.left;
+      if(farIdx != INVALID_INDEX && 
+        _distance->Compute1D(point[cell.axis], split, cell.axis) <= maxDistance)
+        stack[stackSize++] = farIdx;
+      cellIdx = nearIdx;
+    }
+  }
+  return neighbors.size();
 }
 
 void
-KDTree::Update()
+KDTree::KNearestBatch(const GfVec3f* points, size_t numPoints, size_t k, 
+  IndexDistance* neighbors) const
 {
+  WorkParallelForN(numPoints, [&](size_t begin, size_t end) {
+    for(size_t p = begin; p < end; ++p) {
+      IndexDistance* pointNeighbors = neighbors + p * k;
+      const size_t found = KNearest(points[p], k, pointNeighbors);
+      for(size_t n = found; n < k; ++n)
+        pointNeighbors[n] = { INVALID_INDEX, FLT_MAX };
+    }
+  });
 }
 
 bool 
@@ -103,103 +270,24 @@ KDTree::Raycast(const GfRay& ray, Location* hit,
 bool 
 KDTree::Closest(const GfVec3f& point, Location* hit, double maxDistance) const
 {
-  double minDistanceSq = DBL_MAX;
-  KDTree::Cell *nearest = nullptr;
-  _RecurseClosest(_root, point, 0, minDistanceSq, nearest);
-
-  if(nearest) {
-    std::cout << "nearest = " << nearest->point.index << std::endl;
-    size_t cellIndex = nearest->point.index;
-    size_t geomIndex = GetGeometryIndexFromCell(&_cells[cellIndex]);
-    size_t pntIndex = cellIndex - GetGeometryCellsStartIndex(geomIndex);
-    const Geometry *geometry = GetGeometryFromCell(&_cells[cellIndex]);
-
-
-    std::cout << "geometry = " << geomIndex << std::endl;
-    std::cout << "component = " << pntIndex << std::endl;
-    hit->SetComponentIndex(pntIndex);
-    hit->SetGeometryIndex(geomIndex);
-    hit->SetCoordinates(GfVec3f(1.f, 0.f, 0.f));
-    //hit->SetCoordinates(((Deformable*)geometry)->GetPosition(pntIndex));
-    return true;
-  }
-  return false;
-}
-
-size_t 
-KDTree::_BuildTreeRecursively(const GfRange3d& range, size_t depth, size_t begin, size_t end)
-{
-  size_t index = AddCell();
-  KDTree::Cell* cell = GetCell(index);
-  cell->SetMin(range.GetMin());
-  cell->SetMax(range.GetMax());
-  cell->axis = depth % 3;
-
-  if((end - begin) <= 1) {
-    cell->point = _points[begin];
-  } else {
-    size_t middle = (begin + end) >> 1;
-    std::nth_element(_points.begin() + begin, _points.begin() + middle,
-                     _points.begin() + end, _CompareDimension(cell->axis));
-    cell->point = _points[middle];
-
-    if (middle - begin > 0) {
-      GfVec3d maximum(range.GetMax());
-      maximum[cell->axis] = _points[middle].position[cell->axis];
-      cell->left = _BuildTreeRecursively(GfRange3d(range.GetMin(), maximum), depth + 1, begin, middle);
-    }
-    if (end - middle > 1) {
-      GfVec3d minimum(range.GetMin());
-      minimum[cell->axis] = _points[middle].position[cell->axis];
-      cell->right = _BuildTreeRecursively(GfRange3d(minimum, range.GetMax()), depth + 1, middle + 1, end);
-    }
-  }
-
-  return index;
-}
-
-void
-KDTree::_RecurseClosest(const KDTree::Cell *cell, const GfVec3f &point, size_t index, 
-  double &minDistanceSq, KDTree::Cell *&nearest) const
-{
-  
-  double curDist, dist;
-
-  curDist = _distance->Compute(point, GfVec3f(cell->GetMidpoint()));
-  /*
-  if (!(searchpredicate && !(*searchpredicate)(allnodes[node->dataindex]))) {
-    if (neighborheap->size() < k) {
-      neighborheap->push(nn4heap(node->dataindex, curdist));
-    } else if (curdist < neighborheap->top().distance) {
-      neighborheap->pop();
-      neighborheap->push(nn4heap(node->dataindex, curdist));
-    }
-  }
-  // first search on side closer to point
-  if (point[node->cutdim] < node->point[node->cutdim]) {
-    if (node->loson)
-      if (neighbor_search(point, node->loson, k, neighborheap)) return true;
-  } else {
-    if (node->hison)
-      if (neighbor_search(point, node->hison, k, neighborheap)) return true;
-  }
-  // second search on farther side, if necessary
-  if (neighborheap->size() < k) {
-    dist = std::numeric_limits<double>::max();
-  } else {
-    dist = neighborheap->top().distance;
-  }
-  if (point[node->cutdim] < node->point[node->cutdim]) {
-    if (node->hison && bounds_overlap_ball(point, dist, node->hison))
-      if (neighbor_search(point, node->hison, k, neighborheap)) return true;
-  } else {
-    if (node->loson && bounds_overlap_ball(point, dist, node->loson))
-      if (neighbor_search(point, node->loson, k, neighborheap)) return true;
-  }
-
-  if (neighborheap->size() == k) dist = neighborheap->top().distance;
-  return ball_within_bounds(point, dist, node);
-  */
+  double maxMetric = maxDistance;
+  if(_distanceType == DistanceType::EUCLIDEAN && maxDistance < DBL_MAX)
+    maxMetric = maxDistance * maxDistance;
+
+  IndexDistance nearest;
+  if(!KNearest(point, 1, &nearest, maxMetric)) return false;
+
+  const size_t geomIndex = GetGeometryIndexFromPoint(nearest.first);
+  const size_t pntIndex = nearest.first - GetGeometryCellsStartIndex(geomIndex);
+  const Deformable* deformable = (const Deformable*)GetGeometry(geomIndex);
+
+  hit->SetComponentIndex(pntIndex);
+  hit->SetGeometryIndex(geomIndex);
+  hit->SetCoordinates(GfVec3f(1.f, 0.f, 0.f));
+  hit->SetPoint(deformable->GetMatrix().Transform(deformable->GetPositionsCPtr()[pntIndex]));
+  hit->SetDistance(_distanceType == DistanceType::EUCLIDEAN ? 
+    std::sqrt(nearest.second) : nearest.second);
+  return true;
 }
 
 size_t 
@@ -221,26 +309,29 @@ KDTree::GetGeometryFromCell(const KDTree::Cell* cell) const
 size_t
 KDTree::GetGeometryIndexFromCell(const KDTree::Cell* cell) const
 {
-  size_t cellIdx = _GetIndex(cell);
+  return GetGeometryIndexFromPoint(cell->point.index);
+}
+
+size_t
+KDTree::GetGeometryIndexFromPoint(size_t pointIdx) const
+{
   size_t startIdx, endIdx;
   size_t start = 0;
   size_t end = GetNumGeometries();
-  size_t middle = end >> 1;
 
-  while(start != end)
+  while(start < end)
   {
+    const size_t middle = (start + end) >> 1;
     startIdx = GetGeometryCellsStartIndex(middle);
     endIdx = GetGeometryCellsEndIndex(middle);
-    if(startIdx <= cellIdx && cellIdx < endIdx )
+    if(startIdx <= pointIdx && pointIdx < endIdx )
       return middle;
 
-    else if (cellIdx < startIdx)
+    else if (pointIdx < startIdx)
       end = middle;
 
     else
-      start = middle;
-
-    middle = (start + end) >> 1;
+      start = middle + 1;
   } 
   return INVALID_INDEX;
 }
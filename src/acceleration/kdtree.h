@@ -2,7 +2,6 @@
 #define JVR_ACCELERATION_KDTREE_H
 
 #include <vector>
-#include <queue>
 #include <pxr/base/gf/vec3f.h>
 #include "../acceleration/intersector.h"
 #include "../acceleration/distance.h"
@@ -42,22 +41,6 @@ public:
 
   using IndexDistance = std::pair<size_t, float>; // Index + Distance
 
-
-  // helper class for priority queue in k nearest neighbor search
-  struct NN4Heap {
-    size_t index;       // index of actual cell in _cells
-    double distance;    // distance of this neighbor from query point
-
-    (NN4Heap)(size_t i, double d) 
-      : index(i), distance(d) {};
-
-    inline bool operator<(const NN4Heap& other) {
-      return distance < other.distance;
-    };
-  };
-
-  typedef std::priority_queue<NN4Heap, std::vector<NN4Heap>> KNNSearchQueue;
-
   KDTree(DistanceType distanceType=DistanceType::EUCLIDEAN) 
     : _root(nullptr), _distanceType(distanceType), _distance(nullptr) {};
   ~KDTree() {delete _distance;};
@@ -72,6 +55,7 @@ public:
 
   const Geometry* GetGeometryFromCell(const Cell* cell) const;
   size_t GetGeometryIndexFromCell(const Cell* cell) const;
+  size_t GetGeometryIndexFromPoint(size_t pointIdx) const;
 
   // infos
   size_t GetNumComponents(){return _numComponents;};
@@ -81,6 +65,20 @@ public:
   virtual void Init(const std::vector<Geometry*>& geometries) override;
   virtual void Update() override;
 
+  // neighbor queries, distances are in the tree metric (squared for euclidean)
+  // and indices are global point indices (geometry cells start + point)
+  // k nearest written sorted by distance to a caller buffer of k entries
+  size_t KNearest(const GfVec3f& point, size_t k, IndexDistance* neighbors,
+    double maxDistance = DBL_MAX) const;
+  // neighbors within radius appended unsorted, the vector is cleared first
+  // so reusing it across queries never reallocates once grown
+  size_t RadiusSearch(const GfVec3f& point, float radius, 
+    std::vector<IndexDistance>& neighbors) const;
+  // k nearest of each point in parallel, neighbors holds numPoints * k entries
+  // and slots past the found neighbors are set to INVALID_INDEX
+  void KNearestBatch(const GfVec3f* points, size_t numPoints, size_t k, 
+    IndexDistance* neighbors) const;
+
   virtual bool Raycast(const GfRay& ray, Location* hit,
     double maxDistance = DBL_MAX, double* minDistance = NULL) const override;
   virtual bool Closest(const GfVec3f& point, Location* hit,
@@ -95,23 +93,30 @@ private:
     size_t d;
   };
 
+  // max heap on distance, the farthest neighbor sits on top
   struct _CompareDistances
   {
     inline bool operator()(const IndexDistance &d1, const IndexDistance &d2) const noexcept {
-      return (d1.second > d2.second);
+      return (d1.second < d2.second);
     }
   };
 
+  // cell to search with the lower bound of its distance to the query
+  struct _StackEntry {
+    size_t  cell;
+    double  distance;
+  };
+
+  // the balanced median tree depth is bounded by log2 of the points count
+  static const size_t STACK_SIZE = 64;
+
   bool _ContainsSphere(const GfVec3f& center, double radius, KDTree::Cell *cell) ;
   bool _IntersectSphere(const GfVec3f& center, double radius, KDTree::Cell *cell);
 
   size_t _GetIndex(const Cell* cell) const;
 
-  size_t _BuildTreeRecursively(const GfRange3d& range, 
-    size_t depth, size_t begin, size_t end);
-
-  void _RecurseClosest(const Cell *cell, const GfVec3f &point, 
-    size_t index, double &minDistanceSq, Cell *&nearest) const;
+  void _GatherPoints();
+  void _BuildTree();
 
   Cell*                           _root = nullptr;
   std::vector<IndexPoint>         _points;
@@ -320,9 +320,11 @@ uint64_t MortonBigMin( uint64_t zval, uint64_t zmin, uint64_t zmax)
 {
   uint64_t bigmin = 0ul;
 
-  int msb = _MortonMSBPosition(zval);
+  // walk down from the highest bit set in the range, not only in zval
+  int msb = _MortonMSBPosition(zval | zmax);
+  if(msb < 0) return 0ul;
 
-  uint64_t bpos = (0x1ul << (msb+1));
+  uint64_t bpos = (0x1ul << msb);
   while(bpos)
   {
     uint64_t bzval = zval & bpos;
@@ -362,9 +364,11 @@ uint64_t MortonLitMax( uint64_t zval, uint64_t zmin, uint64_t zmax)
 {
   uint64_t litmax    = 0ul;
 
-  int msb = _MortonMSBPosition(zval);
+  // walk down from the highest bit set in the range, not only in zval
+  int msb = _MortonMSBPosition(zval | zmax);
+  if(msb < 0) return 0ul;
 
-  uint64_t bpos = (0x1ul << (msb+1));
+  uint64_t bpos = (0x1ul << msb);
   while(bpos)
   {
     uint64_t bzval = zval & bpos;
@@ -1,6 +1,11 @@
 //======================================================
 // OCTREE IMPLEMENTATION
 //======================================================
+#include <algorithm>
+#include <array>
+#include <pxr/base/gf/math.h>
+#include <pxr/base/work/loops.h>
+#include <pxr/base/work/sort.h>
 #include "../acceleration/octree.h"
 #include "../geometry/point.h"
 #include "../geometry/edge.h"
@@ -8,345 +13,530 @@
 #include "../geometry/geometry.h"
 #include "../geometry/mesh.h"
 #include "../geometry/curve.h"
-#include "../geometry/points.h"
+#include "../geometry/deformable.h"
 
 JVR_NAMESPACE_OPEN_SCOPE
 
 
 const int Octree::MAX_ELEMENTS_NUMBER = 32;
 
-// destructor
-Octree::Cell::~Cell()
+//-------------------------------------------------------
+// Cell
+//-------------------------------------------------------
+GfVec3f Octree::Cell::GetCenter() const
 {
-  for (int i=0; i<8; i++)
-  {
-    if (_child[i])delete _child[i];
-    _child[i] = NULL;
-  }
-  if(_elements.size())_elements.clear();
+  return GfVec3f(
+    0.5f * (min[0] + max[0]), 0.5f * (min[1] + max[1]), 0.5f * (min[2] + max[2]));
 }
 
-// clear tree
-void Octree::Cell::ClearTree()
+GfVec3f Octree::Cell::GetHalfSize() const
 {
-  for (int i=0; i<8; i++)
-  {
-    if (_child[i])delete _child[i];
-    _child[i] = NULL;
-  }
-  if(_elements.size())_elements.clear();
+  return GfVec3f(
+    0.5f * (max[0] - min[0]), 0.5f * (max[1] - min[1]), 0.5f * (max[2] - min[2]));
 }
 
-// get distance
-float Octree::Cell::GetDistance(const GfVec3f &point) const
+float Octree::Cell::GetDistanceSquared(const GfVec3f& point) const
 {
-  float dx = _GetDistance1D(point[0], _min[0], _max[0]);
-  float dy = _GetDistance1D(point[1], _min[1], _max[1]);
-  float dz = _GetDistance1D(point[2], _min[2], _max[2]);
-  return sqrt(dx * dx + dy * dy + dz * dz);
+  float distanceSq = 0.f;
+  for (int i = 0; i < 3; ++i) {
+    if (point[i] < min[i]) distanceSq += (min[i] - point[i]) * (min[i] - point[i]);
+    else if (point[i] > max[i]) distanceSq += (point[i] - max[i]) * (point[i] - max[i]);
+  }
+  return distanceSq;
 }
 
-// intersect sphere
 bool Octree::Cell::IntersectSphere(const GfVec3f& center, const float radius) const
 {
-  float r2 = radius * radius;
-  float dmin = 0;
-
-  for(int ii = 0; ii < 3; ii++ )
-  {
-    if( center[ii] < _min[ii] ) dmin += _Squared( center[ii] - _min[ii] );
-    else if( center[ii] > _max[ii] ) dmin += _Squared( center[ii] - _max[ii] );
-  }
-  return dmin <= r2;
+  return GetDistanceSquared(center) <= radius * radius;
 }
 
-// get bounding box
-void Octree::Cell::GetBoundingBox(const GfVec3f* points, VtArray<int>& vertices)
+bool Octree::Cell::IntersectBox(const GfRange3d& range) const
 {
-  // reset bounding box
-  _min[0] = FLT_MAX;
-  _min[1] = FLT_MAX;
-  _min[2] = FLT_MAX;
-
-  _max[0] = -FLT_MAX;
-  _max[1] = -FLT_MAX;
-  _max[2] = -FLT_MAX;
-    
-  GfVec3f tmp;
-  unsigned int numVertices = vertices.size();
-  for (int i = 0; i < numVertices; i++)
-  {
-    tmp = points[vertices[i]];
-
-    if (tmp[0] < _min[0])_min[0] = tmp[0];
-    if (tmp[1] < _min[1])_min[1] = tmp[1];
-    if (tmp[2] < _min[2])_min[2] = tmp[2];
-
-    if (tmp[0] > _max[0])_max[0] = tmp[0];
-    if (tmp[1] > _max[1])_max[1] = tmp[1];
-    if (tmp[2] > _max[2])_max[2] = tmp[2];
-  }
-    
-  // extend bounding box
-  _min[0] -= 0.1f;
-  _min[1] -= 0.1f;
-  _min[2] -= 0.1f;
-  _max[0] += 0.1f;
-  _max[1] += 0.1f;
-  _max[2] += 0.1f;
+  for (int i = 0; i < 3; ++i)
+    if (range.GetMin()[i] > max[i] || range.GetMax()[i] < min[i]) return false;
+  return true;
 }
 
-
-// get furthest corner
-void Octree::Cell::GetFurthestCorner(const GfVec3f& point, GfVec3f& corner)
+// slab test, same conventions as GfRay::Intersect
+static bool
+_CellIntersect(const Octree::Cell& cell, const GfVec3d& origin, const GfVec3d& direction,
+  double* enterDistance)
 {
-  GfVec3f delta;
-  float dist;
-  float furthestDist=-1.0f;
-    
-  float P[6] = {
-    (float)_min[0],
-    (float)_min[1],
-    (float)_min[2],
-    (float)_max[0],
-    (float)_max[1],
-    (float)_max[2]
-  };
-    
-  static const int permutation[24] = {0,1,2,3,1,2,0,1,5,3,1,5,
-      0,4,2,3,4,2,0,4,5,3,4,5};
-    
-  for(unsigned int z=0;z<8;z++)
-  {
-    GfVec3f currentCorner(P[permutation[z*3]],P[permutation[z*3+1]],P[permutation[z*3+2]]);
-    delta = point - currentCorner;
-    dist = (float)delta.GetLength();
-    if(dist>furthestDist)
-    {
-      furthestDist = dist;
-      corner = currentCorner;
+  double maxStart = -DBL_MAX;
+  double minEnd = DBL_MAX;
+  for(size_t d = 0; d < 3; ++d) {
+    if(direction[d] == 0.0) {
+      if(origin[d] < cell.min[d] || origin[d] > cell.max[d]) return false;
+      continue;
     }
+    double t1 = (cell.min[d] - origin[d]) / direction[d];
+    double t2 = (cell.max[d] - origin[d]) / direction[d];
+    if(t1 > t2) std::swap(t1, t2);
+    if(t1 > maxStart) maxStart = t1;
+    if(t2 < minEnd) minEnd = t2;
+    if(maxStart > minEnd) return false;
   }
+  if(minEnd < 0.0) return false;
+
+  *enterDistance = maxStart;
+  return true;
 }
 
-// build tree
-void Octree::Cell::BuildTree(Component* components, size_t num, Geometry* geometry)
+static void
+_SetCellBounds(Octree::Cell& cell, const GfRange3f& range)
 {
-  ClearTree();
-    
-  if(geometry->GetType() < Geometry::POINT) {
-    // TODO add warning message here
-    return;
+  for (int i = 0; i < 3; ++i) {
+    cell.min[i] = range.GetMin()[i];
+    cell.max[i] = range.GetMax()[i];
   }
-  // loop over all elements, insert all leaves to the tree
-  for(size_t i = 0; i < num; ++i)
-  {
-    Insert(&components[i]);
+}
+
+//-------------------------------------------------------
+// Build
+//-------------------------------------------------------
+// gather the components of every geometry (mesh triangles, curve edges)
+void
+Octree::_GatherComponents()
+{
+  _components.clear();
+  _componentGeoms.clear();
+  for (size_t g = 0; g < GetNumGeometries(); ++g) {
+    Geometry* geometry = GetGeometry(g);
+    const size_t start = _components.size();
+    switch (geometry->GetType()) {
+      case Geometry::MESH:
+      {
+        Mesh* mesh = (Mesh*)geometry;
+        for (size_t t = 0; t < mesh->GetNumTriangles(); ++t)
+          _components.push_back(mesh->GetTriangle(t));
+        break;
+      }
+      case Geometry::CURVE:
+      {
+        Curve* curve = (Curve*)geometry;
+        for (size_t e = 0; e < curve->GetTotalNumSegments(); ++e)
+          _components.push_back(curve->GetEdge(e));
+        break;
+      }
+    }
+    _componentGeoms.resize(_components.size(), g);
+    SetGeometryCellIndices(g, start, _components.size());
   }
-    
-  Split(((Deformable*)geometry)->GetPositionsCPtr());
 }
 
-// split tree
-void Octree::Cell::Split(const GfVec3f* points)
+GfRange3f
+Octree::_GetComponentBoundingBox(size_t index) const
 {
-  int esz = _elements.size();
+  const Deformable* geometry = (const Deformable*)GetGeometry(_componentGeoms[index]);
+  return _components[index]->GetBoundingBox(
+    geometry->GetPositionsCPtr(), geometry->GetMatrix());
+}
 
-  if (esz <= MAX_ELEMENTS_NUMBER || (esz <= 2*MAX_ELEMENTS_NUMBER && _depth > 3) ||(esz <= 3*MAX_ELEMENTS_NUMBER && _depth > 4) ||_depth > 6 )
-  {
-      _isLeaf = true;
-      return;
-  }
-    
-  _isLeaf = false;
-    
-  double xx[] = {_min[0], 0.5*(_min[0]+_max[0]), _max[0]};
-  double yy[] = {_min[1], 0.5*(_min[1]+_max[1]), _max[1]};
-  double zz[] = {_min[2], 0.5*(_min[2]+_max[2]), _max[2]};
-    
-  GfVec3f center, halfSize;
-
-  for (int i = 0; i < 2; ++i) {
-    for (int j = 0; j < 2; ++j) {
-      for (int k = 0; k < 2; ++k) {
-        int m = 4 * i + 2 * j + k;
-        _child[m] = new Cell(GfVec3f(xx[i], yy[j], zz[k]),
-          GfVec3f(xx[i + 1], yy[j + 1], zz[k + 1]), _depth + 1);
-
-        center = _child[m]->GetCenter();
-        halfSize = _child[m]->GetHalfSize();
-        int esz = _elements.size();
-
-        for (int e = 0; e < esz; ++e) {
-          if (_elements[e]->Touch(points, center, halfSize)) {
-            _child[m]->Insert(_elements[e]);
-          }
+// cells are split level by level, each cell of a level finds its children
+// ranges by binary search on the sorted codes, children are then allocated
+// contiguously after a scan of the children counts
+void
+Octree::_BuildCells()
+{
+  const size_t numComponents = _mortons.size();
+  _cells.clear();
+  _levels.clear();
+
+  Cell root;
+  root.begin = 0;
+  root.end = numComponents;
+  root.code = 0;
+  root.child = 0;
+  root.numChildren = 0;
+  root.depth = 0;
+  _cells.push_back(root);
+  _levels.push_back(0);
+
+  std::vector<std::array<uint32_t, 9>> splits;
+  std::vector<uint32_t> offsets;
+  size_t levelBegin = 0, levelEnd = 1;
+  while (levelBegin < levelEnd) {
+    const size_t numCells = levelEnd - levelBegin;
+    splits.resize(numCells);
+    offsets.resize(numCells + 1);
+
+    WorkParallelForN(numCells, [&](size_t begin, size_t end) {
+      for (size_t c = begin; c < end; ++c) {
+        const Cell& cell = _cells[levelBegin + c];
+        std::array<uint32_t, 9>& split = splits[c];
+        offsets[c + 1] = 0;
+        if (cell.NumElements() <= MAX_ELEMENTS_NUMBER || cell.depth >= MORTON_LONG_BITS)
+          continue;
+
+        const size_t shift = 3 * (MORTON_LONG_BITS - cell.depth - 1);
+        split[0] = cell.begin;
+        split[8] = cell.end;
+        for (size_t k = 1; k < 8; ++k) {
+          const Morton key = { cell.code | (uint64_t(k) << shift), 0 };
+          split[k] = std::lower_bound(_mortons.begin() + split[k - 1],
+            _mortons.begin() + cell.end, key) - _mortons.begin();
         }
-
-        if (_child[m]->NumElements() == 0) {
-          delete _child[m];
-          _child[m] = NULL;
-        } else {
-          _child[m]->Split(points);
+        for (size_t k = 0; k < 8; ++k)
+          if (split[k + 1] > split[k]) offsets[c + 1]++;
+      }
+    });
+
+    offsets[0] = 0;
+    for (size_t c = 0; c < numCells; ++c)
+      offsets[c + 1] += offsets[c];
+    _cells.resize(levelEnd + offsets[numCells]);
+
+    WorkParallelForN(numCells, [&](size_t begin, size_t end) {
+      for (size_t c = begin; c < end; ++c) {
+        Cell& cell = _cells[levelBegin + c];
+        cell.child = levelEnd + offsets[c];
+        cell.numChildren = offsets[c + 1] - offsets[c];
+        if (!cell.numChildren) continue;
+
+        const std::array<uint32_t, 9>& split = splits[c];
+        const size_t shift = 3 * (MORTON_LONG_BITS - cell.depth - 1);
+        size_t childIdx = cell.child;
+        for (size_t k = 0; k < 8; ++k) {
+          if (split[k + 1] == split[k]) continue;
+          Cell& child = _cells[childIdx++];
+          child.begin = split[k];
+          child.end = split[k + 1];
+          child.code = cell.code | (uint64_t(k) << shift);
+          child.child = 0;
+          child.numChildren = 0;
+          child.depth = cell.depth + 1;
         }
       }
+    });
+
+    levelBegin = levelEnd;
+    levelEnd = _cells.size();
+    if (levelBegin < levelEnd) _levels.push_back(levelBegin);
+  }
+  _root = &_cells[0];
+}
+
+// leaves union their components bounds, branches union their children
+// from the deepest level up
+void
+Octree::_RefitCells()
+{
+  WorkParallelForN(_cells.size(), [&](size_t begin, size_t end) {
+    for (size_t c = begin; c < end; ++c) {
+      Cell& cell = _cells[c];
+      if (!cell.IsLeaf()) continue;
+      GfRange3f range;
+      for (size_t m = cell.begin; m < cell.end; ++m)
+        range.UnionWith(_GetComponentBoundingBox(_mortons[m].data));
+      _SetCellBounds(cell, range);
     }
+  });
+
+  for (size_t level = _levels.size(); level-- > 0;) {
+    const size_t levelBegin = _levels[level];
+    const size_t levelEnd = level + 1 < _levels.size() ? _levels[level + 1] : _cells.size();
+    WorkParallelForN(levelEnd - levelBegin, [&](size_t begin, size_t end) {
+      for (size_t c = levelBegin + begin; c < levelBegin + end; ++c) {
+        Cell& cell = _cells[c];
+        if (cell.IsLeaf()) continue;
+        GfRange3f range;
+        for (size_t k = cell.child; k < cell.child + cell.numChildren; ++k)
+          range.UnionWith(GfRange3f(
+            GfVec3f(_cells[k].min[0], _cells[k].min[1], _cells[k].min[2]),
+            GfVec3f(_cells[k].max[0], _cells[k].max[1], _cells[k].max[2])));
+        _SetCellBounds(cell, range);
+      }
+    });
   }
-  _elements.clear();
 }
 
-void 
+void
 Octree::Init(const std::vector<Geometry*>& geometries)
 {
+  _Init(geometries);
+  _GatherComponents();
+
+  GfRange3d accum;
+  for (size_t g = 0; g < GetNumGeometries(); ++g)
+    accum.UnionWith(GetGeometry(g)->GetBoundingBox(true).GetRange());
+
+  // flat bounds get a thickness so the morton scale stays finite
+  const GfVec3d extent = accum.GetSize();
+  const double padding = 
+    1e-3 * GfMax(GfMax(extent[0], extent[1]), GfMax(extent[2], 1e-3));
+  for (size_t i = 0; i < 3; ++i)
+    if (extent[i] < padding) {
+      GfVec3d minimum(accum.GetMin()), maximum(accum.GetMax());
+      minimum[i] -= 0.5 * padding;
+      maximum[i] += 0.5 * padding;
+      accum = GfRange3d(minimum, maximum);
+    }
+  SetMin(accum.GetMin());
+  SetMax(accum.GetMax());
+  _mortonRange = accum;
+
+  // morton code of the components centroid
+  _mortons.resize(_components.size());
+  WorkParallelForN(_components.size(), [&](size_t begin, size_t end) {
+    for (size_t c = begin; c < end; ++c) {
+      const GfVec3d centroid(_GetComponentBoundingBox(c).GetMidpoint());
+      _mortons[c] = { MortonEncode3D(WorldToMorton(_mortonRange, centroid)), c };
+    }
+  });
+  WorkParallelSort(&_mortons);
 
+  _BuildCells();
+  _RefitCells();
 }
 
-void 
+// deforming components keep their cell and code, only the bounds follow
+void
 Octree::Update()
 {
+  if (!_root) return;
+  _RefitCells();
+  SetMin(GfVec3d(_root->min[0], _root->min[1], _root->min[2]));
+  SetMax(GfVec3d(_root->max[0], _root->max[1], _root->max[2]));
+}
+
+//-------------------------------------------------------
+// Queries
+//-------------------------------------------------------
+bool
+Octree::_RaycastLeaf(const Cell* cell, const GfRay& ray, Location* hit,
+  double maxDistance, double* minDistance) const
+{
+  bool found = false;
+  size_t geomIdx = INVALID_INDEX;
+  const Geometry* geometry = NULL;
+  const GfVec3f* points = NULL;
+  GfRay localRay;
+
+  for (size_t m = cell->begin; m < cell->end; ++m) {
+    const size_t c = _mortons[m].data;
+    if (_componentGeoms[c] != geomIdx) {
+      geomIdx = _componentGeoms[c];
+      geometry = GetGeometry(geomIdx);
+      points = ((const Deformable*)geometry)->GetPositionsCPtr();
+      localRay = ray;
+      localRay.Transform(geometry->GetInverseMatrix());
+    }
 
+    Location localHit(*hit);
+    if (_components[c]->Raycast(points, localRay, &localHit)) {
+      const GfVec3d localPoint(localRay.GetPoint(localHit.GetDistance()));
+      const double distance =
+        (ray.GetStartPoint() - geometry->GetMatrix().Transform(localPoint)).GetLength();
+      if (distance < hit->GetDistance() && distance < maxDistance) {
+        hit->Set(localHit);
+        hit->SetDistance(distance);
+        hit->SetGeometryIndex(geomIdx);
+        if (minDistance) *minDistance = distance;
+        found = true;
+      }
+    }
+  }
+  return found;
 }
 
-bool 
-Octree::Raycast(const GfRay& ray, Location* hit, 
+bool
+Octree::_ClosestLeaf(const Cell* cell, const GfVec3f& point, Location* hit) const
+{
+  bool found = false;
+  for (size_t m = cell->begin; m < cell->end; ++m) {
+    const size_t c = _mortons[m].data;
+    const Geometry* geometry = GetGeometry(_componentGeoms[c]);
+    const GfMatrix4d& invMatrix = geometry->GetInverseMatrix();
+    const GfVec3f* points = ((const Deformable*)geometry)->GetPositionsCPtr();
+
+    Location localHit(*hit);
+    if (hit->IsValid())
+      localHit.ConvertToLocal(invMatrix);
+
+    if (_components[c]->Closest(points, GfVec3f(invMatrix.Transform(point)), &localHit)) {
+      localHit.ConvertToWorld(geometry->GetMatrix());
+      hit->Set(localHit);
+      hit->SetGeometryIndex(_componentGeoms[c]);
+      found = true;
+    }
+  }
+  return found;
+}
+
+bool
+Octree::Raycast(const GfRay& ray, Location* hit,
   double maxDistance, double* minDistance) const
 {
-  return false;
+  if (!_root || !_root->NumElements()) return false;
+
+  // unit direction so cells enter distances compare with the hits ones
+  const GfRay unitRay(ray.GetStartPoint(), ray.GetDirection().GetNormalized());
+  const GfVec3d& origin = unitRay.GetStartPoint();
+  const GfVec3d& direction = unitRay.GetDirection();
+
+  double enterDistance;
+  if (!_CellIntersect(*_root, origin, direction, &enterDistance) || enterDistance > maxDistance)
+    return false;
+
+  uint32_t stack[STACK_SIZE];
+  size_t stackSize = 0;
+  stack[stackSize++] = 0;
+
+  bool found = false;
+  while (stackSize) {
+    const Cell& cell = _cells[stack[--stackSize]];
+    if (cell.IsLeaf()) {
+      if (_RaycastLeaf(&cell, unitRay, hit, maxDistance, minDistance)) found = true;
+      continue;
+    }
+
+    // children hit before the current hit, pushed farthest first
+    const double distance = GfMin(maxDistance, hit->GetDistance());
+    std::pair<double, uint32_t> children[8];
+    size_t numChildren = 0;
+    for (uint32_t k = cell.child; k < cell.child + cell.numChildren; ++k)
+      if (_CellIntersect(_cells[k], origin, direction, &enterDistance) && enterDistance < distance)
+        children[numChildren++] = { enterDistance, k };
+    std::sort(children, children + numChildren);
+    for (size_t k = numChildren; k-- > 0;)
+      stack[stackSize++] = children[k].second;
+  }
+  return found;
 }
 
-bool 
-Octree::Closest(const GfVec3f& point, 
+bool
+Octree::Closest(const GfVec3f& point,
   Location* hit, double maxDistance) const
 {
-  Cell* closestCell = NULL;
-  _GetClosestCell(point, closestCell);
+  if (!_root || !_root->NumElements()) return false;
 
-  const GfVec3f* positions = NULL;
+  const double maxDistanceSq = maxDistance < DBL_MAX ? maxDistance * maxDistance : DBL_MAX;
+  if (_root->GetDistanceSquared(point) > maxDistanceSq) return false;
 
-  // brute force neighbor cell
-  //std::vector<Triangle*>::iterator tri = closestCell->getTriangles().begin();
-  Component* comp;
-  float closestDistance = FLT_MAX;
+  uint32_t stack[STACK_SIZE];
+  size_t stackSize = 0;
+  stack[stackSize++] = 0;
 
-  for(unsigned e = 0; e < closestCell->NumElements(); ++e)
-  {
-    comp = closestCell->GetElement(e);
-    comp->Closest( positions, point , hit);
-  }
-    
-  std::vector<Cell*> nearbyCells;
-  if(!_octree.IsLeaf())
-  {
-    _GetNearbyCells(point, closestCell, nearbyCells, closestDistance);
-  }
-    
-  // loop nearby cells
-  std::vector<Cell*>::iterator nearby = nearbyCells.begin();
-  for(; nearby < nearbyCells.end(); ++nearby)
-  {
-    for(unsigned e = 0; e <(*nearby)->NumElements(); ++e)
-    {
-      comp = (*nearby)->GetElement(e);
-      comp->Closest( positions, point , hit);
+  bool found = false;
+  while (stackSize) {
+    const Cell& cell = _cells[stack[--stackSize]];
+    const double hitDistSq = hit->IsValid() ?
+      (GfVec3d(point) - hit->GetPoint()).GetLengthSq() : maxDistanceSq;
+    if (cell.GetDistanceSquared(point) > hitDistSq) continue;
+
+    if (cell.IsLeaf()) {
+      if (_ClosestLeaf(&cell, point, hit)) found = true;
+      continue;
     }
+
+    std::pair<float, uint32_t> children[8];
+    size_t numChildren = 0;
+    for (uint32_t k = cell.child; k < cell.child + cell.numChildren; ++k) {
+      const float distanceSq = _cells[k].GetDistanceSquared(point);
+      if (distanceSq <= hitDistSq)
+        children[numChildren++] = { distanceSq, k };
+    }
+    std::sort(children, children + numChildren);
+    for (size_t k = numChildren; k-- > 0;)
+      stack[stackSize++] = children[k].second;
   }
-  return hit->IsValid();
+  return found;
 }
 
-void 
-Octree::_GetClosestCell(const GfVec3f& point, Cell*& closestCell) const
+void
+Octree::Overlap(const GfRange3d& range, std::vector<size_t>& components) const
 {
-  float closestDistance = FLT_MAX;
-    
-  // the case of low polygon count
-  if(_octree.IsLeaf())
-  {
-    closestCell = (Cell*)&_octree;
-  }
-    
-  // normal case
-  else
-  {
-    for(unsigned int j = 0; j < 8; ++j)
-    {
-      if(_octree.GetCell(j) != NULL)
-        _RecurseGetClosestCell(point, _octree.GetCell(j), closestDistance, closestCell);
+  if (!_root) return;
+
+  uint32_t stack[STACK_SIZE];
+  size_t stackSize = 0;
+  stack[stackSize++] = 0;
+
+  while (stackSize) {
+    const Cell& cell = _cells[stack[--stackSize]];
+    if (!cell.IntersectBox(range)) continue;
+
+    if (cell.IsLeaf()) {
+      for (size_t m = cell.begin; m < cell.end; ++m)
+        if (!GfRange3d::GetIntersection(range,
+          GfRange3d(_GetComponentBoundingBox(_mortons[m].data))).IsEmpty())
+          components.push_back(_mortons[m].data);
+      continue;
     }
+    for (uint32_t k = cell.child; k < cell.child + cell.numChildren; ++k)
+      stack[stackSize++] = k;
   }
 }
 
-void 
-Octree::_RecurseGetClosestCell(const GfVec3f& point, const Cell* cell, 
-  float& closestDistance, Cell*& closestCell) const
+void
+Octree::Overlap(const GfVec3f& center, float radius, std::vector<size_t>& components) const
 {
-  if(cell==NULL)return;
-  float distance;
-  if(cell->IsLeaf())
-  {
-    distance = cell->GetDistance(point);
-    if(distance < closestDistance)
-    {
-      closestDistance = distance;
-      closestCell = (Cell*)cell;
-    }
-  }
-  else
-  {
-    int cid = -1;
-    float cdist = FLT_MAX;
-    for(unsigned int k = 0; k < 8; ++k)
-    {
-      const Cell* current = cell->GetCell(k);
-            
-      if(current!=NULL)
-      {
-        distance = current->GetDistance(point);
-        if(distance<=cdist)
-        {
-          cdist = distance;
-          cid = k;
+  if (!_root) return;
+
+  uint32_t stack[STACK_SIZE];
+  size_t stackSize = 0;
+  stack[stackSize++] = 0;
+
+  while (stackSize) {
+    const Cell& cell = _cells[stack[--stackSize]];
+    if (!cell.IntersectSphere(center, radius)) continue;
+
+    if (cell.IsLeaf()) {
+      for (size_t m = cell.begin; m < cell.end; ++m) {
+        const GfRange3f bounds = _GetComponentBoundingBox(_mortons[m].data);
+        float distanceSq = 0.f;
+        for (int i = 0; i < 3; ++i) {
+          if (center[i] < bounds.GetMin()[i]) distanceSq += GfSqr(bounds.GetMin()[i] - center[i]);
+          else if (center[i] > bounds.GetMax()[i]) distanceSq += GfSqr(center[i] - bounds.GetMax()[i]);
         }
+        if (distanceSq <= radius * radius)
+          components.push_back(_mortons[m].data);
       }
+      continue;
     }
-    if(cid >= 0)
-      _RecurseGetClosestCell(point, cell->GetCell(cid), closestDistance, closestCell);
+    for (uint32_t k = cell.child; k < cell.child + cell.numChildren; ++k)
+      stack[stackSize++] = k;
   }
 }
 
-void 
-Octree::_GetNearbyCells(const GfVec3f& point, const Cell* cell, 
-    std::vector<Cell*>& cells, float closestDistance) const
+// walk the sorted codes inside [zmin, zmax], codes leaving the box jump to
+// the next code back inside it (bigmin) instead of being scanned
+void
+Octree::GetCentroidsInRange(const GfRange3d& range, std::vector<size_t>& components) const
 {
-  // the case of low polygon count
-  if(!_octree.IsLeaf())
-  {
-    for(unsigned int j = 0; j < 8; ++j)
-    {
-      _RecurseGetNearbyCells(_octree.GetCell(j), point, closestDistance, cells);
+  if (_mortons.empty()) return;
+
+  const GfVec3i minCoords = WorldToMorton(_mortonRange, range.GetMin());
+  const GfVec3i maxCoords = WorldToMorton(_mortonRange, range.GetMax());
+  const uint64_t zmin = MortonEncode3D(minCoords);
+  const uint64_t zmax = MortonEncode3D(maxCoords);
+
+  auto it = std::lower_bound(_mortons.begin(), _mortons.end(), Morton{ zmin, 0 });
+  while (it != _mortons.end() && it->code <= zmax) {
+    const GfVec3i coords = MortonDecode3D(it->code);
+    if (coords[0] >= minCoords[0] && coords[0] <= maxCoords[0] &&
+      coords[1] >= minCoords[1] && coords[1] <= maxCoords[1] &&
+      coords[2] >= minCoords[2] && coords[2] <= maxCoords[2]) {
+      components.push_back(it->data);
+      ++it;
+      continue;
     }
+    const uint64_t bigmin = MortonBigMin(it->code, zmin, zmax);
+    if (bigmin <= it->code) ++it;
+    else it = std::lower_bound(it, _mortons.end(), Morton{ bigmin, 0 });
   }
 }
 
-void 
-Octree::_RecurseGetNearbyCells(const Cell* cell, const GfVec3f& center, 
-    const float radius, std::vector<Cell*>& cells) const
+void
+Octree::GetCells(VtArray<GfVec3f>& positions, VtArray<GfVec3f>& sizes,
+  VtArray<GfVec3f>& colors, bool branchOrLeaf)
 {
-  if(cell == NULL) return;
-  Cell* child = NULL;
-  if(!cell->IsLeaf()) {
-    for(unsigned int k = 0; k < 8; ++k) {
-      child = (Cell*)cell->GetCell(k);
-      if (child != NULL) {
-        if (child->IntersectSphere(center, radius)) {
-          _RecurseGetNearbyCells(child, center, radius, cells);
-        }
-      }
-    }
-  } else {
-    if(cell->IntersectSphere(center, radius)) {
-      cells.push_back((Cell*)cell);
-    }
+  for (const Cell& cell: _cells) {
+    if (cell.IsLeaf() != branchOrLeaf || !cell.NumElements()) continue;
+    positions.push_back(cell.GetCenter());
+    sizes.push_back(cell.GetHalfSize() * 2.f);
+    colors.push_back(MortonColor(_mortons[cell.begin]));
   }
 }
 
-JVR_NAMESPACE_CLOSE_SCOPE
\ No newline at end of file
+JVR_NAMESPACE_CLOSE_SCOPE
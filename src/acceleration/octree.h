@@ -12,111 +12,52 @@
 #include "../common.h"
 #include "../geometry/geometry.h"
 #include "../geometry/component.h"
+#include "../acceleration/morton.h"
 #include "../acceleration/intersector.h"
 
 JVR_NAMESPACE_OPEN_SCOPE
 
 class Geometry;
-class Mesh;
-class Curve;
-class Points;
-struct Point;
-struct Edge;
-struct Triangle;
 
+// linear octree keyed by the morton code of the components centroid,
+// components are sorted by code so every cell owns a contiguous range of
+// them and the children of a cell are stored contiguously, cells bounds are
+// the union of their components bounds so queries stay exact when
+// components straddle cells
 class Octree : public Intersector {
-public: 
-  class Cell {
-
-  public:
-    Cell() : _depth(0), _min(-1, -1, -1), _max(1, 1, 1), _isLeaf(true)
-    {
-      for (int i = 0; i < 8; i++) _child[i] = NULL;
-    };
-
-    Cell(const GfVec3f& minp, const GfVec3f& maxp, int depth = 0) :
-      _depth(depth), _isLeaf(true), _min(minp), _max(maxp)
-    {
-      for (int i = 0; i < 8; i++) _child[i] = NULL;
-    };
-
-    ~Cell();
-
-    // depth in octree
-    int GetDepth() const { return _depth; };
-
-    // center
-    GfVec3f GetCenter() { return (GfVec3f((_min + _max) * 0.5f)); };
-    GfVec3f GetHalfSize() { return (GfVec3f((_max - _min) * 0.5f)); };
-
-    // distance
-    inline float _Squared(float v) const { return v * v; };
-    inline float _GetDistance1D(float p, float lower, float upper) const
-    {
-      if (p < lower)return lower - p;
-      if (p > upper)return p - upper;
-      return fmin(p - lower, upper - p);
-    };
-    float GetDistance(const GfVec3f& point) const;
-
-    // intersect sphere
+public:
+  struct Cell {
+    float     min[3];
+    uint32_t  begin;        // first sorted component
+    float     max[3];
+    uint32_t  end;          // past last sorted component
+    uint64_t  code;         // morton prefix
+    uint32_t  child;        // first child cell
+    uint8_t   numChildren;  // 0 for leaves
+    uint8_t   depth;
+
+    bool IsLeaf() const { return numChildren == 0; };
+    size_t NumElements() const { return end - begin; };
+    GfVec3f GetCenter() const;
+    GfVec3f GetHalfSize() const;
+    float GetDistanceSquared(const GfVec3f& point) const;
     bool IntersectSphere(const GfVec3f& center, const float radius) const;
+    bool IntersectBox(const GfRange3d& range) const;
+  };
 
-    // leaf
-    bool IsLeaf() const { return _isLeaf; };
-
-    // get cell
-    Cell* GetCell(int x) { return _child[x]; }
-    const Cell* GetCell(int x) const { return _child[x]; }
-
-    // triangles size
-    int NumElements() const { return _elements.size(); };
-    std::vector<Component*>& GetElements() { return _elements; };
-    Component* GetElement(unsigned index) { return _elements[index]; };
-
-    // insert a triangle
-    void Insert(Component* e) { _elements.push_back(e); };
-
-    // split into 8
-    void Split(const GfVec3f* points);
-
-    // get bounding box
-    void GetBoundingBox(const GfVec3f* points, VtArray<int>& vertices);
-
-    // get furthest corner
-    void GetFurthestCorner(const GfVec3f& point, GfVec3f& corner);
-
-    // build the tree
-    void BuildTree(Component* comonents, size_t num, Geometry* geometry);
-    void ClearTree();
-
-  private:
-    // depth in octree
-    int _depth;
-
-    // bounding box
-    GfVec3f _min, _max;
-
-    // leaf ?
-    bool _isLeaf;
-
-    // children
-    Cell* _child[8];
+  Octree() : _root(NULL) {};
+  ~Octree() {};
 
-    // elements
-    std::vector<Component*> _elements;
-  };
+  const Cell* GetRoot() const { return _root; };
+  const Cell* GetCell(size_t index) const { return &_cells[index]; };
+  size_t GetNumCells() const { return _cells.size(); };
+  size_t GetNumLevels() const { return _levels.size(); };
 
-protected:
-  void _GetClosestCell(const GfVec3f& point, Cell*& closestCell) const;
-  void _RecurseGetClosestCell(const GfVec3f& point, const Cell* cell, 
-    float& closestDistance, Cell*& closestCell) const;
-  void _GetNearbyCells(const GfVec3f& point, const Cell* cell, 
-    std::vector<Cell*>& cells, float closestDistance) const;
-  void _RecurseGetNearbyCells(const Cell* cell, const GfVec3f& center, 
-    const float radius, std::vector<Cell*>& cells) const;
+  // components in build order and their geometry
+  size_t GetNumComponents() const { return _components.size(); };
+  const Component* GetComponent(size_t index) const { return _components[index]; };
+  size_t GetComponentGeometryIndex(size_t index) const { return _componentGeoms[index]; };
 
-public:
   virtual void Init(const std::vector<Geometry*>& geometries) override;
   virtual void Update() override;
   virtual bool Raycast(const GfRay& ray, Location* hit,
@@ -124,15 +65,39 @@ public:
   virtual bool Closest(const GfVec3f& point, Location* hit,
     double maxDistance=DBL_MAX) const override;
 
+  // components whose bounds overlap a box or a sphere
+  void Overlap(const GfRange3d& range, std::vector<size_t>& components) const;
+  void Overlap(const GfVec3f& center, float radius, std::vector<size_t>& components) const;
+  // components whose centroid lies in range, scanned on the sorted codes
+  void GetCentroidsInRange(const GfRange3d& range, std::vector<size_t>& components) const;
+
+  void GetCells(VtArray<GfVec3f>& positions, VtArray<GfVec3f>& sizes,
+    VtArray<GfVec3f>& colors, bool branchOrLeaf) override;
+
+protected:
+  void _GatherComponents();
+  void _BuildCells();
+  void _RefitCells();
+  GfRange3f _GetComponentBoundingBox(size_t index) const;
+  bool _RaycastLeaf(const Cell* cell, const GfRay& ray, Location* hit,
+    double maxDistance, double* minDistance) const;
+  bool _ClosestLeaf(const Cell* cell, const GfVec3f& point, Location* hit) const;
+
 private:
   // static members
   static const int MAX_ELEMENTS_NUMBER;
-
-  Cell                      _octree;
-  std::vector<Component*>   _elements;
-
+  // a cell pushes at most 8 children per level on top of the 21 levels
+  static const size_t STACK_SIZE = 8 * MORTON_LONG_BITS + 8;
+
+  const Cell*               _root;
+  std::vector<Cell>         _cells;
+  std::vector<size_t>       _levels;      // first cell of each level
+  std::vector<Morton>       _mortons;     // sorted, data is the component
+  GfRange3d                 _mortonRange; // codes quantization bounds, set at init
+  std::vector<Component*>   _components;
+  std::vector<uint32_t>     _componentGeoms;
 };
 
 JVR_NAMESPACE_CLOSE_SCOPE
 
-#endif // JVR_ACCELERATION_OCTREE_H 
\ No newline at end of file
+#endif // JVR_ACCELERATION_OCTREE_H
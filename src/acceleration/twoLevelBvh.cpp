@@ -0,0 +1,290 @@
+#include <algorithm>
+#include <numeric>
+
+#include <pxr/base/gf/bbox3d.h>
+#include <pxr/base/work/loops.h>
+#include "../acceleration/twoLevelBvh.h"
+#include "../geometry/geometry.h"
+#include "../geometry/location.h"
+
+JVR_NAMESPACE_OPEN_SCOPE
+
+//-------------------------------------------------------
+// Bottom level
+//-------------------------------------------------------
+BVH*
+TwoLevelBVH::_GetOrCreateBottomLevel(Geometry* geometry)
+{
+  std::unique_ptr<BVH>& bvh = _blas[geometry];
+  if(!bvh) {
+    bvh.reset(new BVH());
+    bvh->SetLocalSpace(true);
+    bvh->Init({ geometry });
+  }
+  return bvh.get();
+}
+
+BVH*
+TwoLevelBVH::GetBottomLevel(const Geometry* geometry)
+{
+  auto it = _blas.find(geometry);
+  return it != _blas.end() ? it->second.get() : NULL;
+}
+
+void
+TwoLevelBVH::SetDeformed(const Geometry* geometry)
+{
+  if(std::find(_deformed.begin(), _deformed.end(), geometry) == _deformed.end())
+    _deformed.push_back(geometry);
+}
+
+//-------------------------------------------------------
+// Instances
+//-------------------------------------------------------
+size_t
+TwoLevelBVH::AddInstance(Geometry* geometry, const GfMatrix4d& matrix)
+{
+  Instance instance;
+  instance.geometry = geometry;
+  instance.bvh = _GetOrCreateBottomLevel(geometry);
+  instance.matrix = matrix;
+  instance.invMatrix = matrix.GetInverse();
+  instance.follow = false;
+  _UpdateInstance(instance);
+  _instances.push_back(instance);
+  return _instances.size() - 1;
+}
+
+// instances of a removed geometry go with its bottom level, 
+// remaining instances indices shift down
+void
+TwoLevelBVH::RemoveGeometry(const Geometry* geometry)
+{
+  _instances.erase(std::remove_if(_instances.begin(), _instances.end(),
+    [&](const Instance& instance) {return instance.geometry == geometry;}), _instances.end());
+  _deformed.erase(std::remove(_deformed.begin(), _deformed.end(), geometry), _deformed.end());
+  _blas.erase(geometry);
+  _BuildTopLevel();
+}
+
+void
+TwoLevelBVH::SetInstanceMatrix(size_t index, const GfMatrix4d& matrix)
+{
+  Instance& instance = _instances[index];
+  instance.matrix = matrix;
+  instance.invMatrix = matrix.GetInverse();
+  instance.follow = false;
+}
+
+void
+TwoLevelBVH::_UpdateInstance(Instance& instance)
+{
+  if(instance.follow) {
+    instance.matrix = instance.geometry->GetMatrix();
+    instance.invMatrix = instance.geometry->GetInverseMatrix();
+  }
+  instance.range = GfBBox3d(*instance.bvh, instance.matrix).ComputeAlignedRange();
+}
+
+//-------------------------------------------------------
+// Top level
+//-------------------------------------------------------
+// median split of the instances centroids along the largest axis, nodes
+// are stored depth first so the root is the first node
+uint32_t
+TwoLevelBVH::_BuildNode(uint32_t* instances, size_t begin, size_t end)
+{
+  const uint32_t nodeIdx = _nodes.size();
+  _nodes.push_back({ GfRange3d(), INVALID_NODE, INVALID_NODE, INVALID_NODE });
+
+  if(end - begin == 1) {
+    _nodes[nodeIdx].range = _instances[instances[begin]].range;
+    _nodes[nodeIdx].instance = instances[begin];
+    return nodeIdx;
+  }
+
+  GfRange3d centroids;
+  for(size_t i = begin; i < end; ++i)
+    centroids.UnionWith(_instances[instances[i]].range.GetMidpoint());
+  const GfVec3d size = centroids.GetSize();
+  short axis = size[1] > size[0] ? 1 : 0;
+  if(size[2] > size[axis]) axis = 2;
+
+  const size_t middle = (begin + end) >> 1;
+  std::nth_element(instances + begin, instances + middle, instances + end,
+    [&](uint32_t lhs, uint32_t rhs) {
+      return _instances[lhs].range.GetMidpoint()[axis] <
+        _instances[rhs].range.GetMidpoint()[axis];
+    });
+
+  const uint32_t left = _BuildNode(instances, begin, middle);
+  const uint32_t right = _BuildNode(instances, middle, end);
+  _nodes[nodeIdx].left = left;
+  _nodes[nodeIdx].right = right;
+  _nodes[nodeIdx].range = GfRange3d::GetUnion(_nodes[left].range, _nodes[right].range);
+  return nodeIdx;
+}
+
+void
+TwoLevelBVH::_BuildTopLevel()
+{
+  _nodes.clear();
+  if(_instances.empty()) return;
+
+  std::vector<uint32_t> instances(_instances.size());
+  std::iota(instances.begin(), instances.end(), 0);
+  _nodes.reserve(2 * _instances.size() - 1);
+  _BuildNode(&instances[0], 0, instances.size());
+
+  SetMin(_nodes[0].range.GetMin());
+  SetMax(_nodes[0].range.GetMax());
+}
+
+void
+TwoLevelBVH::Init(const std::vector<Geometry*>& geometries)
+{
+  Intersector::_Init(geometries);
+
+  // bottom levels are rebuilt, geometries topology may have changed
+  _blas.clear();
+  _instances.clear();
+  _deformed.clear();
+  for(size_t g = 0; g < GetNumGeometries(); ++g) {
+    Instance instance;
+    instance.geometry = GetGeometry(g);
+    instance.bvh = _GetOrCreateBottomLevel(instance.geometry);
+    instance.follow = true;
+    _UpdateInstance(instance);
+    _instances.push_back(instance);
+  }
+  _BuildTopLevel();
+}
+
+// deformed bottom levels are refit (rebuilt past their cost ratio), then
+// every instance picks up its transform and the top level is rebuilt
+void
+TwoLevelBVH::Update()
+{
+  for(const Geometry* geometry: _deformed) {
+    BVH* bvh = GetBottomLevel(geometry);
+    if(bvh) bvh->Update();
+  }
+  _deformed.clear();
+
+  WorkParallelForN(_instances.size(), [&](size_t begin, size_t end) {
+    for(size_t i = begin; i < end; ++i)
+      _UpdateInstance(_instances[i]);
+  });
+  _BuildTopLevel();
+}
+
+//-------------------------------------------------------
+// Queries
+//-------------------------------------------------------
+bool
+TwoLevelBVH::Raycast(const GfRay& ray, Location* hit,
+  double maxDistance, double* minDistance) const
+{
+  if(_nodes.empty()) return false;
+
+  uint32_t stack[STACK_SIZE];
+  size_t stackSize = 0;
+  stack[stackSize++] = 0;
+
+  bool found = false;
+  while(stackSize) {
+    const _Node& node = _nodes[stack[--stackSize]];
+    double enterDistance, exitDistance;
+    if(!ray.Intersect(node.range, &enterDistance, &exitDistance) ||
+      enterDistance > GfMin(maxDistance, hit->GetDistance()))
+      continue;
+
+    if(node.instance == INVALID_NODE) {
+      stack[stackSize++] = node.right;
+      stack[stackSize++] = node.left;
+      continue;
+    }
+
+    // enter the instance local space
+    const Instance& instance = _instances[node.instance];
+    GfRay localRay(ray);
+    localRay.Transform(instance.invMatrix);
+
+    Location localHit;
+    if(instance.bvh->Raycast(localRay, &localHit)) {
+      const GfVec3d localPoint = localRay.GetStartPoint() +
+        localRay.GetDirection().GetNormalized() * localHit.GetDistance();
+      const double distance =
+        (ray.GetStartPoint() - instance.matrix.Transform(localPoint)).GetLength();
+      if(distance < hit->GetDistance() && distance < maxDistance) {
+        hit->Set(localHit);
+        hit->SetDistance(distance);
+        hit->SetGeometryIndex(node.instance);
+        if(minDistance) *minDistance = distance;
+        found = true;
+      }
+    }
+  }
+  return found;
+}
+
+static double
+_RangeDistanceSquared(const GfRange3d& range, const GfVec3d& point)
+{
+  double distanceSq = 0.0;
+  for(size_t d = 0; d < 3; ++d) {
+    if(point[d] < range.GetMin()[d]) distanceSq += GfSqr(range.GetMin()[d] - point[d]);
+    else if(point[d] > range.GetMax()[d]) distanceSq += GfSqr(point[d] - range.GetMax()[d]);
+  }
+  return distanceSq;
+}
+
+bool
+TwoLevelBVH::Closest(const GfVec3f& point, Location* hit, double maxDistance) const
+{
+  if(_nodes.empty()) return false;
+
+  const GfVec3d position(point);
+  const double maxDistanceSq = maxDistance < DBL_MAX ? maxDistance * maxDistance : DBL_MAX;
+
+  uint32_t stack[STACK_SIZE];
+  size_t stackSize = 0;
+  stack[stackSize++] = 0;
+
+  bool found = false;
+  while(stackSize) {
+    const _Node& node = _nodes[stack[--stackSize]];
+    const double hitDistSq = hit->IsValid() ?
+      (position - hit->GetPoint()).GetLengthSq() : maxDistanceSq;
+    if(_RangeDistanceSquared(node.range, position) > hitDistSq) continue;
+
+    if(node.instance == INVALID_NODE) {
+      // nearest child is pushed last to be traversed first
+      if(_RangeDistanceSquared(_nodes[node.left].range, position) <
+        _RangeDistanceSquared(_nodes[node.right].range, position)) {
+        stack[stackSize++] = node.right;
+        stack[stackSize++] = node.left;
+      } else {
+        stack[stackSize++] = node.left;
+        stack[stackSize++] = node.right;
+      }
+      continue;
+    }
+
+    // enter the instance local space, the current hit bounds the query
+    const Instance& instance = _instances[node.instance];
+    Location localHit(*hit);
+    if(hit->IsValid())
+      localHit.ConvertToLocal(instance.invMatrix);
+
+    if(instance.bvh->Closest(GfVec3f(instance.invMatrix.Transform(position)), &localHit, DBL_MAX)) {
+      localHit.ConvertToWorld(instance.matrix);
+      hit->Set(localHit);
+      hit->SetGeometryIndex(node.instance);
+      found = true;
+    }
+  }
+  return found;
+}
+
+JVR_NAMESPACE_CLOSE_SCOPE
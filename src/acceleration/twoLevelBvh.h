@@ -0,0 +1,85 @@
+#ifndef JVR_ACCELERATION_TWOLEVELBVH_H
+#define JVR_ACCELERATION_TWOLEVELBVH_H
+
+#include <map>
+#include <memory>
+#include <vector>
+#include <pxr/base/gf/ray.h>
+#include <pxr/base/gf/vec3f.h>
+#include <pxr/base/gf/matrix4d.h>
+#include <pxr/base/gf/range3d.h>
+#include "../acceleration/intersector.h"
+#include "../acceleration/bvh.h"
+
+JVR_NAMESPACE_OPEN_SCOPE
+
+class Geometry;
+
+// two level hierarchy, every geometry owns a bottom level bvh built once in
+// its local space and shared by all its instances, a small top level bvh over
+// the instances world bounds is rebuilt on update so rigid motion never
+// touches the bottom level, queries enter the local space at the instance
+// hits report the instance index as geometry index (instances created by
+// Init match the geometries indices)
+class TwoLevelBVH : public Intersector
+{
+public:
+  struct Instance {
+    Geometry*     geometry;
+    BVH*          bvh;        // bottom level owned by the cache
+    GfMatrix4d    matrix;
+    GfMatrix4d    invMatrix;
+    GfRange3d     range;      // world bounds
+    bool          follow;     // track the geometry matrix
+  };
+
+  TwoLevelBVH() {};
+  ~TwoLevelBVH() {};
+
+  virtual void Init(const std::vector<Geometry*>& geometries) override;
+  virtual void Update() override;
+
+  // extra instances of a geometry with their own transform
+  size_t AddInstance(Geometry* geometry, const GfMatrix4d& matrix);
+  void RemoveGeometry(const Geometry* geometry);
+  void SetInstanceMatrix(size_t index, const GfMatrix4d& matrix);
+  const Instance& GetInstance(size_t index) const { return _instances[index]; };
+  size_t GetNumInstances() const { return _instances.size(); };
+
+  // bottom level of a deformed geometry is refit on next update
+  void SetDeformed(const Geometry* geometry);
+  BVH* GetBottomLevel(const Geometry* geometry);
+  size_t GetNumBottomLevels() const { return _blas.size(); };
+
+  virtual bool Raycast(const GfRay& ray, Location* hit,
+    double maxDistance = DBL_MAX, double* minDistance = NULL) const override;
+  virtual bool Closest(const GfVec3f& point, Location* hit,
+    double maxDistance = DBL_MAX) const override;
+
+protected:
+  // top level node, leaves hold one instance
+  struct _Node {
+    GfRange3d   range;
+    uint32_t    left;
+    uint32_t    right;
+    uint32_t    instance;
+  };
+
+  BVH* _GetOrCreateBottomLevel(Geometry* geometry);
+  void _UpdateInstance(Instance& instance);
+  uint32_t _BuildNode(uint32_t* instances, size_t begin, size_t end);
+  void _BuildTopLevel();
+
+private:
+  static const uint32_t           INVALID_NODE = 0xFFFFFFFF;
+  static const size_t             STACK_SIZE = 64;
+
+  std::map<const Geometry*, std::unique_ptr<BVH>>  _blas;
+  std::vector<const Geometry*>    _deformed;
+  std::vector<Instance>           _instances;
+  std::vector<_Node>              _nodes;
+};
+
+JVR_NAMESPACE_CLOSE_SCOPE
+
+#endif // JVR_ACCELERATION_TWOLEVELBVH_H
@@ -0,0 +1,267 @@
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+
+#include <pxr/base/work/loops.h>
+#include "../acceleration/wideBvh.h"
+#include "../geometry/geometry.h"
+
+JVR_NAMESPACE_OPEN_SCOPE
+
+static double
+_SurfaceArea(const GfRange3d& range)
+{
+  if(range.IsEmpty()) return 0.0;
+  const GfVec3d size = range.GetSize();
+  return 2.0 * (size[0] * size[1] + size[1] * size[2] + size[2] * size[0]);
+}
+
+// float bounds rounded outward so a child never shrinks its cell
+static float
+_RoundDown(double value)
+{
+  float result = static_cast<float>(value);
+  return result > value ? std::nextafter(result, -FLT_MAX) : result;
+}
+
+static float
+_RoundUp(double value)
+{
+  float result = static_cast<float>(value);
+  return result < value ? std::nextafter(result, FLT_MAX) : result;
+}
+
+template<size_t N>
+void
+WideBVH<N>::_SetChildBounds(size_t nodeIdx, size_t slot, const GfRange3d& range)
+{
+  Node& node = _nodes[nodeIdx];
+  node.minX[slot] = _RoundDown(range.GetMin()[0]);
+  node.minY[slot] = _RoundDown(range.GetMin()[1]);
+  node.minZ[slot] = _RoundDown(range.GetMin()[2]);
+  node.maxX[slot] = _RoundUp(range.GetMax()[0]);
+  node.maxY[slot] = _RoundUp(range.GetMax()[1]);
+  node.maxZ[slot] = _RoundUp(range.GetMax()[2]);
+}
+
+// open the largest branch among the gathered children until the node is full
+template<size_t N>
+uint32_t
+WideBVH<N>::_CollapseCell(size_t cellIdx)
+{
+  const uint32_t nodeIdx = static_cast<uint32_t>(_nodes.size());
+  _nodes.push_back(Node());
+  _slotCells.resize(_slotCells.size() + N, INVALID_INDEX);
+
+  size_t children[N];
+  size_t numChildren = 0;
+  children[numChildren++] = cellIdx;
+  while(numChildren < N) {
+    size_t best = INVALID_INDEX;
+    double bestArea = -1.0;
+    for(size_t c = 0; c < numChildren; ++c) {
+      const BVH::Cell* cell = _bvh.GetCell(children[c]);
+      if(cell->IsLeaf()) continue;
+      const double area = _SurfaceArea(*cell);
+      if(area > bestArea) {
+        best = c;
+        bestArea = area;
+      }
+    }
+    if(best == INVALID_INDEX) break;
+
+    const BVH::Cell* branch = _bvh.GetCell(children[best]);
+    children[best] = branch->GetLeft();
+    children[numChildren++] = branch->GetRight();
+  }
+
+  for(size_t slot = 0; slot < N; ++slot) {
+    if(slot >= numChildren) {
+      Node& node = _nodes[nodeIdx];
+      node.minX[slot] = node.minY[slot] = node.minZ[slot] = FLT_MAX;
+      node.maxX[slot] = node.maxY[slot] = node.maxZ[slot] = -FLT_MAX;
+      node.children[slot] = EMPTY;
+      continue;
+    }
+
+    const BVH::Cell* cell = _bvh.GetCell(children[slot]);
+    _slotCells[nodeIdx * N + slot] = children[slot];
+    _SetChildBounds(nodeIdx, slot, *cell);
+    // recursion grows the nodes vector, index it again afterward
+    const uint32_t child = cell->IsLeaf() ?
+      static_cast<uint32_t>(children[slot]) | LEAF : _CollapseCell(children[slot]);
+    _nodes[nodeIdx].children[slot] = child;
+  }
+  return nodeIdx;
+}
+
+template<size_t N>
+void
+WideBVH<N>::_Collapse()
+{
+  _nodes.clear();
+  _slotCells.clear();
+  _numBuilds = _bvh.GetNumBuilds();
+  if(!_bvh.GetRoot()) return;
+
+  const size_t rootIdx = _bvh.GetRoot() - _bvh.GetCell(0);
+  _CollapseCell(rootIdx);
+}
+
+template<size_t N>
+void
+WideBVH<N>::_UpdateBounds()
+{
+  WorkParallelForN(_nodes.size(), [&](size_t begin, size_t end) {
+    for(size_t nodeIdx = begin; nodeIdx < end; ++nodeIdx)
+      for(size_t slot = 0; slot < N; ++slot) {
+        const size_t cellIdx = _slotCells[nodeIdx * N + slot];
+        if(cellIdx != INVALID_INDEX)
+          _SetChildBounds(nodeIdx, slot, *_bvh.GetCell(cellIdx));
+      }
+  });
+}
+
+template<size_t N>
+void
+WideBVH<N>::Init(const std::vector<Geometry*>& geometries)
+{
+  Intersector::_Init(geometries);
+  _bvh.Init(geometries);
+  SetMin(_bvh.GetMin());
+  SetMax(_bvh.GetMax());
+  _Collapse();
+}
+
+// the binary tree is refitted or rebuilt, nodes follow
+template<size_t N>
+void
+WideBVH<N>::Update()
+{
+  _bvh.Update();
+  SetMin(_bvh.GetMin());
+  SetMax(_bvh.GetMax());
+  if(_bvh.GetNumBuilds() != _numBuilds) _Collapse();
+  else _UpdateBounds();
+}
+
+template<size_t N>
+bool 
+WideBVH<N>::Raycast(const GfRay& ray, Location* hit,
+  double maxDistance, double* minDistance) const
+{
+  if(_nodes.empty()) return _bvh.Raycast(ray, hit, maxDistance, minDistance);
+
+  const GfVec3d& start = ray.GetStartPoint();
+  const GfVec3d& direction = ray.GetDirection();
+  const float ox = start[0], oy = start[1], oz = start[2];
+  const float ix = 1.f / (direction[0] != 0.0 ? float(direction[0]) : 1e-20f);
+  const float iy = 1.f / (direction[1] != 0.0 ? float(direction[1]) : 1e-20f);
+  const float iz = 1.f / (direction[2] != 0.0 ? float(direction[2]) : 1e-20f);
+
+  _Entry stack[STACK_SIZE];
+  size_t stackSize = 0;
+  stack[stackSize++] = { 0, 0.f };
+
+  bool found = false;
+  float enter[N];
+  while(stackSize) {
+    const _Entry entry = stack[--stackSize];
+    const double distance = GfMin(maxDistance, hit->GetDistance());
+    if(entry.distance >= distance) continue;
+
+    if(entry.child & LEAF) {
+      if(_bvh._RaycastLeaf(_bvh.GetCell(entry.child & ~LEAF), ray, hit, distance, minDistance))
+        found = true;
+      continue;
+    }
+
+    // slab test of the N children at once
+    const Node& node = _nodes[entry.child];
+    for(size_t c = 0; c < N; ++c) {
+      const float t1x = (node.minX[c] - ox) * ix, t2x = (node.maxX[c] - ox) * ix;
+      const float t1y = (node.minY[c] - oy) * iy, t2y = (node.maxY[c] - oy) * iy;
+      const float t1z = (node.minZ[c] - oz) * iz, t2z = (node.maxZ[c] - oz) * iz;
+      const float tMin = 
+        std::max(std::max(std::min(t1x, t2x), std::min(t1y, t2y)), std::min(t1z, t2z));
+      const float tMax = 
+        std::min(std::min(std::max(t1x, t2x), std::max(t1y, t2y)), std::max(t1z, t2z));
+      enter[c] = (tMin <= tMax && tMax >= 0.f) ? tMin : FLT_MAX;
+    }
+
+    // nearest child is pushed last to be traversed first
+    size_t order[N];
+    size_t numHits = 0;
+    for(size_t c = 0; c < N; ++c) {
+      if(node.children[c] == EMPTY || enter[c] >= distance) continue;
+      size_t o = numHits++;
+      for(; o > 0 && enter[order[o - 1]] < enter[c]; --o)
+        order[o] = order[o - 1];
+      order[o] = c;
+    }
+    for(size_t o = 0; o < numHits; ++o)
+      stack[stackSize++] = { node.children[order[o]], enter[order[o]] };
+  }
+  return found;
+}
+
+template<size_t N>
+bool 
+WideBVH<N>::Closest(const GfVec3f& point, Location* hit, double maxDistance) const
+{
+  if(_nodes.empty()) return _bvh.Closest(point, hit, maxDistance);
+
+  // max distance bounds the root, nodes below are bounded by the current hit
+  const double maxDistanceSq = maxDistance < DBL_MAX ? maxDistance * maxDistance : DBL_MAX;
+  const GfVec3d position(point);
+  if(!Contains(position) && (GetDistanceSquared(position) > maxDistanceSq ||
+    GetDistanceSquared(position) > (point - hit->GetPoint()).GetLengthSq()))
+    return false;
+
+  const float px = point[0], py = point[1], pz = point[2];
+
+  _Entry stack[STACK_SIZE];
+  size_t stackSize = 0;
+  stack[stackSize++] = { 0, 0.f };
+
+  bool found = false;
+  float distances[N];
+  while(stackSize) {
+    const _Entry entry = stack[--stackSize];
+    const double hitDistSq = hit->IsValid() ? (point - hit->GetPoint()).GetLengthSq() : DBL_MAX;
+    if(entry.distance > hitDistSq) continue;
+
+    if(entry.child & LEAF) {
+      if(_bvh._ClosestLeaf(_bvh.GetCell(entry.child & ~LEAF), point, hit))
+        found = true;
+      continue;
+    }
+
+    // squared distance to the N children at once
+    const Node& node = _nodes[entry.child];
+    for(size_t c = 0; c < N; ++c) {
+      const float dx = std::max(std::max(node.minX[c] - px, 0.f), px - node.maxX[c]);
+      const float dy = std::max(std::max(node.minY[c] - py, 0.f), py - node.maxY[c]);
+      const float dz = std::max(std::max(node.minZ[c] - pz, 0.f), pz - node.maxZ[c]);
+      distances[c] = dx * dx + dy * dy + dz * dz;
+    }
+
+    size_t order[N];
+    size_t numHits = 0;
+    for(size_t c = 0; c < N; ++c) {
+      if(node.children[c] == EMPTY || distances[c] >= hitDistSq) continue;
+      size_t o = numHits++;
+      for(; o > 0 && distances[order[o - 1]] < distances[c]; --o)
+        order[o] = order[o - 1];
+      order[o] = c;
+    }
+    for(size_t o = 0; o < numHits; ++o)
+      stack[stackSize++] = { node.children[order[o]], distances[order[o]] };
+  }
+  return found;
+}
+
+template class WideBVH<4>;
+template class WideBVH<8>;
+
+JVR_NAMESPACE_CLOSE_SCOPE
@@ -0,0 +1,76 @@
+#ifndef JVR_ACCELERATION_WIDEBVH_H
+#define JVR_ACCELERATION_WIDEBVH_H
+
+#include <vector>
+#include <pxr/base/gf/ray.h>
+#include <pxr/base/gf/vec3f.h>
+#include <pxr/base/gf/range3d.h>
+#include "../acceleration/bvh.h"
+#include "../acceleration/intersector.h"
+
+JVR_NAMESPACE_OPEN_SCOPE
+
+class Geometry;
+
+// n-ary bvh collapsed from the morton built binary BVH, children bounds are
+// stored as structure of arrays so that a node tests its N children in one 
+// fixed width loop the compiler turns into simd instructions
+template<size_t N>
+class WideBVH : public Intersector
+{
+public:
+  static const uint32_t EMPTY = 0xFFFFFFFF;
+  static const uint32_t LEAF = 0x80000000;
+
+  struct Node {
+    float     minX[N], minY[N], minZ[N];
+    float     maxX[N], maxY[N], maxZ[N];
+    uint32_t  children[N];   // child node, leaf cell | LEAF or EMPTY
+  };
+
+  WideBVH() : _numBuilds(0) {};
+  ~WideBVH() {};
+
+  BVH* GetTree() { return &_bvh; };
+  const BVH* GetTree() const { return &_bvh; };
+  size_t GetNumNodes() const { return _nodes.size(); };
+
+  // visual debug
+  void GetCells(VtArray<GfVec3f>& positions, VtArray<GfVec3f>& sizes, 
+    VtArray<GfVec3f>& colors, bool branchOrLeaf) override {
+    _bvh.GetCells(positions, sizes, colors, branchOrLeaf);
+  };
+
+  void Init(const std::vector<Geometry*>& geometries) override;
+  void Update() override;
+
+  bool Raycast(const GfRay& ray, Location* hit,
+    double maxDistance = DBL_MAX, double* minDistance = NULL) const override;
+  bool Closest(const GfVec3f& point, Location* hit,
+    double maxDistance = DBL_MAX) const override;
+
+private:
+  static const size_t STACK_SIZE = 128 * N;
+
+  struct _Entry {
+    uint32_t  child;
+    float     distance;
+  };
+
+  void _Collapse();
+  uint32_t _CollapseCell(size_t cellIdx);
+  void _UpdateBounds();
+  void _SetChildBounds(size_t nodeIdx, size_t slot, const GfRange3d& range);
+
+  BVH                     _bvh;
+  std::vector<Node>       _nodes;
+  std::vector<size_t>     _slotCells;   // binary cell of each node slot
+  size_t                  _numBuilds;
+};
+
+typedef WideBVH<4> BVH4;
+typedef WideBVH<8> BVH8;
+
+JVR_NAMESPACE_CLOSE_SCOPE
+
+#endif // JVR_ACCELERATION_WIDEBVH_H
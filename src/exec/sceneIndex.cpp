@@ -14,6 +14,7 @@
 #include <pxr/imaging/hd/retainedDataSource.h>
 
 #include <pxr/imaging/hd/sceneIndex.h>
+#include <pxr/imaging/hd/dirtyBitsTranslator.h>
 #include "pxr/imaging/hd/renderIndex.h"
 #include <pxr/imaging/hd/visibilitySchema.h>
 
@@ -44,71 +45,67 @@ ExecSceneIndex::~ExecSceneIndex()
 }
 
 
-HdSceneIndexPrim
-_GetPointsSceneIndexPrim(Points* points) 
+// samples a buffer owned by an exec geometry, the array is only read when
+// hydra samples it and returned by reference count (no copy), the buffer
+// address is stable for the geometry lifetime (positions are swapped in place)
+template <typename T>
+class _BufferDataSource : public HdTypedSampledDataSource<VtArray<T>>
 {
-  HdSceneIndexPrim prim = HdSceneIndexPrim(
-    {HdPrimTypeTokens->points,
+public:
+  HD_DECLARE_DATASOURCE(_BufferDataSource<T>);
+  using Time = HdSampledDataSource::Time;
+
+  VtValue GetValue(Time shutterOffset) override {
+    return VtValue(GetTypedValue(shutterOffset));
+  };
+  VtArray<T> GetTypedValue(Time shutterOffset) override {
+    return *_buffer;
+  };
+  bool GetContributingSampleTimesForInterval(Time startTime, Time endTime,
+    std::vector<Time>* outSampleTimes) override {
+    return false;
+  };
+
+private:
+  _BufferDataSource(const VtArray<T>* buffer) : _buffer(buffer) {};
+  const VtArray<T>*   _buffer;
+};
+
+static HdContainerDataSourceHandle
+_GetPointsDataSource(Points* points) 
+{
+  return HdRetainedContainerDataSource::New(
+    HdPrimvarsSchemaTokens->primvars,
       HdRetainedContainerDataSource::New(
-        HdPrimvarsSchemaTokens->primvars,
-          HdRetainedContainerDataSource::New(
-            HdTokens->points,
-            HdPrimvarSchema::Builder()
-              .SetPrimvarValue(
-                HdRetainedTypedSampledDataSource<VtVec3fArray>::New(
-                  points->GetPositions()))
-              .SetInterpolation(
-                HdPrimvarSchema::BuildInterpolationDataSource(
-                  HdPrimvarSchemaTokens->vertex))
-              .SetRole(HdPrimvarSchema::BuildRoleDataSource(
-                HdPrimvarSchemaTokens->point))
-              .Build(),
-          HdPrimvarsSchemaTokens->widths,
-          HdPrimvarSchema::Builder()
-            .SetPrimvarValue(
-              HdRetainedTypedSampledDataSource<VtFloatArray>::New(
-                points->GetWidths()))
-            .SetInterpolation(
-              HdPrimvarSchema::BuildInterpolationDataSource(
-                HdPrimvarSchemaTokens->varying))
-            .Build())/*,
-          HdTokens->displayColor,
-          HdPrimvarSchema::Builder()
-            .SetPrimvarValue(_PointDataSource::New(colors))
-            .SetInterpolation(
-              HdPrimvarSchema::BuildInterpolationDataSource(
-                HdPrimvarSchemaTokens->vertex))
-            .SetRole(HdPrimvarSchema::BuildRoleDataSource(
-              HdPrimvarSchemaTokens->color))
-            .Build()),
-        HdPurposeSchemaTokens->purpose,
-        HdPurposeSchema::Builder()
-          .SetPurpose(
-            _TokenDataSource::New(HdRenderTagTokens->geometry))
+        HdTokens->points,
+        HdPrimvarSchema::Builder()
+          .SetPrimvarValue(
+            _BufferDataSource<GfVec3f>::New(&points->GetPositions()))
+          .SetInterpolation(
+            HdPrimvarSchema::BuildInterpolationDataSource(
+              HdPrimvarSchemaTokens->vertex))
+          .SetRole(HdPrimvarSchema::BuildRoleDataSource(
+            HdPrimvarSchemaTokens->point))
           .Build(),
-        HdVisibilitySchemaTokens->visibility,
-        HdVisibilitySchema::Builder()
-          .SetVisibility(_BoolDataSource::New(true))
-          .Build(),
-        HdXformSchemaTokens->xform,
-        HdXformSchema::Builder()
-          .SetMatrix(_MatrixDataSource::New(GfMatrix4d(1)))
-          .SetResetXformStack(_BoolDataSource::New(false))
-          .Build()*/)});
-  return prim;
+      HdPrimvarsSchemaTokens->widths,
+      HdPrimvarSchema::Builder()
+        .SetPrimvarValue(
+          _BufferDataSource<float>::New(&points->GetWidths()))
+        .SetInterpolation(
+          HdPrimvarSchema::BuildInterpolationDataSource(
+            HdPrimvarSchemaTokens->varying))
+        .Build()));
 }
 
-
-HdSceneIndexPrim
-_GetBasisCurvesSceneIndexPrim(Curve* curve) 
+static HdContainerDataSourceHandle
+_GetBasisCurvesDataSource(Curve* curve) 
 {
   HdDataSourceBaseHandle bcs =
     HdBasisCurvesSchema::Builder()
       .SetTopology(
         HdBasisCurvesTopologySchema::Builder()
           .SetCurveVertexCounts(
-            HdRetainedTypedSampledDataSource<VtIntArray>::New(
-              curve->GetCvCounts()))
+            _BufferDataSource<int>::New(&curve->GetCvCounts()))
           .SetCurveIndices(
             HdRetainedTypedSampledDataSource<VtIntArray>::New(
               VtIntArray()))
@@ -124,20 +121,12 @@ _GetBasisCurvesSceneIndexPrim(Curve* curve)
           .Build())
       .Build();
 
-    
-    //const _Primvars &primvars = curve.primvars;
-    std::vector<TfToken> primvarNames;
-    primvarNames.reserve(1);
-    std::vector<HdDataSourceBaseHandle> primvarDataSources;
-    primvarDataSources.reserve(1);
-
-    // points
-    primvarNames.push_back(HdTokens->points);
-    primvarDataSources.push_back(
+  HdDataSourceBaseHandle primvarsDs =
+    HdRetainedContainerDataSource::New(
+      HdTokens->points,
       HdPrimvarSchema::Builder()
         .SetPrimvarValue(
-          HdRetainedTypedSampledDataSource<VtVec3fArray>::New(
-            curve->GetPositions()))
+          _BufferDataSource<GfVec3f>::New(&curve->GetPositions()))
         .SetInterpolation(
           HdPrimvarSchema::BuildInterpolationDataSource(
             HdPrimvarSchemaTokens->vertex))
@@ -145,23 +134,65 @@ _GetBasisCurvesSceneIndexPrim(Curve* curve)
           HdPrimvarSchemaTokens->point))
         .Build());
 
-    HdDataSourceBaseHandle primvarsDs =
-      HdRetainedContainerDataSource::New(1, primvarNames.data(),
-                                      primvarDataSources.data());
+  return HdRetainedContainerDataSource::New(
+    HdBasisCurvesSchemaTokens->basisCurves,
+    bcs,
+    HdPrimvarsSchemaTokens->primvars,
+    primvarsDs);
+}
 
-    return HdSceneIndexPrim(
-      { HdPrimTypeTokens->basisCurves,
-        HdRetainedContainerDataSource::New(
-            HdBasisCurvesSchemaTokens->basisCurves,
-            bcs,
-            HdPrimvarsSchemaTokens->primvars,
-            primvarsDs)});
+// points overlaid on the input prim of a deformed mesh
+static HdContainerDataSourceHandle
+_GetDeformedPointsDataSource(Deformable* deformable)
+{
+  return HdRetainedContainerDataSource::New(
+    HdPrimvarsSchemaTokens->primvars,
+    HdRetainedContainerDataSource::New(
+      HdTokens->points,
+      HdPrimvarSchema::Builder()
+        .SetPrimvarValue(
+          _BufferDataSource<GfVec3f>::New(&deformable->GetPositions()))
+        .SetInterpolation(
+          HdPrimvarSchema::BuildInterpolationDataSource(
+            HdPrimvarSchemaTokens->varying))
+        .SetRole(HdPrimvarSchema::BuildRoleDataSource(
+          HdPrimvarSchemaTokens->color))
+        .Build()));
+}
+
+// data sources are built once per prim and reference the live buffers
+HdContainerDataSourceHandle
+ExecSceneIndex::_GetDataSource(const SdfPath& path, Geometry* geometry) const
+{
+  std::lock_guard<std::mutex> lock(_sourcesLock);
+  _Source& source = _sources[path];
+  if(!source.dataSource) {
+    if(geometry->IsInput() || geometry->GetType() == Geometry::MESH)
+      source.dataSource = _GetDeformedPointsDataSource((Deformable*)geometry);
+    else if(geometry->GetType() == Geometry::POINT)
+      source.dataSource = _GetPointsDataSource((Points*)geometry);
+    else if(geometry->GetType() == Geometry::CURVE)
+      source.dataSource = _GetBasisCurvesDataSource((Curve*)geometry);
+  }
+  return source.dataSource;
+}
+
+size_t
+ExecSceneIndex::GetVersion(const SdfPath& path) const
+{
+  std::lock_guard<std::mutex> lock(_sourcesLock);
+  const auto& it = _sources.find(path);
+  return it != _sources.end() ? it->second.version : 0;
 }
 
 void ExecSceneIndex::SetExec(Execution* exec)
 {
   if(_exec)delete _exec;
   _exec = exec;
+  {
+    std::lock_guard<std::mutex> lock(_sourcesLock);
+    _sources.clear();
+  }
 
   if(!_exec)return;
 
@@ -182,7 +213,7 @@ void ExecSceneIndex::SetExec(Execution* exec)
         std::cout << "exec populate points : " << path << std::endl;
         if(path.IsEmpty()) continue;
         if(!geometry->IsInput()) {
-          indexPrim = _GetPointsSceneIndexPrim((Points*)geometry);
+          indexPrim = {HdPrimTypeTokens->points, _GetDataSource(path, geometry)};
         } else {
           indexPrim = _GetInputSceneIndex()->GetPrim(path);
         }
@@ -194,7 +225,7 @@ void ExecSceneIndex::SetExec(Execution* exec)
         std::cout << "exec populate curve : " << path << std::endl;
         if(path.IsEmpty()) continue;
         if(!geometry->IsInput()) {
-          indexPrim = _GetBasisCurvesSceneIndexPrim((Curve*)geometry);
+          indexPrim = {HdPrimTypeTokens->basisCurves, _GetDataSource(path, geometry)};
         } else {
           indexPrim = _GetInputSceneIndex()->GetPrim(path);
         }
@@ -248,25 +279,51 @@ ExecSceneIndex::Populate(bool populate)
 }
 
 
+static const TfToken&
+_GetPrimType(const Geometry* geometry)
+{
+  static const TfToken empty;
+  switch(geometry->GetType()) {
+    case Geometry::MESH:  return HdPrimTypeTokens->mesh;
+    case Geometry::POINT: return HdPrimTypeTokens->points;
+    case Geometry::CURVE: return HdPrimTypeTokens->basisCurves;
+    default:              return empty;
+  }
+}
+
+// only prims marked dirty are sent, their bits translated to the matching
+// locators so hydra pulls back what changed (points only for DirtyPoints)
 void 
 ExecSceneIndex::UpdateExec()
 {
   Scene* scene = _exec->GetScene();
 
   HdSceneIndexObserver::DirtiedPrimEntries entries;
+  std::vector<HdDirtyBits*> dispatched;
   for(auto& prim: scene->GetPrims()) {
-    if(prim.second.geom->GetType() == Geometry::MESH) {
-      HdDataSourceLocator locator(HdPrimvarsSchemaTokens->primvars);
-        entries.push_back({prim.first, locator});
-    } else if(prim.second.geom->GetType() == Geometry::POINT) {
-      HdDataSourceLocator locator(HdPrimvarsSchemaTokens->primvars);
-        entries.push_back({prim.first, locator});
-    } else if(prim.second.geom->GetType() == Geometry::CURVE) {
-      HdDataSourceLocator locator(HdPrimvarsSchemaTokens->primvars);
-        entries.push_back({prim.first, locator});
-    }
+    HdDirtyBits& bits = prim.second.bits;
+    if(bits == HdChangeTracker::Clean) continue;
+
+    const TfToken& primType = _GetPrimType(prim.second.geom);
+    if(primType.IsEmpty()) continue;
+
+    HdDataSourceLocatorSet locators;
+    HdDirtyBitsTranslator::RprimDirtyBitsToLocatorSet(primType, bits, &locators);
+    if(!locators.IsEmpty())
+      entries.push_back({prim.first, locators});
+    dispatched.push_back(&bits);
+  }
+  if(!entries.empty())
+    _SendPrimsDirtied(entries);
+
+  for(HdDirtyBits* bits: dispatched)
+    *bits = HdChangeTracker::Clean;
+
+  std::lock_guard<std::mutex> lock(_sourcesLock);
+  for(const auto& entry: entries) {
+    const auto& it = _sources.find(entry.primPath);
+    if(it != _sources.end()) it->second.version++;
   }
-  _SendPrimsDirtied(entries);
 }
 
 HdSceneIndexPrim ExecSceneIndex::GetPrim(const SdfPath &primPath) const
@@ -275,74 +332,21 @@ HdSceneIndexPrim ExecSceneIndex::GetPrim(const SdfPath &primPath) const
   if(_exec) {    
     Scene::_Prim* prim = _exec->GetScene()->GetPrim(primPath);
     if(prim) {
-      if(!prim->geom->IsInput()) {
-        switch (prim->geom->GetType()) {
-          case Geometry::POINT:
-          {
-            return _GetPointsSceneIndexPrim((Points*)prim->geom); 
-          }
-          case Geometry::CURVE:
-          {
-            return _GetBasisCurvesSceneIndexPrim((Curve*)prim->geom); 
-          }
-          case Geometry::MESH:
-          {
-            HdSceneIndexPrim siPrim = _GetInputSceneIndex()->GetPrim(primPath);
-            VtArray<GfVec3f> points();
-
-            siPrim.dataSource = 
-              HdOverlayContainerDataSource::New(
-                HdRetainedContainerDataSource::New(
-                  HdPrimvarsSchemaTokens->primvars,
-                  HdRetainedContainerDataSource::New(
-                    HdTokens->points,
-                    HdPrimvarSchema::Builder()
-                      .SetPrimvarValue(
-                        HdRetainedTypedSampledDataSource<VtVec3fArray>::New(
-                          ((Deformable*)prim->geom)->GetPositions()
-                        ))
-                      .SetInterpolation(
-                        HdPrimvarSchema::BuildInterpolationDataSource(
-                          HdPrimvarSchemaTokens->varying))
-                      .SetRole(HdPrimvarSchema::BuildRoleDataSource(
-                        HdPrimvarSchemaTokens->color))
-                      .Build())),
-                siPrim.dataSource);
-            return siPrim;
-          
-
-          }
-        }
-      } else {
-        switch (prim->geom->GetType()) {
-          case Geometry::POINT:
-          case Geometry::CURVE:
-          case Geometry::MESH:
-          {
-            HdSceneIndexPrim siPrim = _GetInputSceneIndex()->GetPrim(primPath);
-            VtArray<GfVec3f> points();
-
-            siPrim.dataSource = 
-              HdOverlayContainerDataSource::New(
-                HdRetainedContainerDataSource::New(
-                  HdPrimvarsSchemaTokens->primvars,
-                  HdRetainedContainerDataSource::New(
-                    HdTokens->points,
-                    HdPrimvarSchema::Builder()
-                      .SetPrimvarValue(
-                        HdRetainedTypedSampledDataSource<VtVec3fArray>::New(
-                          ((Deformable*)prim->geom)->GetPositions()
-                        ))
-                      .SetInterpolation(
-                        HdPrimvarSchema::BuildInterpolationDataSource(
-                          HdPrimvarSchemaTokens->varying))
-                      .SetRole(HdPrimvarSchema::BuildRoleDataSource(
-                        HdPrimvarSchemaTokens->color))
-                      .Build())),
-                siPrim.dataSource);
-            return siPrim;
-          }
-        }
+      Geometry* geometry = prim->geom;
+      const short type = geometry->GetType();
+      if(!geometry->IsInput() && type == Geometry::POINT)
+        return {HdPrimTypeTokens->points, _GetDataSource(primPath, geometry)};
+
+      if(!geometry->IsInput() && type == Geometry::CURVE)
+        return {HdPrimTypeTokens->basisCurves, _GetDataSource(primPath, geometry)};
+
+      if(type == Geometry::MESH || (geometry->IsInput() && 
+        (type == Geometry::POINT || type == Geometry::CURVE))) {
+        HdSceneIndexPrim siPrim = _GetInputSceneIndex()->GetPrim(primPath);
+        siPrim.dataSource = 
+          HdOverlayContainerDataSource::New(
+            _GetDataSource(primPath, geometry), siPrim.dataSource);
+        return siPrim;
       }
     }
   }
@@ -383,6 +387,14 @@ void ExecSceneIndex::_PrimsRemoved(
   const pxr::HdSceneIndexBase &sender,
   const pxr::HdSceneIndexObserver::RemovedPrimEntries &entries)
 {
+  {
+    std::lock_guard<std::mutex> lock(_sourcesLock);
+    for(const auto& entry: entries)
+      for(auto it = _sources.begin(); it != _sources.end();) {
+        if(it->first.HasPrefix(entry.primPath)) it = _sources.erase(it);
+        else ++it;
+      }
+  }
   _SendPrimsRemoved(entries);
 }
 
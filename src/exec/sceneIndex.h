@@ -1,6 +1,8 @@
 #ifndef JVR_EXEC_SCENEINDEX_H
 #define JVR_EXEC_SCENEINDEX_H
 
+#include <mutex>
+#include <unordered_map>
 #include <pxr/base/gf/matrix4d.h>
 #include <pxr/base/vt/dictionary.h>
 #include <pxr/imaging/hd/filteringSceneIndex.h>
@@ -11,6 +13,7 @@
 JVR_NAMESPACE_OPEN_SCOPE
 
 class Execution;
+class Geometry;
 
 TF_DECLARE_REF_PTRS(ExecSceneIndex);
 
@@ -27,6 +30,9 @@ class ExecSceneIndex : public HdSingleInputFilteringSceneIndexBase {
     void SetExec(Execution* exec);
     void UpdateExec();
 
+    // bumped every time the prim is dirtied by the exec
+    size_t GetVersion(const SdfPath& primPath) const;
+
     virtual HdSceneIndexPrim GetPrim(
       const SdfPath &primPath) const override;
 
@@ -35,6 +41,8 @@ class ExecSceneIndex : public HdSingleInputFilteringSceneIndexBase {
 
   protected:
     HdSceneIndexPrim _CreateGridPrim();
+    HdContainerDataSourceHandle _GetDataSource(const SdfPath& path,
+      Geometry* geometry) const;
 
     virtual void _PrimsAdded(
       const pxr::HdSceneIndexBase &sender,
@@ -59,6 +67,15 @@ class ExecSceneIndex : public HdSingleInputFilteringSceneIndexBase {
     HdSceneIndexPrim _gridPrim;
     bool _isPopulated;
 
+    // cached data sources referencing the exec geometries buffers
+    struct _Source {
+      HdContainerDataSourceHandle dataSource;
+      size_t                      version = 0;
+    };
+    typedef std::unordered_map<SdfPath, _Source, SdfPath::Hash> _SourceMap;
+    mutable std::mutex _sourcesLock;
+    mutable _SourceMap _sources;
+
 };
 
 JVR_NAMESPACE_CLOSE_SCOPE
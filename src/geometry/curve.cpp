@@ -228,10 +228,9 @@ Curve::_Sync( const GfMatrix4d& matrix, const UsdTimeCode& time)
 {
   if(_prim.IsValid() && _prim.IsA<UsdGeomCurves>())
   {
-    _previous = _positions;
     UsdGeomBasisCurves usdCurve(_prim);
-    const size_t nbPositions = _positions.size();
-    usdCurve.GetPointsAttr().Get(&_positions, time);
+    return _SyncPositions(usdCurve.GetPointsAttr(), time) ?
+      Geometry::DirtyState::DEFORM : Geometry::DirtyState::CLEAN;
   }
   return Geometry::DirtyState::DEFORM;
 }
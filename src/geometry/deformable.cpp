@@ -1,6 +1,8 @@
 // Points
 //----------------------------------------------
 
+#include <cstring>
+#include <limits>
 #include <pxr/base/gf/ray.h>
 
 #include <pxr/usd/usdGeom/tokens.h>
@@ -22,11 +24,15 @@ Deformable::Deformable(short type, const GfMatrix4d& matrix)
   , _haveWidths(false)
   , _haveNormals(false)
   , _haveColors(false)
+  , _positionsSample(std::numeric_limits<double>::quiet_NaN())
+  , _positionsSynced(false)
 {
 }
 
 Deformable::Deformable(const UsdPrim& prim, const GfMatrix4d& matrix)
   : Geometry(prim, matrix)
+  , _positionsSample(std::numeric_limits<double>::quiet_NaN())
+  , _positionsSynced(false)
 {
   if(prim.IsA<UsdGeomPointBased>()) {
     UsdGeomPointBased pointBased(prim);
@@ -72,12 +78,57 @@ void Deformable::_ValidateNumPoints(size_t n)
 
 }
 
+// time sample the points value comes from, the time itself when it is
+// interpolated between two samples, nan for default or unsampled values
+static double
+_GetPositionsSample(const UsdAttribute& attr, const UsdTimeCode& time)
+{
+  double lower, upper;
+  bool hasSamples = false;
+  if(time.IsDefault() || 
+    !attr.GetBracketingTimeSamples(time.GetValue(), &lower, &upper, &hasSamples) || 
+    !hasSamples)
+    return std::numeric_limits<double>::quiet_NaN();
+  return lower == upper ? lower : time.GetValue();
+}
+
+bool
+Deformable::_SyncPositions(const UsdAttribute& attr, const UsdTimeCode& time)
+{
+  // same sample as last sync (nan never compares equal)
+  const double sample = _GetPositionsSample(attr, time);
+  bool changed = false;
+  if(sample != _positionsSample) {
+    VtArray<GfVec3f> positions;
+    attr.Get(&positions, time);
+    _positionsSample = sample;
+    _positionsSynced = true;
+
+    // same buffer handed back or same content
+    changed = !positions.IsIdentical(_positions) && 
+      (positions.size() != _positions.size() || memcmp(positions.cdata(), 
+        _positions.cdata(), positions.size() * sizeof(GfVec3f)));
+    if(changed) {
+      if(positions.size() == _positions.size()) _previous.swap(_positions);
+      else _previous = positions;
+      _positions.swap(positions);
+    }
+  }
+
+  // previous shares the points buffer while they rest
+  if(!changed && !_previous.IsIdentical(_positions)) _previous = _positions;
+  return changed;
+}
+
 void
 Deformable::SetPositions(const GfVec3f* positions, size_t n)
 {
   _ValidateNumPoints(n);
-  memcpy(&_previous[0], &_positions[0], n * sizeof(GfVec3f));
-  memcpy(&_positions[0], positions, n * sizeof(GfVec3f));
+  // the current buffer becomes the previous one, the old previous is reused
+  _previous.swap(_positions);
+  memcpy(_positions.data(), positions, n * sizeof(GfVec3f));
+  _positionsSample = std::numeric_limits<double>::quiet_NaN();
+  _positionsSynced = false;
 }
 
 
@@ -110,8 +161,11 @@ Deformable::SetPositions(const VtArray<GfVec3f>& positions)
 {
   const size_t n = positions.size();
   _ValidateNumPoints(n);
-  memcpy(&_previous[0], &_positions[0], n * sizeof(GfVec3f));
-  memcpy(&_positions[0], &positions[0], n * sizeof(GfVec3f));
+  // share the given storage, copied on write
+  _previous.swap(_positions);
+  _positions = positions;
+  _positionsSample = std::numeric_limits<double>::quiet_NaN();
+  _positionsSynced = false;
 }
 
 void
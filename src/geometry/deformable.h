@@ -1,6 +1,7 @@
 #ifndef JVR_GEOMETRY_DEFORMABLE_H
 #define JVR_GEOMETRY_DEFORMABLE_H
 
+#include <limits>
 #include "../geometry/point.h"
 #include "../geometry/geometry.h"
 
@@ -87,9 +88,22 @@ public:
     return false;
   };
 
+  // next sync reads the points even if their time sample didn't change,
+  // for edits that keep the sample (default value, authored in place)
+  void ResetPositionsSample() {
+    _positionsSample = std::numeric_limits<double>::quiet_NaN();};
+
+  // true when the points were last written by a sync, false once set
+  // from code (a solver writing its outputs back)
+  bool ArePositionsSynced() const {return _positionsSynced;};
+
 protected:
   virtual void _ValidateNumPoints(size_t n);
 
+  // read the points sharing the attribute value storage, the current points
+  // become the previous ones by swap, returns true when they changed
+  bool _SyncPositions(const UsdAttribute& attr, const UsdTimeCode& time);
+
   // todo have extensible list of attribute referenced by their name
   // with some predefined and other we can append on demand
   //std::map<TfToken, Attribute>  _attributes;
@@ -104,6 +118,10 @@ protected:
   bool                      _haveWidths;
   VtArray<float>            _widths;
   VtArray<Point>            _points;
+
+  // points time sample read by the last sync, nan when unknown
+  double                    _positionsSample;
+  bool                      _positionsSynced;
 };
 
 JVR_NAMESPACE_CLOSE_SCOPE
@@ -36,10 +36,11 @@ HalfEdgeGraph::AllocateEdges(size_t num)
   size_t first = _halfEdges.size();
   _halfEdges.resize(first + num);
   _halfEdgeUsed.resize(first + num);
-  for (size_t edgeIdx = first; edgeIdx < (first + num); ++edgeIdx) {
-    HalfEdge* edge = &_halfEdges[edgeIdx];
-    _halfEdgeUsed[edgeIdx] = false;
-    _availableEdges.push(edgeIdx);
+  // pushed in reverse so the lowest index is handed out first
+  _availableEdges.reserve(_availableEdges.size() + num);
+  for (size_t edgeIdx = first + num; edgeIdx > first; --edgeIdx) {
+    _halfEdgeUsed[edgeIdx - 1] = false;
+    _availableEdges.push_back(edgeIdx - 1);
   }
 }
 
@@ -73,8 +74,8 @@ HalfEdge*
 HalfEdgeGraph::GetAvailableEdge()
 {
   if (_availableEdges.empty())AllocateEdges(64);
-  HalfEdge* edge = &_halfEdges[_availableEdges.front()];
-  _availableEdges.pop();
+  HalfEdge* edge = &_halfEdges[_availableEdges.back()];
+  _availableEdges.pop_back();
   _halfEdgeUsed[_GetEdgeIndex(edge)] = true;
   return edge;
 }
@@ -171,32 +172,49 @@ HalfEdgeGraph::IsUsed(const HalfEdge* edge) const
   return _halfEdgeUsed[_GetEdgeIndex(edge)];
 }
 
-// custom comparator for sorting half edge by key
-struct
-{
-  inline bool operator() (const HalfEdgeKey& edge1, const HalfEdgeKey& edge2)
-  {
-    return (edge1.first < edge2.first);
-  }
-} _SortEdgeByKey;
-
-static HalfEdge*
-_FindTwinEdge(const HalfEdgesKeys& halfEdgesKeys, uint64_t twinKey)
-{
-  int low = 0;
-  int high = halfEdgesKeys.size();
-  while (low < high) {
-    int mid =  low + (high - low) / 2;
-    if(halfEdgesKeys[mid].first == twinKey)
-      return halfEdgesKeys[mid].second;
-
-    if (twinKey <= halfEdgesKeys[mid].first) {
-        high = mid;
-    } else {
-        low = mid + 1;
-    }
+// parallel lsd radix sort of the edge keys on 8 bits digits, keys are
+// histogrammed per block and scattered in digit major order so every pass
+// is stable, only the digits the keys use are sorted
+static void
+_RadixSortKeys(HalfEdgesKeys& keys, HalfEdgesKeys& buffer, size_t numBits)
+{
+  static const size_t RADIX = 256;
+  static const size_t BLOCK_SIZE = 1 << 16;
+
+  const size_t numKeys = keys.size();
+  const size_t numBlocks = (numKeys + BLOCK_SIZE - 1) / BLOCK_SIZE;
+  std::vector<size_t> histograms(numBlocks * RADIX);
+  buffer.resize(numKeys);
+
+  for (size_t shift = 0; shift < numBits; shift += 8) {
+    std::fill(histograms.begin(), histograms.end(), 0);
+    WorkParallelForN(numBlocks, [&](size_t begin, size_t end) {
+      for (size_t block = begin; block < end; ++block) {
+        size_t* histogram = &histograms[block * RADIX];
+        const size_t last = std::min((block + 1) * BLOCK_SIZE, numKeys);
+        for (size_t k = block * BLOCK_SIZE; k < last; ++k)
+          histogram[(keys[k].first >> shift) & 0xFF]++;
+      }
+    });
+
+    size_t offset = 0;
+    for (size_t digit = 0; digit < RADIX; ++digit)
+      for (size_t block = 0; block < numBlocks; ++block) {
+        const size_t count = histograms[block * RADIX + digit];
+        histograms[block * RADIX + digit] = offset;
+        offset += count;
+      }
+
+    WorkParallelForN(numBlocks, [&](size_t begin, size_t end) {
+      for (size_t block = begin; block < end; ++block) {
+        size_t* histogram = &histograms[block * RADIX];
+        const size_t last = std::min((block + 1) * BLOCK_SIZE, numKeys);
+        for (size_t k = block * BLOCK_SIZE; k < last; ++k)
+          buffer[histogram[(keys[k].first >> shift) & 0xFF]++] = keys[k];
+      }
+    });
+    keys.swap(buffer);
   }
-  return NULL;
 }
 
 void 
@@ -205,79 +223,84 @@ HalfEdgeGraph::ComputeGraph(Mesh* mesh)
   const size_t numPoints = mesh->GetNumPoints();
   const VtArray<int>& faceConnects = mesh->GetFaceConnects();
   const VtArray<int>& faceVertexCounts = mesh->GetFaceCounts();
+  const size_t numFaces = faceVertexCounts.size();
 
-  size_t numHalfEdges = 0;
-  for (const auto& faceVertexCount : mesh->GetFaceCounts()) {
-    numHalfEdges += faceVertexCount;
-  }
+  std::vector<int> faceOffsets(numFaces + 1, 0);
+  for (size_t faceIdx = 0; faceIdx < numFaces; ++faceIdx)
+    faceOffsets[faceIdx + 1] = faceOffsets[faceIdx] + faceVertexCounts[faceIdx];
+  const size_t numHalfEdges = faceOffsets[numFaces];
 
   _halfEdges.resize(numHalfEdges);
-  _halfEdgeUsed.resize(numHalfEdges);
-
-  size_t faceIdx = 0;
-  size_t faceOffsetIdx = 0;
-
-  HalfEdge* halfEdge = &_halfEdges[0];
-
-  size_t halfEdgeIndex = 0;
-  HalfEdgesKeys halfEdgesKeys;
-  halfEdgesKeys.resize(numHalfEdges);
-
-  _vertexHalfEdge.resize(numPoints);
-  memset(&_vertexHalfEdge[0], HalfEdge::INVALID_INDEX, numPoints * sizeof(int));
-
-  for (const auto& faceVertexCount: faceVertexCounts)
-  { 
-    for (size_t faceEdgeIdx = 0; faceEdgeIdx < faceVertexCount; ++faceEdgeIdx) {
-      // get vertices
-      size_t v0 = faceConnects[faceOffsetIdx + faceEdgeIdx];
-      size_t v1 = faceConnects[faceOffsetIdx + ((faceEdgeIdx + 1) % faceVertexCount)];
-      if (_vertexHalfEdge[v0] < 0)_vertexHalfEdge[v0] = _GetEdgeIndex(halfEdge);
-
-      size_t last = faceVertexCount - 1;
-      halfEdgesKeys[halfEdgeIndex++] = {v1 | (v0 << 32), halfEdge};
-      halfEdge->vertex = v0;
-      halfEdge->face = faceIdx;
-      if (!faceEdgeIdx) {
-        halfEdge->prev = _GetEdgeIndex(halfEdge + last);
-        halfEdge->next = _GetEdgeIndex(halfEdge + 1);
-      } else if (faceEdgeIdx == last) {
-        halfEdge->prev = _GetEdgeIndex(halfEdge - 1);
-        halfEdge->next = _GetEdgeIndex(halfEdge - last);
-      } else {
-        halfEdge->prev = _GetEdgeIndex(halfEdge - 1);
-        halfEdge->next = _GetEdgeIndex(halfEdge + 1);
+  _halfEdgeUsed.assign(numHalfEdges, true);
+  _availableEdges.clear();
+
+  // undirected keys packed on the bits the vertex indices need
+  size_t numBits = 1;
+  while ((size_t(1) << numBits) < numPoints) numBits++;
+
+  HalfEdgesKeys halfEdgesKeys(numHalfEdges);
+  HalfEdge* halfEdges = _halfEdges.data();
+  const int* connects = faceConnects.cdata();
+
+  // faces own a contiguous range of half-edges
+  WorkParallelForN(numFaces, [&](size_t begin, size_t end) {
+    for (size_t faceIdx = begin; faceIdx < end; ++faceIdx) {
+      const int first = faceOffsets[faceIdx];
+      const int count = faceOffsets[faceIdx + 1] - first;
+      for (int faceEdgeIdx = 0; faceEdgeIdx < count; ++faceEdgeIdx) {
+        const int edgeIdx = first + faceEdgeIdx;
+        const uint64_t v0 = connects[edgeIdx];
+        const uint64_t v1 = connects[first + (faceEdgeIdx + 1) % count];
+        HalfEdge& halfEdge = halfEdges[edgeIdx];
+        halfEdge.vertex = v0;
+        halfEdge.face = faceIdx;
+        halfEdge.twin = HalfEdge::INVALID_INDEX;
+        halfEdge.prev = first + (faceEdgeIdx + count - 1) % count;
+        halfEdge.next = first + (faceEdgeIdx + 1) % count;
+        halfEdgesKeys[edgeIdx] = { v0 < v1 ? (v0 << numBits) | v1 : (v1 << numBits) | v0, edgeIdx };
       }
-
-      _halfEdgeUsed[faceOffsetIdx + faceEdgeIdx] = true;
-      halfEdge++;
     }
-    faceOffsetIdx += faceVertexCount;
-    faceIdx++;
-  }
+  });
 
-  // sort the half-edges vector by edge key
-  std::sort(halfEdgesKeys.begin(), halfEdgesKeys.end(), _SortEdgeByKey);
-
-  _boundary.resize(numPoints, false);
-
-  // populate the twin pointers by parallel processing the key vector:
-  WorkParallelForEach(halfEdgesKeys.begin(), halfEdgesKeys.end(),
-    [&](const HalfEdgeKey& halfEdge) {
-      uint64_t edgeIndex = halfEdge.first;
-      uint64_t twinIndex = ((edgeIndex & 0xffffffff) << 32) | (edgeIndex >> 32);
-      HalfEdge* twinEdge = _FindTwinEdge(halfEdgesKeys, twinIndex);
-      if(twinEdge)
-      {
-        twinEdge->twin = _GetEdgeIndex(halfEdge.second);
-        halfEdge.second->twin = _GetEdgeIndex(twinEdge);
-      }
-      else {
-        halfEdge.second->twin = HalfEdge::INVALID_INDEX;
-        _boundary[halfEdge.second->vertex] = true;
-        _boundary[_halfEdges[halfEdge.second->next].vertex] = true;
+  // equal keys end up adjacent, stable sort keeps them by half-edge index
+  HalfEdgesKeys buffer;
+  _RadixSortKeys(halfEdgesKeys, buffer, 2 * numBits);
+
+  // every run of equal keys is one edge, half-edges pair with the first
+  // opposite half-edge of their run (several on non manifold edges)
+  WorkParallelForN(numHalfEdges, [&](size_t begin, size_t end) {
+    for (size_t k = begin; k < end; ++k) {
+      if (k > 0 && halfEdgesKeys[k - 1].first == halfEdgesKeys[k].first) continue;
+      size_t last = k + 1;
+      while (last < numHalfEdges && halfEdgesKeys[last].first == halfEdgesKeys[k].first) last++;
+      if (last - k < 2) continue;
+
+      for (size_t e = k; e < last; ++e) {
+        HalfEdge& halfEdge = halfEdges[halfEdgesKeys[e].second];
+        for (size_t t = k; t < last; ++t) {
+          const HalfEdge& twinEdge = halfEdges[halfEdgesKeys[t].second];
+          if (twinEdge.vertex != halfEdge.vertex) {
+            halfEdge.twin = halfEdgesKeys[t].second;
+            break;
+          }
+        }
       }
+    }
   });
+
+  // first half-edge of every vertex and boundaries
+  _vertexHalfEdge.assign(numPoints, HalfEdge::INVALID_INDEX);
+  _boundary.assign(numPoints, false);
+  int* vertexHalfEdge = _vertexHalfEdge.data();
+  bool* boundary = _boundary.data();
+  for (size_t edgeIdx = numHalfEdges; edgeIdx > 0; --edgeIdx) {
+    const HalfEdge& halfEdge = halfEdges[edgeIdx - 1];
+    vertexHalfEdge[halfEdge.vertex] = edgeIdx - 1;
+    if (halfEdge.twin == HalfEdge::INVALID_INDEX) {
+      boundary[halfEdge.vertex] = true;
+      boundary[halfEdges[halfEdge.next].vertex] = true;
+    }
+  }
 }
 
 size_t 
@@ -309,7 +332,7 @@ HalfEdgeGraph::_RemoveOneEdge(const HalfEdge* edge, bool* modified)
 {
   const int edgeIdx = _GetEdgeIndex(edge);
   if (_halfEdgeUsed[edgeIdx]) {
-    _availableEdges.push(edgeIdx);
+    _availableEdges.push_back(edgeIdx);
     _halfEdgeUsed[edgeIdx] = false;
     *modified = true;
   }
@@ -509,28 +532,58 @@ HalfEdgeGraph::_TriangulateFace(const HalfEdge* edge)
   }
 }
 
+// rings of every vertex into compressed rows, vertices are processed by
+// chunks in parallel, each chunk gathers its rings locally then they are
+// copied at their offset once the counts are scanned
+void
+HalfEdgeGraph::_ComputeVertexRings(bool connected, std::vector<int>& offsets, 
+  std::vector<int>& rings)
+{
+  static const size_t CHUNK_SIZE = 4096;
+
+  const size_t numPoints = _boundary.size();
+  const size_t numChunks = (numPoints + CHUNK_SIZE - 1) / CHUNK_SIZE;
+
+  // lowest used half-edge leaving every vertex
+  std::vector<int> vertexHalfEdge(numPoints, HalfEdge::INVALID_INDEX);
+  for (size_t edgeIdx = _halfEdges.size(); edgeIdx > 0; --edgeIdx)
+    if (_halfEdgeUsed[edgeIdx - 1])
+      vertexHalfEdge[_halfEdges[edgeIdx - 1].vertex] = edgeIdx - 1;
+
+  // detach once so the parallel reads below never copy
+  _halfEdges.data();
+  _boundary.data();
+
+  offsets.assign(numPoints + 1, 0);
+  std::vector<std::vector<int>> chunks(numChunks);
+  WorkParallelForN(numChunks, [&](size_t begin, size_t end) {
+    VtArray<int> ring;
+    for (size_t chunk = begin; chunk < end; ++chunk) {
+      const size_t last = std::min((chunk + 1) * CHUNK_SIZE, numPoints);
+      for (size_t vertex = chunk * CHUNK_SIZE; vertex < last; ++vertex) {
+        if (vertexHalfEdge[vertex] == HalfEdge::INVALID_INDEX) continue;
+        ring.clear();
+        _ComputeVertexNeighbors(&_halfEdges[vertexHalfEdge[vertex]], ring, connected);
+        offsets[vertex + 1] = ring.size();
+        chunks[chunk].insert(chunks[chunk].end(), ring.cbegin(), ring.cend());
+      }
+    }
+  });
+
+  for (size_t vertex = 0; vertex < numPoints; ++vertex)
+    offsets[vertex + 1] += offsets[vertex];
+
+  rings.resize(offsets[numPoints]);
+  WorkParallelForN(numChunks, [&](size_t begin, size_t end) {
+    for (size_t chunk = begin; chunk < end; ++chunk)
+      std::copy(chunks[chunk].begin(), chunks[chunk].end(), 
+        rings.begin() + offsets[chunk * CHUNK_SIZE]);
+  });
+}
+
 void HalfEdgeGraph::ComputeAdjacents()
 {
-  size_t numPoints = _boundary.size();
-  _adjacents.clear();
-  _adjacentsCount.resize(numPoints);
-  _adjacentsOffset.resize(numPoints);
-
-  std::vector<int> visited(numPoints, 0);
-
-  VtArray<int> adjacents;
-  size_t adjacentsOffset = 0;
-
-  for (HalfEdge& halfEdge : _halfEdges) {
-    if(visited[halfEdge.vertex]) continue;
-    adjacents.clear();
-    _ComputeVertexNeighbors(&halfEdge, adjacents, true);
-    for(auto& adjacent: adjacents)_adjacents.push_back(adjacent);
-    _adjacentsCount[halfEdge.vertex] = adjacents.size();
-    _adjacentsOffset[halfEdge.vertex] = adjacentsOffset;
-    adjacentsOffset += adjacents.size();
-    visited[halfEdge.vertex]++;
-  }
+  _ComputeVertexRings(true, _adjacentsOffset, _adjacents);
 }
 
 void
@@ -541,26 +594,7 @@ HalfEdgeGraph::ComputeAdjacents(const HalfEdge* edge, VtArray<int>& adjacents)
 
 void HalfEdgeGraph::ComputeNeighbors()
 {
-  size_t numPoints = _boundary.size();
-  _neighbors.clear();
-  _neighborsCount.resize(numPoints);
-  _neighborsOffset.resize(numPoints);
-
-  std::vector<int> visited(numPoints, 0);
-
-  VtArray<int> neighbors;
-  size_t neighborsOffset = 0;
-
-  for (HalfEdge& halfEdge : _halfEdges) {
-    if(visited[halfEdge.vertex]) continue;
-    neighbors.clear();
-    _ComputeVertexNeighbors(&halfEdge, neighbors, false);
-    for(auto& neighbor: neighbors)_neighbors.push_back(neighbor);
-    _neighborsCount[halfEdge.vertex] = neighbors.size();
-    _neighborsOffset[halfEdge.vertex] = neighborsOffset;
-    neighborsOffset += neighbors.size();
-    visited[halfEdge.vertex]++;
-  }
+  _ComputeVertexRings(false, _neighborsOffset, _neighbors);
 }
 
 void
@@ -824,7 +858,7 @@ HalfEdgeGraph::GetTotalNumNeighbors() const
 size_t 
 HalfEdgeGraph::GetNumNeighbors(size_t index) const
 {
-  return _neighborsCount[index];
+  return _neighborsOffset[index + 1] - _neighborsOffset[index];
 }
 
 const int*  
@@ -842,7 +876,7 @@ HalfEdgeGraph::GetNeighbor(size_t index, size_t neighbor) const
 int  
 HalfEdgeGraph::GetNeighborIndex(size_t index, size_t neighbor) const
 {
-  for(size_t n = 0; n < _neighborsCount[index]; ++n)
+  for(size_t n = 0; n < GetNumNeighbors(index); ++n)
     if(_neighbors[_neighborsOffset[index] + n] == neighbor)return n;
 
   return HalfEdge::INVALID_INDEX;
@@ -857,7 +891,7 @@ HalfEdgeGraph::GetTotalNumAdjacents() const
 size_t  
 HalfEdgeGraph::GetNumAdjacents(size_t index) const
 {
-  return _adjacentsCount[index];
+  return _adjacentsOffset[index + 1] - _adjacentsOffset[index];
 }
 
 const int*  
@@ -875,7 +909,7 @@ HalfEdgeGraph::GetAdjacent(size_t index, size_t adjacent) const
 int  
 HalfEdgeGraph::GetAdjacentIndex(size_t index, size_t adjacent) const
 {
-  for(size_t n = 0; n < _adjacentsCount[index]; ++n)
+  for(size_t n = 0; n < GetNumAdjacents(index); ++n)
     if(_adjacents[_adjacentsOffset[index] + n] == adjacent)return n;
 
   return HalfEdge::INVALID_INDEX;
@@ -1,7 +1,6 @@
 #ifndef JVR_GEOMETRY_HALFEDGE_H
 #define JVR_GEOMETRY_HALFEDGE_H
 
-#include <queue>
 #include <iterator>
 #include <vector>
 #include <iomanip>
@@ -119,6 +118,7 @@ protected:
   
   void _RemoveOneEdge(const HalfEdge* edge, bool* modified);
   void _ComputeVertexNeighbors(const HalfEdge* edge, VtArray<int>& neighbors, bool connected=false);
+  void _ComputeVertexRings(bool connected, std::vector<int>& offsets, std::vector<int>& rings);
   size_t _GetEdgeIndex(const HalfEdge* edge) const;
   size_t _GetFaceVerticesCount(const HalfEdge* edge);
 
@@ -127,24 +127,25 @@ private:
   // half-edge data
   VtArray<bool>                   _halfEdgeUsed;
   VtArray<HalfEdge>               _halfEdges;
-  std::queue<int>                      _availableEdges;
+  std::vector<int>                _availableEdges;  // free list, lowest index last
 
   // vertex data
   VtArray<int>                    _vertexHalfEdge;
   VtArray<bool>                   _boundary;
   VtArray<int>                    _shell;
-  VtArray<int>                    _adjacents; // connected
-  VtArray<int>                    _adjacentsCount;
-  VtArray<int>                    _adjacentsOffset;
-  VtArray<int>                    _neighbors; // first ring
-  VtArray<int>                    _neighborsCount;
-  VtArray<int>                    _neighborsOffset;
+
+  // compressed rows, offsets hold one more entry than vertices
+  std::vector<int>                _adjacents; // connected
+  std::vector<int>                _adjacentsOffset;
+  std::vector<int>                _neighbors; // first ring
+  std::vector<int>                _neighborsOffset;
 
   friend Mesh;
 
 };
 
-using HalfEdgesKeys = std::vector<std::pair<uint64_t, HalfEdge*>>;
+// undirected edge key and half-edge index
+using HalfEdgesKeys = std::vector<std::pair<uint64_t, int>>;
 using HalfEdgeKey  = HalfEdgesKeys::value_type;
 
 
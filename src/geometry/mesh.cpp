@@ -2,7 +2,10 @@
 //----------------------------------------------
 
 #include <cmath>
+#include <cstring>
+#include <limits>
 #include <algorithm>
+#include <pxr/base/work/loops.h>
 #include <pxr/base/gf/ray.h>
 #include <pxr/base/gf/vec2d.h>
 #include <pxr/base/gf/vec3f.h>
@@ -24,6 +27,8 @@ JVR_NAMESPACE_OPEN_SCOPE
 Mesh::Mesh(const GfMatrix4d& xfo)
   : Deformable(Geometry::MESH, xfo)
   , _flags(0)
+  , _topologyVersion(0)
+  , _normalsTopologyVersion(std::numeric_limits<size_t>::max())
   , _halfEdges()
 {
 }
@@ -31,6 +36,8 @@ Mesh::Mesh(const GfMatrix4d& xfo)
 Mesh::Mesh(const UsdGeomMesh& mesh, const GfMatrix4d& world, size_t connectivity)
   : Deformable(mesh.GetPrim(), world)
   , _flags(0)
+  , _topologyVersion(0)
+  , _normalsTopologyVersion(std::numeric_limits<size_t>::max())
   , _halfEdges()
 {
   UsdAttribute pointsAttr = mesh.GetPointsAttr();
@@ -615,6 +622,7 @@ Mesh::Set(
 {
   _faceVertexCounts = faceVertexCounts;
   _faceVertexIndices = faceVertexIndices;
+  _topologyVersion++;
   _positions = positions;
   _previous = _positions;
   _normals = positions;
@@ -630,6 +638,7 @@ void Mesh::SetTopology(
 {
   _faceVertexCounts = faceVertexCounts;
   _faceVertexIndices = faceVertexIndices;
+  _topologyVersion++;
 
   if(init)Init(connectivity);
 }
@@ -637,10 +646,13 @@ void Mesh::SetTopology(
 void Mesh::SetPositions(const GfVec3f* positions, size_t n)
 {
   if(n == GetNumPoints()) {
-    memcpy(&_positions[0], positions, n * sizeof(GfVec3f));
+    // the current buffer becomes the previous one, the old previous is reused
+    _previous.swap(_positions);
+    memcpy(_positions.data(), positions, n * sizeof(GfVec3f));
+    _positionsSample = std::numeric_limits<double>::quiet_NaN();
+    _positionsSynced = false;
     // recompute normals
-    ComputeVertexNormals(_positions, _faceVertexCounts, 
-    _faceVertexIndices, _triangles, _normals);
+    ComputeNormals();
   }
 }
 
@@ -648,21 +660,156 @@ void Mesh::SetPositions(const VtArray<GfVec3f>& positions)
 {
   const size_t n = positions.size();
   if(n == GetNumPoints()) {
+    _previous.swap(_positions);
     _positions = positions;
+    _positionsSample = std::numeric_limits<double>::quiet_NaN();
+    _positionsSynced = false;
     // recompute normals
-    ComputeVertexNormals(_positions, _faceVertexCounts, 
-    _faceVertexIndices, _triangles, _normals);
+    ComputeNormals();
   }
 }
 
+void Mesh::SetPositions(const GfVec3f* positions, const int* indices, size_t n)
+{
+  GfVec3f* dst = _positions.data();
+  for(size_t p = 0; p < n; ++p)
+    dst[indices[p]] = positions[p];
+  _positionsSample = std::numeric_limits<double>::quiet_NaN();
+  _positionsSynced = false;
+  // recompute normals around the moved points
+  ComputeNormals(indices, n);
+}
+
+//-------------------------------------------------------
+// Normals
+//-------------------------------------------------------
+// face offsets and vertex to faces rows, filled by counting sort
+void Mesh::_ComputeNormalsTopology()
+{
+  const size_t numFaces = _faceVertexCounts.size();
+  const size_t numPoints = _positions.size();
+
+  _normalsTopologyVersion = _topologyVersion;
+  _faceOffsets.resize(numFaces + 1);
+  _faceTriangles.resize(numFaces + 1);
+  _faceOffsets[0] = _faceTriangles[0] = 0;
+  for(size_t f = 0; f < numFaces; ++f) {
+    _faceOffsets[f + 1] = _faceOffsets[f] + _faceVertexCounts[f];
+    _faceTriangles[f + 1] = _faceTriangles[f] + GfMax(_faceVertexCounts[f] - 2, 0);
+  }
+
+  _vertexFacesOffsets.assign(numPoints + 1, 0);
+  for(const int& vertex: _faceVertexIndices)
+    _vertexFacesOffsets[vertex + 1]++;
+  for(size_t p = 0; p < numPoints; ++p)
+    _vertexFacesOffsets[p + 1] += _vertexFacesOffsets[p];
+
+  std::vector<int> cursors(_vertexFacesOffsets.begin(), _vertexFacesOffsets.end() - 1);
+  _vertexFaces.resize(_faceVertexIndices.size());
+  for(size_t f = 0; f < numFaces; ++f)
+    for(int v = _faceOffsets[f]; v < _faceOffsets[f + 1]; ++v)
+      _vertexFaces[cursors[_faceVertexIndices[v]]++] = f;
+
+  _faceNormals.resize(numFaces);
+}
+
+bool Mesh::_IsNormalsTopologyValid() const
+{
+  return 
+    _normalsTopologyVersion == _topologyVersion &&
+    _vertexFacesOffsets.size() == _positions.size() + 1;
+}
+
+// normalized sum of the face triangles normals
+GfVec3f Mesh::_ComputeFaceNormal(size_t face) const
+{
+  const GfVec3f* positions = _positions.cdata();
+  GfVec3f normal(0.f);
+  for(int t = _faceTriangles[face]; t < _faceTriangles[face + 1]; ++t) {
+    const Triangle& triangle = _triangles[t];
+    const GfVec3f& a = positions[triangle.vertices[0]];
+    GfVec3f triangleNormal = 
+      (positions[triangle.vertices[1]] - a) ^ (positions[triangle.vertices[2]] - a);
+    if(triangleNormal.GetLengthSq() > 0.f) triangleNormal.Normalize();
+    normal += triangleNormal;
+  }
+  return normal.GetNormalized();
+}
+
+// normalized sum of the adjacent faces normals
+GfVec3f Mesh::_ComputeVertexNormal(size_t vertex) const
+{
+  GfVec3f normal(0.f);
+  for(int f = _vertexFacesOffsets[vertex]; f < _vertexFacesOffsets[vertex + 1]; ++f)
+    normal += _faceNormals[_vertexFaces[f]];
+  return normal.GetNormalized();
+}
+
+void Mesh::ComputeNormals()
+{
+  if(!_IsNormalsTopologyValid()) _ComputeNormalsTopology();
+
+  const size_t numFaces = _faceVertexCounts.size();
+  const size_t numPoints = _positions.size();
+  _normals.resize(numPoints);
+  GfVec3f* normals = _normals.data();
+
+  WorkParallelForN(numFaces, [&](size_t begin, size_t end) {
+    for(size_t f = begin; f < end; ++f)
+      _faceNormals[f] = _ComputeFaceNormal(f);
+  });
+
+  WorkParallelForN(numPoints, [&](size_t begin, size_t end) {
+    for(size_t p = begin; p < end; ++p)
+      normals[p] = _ComputeVertexNormal(p);
+  });
+}
+
+void Mesh::ComputeNormals(const int* points, size_t numPoints)
+{
+  // past a quarter of the points a full pass is cheaper than gathering
+  if(!_IsNormalsTopologyValid() || _normals.size() != _positions.size() ||
+    numPoints * 4 > _positions.size()) {
+    ComputeNormals();
+    return;
+  }
+
+  _dirtyFaces.clear();
+  for(size_t p = 0; p < numPoints; ++p)
+    for(int f = _vertexFacesOffsets[points[p]]; f < _vertexFacesOffsets[points[p] + 1]; ++f)
+      _dirtyFaces.push_back(_vertexFaces[f]);
+  std::sort(_dirtyFaces.begin(), _dirtyFaces.end());
+  _dirtyFaces.erase(std::unique(_dirtyFaces.begin(), _dirtyFaces.end()), _dirtyFaces.end());
+
+  _dirtyPoints.clear();
+  for(const int& f: _dirtyFaces)
+    for(int v = _faceOffsets[f]; v < _faceOffsets[f + 1]; ++v)
+      _dirtyPoints.push_back(_faceVertexIndices[v]);
+  std::sort(_dirtyPoints.begin(), _dirtyPoints.end());
+  _dirtyPoints.erase(std::unique(_dirtyPoints.begin(), _dirtyPoints.end()), _dirtyPoints.end());
+
+  GfVec3f* normals = _normals.data();
+  WorkParallelForN(_dirtyFaces.size(), [&](size_t begin, size_t end) {
+    for(size_t f = begin; f < end; ++f)
+      _faceNormals[_dirtyFaces[f]] = _ComputeFaceNormal(_dirtyFaces[f]);
+  });
+
+  WorkParallelForN(_dirtyPoints.size(), [&](size_t begin, size_t end) {
+    for(size_t p = begin; p < end; ++p)
+      normals[_dirtyPoints[p]] = _ComputeVertexNormal(_dirtyPoints[p]);
+  });
+}
+
+// topology arrays may have been edited in place, init starts a new version
 void Mesh::Init(size_t connectivity)
 {
   size_t numPoints = _positions.size();
+  _topologyVersion++;
   // compute triangles
   TriangulateMesh(_faceVertexCounts, _faceVertexIndices, _triangles);
   // compute normals
-  ComputeVertexNormals(_positions, _faceVertexCounts, 
-    _faceVertexIndices, _triangles, _normals);
+  _ComputeNormalsTopology();
+  ComputeNormals();
   // compute bouding box
   ComputeBoundingBox();
 
@@ -701,18 +848,8 @@ Mesh::_Sync(const GfMatrix4d& matrix, const UsdTimeCode& time)
   if(_prim.IsValid() && _prim.IsA<UsdGeomMesh>())
   {
     UsdGeomMesh usdMesh(_prim);
-    if(_previous.size() == _positions.size())
-      memcpy(&_previous[0], &_positions[0], _positions.size() * sizeof(GfVec3f));
-    else
-      usdMesh.GetPointsAttr().Get(&_previous, time);
-
-    usdMesh.GetPointsAttr().Get(&_positions, time);
-
-    // recompute normals if needed
-    if(VtValue(_positions).GetHash() != VtValue(_previous).GetHash()) {
-      ComputeVertexNormals(_positions, _faceVertexCounts, 
-        _faceVertexIndices, _triangles, _normals);
-    
+    if(_SyncPositions(usdMesh.GetPointsAttr(), time)) {
+      ComputeNormals();
       return Geometry::DirtyState::DEFORM;
     }
   }
@@ -91,6 +91,8 @@ public:
   virtual ~Mesh();
 
   size_t GetFlags(){return _flags;};
+  // bumped whenever the faces are set or the mesh is initialized
+  size_t GetTopologyVersion() const {return _topologyVersion;};
   const VtArray<int>& GetFaceCounts() const { return _faceVertexCounts;};
   const VtArray<int>& GetFaceConnects() const { return _faceVertexIndices;};
   VtArray<int>& GetFaceCounts() { return _faceVertexCounts;};
@@ -157,9 +159,15 @@ public:
 
   void Init(size_t connectivity=0);
 
+  // smooth vertex normals, the indexed version only recomputes the faces
+  // around the given points and the normals of their vertices
+  void ComputeNormals();
+  void ComputeNormals(const int* points, size_t numPoints);
+
   // points (deformation)
   void SetPositions(const GfVec3f* positions, size_t n) override;
   void SetPositions(const VtArray<GfVec3f>& positions) override;
+  void SetPositions(const GfVec3f* positions, const int* indices, size_t n);
 
   // topology
   void Set(
@@ -219,8 +227,15 @@ protected:
   void _Inject(const GfMatrix4d& parent,
     const UsdTimeCode& code=UsdTimeCode::Default()) override;
 
+  void _ComputeNormalsTopology();
+  bool _IsNormalsTopologyValid() const;
+  GfVec3f _ComputeFaceNormal(size_t face) const;
+  GfVec3f _ComputeVertexNormal(size_t vertex) const;
+
 private:
   int                                 _flags;
+  size_t                              _topologyVersion;
+  size_t                              _normalsTopologyVersion;
   // polygonal description
   VtArray<int>                   _faceVertexCounts;  
   VtArray<int>                   _faceVertexIndices;
@@ -232,6 +247,15 @@ private:
   // half-edge data
   HalfEdgeGraph                       _halfEdges;
 
+  // normals scratch, rebuilt with the topology
+  std::vector<int>               _faceOffsets;         // first face vertex
+  std::vector<int>               _faceTriangles;       // first face triangle
+  std::vector<int>               _vertexFacesOffsets;
+  std::vector<int>               _vertexFaces;
+  std::vector<GfVec3f>           _faceNormals;
+  std::vector<int>               _dirtyFaces;
+  std::vector<int>               _dirtyPoints;
+
 };
 
 
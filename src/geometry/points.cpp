@@ -23,10 +23,9 @@ Points::_Sync(const GfMatrix4d& matrix, const UsdTimeCode& time)
 {
   if(_prim.IsValid() && _prim.IsA<UsdGeomPoints>())
   {
-    _previous = _positions;
     UsdGeomPoints usdPoints(_prim);
-    const size_t nbPositions = _positions.size();
-    usdPoints.GetPointsAttr().Get(&_positions, time);
+    return _SyncPositions(usdPoints.GetPointsAttr(), time) ?
+      Geometry::DirtyState::DEFORM : Geometry::DirtyState::CLEAN;
   }
   return Geometry::DirtyState::DEFORM;
 }
@@ -2,6 +2,8 @@
 #include <pxr/base/vt/value.h>
 #include <pxr/base/tf/token.h>
 #include <pxr/usd/sdf/path.h>
+#include <pxr/base/work/loops.h>
+#include <pxr/usd/usdGeom/xformCache.h>
 #include <pxr/usd/usdGeom/xform.h>
 #include <pxr/usd/usdGeom/xformCommonAPI.h>
 #include <pxr/usd/usdGeom/mesh.h>
@@ -16,6 +18,7 @@
 #include "../geometry/utils.h"
 #include "../geometry/geometry.h"
 #include "../geometry/implicit.h"
+#include "../geometry/deformable.h"
 #include "../geometry/mesh.h"
 #include "../geometry/curve.h"
 #include "../geometry/points.h"
@@ -27,11 +30,13 @@
 JVR_NAMESPACE_OPEN_SCOPE
 
 Scene::Scene()
+  : _allDirty(true)
 {
 }
 
 Scene::~Scene()
 {
+  TfNotice::Revoke(_objectsChangedKey);
   for(auto& prim: _prims) 
     if(prim.second.geom)
       delete prim.second.geom;
@@ -51,21 +56,135 @@ Scene::Init(const UsdStageRefPtr& stage)
   std::cout << "SCENE INIT END" << std::endl;
 }
 
+//-------------------------------------------------------
+// Dirty list
+//-------------------------------------------------------
+void
+Scene::_WatchStage(const UsdStageRefPtr& stage)
+{
+  if(_stage == stage) return;
+
+  TfNotice::Revoke(_objectsChangedKey);
+  _stage = stage;
+  if(stage)
+    _objectsChangedKey = TfNotice::Register(
+      TfCreateWeakPtr(this), &Scene::_OnObjectsChanged, UsdStageWeakPtr(stage));
+  MarkAllDirty();
+}
+
+// notices can come from any thread editing the stage
+void
+Scene::_OnObjectsChanged(const UsdNotice::ObjectsChanged& notice,
+  const UsdStageWeakPtr& sender)
+{
+  std::lock_guard<std::mutex> lock(_dirtyLock);
+  for(const SdfPath& path: notice.GetResyncedPaths()) {
+    if(path == SdfPath::AbsoluteRootPath()) _allDirty = true;
+    else _dirtyPaths.insert(path.GetPrimPath());
+  }
+  for(const SdfPath& path: notice.GetChangedInfoOnlyPaths())
+    _dirtyPaths.insert(path.GetPrimPath());
+}
+
+void
+Scene::MarkAllDirty()
+{
+  std::lock_guard<std::mutex> lock(_dirtyLock);
+  _allDirty = true;
+}
+
+// a change on an ancestor dirties its descendants (inherited xform)
+bool
+Scene::_IsPathDirty(const SdfPath& path) const
+{
+  if(_dirtyPaths.empty()) return false;
+  for(SdfPath current = path; !current.IsEmpty() &&
+    current != SdfPath::AbsoluteRootPath(); current = current.GetParentPath())
+    if(_dirtyPaths.find(current) != _dirtyPaths.end())
+      return true;
+  return false;
+}
+
+static bool
+_IsTimeVarying(const UsdPrim& prim)
+{
+  for(const UsdAttribute& attribute: prim.GetAttributes())
+    if(attribute.ValueMightBeTimeVarying())
+      return true;
+
+  for(UsdPrim parent = prim.GetParent(); parent && !parent.IsPseudoRoot();
+    parent = parent.GetParent()) {
+    UsdGeomXformable xformable(parent);
+    if(xformable && xformable.TransformMightBeTimeVarying())
+      return true;
+  }
+  return false;
+}
+
+// sync state to the matching render index dirty bits
+static HdDirtyBits
+_GetDirtyBits(size_t state)
+{
+  HdDirtyBits bits = HdChangeTracker::Clean;
+  if(state & Geometry::TRANSFORM)
+    bits |= HdChangeTracker::DirtyTransform;
+  if(state & Geometry::DEFORM)
+    bits |= HdChangeTracker::DirtyPoints | HdChangeTracker::DirtyNormals;
+  if(state & Geometry::TOPOLOGY)
+    bits |= HdChangeTracker::DirtyTopology | HdChangeTracker::DirtyPoints |
+      HdChangeTracker::DirtyNormals;
+  if(state & Geometry::ATTRIBUTE)
+    bits |= HdChangeTracker::DirtyPrimvar;
+  return bits;
+}
+
+// only dirty or time varying prims are synced, geometries are independent
+// so they sync in parallel, each task owns its xform cache
 void
 Scene::Sync(const UsdStageRefPtr& stage, const UsdTimeCode& time)
 {
-  UsdTimeCode activeTime = UsdTimeCode(time);
-  UsdGeomXformCache xformCache(activeTime);
-
-  for(auto& itPrim: _prims) {
-    UsdPrim prim = stage->GetPrimAtPath(itPrim.first);
-    Geometry* geometry = itPrim.second.geom;
-    if (!geometry->IsInput() || !prim.IsValid())
-      continue;
-    
-    GfMatrix4d matrix(xformCache.GetLocalToWorldTransform(prim));
-    geometry->Sync(matrix, time);
+  _WatchStage(stage);
+
+  _syncPrims.clear();
+  {
+    std::lock_guard<std::mutex> lock(_dirtyLock);
+    for(auto& itPrim: _prims) {
+      _Prim& entry = itPrim.second;
+      if (!entry.geom->IsInput())
+        continue;
+
+      if(_allDirty || _IsPathDirty(itPrim.first) || !entry.prim.IsValid()) {
+        entry.prim = stage->GetPrimAtPath(itPrim.first);
+        entry.varying = entry.prim.IsValid() && _IsTimeVarying(entry.prim);
+        entry.dirty = true;
+      }
+      // points written from code (solver outputs) are read back from the 
+      // stage, a static prim would otherwise keep its last written pose
+      if(entry.geom->GetType() >= Geometry::POINT && 
+        !((Deformable*)entry.geom)->ArePositionsSynced())
+        entry.dirty = true;
+      if(!entry.prim.IsValid() || (!entry.dirty && !entry.varying))
+        continue;
+
+      _syncPrims.push_back(&entry);
+    }
+    _dirtyPaths.clear();
+    _allDirty = false;
   }
+
+  WorkParallelForN(_syncPrims.size(), [&](size_t begin, size_t end) {
+    UsdGeomXformCache xformCache(time);
+    for(size_t i = begin; i < end; ++i) {
+      _Prim* entry = _syncPrims[i];
+      // an edited prim may keep its points sample, it must be read anyway
+      if(entry->dirty && entry->geom->GetType() >= Geometry::POINT)
+        ((Deformable*)entry->geom)->ResetPositionsSample();
+      GfMatrix4d matrix(xformCache.GetLocalToWorldTransform(entry->prim));
+      // each task owns its entries, their bits are set without lock
+      entry->bits |= _GetDirtyBits(entry->geom->Sync(matrix, time));
+      entry->dirty = false;
+    }
+  });
 }
 
 Mesh* Scene::AddMesh(const SdfPath& path, const GfMatrix4d& xfo)
@@ -268,7 +387,7 @@ void
 Scene::MarkPrimDirty(const SdfPath& path, HdDirtyBits bits)
 {
   Scene::_Prim* prim = GetPrim(path);
-  if(prim) prim->bits = bits; 
+  if(prim) prim->bits |= bits;
 }
 
 // -----------------------------------------------------------------------//
@@ -2,11 +2,16 @@
 #define JVR_GEOMETRY_SCENE_H
 #include <vector>
 #include <map>
+#include <mutex>
 #include "../common.h"
 #include <pxr/usd/usd/stage.h>
 #include <pxr/usd/usd/prim.h>
 #include <pxr/base/tf/hashmap.h>
 #include <pxr/base/tf/denseHashSet.h>
+#include <pxr/base/tf/hashset.h>
+#include <pxr/base/tf/notice.h>
+#include <pxr/base/tf/weakBase.h>
+#include <pxr/usd/usd/notice.h>
 #include <pxr/usdImaging/usdImaging/delegate.h>
 
 
@@ -22,11 +27,17 @@ struct Sample;
 class Solver;
 class Execution;
 
-class Scene  {
+// geometries are synced from their usd prim, prim handles are cached and
+// only refreshed when the stage reports a change under their path, static
+// prims are synced once and skipped until marked dirty again
+class Scene : public TfWeakBase {
 public:
   struct _Prim {
     Geometry*     geom;
-    HdDirtyBits   bits;
+    HdDirtyBits   bits = HdChangeTracker::Clean;
+    UsdPrim       prim;                 // cached handle
+    bool          varying = false;      // xform or attributes time varying
+    bool          dirty = true;         // refresh handle and sync
   };
 
   struct _Graph {
@@ -38,6 +49,7 @@ public:
   typedef TfHashMap< SdfPath, _Graph, SdfPath::Hash >       _GraphMap;
   typedef std::map< SdfPath, VtValue >                      _MaterialMap;
   typedef std::map< SdfPath, SdfPath >                      _MaterialBindingMap;
+  typedef TfHashSet< SdfPath, SdfPath::Hash >               _PathSet;
   
   friend class Execution;
 
@@ -77,6 +89,7 @@ public:
   SdfPath GetInstancerBinding(const SdfPath& path);
 
   void MarkPrimDirty(const SdfPath& path, HdDirtyBits bits);
+  void MarkAllDirty();
 
   /// Gets the topological mesh data for a given prim.
   HdMeshTopology GetMeshTopology(SdfPath const& id);
@@ -121,11 +134,25 @@ public:
   VtValue GetMaterialResource(SdfPath const &materialId);
 
 
+protected:
+  void _WatchStage(const UsdStageRefPtr& stage);
+  void _OnObjectsChanged(const UsdNotice::ObjectsChanged& notice,
+    const UsdStageWeakPtr& sender);
+  bool _IsPathDirty(const SdfPath& path) const;
+
 private:
   Solver*                                                     _solver;
   _PrimMap                                                    _prims;
   _MaterialMap                                                _materials;
   _MaterialBindingMap                                         _materialBindings;
+
+  // dirty list
+  UsdStageWeakPtr                                             _stage;
+  TfNotice::Key                                               _objectsChangedKey;
+  std::mutex                                                  _dirtyLock;
+  _PathSet                                                    _dirtyPaths;
+  bool                                                        _allDirty;
+  std::vector<_Prim*>                                         _syncPrims;
 };
 
 
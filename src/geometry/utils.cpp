@@ -1,3 +1,5 @@
+#include <algorithm>
+#include <pxr/base/work/loops.h>
 #include "../geometry/utils.h"
 #include <pxr/base/gf/matrix4f.h>
 #include <pxr/base/gf/plane.h>
@@ -230,6 +232,27 @@ ComputeTriangleNormals( const VtArray<GfVec3f>& positions,
   }
 }
 
+void
+TransformPoints(const GfMatrix4d& matrix, const GfVec3f* src, GfVec3f* dst, size_t n)
+{
+  static const size_t BLOCK_SIZE = 4096;
+
+  // rows of the affine part, the projective column is ignored
+  const GfMatrix4f m(matrix);
+  const GfVec3f x(m[0][0], m[0][1], m[0][2]);
+  const GfVec3f y(m[1][0], m[1][1], m[1][2]);
+  const GfVec3f z(m[2][0], m[2][1], m[2][2]);
+  const GfVec3f t(m[3][0], m[3][1], m[3][2]);
+
+  WorkParallelForN((n + BLOCK_SIZE - 1) / BLOCK_SIZE, [&](size_t begin, size_t end) {
+    const size_t last = std::min(end * BLOCK_SIZE, n);
+    for(size_t p = begin * BLOCK_SIZE; p < last; ++p) {
+      const GfVec3f point = src[p];
+      dst[p] = x * point[0] + y * point[1] + z * point[2] + t;
+    }
+  });
+}
+
 void
 ComputeLineTangents(const GfVec3f* points, const GfVec3f* ups,
   GfVec3f* tangents, size_t numPoints)
@@ -7,6 +7,7 @@
 #include <pxr/base/gf/vec3f.h>
 #include <pxr/base/gf/vec3d.h>
 #include <pxr/base/gf/matrix4f.h>
+#include <pxr/base/gf/matrix4d.h>
 #include <pxr/base/gf/plane.h>
 #include <pxr/base/gf/line.h>
 #include <pxr/usd/sdf/path.h>
@@ -127,6 +128,11 @@ void
 ComputeTriangleNormals( const VtArray<GfVec3f>& positions,
                         const VtArray<Triangle>& triangles,
                         VtArray<GfVec3f>& normals);
+
+/// Transform points by an affine matrix, dst may alias src
+/// Runs in parallel blocks of plain float math the compiler vectorizes
+void
+TransformPoints(const GfMatrix4d& matrix, const GfVec3f* src, GfVec3f* dst, size_t n);
                           
 /// Triangulate data
 /// No checks are made on data type or array bounds
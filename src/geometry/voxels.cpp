@@ -72,8 +72,10 @@ void Voxels::Init(Deformable* geometry, float radius)
 }
 
 // trace voxel grid (axis direction)
+// one ray per column traced by waves of batched raycasts, columns whose ray
+// hit the geometry restart past the hit in the next wave
 //--------------------------------------------------------------------------------
-void Voxels::_TraceWork(const size_t begin, const size_t end, short axis)
+void Voxels::Trace(short axis)
 {
   GfBBox3d bbox = _geometry->GetBoundingBox(true);
   const GfRange3d range(bbox.GetRange());
@@ -82,89 +84,93 @@ void Voxels::_TraceWork(const size_t begin, const size_t end, short axis)
 
   // this is the bias we apply to step 'off' a triangle we hit, not very robust
   const float eps = 0.000001f * size[axis];
-  uint32_t x = begin;
+  const size_t numX = _resolution[(axis + 1) % 3];
+  const size_t numY = _resolution[(axis + 2) % 3];
+  const size_t numColumns = numX * numY;
+
+  GfVec3f rayDir(0.f);
+  rayDir[axis] = 1.f;
+
+  std::vector<GfVec3f> rayStarts(numColumns, minExtents);
+  std::vector<uint8_t> inside(numColumns, 0);
+  std::vector<size_t> active(numColumns);
+  for (size_t column = 0; column < numColumns; ++column) {
+    rayStarts[column][(axis + 1) % 3] += (column / numY + 0.5f) * _radius;
+    rayStarts[column][(axis + 2) % 3] += (column % numY + 0.5f) * _radius;
+    active[column] = column;
+  }
 
-  for (uint32_t y = 0; y < _resolution[(axis + 2) % 3]; ++y)
+  std::vector<GfRay> rays;
+  std::vector<Location> hits;
+  while (active.size())
   {
-    bool inside = false;
-
-    GfVec3f rayDir(0.f);
-    rayDir[axis] = 1.f;
-
-    GfVec3f rayStart = minExtents;
-    rayStart[(axis + 1) % 3] += (x + 0.5f) * _radius;
-    rayStart[(axis + 2) % 3] += (y + 0.5f) * _radius;
-
-    while (true)
-    {
-      // calculate ray start
-      Location hit;
-      double minDistance = DBL_MAX;
-      if (_bvh.Raycast(GfRay(rayStart, rayDir), &hit, DBL_MAX, &minDistance))
-      {
+    const size_t numRays = active.size();
+    rays.resize(numRays);
+    for (size_t r = 0; r < numRays; ++r)
+      rays[r] = GfRay(rayStarts[active[r]], rayDir);
+    hits.assign(numRays, Location());
+
+    _bvh.RaycastBatch(rays.data(), numRays, hits.data());
+
+    WorkParallelForN(numRays, [&](size_t begin, size_t end) {
+      for (size_t r = begin; r < end; ++r) {
+        if (!hits[r].IsValid()) continue;
+
         // calculate cell in which intersection occurred
-        const float zpos = rayStart[axis] + hit.GetDistance() * rayDir[axis];
+        const size_t column = active[r];
+        GfVec3f& rayStart = rayStarts[column];
+        const float zpos = rayStart[axis] + hits[r].GetDistance() * rayDir[axis];
         const float zhit = (zpos - minExtents[axis]) / _radius;
 
         uint32_t z = uint32_t(floorf((rayStart[axis] - minExtents[axis]) / _radius + 0.5f));
         uint32_t zend = std::min(uint32_t(floorf(zhit + 0.5f)), uint32_t(_resolution[axis] - 1));
 
-        if (inside)
+        if (inside[column])
         {
           // march along column setting bits 
           for (uint32_t k = z; k < zend; ++k)
-            _data[_ComputeFlatIndex(x, y, k, axis)] += 1;
+            _data[_ComputeFlatIndex(column / numY, column % numY, k, axis)] += 1;
         }
 
-        inside = !inside;
+        inside[column] = !inside[column];
 
-        rayStart += rayDir * (hit.GetDistance() + eps);
-
-      }
-      else {
-        break;
+        rayStart += rayDir * (hits[r].GetDistance() + eps);
       }
-    }
-  }
-}
+    });
 
-void Voxels::Trace(short axis)
-{
-  WorkParallelForN(
-    _resolution[(axis + 1) % 3], std::bind(
-      &Voxels::_TraceWork, 
-      this, 
-      std::placeholders::_1,     // begin
-      std::placeholders::_2,     // end)
-      axis
-    ), 1); // grain size fixed to 1 eliminating one nested loop  
+    size_t numActive = 0;
+    for (size_t r = 0; r < numRays; ++r)
+      if (hits[r].IsValid()) active[numActive++] = active[r];
+    active.resize(numActive);
+  }
 }
 
-// closest point query voxel grid
+// closest point query voxel grid, batched by slabs of cells
 //--------------------------------------------------------------------------------
-void Voxels::_ProximityWork(size_t begin, size_t end)
+void Voxels::Proximity()
 {
-  const GfVec3f* points = _geometry->GetPositionsCPtr();
   const float threshold = 0.5f * _radius;
-
-  for (size_t cell = begin; cell < end; ++cell) {
-    const GfVec3f point = GetCellPosition(cell);
-    Location hit;
-    if(_bvh.Closest(point, &hit, threshold))
-      _data[cell] += 3;
+  const size_t numCells = GetNumCells();
+
+  std::vector<GfVec3f> points;
+  std::vector<Location> hits;
+  for (size_t first = 0; first < numCells; first += PROXIMITY_BATCH_SIZE) {
+    const size_t numPoints = std::min(size_t(PROXIMITY_BATCH_SIZE), numCells - first);
+    points.resize(numPoints);
+    WorkParallelForN(numPoints, [&](size_t begin, size_t end) {
+      for (size_t p = begin; p < end; ++p)
+        points[p] = GetCellPosition(first + p);
+    });
+    hits.assign(numPoints, Location());
+
+    _bvh.ClosestBatch(points.data(), numPoints, hits.data(), threshold);
+
+    for (size_t p = 0; p < numPoints; ++p)
+      if (hits[p].IsValid())
+        _data[first + p] += 3;
   }
 }
 
-void Voxels::Proximity()
-{
-  WorkParallelForN(GetNumCells(), std::bind(
-    &Voxels::_ProximityWork, 
-    this,
-    std::placeholders::_1,     // begin
-    std::placeholders::_2      // end
-  ), 32);
-}
-
 GfVec3f Voxels::GetCellPosition(size_t cellIdx)
 {
   const GfRange3d range(_geometry->GetBoundingBox(true).GetRange());
@@ -5,7 +5,7 @@
 #include <pxr/base/gf/vec3i.h>
 #include <pxr/base/vt/array.h>
 #include "../common.h"
-#include "../acceleration/bvh.h"
+#include "../acceleration/wideBvh.h"
 #include "../geometry/deformable.h"
 
 JVR_NAMESPACE_OPEN_SCOPE
@@ -22,8 +22,8 @@ public:
 
   size_t GetNumCells();
   GfVec3f GetCellPosition(size_t cellIdx);
-  BVH* GetTree() { return &_bvh; };
-  const BVH* GetTree() const { return &_bvh; };
+  BVH* GetTree() { return _bvh.GetTree(); };
+  const BVH* GetTree() const { return _bvh.GetTree(); };
 
   float GetRadius() { return _radius; };
 
@@ -38,8 +38,8 @@ public:
   };
 
 private:
-  void _TraceWork(const size_t begin, const size_t end, short axis);
-  void _ProximityWork(size_t begin, size_t end);
+  static const size_t PROXIMITY_BATCH_SIZE = 65536;
+
   size_t _ComputeFlatIndex(size_t x, size_t y, size_t z, short axis);
 
   DirtyState _Sync(const GfMatrix4d& matrix, 
@@ -50,7 +50,7 @@ private:
   GfVec3i            _resolution;
   std::vector<uint8_t>    _data;
   Deformable*             _geometry;
-  BVH                     _bvh;
+  BVH4                    _bvh;
   float                   _radius;
 };
 
@@ -1,3 +1,4 @@
+#include <cstring>
 
 #include <pxr/base/work/loops.h>
 
@@ -21,7 +22,54 @@ JVR_NAMESPACE_OPEN_SCOPE
 
 const size_t Collision::PACKET_SIZE = 64;
 const float Collision::TOLERANCE_MARGIN = 0.01f;
+const float Collision::PERSISTENCE_COSINE = 0.9f;
 
+Collision::~Collision()
+{
+  for(auto& constraint: _constraints)
+    delete constraint;
+  for(auto& constraint: _contactConstraints)
+    delete constraint;
+}
+
+CollisionConstraint* 
+Collision::_CreateConstraint(Body* body, const VtArray<int>& elements)
+{
+  return new CollisionConstraint(body, this, elements, _stiffness, _damp);
+}
+
+CollisionConstraint* 
+Collision::_UseConstraint(Body* body, const VtArray<int>& elements)
+{
+  if(_numConstraintsUsed < _constraints.size()) {
+    CollisionConstraint* constraint = _constraints[_numConstraintsUsed++];
+    constraint->SetElements(elements);
+    constraint->SetStiffness(_stiffness);
+    constraint->SetDamp(_damp);
+    return constraint;
+  }
+  _constraints.push_back(_CreateConstraint(body, elements));
+  _numConstraintsUsed = _constraints.size();
+  return _constraints.back();
+}
+
+ContactConstraint* 
+Collision::_UseContactConstraint(Body* body, const VtArray<int>& elements, 
+  const VtArray<Contact*>& contacts)
+{
+  if(_numContactConstraintsUsed < _contactConstraints.size()) {
+    ContactConstraint* constraint = _contactConstraints[_numContactConstraintsUsed++];
+    constraint->SetElements(elements);
+    constraint->SetContacts(contacts);
+    constraint->SetStiffness(_stiffness);
+    constraint->SetDamp(_damp);
+    return constraint;
+  }
+  _contactConstraints.push_back(
+    new ContactConstraint(body, elements, this, contacts, _stiffness, _damp));
+  _numContactConstraintsUsed = _contactConstraints.size();
+  return _contactConstraints.back();
+}
 
 void Collision::Reset()
 {
@@ -110,12 +158,22 @@ void Collision::FindContacts(Particles* particles, const std::vector<Body*>& bod
   _BuildContacts(particles, bodies, constraints, ft);
 }
 
+// the multiplier of a contact is kept if the particle touched the same 
+// component of this collider last frame with a close enough normal
 void Collision::StoreContactsLocation(Particles* particles, int* elements, size_t n, float ft)
 {
   for (size_t elemIdx = 0; elemIdx < n; ++elemIdx) {
     const size_t index = elements[elemIdx];
-    _StoreContactLocation(particles, index, _contacts.Use(index), ft);
-    
+    const bool persistent = _contacts.WasUsed(index);
+    Contact* contact = _contacts.Use(index);
+    const int component = contact->GetComponentIndex();
+    const GfVec3f normal = contact->GetNormal();
+
+    _StoreContactLocation(particles, index, contact, ft);
+
+    if(!persistent || contact->GetComponentIndex() != component ||
+      GfDot(normal, contact->GetNormal()) < PERSISTENCE_COSINE)
+      contact->SetLambda(0.f);
   }
 }
 
@@ -130,7 +188,9 @@ void Collision::_ResetContacts(Particles* particles)
   _c2p.reserve(numParticles);
 
   _contacts.Resize(numParticles, 1);
-  _contacts.ResetAllUsed();
+  _contacts.Persist();
+  _numConstraintsUsed = 0;
+  _numContactConstraintsUsed = 0;
 
 }
 
@@ -153,7 +213,7 @@ void Collision::_BuildContacts(Particles* particles, const std::vector<Body*>& b
       _c2p.push_back(index);
       if (particles->body[index] != currentBody || elements.size() >= Constraint::BlockSize) {
         if (elements.size()) {
-          constraint = new CollisionConstraint(currentBody, this, elements, _stiffness, _damp);
+          constraint = _UseConstraint(currentBody, elements);
           StoreContactsLocation(particles, & elements[0], elements.size(), ft);
           constraints.push_back(constraint);
           elements.clear();
@@ -165,7 +225,7 @@ void Collision::_BuildContacts(Particles* particles, const std::vector<Body*>& b
   } 
   
   if (elements.size()) {
-    constraint = new CollisionConstraint(currentBody, this, elements);
+    constraint = _UseConstraint(currentBody, elements);
     StoreContactsLocation(particles, & elements[0], elements.size(), ft);
     constraints.push_back(constraint);
   }
@@ -175,6 +235,7 @@ void Collision::_FindContacts(Particles* particles, size_t begin, size_t end, fl
 {
   Mask::Iterator iterator(this, begin, end);
   for (size_t index = iterator.Begin(); index != Mask::INVALID_INDEX; index = iterator.Next()) {
+    if(particles->state[index] == Particles::IDLE)continue;
     _FindContact(particles, index, ft);
   }
 }
@@ -183,7 +244,7 @@ void
 Collision::CreateContactConstraints(Particles* particles, const std::vector<Body*>& bodies,
     std::vector<Constraint*>& constraints)
 {
-  Constraint* constraint = nullptr;
+  ContactConstraint* constraint = nullptr;
   if(_contacts.GetTotalNumUsed()) {
     if(GetTypeId() == Collision::MESH) {
       const Mesh* mesh = (const Mesh*)_collider;
@@ -213,7 +274,7 @@ Collision::CreateContactConstraints(Particles* particles, const std::vector<Body
 
         if ((elements.size() >= Constraint::BlockSize) || iterator.End()) {
           if (elements.size()) {
-            constraint = new ContactConstraint(particles->body[index], elements, this, contacts, _stiffness, _damp);
+            constraint = _UseContactConstraint(particles->body[index], elements, contacts);
             constraints.push_back(constraint);
             elements.clear();
             contacts.clear();
@@ -245,7 +306,7 @@ Collision::CreateContactConstraints(Particles* particles, const std::vector<Body
     
     if ((elements.size() >= Constraint::BlockSize) || iterator.End()) {
       if (elements.size()) {
-        constraint = new CollisionConstraint(particles, this, elements);
+        constraint = _UseConstraint(NULL, elements);
         constraints.push_back(constraint);
         elements.clear();
       } 
@@ -322,6 +383,16 @@ float Collision::GetContactInitDepth(size_t index, size_t c) const
   return _contacts.Get(index, c)->GetInitDepth();
 }
 
+float Collision::GetContactLambda(size_t index, size_t c) const
+{
+  return _contacts.Get(index, c)->GetLambda();
+}
+
+void Collision::SetContactLambda(size_t index, float lambda, size_t c)
+{
+  _contacts.Get(index, c)->SetLambda(lambda);
+}
+
 void Collision::SetContactTouching(size_t index, bool touching, size_t c)
 {
   _contacts.Get(index, c)->SetTouching(touching);
@@ -669,6 +740,10 @@ size_t MeshCollision::TYPE_ID = Collision::MESH;
 MeshCollision::MeshCollision(Geometry* collider, const SdfPath& path, 
   float restitution, float friction)
   : Collision(collider, path, restitution, friction)
+  , _continuous(false)
+  , _maxDisplacement(0.f)
+  , _useDistanceField(false)
+  , _voxelSize(0.f)
 {
   _CreateAccelerationStructure();
 }
@@ -696,9 +771,197 @@ void MeshCollision::_CreateAccelerationStructure()
 
 void MeshCollision::_UpdateAccelerationStructure()
 {
-  _bvh.Update();
+  // refit every frame, rebuild once the deformation degraded the tree
+  _bvh.Refit();
+  if(_bvh.GetRebuildRatio() > 0.f && _bvh.GetCostRatio() > _bvh.GetRebuildRatio())
+    _bvh.Rebuild();
+
+  Mesh* mesh = (Mesh*)_collider;
+
+  // the field lives in local space, only deformation invalidates it
+  // (same test Mesh::_Sync flags DEFORM with)
+  if(_useDistanceField && !mesh->GetPrevious().IsIdentical(mesh->GetPositions()) &&
+    (mesh->GetPrevious().size() != mesh->GetNumPoints() ||
+    memcmp(mesh->GetPreviousCPtr(), mesh->GetPositionsCPtr(), mesh->GetNumPoints() * sizeof(GfVec3f))))
+    _BuildDistanceField();
+
+  _maxDisplacement = 0.f;
+  if(!_continuous) return;
+
+  if(mesh->GetPrevious().size() != mesh->GetNumPoints()) return;
+
+  const GfVec3f* positions = mesh->GetPositionsCPtr();
+  const GfVec3f* previous = mesh->GetPreviousCPtr();
+  const GfMatrix4d& matrix = mesh->GetMatrix();
+  float maxDisplacementSq = 0.f;
+  for(size_t p = 0; p < mesh->GetNumPoints(); ++p)
+    maxDisplacementSq = GfMax(maxDisplacementSq, 
+      GfVec3f(matrix.TransformDir(positions[p] - previous[p])).GetLengthSq());
+  _maxDisplacement = std::sqrt(maxDisplacementSq);
 } 
 
+void MeshCollision::SetUseDistanceField(bool use, float voxelSize)
+{
+  _useDistanceField = use;
+  _voxelSize = voxelSize;
+  if(_useDistanceField) _BuildDistanceField();
+  else _distanceField.Clear();
+}
+
+void MeshCollision::_BuildDistanceField()
+{
+  static const float MAX_RESOLUTION = 256.f;
+
+  Mesh* mesh = (Mesh*)_collider;
+  float voxelSize = _voxelSize;
+  if(voxelSize <= 0.f && mesh->GetNumTriangles()) {
+    const GfVec3f* positions = mesh->GetPositionsCPtr();
+    double sum = 0.0;
+    for(size_t t = 0; t < mesh->GetNumTriangles(); ++t) {
+      const Triangle* triangle = mesh->GetTriangle(t);
+      for(size_t e = 0; e < 3; ++e)
+        sum += (positions[triangle->vertices[(e + 1) % 3]] - 
+          positions[triangle->vertices[e]]).GetLength();
+    }
+    voxelSize = sum / (3.0 * mesh->GetNumTriangles());
+  }
+  // bound the memory on dense meshes
+  const float diagonal = mesh->GetBoundingBox(false).GetRange().GetSize().GetLength();
+  _distanceField.Init(mesh, GfMax(voxelSize, diagonal / MAX_RESOLUTION));
+}
+
+// uniform scale of the collider matrix
+static float
+_GetUniformScale(const GfMatrix4d& matrix)
+{
+  return matrix.TransformDir(GfVec3d(1.0, 0.0, 0.0)).GetLength();
+}
+
+// world space distance and normalized gradient from the field
+bool MeshCollision::_SampleDistanceField(const GfVec3f& point, float* distance, 
+  GfVec3f* gradient) const
+{
+  if(!_useDistanceField) return false;
+
+  const GfVec3f local(_collider->GetInverseMatrix().Transform(point));
+  GfVec3f localGradient;
+  if(!_distanceField.Sample(local, distance, gradient ? &localGradient : NULL))
+    return false;
+
+  const GfMatrix4d& matrix = _collider->GetMatrix();
+  *distance *= _GetUniformScale(matrix);
+  if(gradient)
+    *gradient = GfVec3f(matrix.TransformDir(localGradient)).GetNormalized();
+  return true;
+}
+
+// signed distance of p to the plane of triangle a moving along da at time t
+static float 
+_SweptPlaneDistance(const GfVec3f& p, const GfVec3f* a, const GfVec3f* da, float t)
+{
+  const GfVec3f a0 = a[0] + da[0] * t;
+  const GfVec3f normal = ((a[1] + da[1] * t - a0) ^ (a[2] + da[2] * t - a0)).GetNormalized();
+  return GfDot(normal, p - a0);
+}
+
+// particle moving from p along d against triangle a moving along da, both over
+// a normalized time, the particle must enter the radius shell from the front side,
+// time of impact is refined by bisection of the plane distance sign change
+static bool
+_SweepTriangle(const GfVec3f& p, const GfVec3f& d, const GfVec3f* a, const GfVec3f* da,
+  float radius, float maxToi, float* toi, GfVec3f* coords)
+{
+  static const size_t NUM_ITERATIONS = 12;
+  static const float TOLERANCE = 1e-3f;
+
+  float lo = 0.f, hi = maxToi;
+  if(_SweptPlaneDistance(p, a, da, lo) < radius) return false;
+  if(_SweptPlaneDistance(p + d * hi, a, da, hi) > radius) return false;
+
+  for(size_t i = 0; i < NUM_ITERATIONS; ++i) {
+    const float t = (lo + hi) * 0.5f;
+    if(_SweptPlaneDistance(p + d * t, a, da, t) > radius) lo = t;
+    else hi = t;
+  }
+
+  // barycentric coordinates of the particle on the triangle at impact time
+  const GfVec3f a0 = a[0] + da[0] * hi;
+  const GfVec3f e0 = a[1] + da[1] * hi - a0;
+  const GfVec3f e1 = a[2] + da[2] * hi - a0;
+  const GfVec3f v = p + d * hi - a0;
+  const float d00 = GfDot(e0, e0);
+  const float d01 = GfDot(e0, e1);
+  const float d11 = GfDot(e1, e1);
+  const float d20 = GfDot(v, e0);
+  const float d21 = GfDot(v, e1);
+  const float denom = d00 * d11 - d01 * d01;
+  if(denom < 1e-12f) return false;
+
+  const float u = (d11 * d20 - d01 * d21) / denom;
+  const float w = (d00 * d21 - d01 * d20) / denom;
+  if(u < -TOLERANCE || w < -TOLERANCE || u + w > 1.f + TOLERANCE) return false;
+
+  const float cu = GfClamp(u, 0.f, 1.f);
+  const float cw = GfClamp(w, 0.f, 1.f - cu);
+  *toi = hi;
+  *coords = GfVec3f(1.f - cu - cw, cu, cw);
+  return true;
+}
+
+bool MeshCollision::_FindContinuousContact(Particles* particles, size_t index, float ft)
+{
+  Mesh* mesh = (Mesh*)_collider;
+  const GfVec3f* positions = mesh->GetPositionsCPtr();
+  const GfVec3f* previous = mesh->GetPrevious().size() == mesh->GetNumPoints() ?
+    mesh->GetPreviousCPtr() : positions;
+  const GfMatrix4d& matrix = mesh->GetMatrix();
+
+  const float radius = particles->radius[index];
+  const GfVec3f start = particles->predicted[index];
+  const GfVec3f displacement = particles->velocity[index] * ft;
+
+  // swept particle box grown by the collider motion
+  GfRange3d swept;
+  swept.UnionWith(GfVec3d(start));
+  swept.UnionWith(GfVec3d(start + displacement));
+  const GfVec3d extent(radius + _margin + _maxDisplacement);
+  swept.SetMin(swept.GetMin() - extent);
+  swept.SetMax(swept.GetMax() + extent);
+
+  // candidates buffer is reused by every query running on the same thread
+  static thread_local std::vector<const BVH::Cell*> leaves;
+  leaves.clear();
+  _bvh.Overlap(swept, leaves);
+
+  // triangles move from their previous to their current positions
+  float toi = 1.f;
+  GfVec3f coords;
+  const Triangle* hit = nullptr;
+  GfVec3f a[3], da[3];
+  for(const BVH::Cell* leaf: leaves) {
+    const TrianglePair* pair = (const TrianglePair*)leaf->GetData();
+    for(const Triangle* triangle: {pair->left, pair->right}) {
+      if(!triangle) continue;
+      for(size_t v = 0; v < 3; ++v) {
+        const int vertex = triangle->vertices[v];
+        a[v] = GfVec3f(matrix.Transform(previous[vertex]));
+        da[v] = GfVec3f(matrix.TransformDir(positions[vertex] - previous[vertex]));
+      }
+      if(_SweepTriangle(start, displacement, a, da, radius, toi, &toi, &coords))
+        hit = triangle;
+    }
+  }
+
+  if(!hit) return false;
+
+  Location& location = _closest[index];
+  location.SetGeometryIndex(0);
+  location.SetComponentIndex(hit->id);
+  location.SetCoordinates(GfVec3d(coords));
+  location.SetPoint(GfVec3d(location.ComputePosition(positions, &hit->vertices[0], 3, &matrix)));
+  return true;
+}
+
 
 void MeshCollision::_FindContact(Particles* particles, size_t index, float ft)
 {
@@ -709,6 +972,30 @@ void MeshCollision::_FindContact(Particles* particles, size_t index, float ft)
   const GfVec3f predicted = particles->predicted[index] + particles->velocity[index] * ft;
   const float maxDistance = particles->velocity[index].GetLength() * ft + particles->radius[index] + _margin;
 
+  // fast particles could tunnel through thin parts of the collider
+  if(_continuous && particles->velocity[index].GetLength() * ft > particles->radius[index] &&
+    _FindContinuousContact(particles, index, ft)) {
+    SetHit(index, true);
+    return;
+  }
+
+  // far particles are rejected by the field without touching the bvh, outside
+  // the field bounds the distance is at least the band width
+  if(_useDistanceField && _distanceField.IsValid()) {
+    const float threshold = maxDistance * 4.f;
+    const float scale = _GetUniformScale(mesh->GetMatrix());
+    const GfVec3f local(mesh->GetInverseMatrix().Transform(predicted));
+    float distance;
+    const bool far = _distanceField.Sample(local, &distance) ? 
+      distance * scale > threshold :
+      !_distanceField.GetRange().Contains(local) && 
+        _distanceField.GetBandWidth() * scale > threshold;
+    if(far) {
+      SetHit(index, false);
+      return;
+    }
+  }
+
   if(_bvh.Closest(predicted, &_closest[index], maxDistance * 4.f)) {
 
     const Triangle* triangle = mesh->GetTriangle(_closest[index].GetComponentIndex());
@@ -755,6 +1042,10 @@ void MeshCollision::_StoreContactLocation(Particles* particles, int index, Conta
 float 
 MeshCollision::GetValue(Particles* particles, size_t index)
 {
+  float distance;
+  if(_SampleDistanceField(particles->predicted[index], &distance, NULL))
+    return distance - particles->radius[index];
+
   Mesh* mesh = (Mesh*)GetGeometry();
   const GfVec3f* positions = mesh->GetPositionsCPtr();
   const GfVec3f* normals = mesh->GetNormalsCPtr();
@@ -774,6 +1065,11 @@ MeshCollision::GetValue(Particles* particles, size_t index)
 GfVec3f 
 MeshCollision::GetGradient(Particles* particles, size_t index)
 {
+  float distance;
+  GfVec3f gradient;
+  if(_SampleDistanceField(particles->predicted[index], &distance, &gradient))
+    return gradient;
+
   if(!_closest[index].IsValid())return GfVec3f(0.f);
   Mesh* mesh = (Mesh*)GetGeometry();
   const GfVec3f* normals = mesh->GetNormalsCPtr();
@@ -904,6 +1200,12 @@ SelfCollision::~SelfCollision()
   
 }
 
+CollisionConstraint* 
+SelfCollision::_CreateConstraint(Body* body, const VtArray<int>& elements)
+{
+  return new CollisionConstraint(_particles, this, elements, _stiffness, _damp);
+}
+
 void SelfCollision::_UpdateParameters(const UsdPrim& prim, double time)
 {
   UsdPbdCollisionAPI api(prim);
@@ -986,6 +1288,8 @@ void SelfCollision::_ResetContacts(Particles* particles)
 
   _contacts.Resize(numParticles, PARTICLE_MAX_CONTACTS);
   _contacts.ResetAllUsed();
+  _numConstraintsUsed = 0;
+  _numContactConstraintsUsed = 0;
 
 }
 
@@ -993,26 +1297,28 @@ void SelfCollision::_FindContacts(Particles* particles, size_t begin, size_t end
 {
   Mask::Iterator iterator(this, begin, end);
   for (size_t index = iterator.Begin(); index != Mask::INVALID_INDEX; index = iterator.Next()) {
+    if(particles->state[index] == Particles::IDLE)continue;
     _FindContact(particles, index, ft);
   }
 }
 
 void SelfCollision::_FindContact(Particles* particles, size_t index, float ft)
 {
-  std::vector<int> closests;
-
   Body* body = particles->body[index];
   if(!body->GetSelfCollisionEnabled())return;
   const float radiusMultiplier = body->GetSelfCollisionRadius();
   size_t numCollide = 0;
-  _grid.Closests(index, &particles->predicted[0], /*&particles->velocity[0], ft,*/
-    closests,  2.f * ( particles->radius[index] * radiusMultiplier + TOLERANCE_MARGIN));
-  for(int closest: closests) {
-    if(numCollide >= PARTICLE_MAX_CONTACTS)break;
 
-    Body* other = particles->body[closest];
-    if(other != body) continue;
-    if(_AreConnected(index, closest))continue;
+  // other bodies and connected particles are filtered before counting as candidates
+  int closests[MAX_CANDIDATES];
+  const size_t numClosests = _grid.Closests(index, &particles->predicted[0], 
+    closests, MAX_CANDIDATES, 2.f * ( particles->radius[index] * radiusMultiplier + TOLERANCE_MARGIN),
+    [&](int closest) {
+      return particles->body[closest] == body && !_AreConnected(index, closest);
+    });
+  for(size_t c = 0; c < numClosests; ++c) {
+    if(numCollide >= PARTICLE_MAX_CONTACTS)break;
+    const int closest = closests[c];
 
     GfVec3f ip(particles->position[index] + particles->velocity[index] * ft);
     GfVec3f cp(particles->position[closest] + particles->velocity[closest] * ft);
@@ -1069,7 +1375,7 @@ void SelfCollision::_BuildContacts(Particles* particles, const std::vector<Body*
     
     if ((elements.size() >= Constraint::BlockSize) || iterator.End()) {
       if (elements.size()) {
-        constraint = new CollisionConstraint(particles, this, elements);
+        constraint = _UseConstraint(NULL, elements);
         constraints.push_back(constraint);
         elements.clear();
       } 
@@ -1127,10 +1433,11 @@ SelfCollision::_ComputeNeighbors(const std::vector<Body*> &bodies)
         for (size_t p = 0; p < numPoints; ++p) {
           size_t numNeighbors = mesh->GetNumNeighbors(p);
           for (size_t n = 0; n < numNeighbors; ++n)
-            _neighbors.push_back(offset + mesh->GetNeighbor(p, n));
+            _neighbors.push_back(offset + bodies[b]->GetParticle(mesh->GetNeighbor(p, n)));
       
-          _neighborsCounts[offset + p] = numNeighbors;
-          _neighborsOffsets[offset + p] = neighborsOffset;
+          const size_t particle = offset + bodies[b]->GetParticle(p);
+          _neighborsCounts[particle] = numNeighbors;
+          _neighborsOffsets[particle] = neighborsOffset;
           neighborsOffset += numNeighbors;
         }
         break;
@@ -8,6 +8,7 @@
 #include "../common.h"
 #include "../acceleration/hashGrid.h"
 #include "../acceleration/bvh.h"
+#include "../acceleration/distanceField.h"
 #include "../pbd/contact.h"
 #include "../pbd/mask.h"
 
@@ -19,6 +20,7 @@ struct Particles;
 struct Body;
 class Constraint;
 class CollisionConstraint;
+class ContactConstraint;
 class Points;
 class Solver;
 class HashGrid;
@@ -29,6 +31,7 @@ class Collision : public Mask
 public:
 
   static const float TOLERANCE_MARGIN;
+  static const float PERSISTENCE_COSINE;
 
   enum Type {
     PLANE = 1,
@@ -42,6 +45,8 @@ public:
   Collision(Geometry* collider, const SdfPath& path, 
     float restitution=0.5f, float friction=0.5f) 
     : Mask(Element::COLLISION)
+    , _numConstraintsUsed(0)
+    , _numContactConstraintsUsed(0)
     , _collider(collider)
     , _restitution(restitution)
     , _friction(friction){};
@@ -50,7 +55,7 @@ public:
   void AddBody(Particles* particles, Body* body);
   void RemoveBody(Particles* particles, Body* body);
   */
-  virtual ~Collision() {};
+  virtual ~Collision();
   virtual size_t GetTypeId() const override = 0; // pure virtual
 
   virtual void Init(size_t numParticles);
@@ -72,6 +77,8 @@ public:
   virtual float GetContactDepth(size_t index, size_t c=0) const;
   virtual float GetContactInitDepth(size_t index, size_t c=0) const;
   virtual float GetMaxSeparationVelocity() const {return _maxSeparationVelocity;};
+  virtual float GetContactLambda(size_t index, size_t c=0) const;
+  virtual void SetContactLambda(size_t index, float lambda, size_t c=0);
 
   virtual void SetContactTouching(size_t index, bool touching, size_t c=0);
   virtual bool IsContactTouching(size_t index, size_t c=0) const;
@@ -123,11 +130,21 @@ protected:
   virtual void _FindContact(Particles* particles, size_t index, float ft) = 0; // pure virtual
   virtual void _StoreContactLocation(Particles* particles, int elem, Contact* contact, float ft){};
 
+  // contact constraints are pooled and reused from frame to frame
+  virtual CollisionConstraint* _CreateConstraint(Body* body, const VtArray<int>& elements);
+  CollisionConstraint* _UseConstraint(Body* body, const VtArray<int>& elements);
+  ContactConstraint* _UseContactConstraint(Body* body, const VtArray<int>& elements,
+    const VtArray<Contact*>& contacts);
+
   // hits encode vertex hit in the int list bits
   VtArray<int>                 _hits;
   std::vector<int>                  _c2p;
   size_t                            _numParticles;
   Contacts                          _contacts;
+  std::vector<CollisionConstraint*> _constraints;
+  size_t                            _numConstraintsUsed;
+  std::vector<ContactConstraint*>   _contactConstraints;
+  size_t                            _numContactConstraintsUsed;
 
   bool                              _enabled;
   float                             _restitution;
@@ -252,6 +269,21 @@ public:
   GfVec3f GetVelocity(Particles* particles, size_t index) override;
   void Update(const UsdPrim& prim, double time) override;
 
+  // continuous collision for particles travelling further than their radius
+  void SetContinuous(bool continuous){_continuous = continuous;};
+  bool GetContinuous() const {return _continuous;};
+
+  // bvh rebuild threshold on the surface area heuristic cost ratio, 0 only refits
+  void SetRebuildRatio(float ratio){_bvh.SetRebuildRatio(ratio);};
+  float GetRebuildRatio() const {return _bvh.GetRebuildRatio();};
+
+  // signed distance field baked in the collider local space, value and gradient
+  // become trilinear lookups, rebuilt only when the collider deforms so it
+  // suits rigid colliders, voxel size 0 uses the mean edge length
+  void SetUseDistanceField(bool use, float voxelSize=0.f);
+  bool GetUseDistanceField() const {return _useDistanceField;};
+  const DistanceField& GetDistanceField() const {return _distanceField;};
+
   // for visual debugging
   void GetPoints(Particles* particles, VtArray<GfVec3f>& points,
     VtArray<float>& radius, VtArray<GfVec3f>& colors) override;
@@ -263,7 +295,10 @@ public:
 protected:
   void _CreateAccelerationStructure();
   void _UpdateAccelerationStructure();
+  void _BuildDistanceField();
+  bool _SampleDistanceField(const GfVec3f& point, float* distance, GfVec3f* gradient) const;
   void _FindContact(Particles* particles, size_t index, float ft) override;
+  bool _FindContinuousContact(Particles* particles, size_t index, float ft);
   void _StoreContactLocation(Particles* particles, int elem, Contact* contact, float ft) override;
   
 
@@ -271,6 +306,11 @@ private:
   static size_t                 TYPE_ID;
   BVH                           _bvh;
   std::vector<Location>         _closest;
+  bool                          _continuous;
+  float                         _maxDisplacement; // largest collider point motion over a frame
+  bool                          _useDistanceField;
+  float                         _voxelSize;
+  DistanceField                 _distanceField;
 };
 
 class SelfCollision : public Collision
@@ -298,6 +338,7 @@ public:
 
 protected:
   void _UpdateParameters( const UsdPrim& prim, double time) override;
+  CollisionConstraint* _CreateConstraint(Body* body, const VtArray<int>& elements) override;
   void _ComputeNeighbors(const std::vector<Body*>& bodies);
   void _UpdateAccelerationStructure();
   void _ResetContacts(Particles* particles) override;
@@ -313,6 +354,7 @@ protected:
 
 private:
   static size_t                     TYPE_ID;
+  static const size_t               MAX_CANDIDATES = 4 * PARTICLE_MAX_CONTACTS;
   HashGrid                          _grid;
   Particles*                        _particles;
 
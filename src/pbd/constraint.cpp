@@ -21,6 +21,7 @@ Constraint::Constraint(size_t elementSize, float stiffness,
   , _compliance(stiffness > 0.f ? 1.f / stiffness : 0.f)
   , _damp(damp)
   , _color(RANDOM_0_1, RANDOM_0_1, RANDOM_0_1)
+  , _graphColor(-1)
 {
   const size_t numElements = elems.size() / elementSize;
 
@@ -30,6 +31,7 @@ Constraint::Constraint(size_t elementSize, float stiffness,
 
 void Constraint::SetElements(const VtArray<int>& elems)
 {
+  _elements = elems;
   const size_t numElements = _elements.size() / GetElementSize();
   _correction.resize(elems.size());
   _gradient.resize(numElements+1);
@@ -75,56 +77,119 @@ void Constraint::Reset(Particles* particles)
 }
 
 
-ConstraintsGroup* CreateConstraintsGroup(Body* body, const TfToken& name, short type, 
-  const VtArray<int>& allElements, size_t elementSize, size_t blockSize, void* data)
+static Constraint* _CreateConstraint(Body* body, short type, const VtArray<int>& elements,
+  float stiffness, float damping, void* data)
 {
+  switch (type) {
+    case Constraint::ATTACH:
+      return new AttachConstraint(body, elements, stiffness, damping);
 
-  ConstraintsGroup* group = body->AddConstraintsGroup(name, type);
+    case Constraint::PIN:
+      return new PinConstraint(body, elements, (Geometry*)data, stiffness, damping);
 
-  size_t numElements = allElements.size();
-  size_t numBlocks = 0;
-  size_t first = 0;
-  size_t last = GfMin(blockSize * elementSize, numElements);
+    case Constraint::STRETCH: 
+      return new StretchConstraint(body, elements, stiffness, damping);
 
-  float stiffness = 100000.f;
-  float damping = 0.1;
+    case Constraint::SHEAR: 
+      return new ShearConstraint(body, elements, stiffness, damping);
 
-  Geometry* geometry = body->GetGeometry();
+    case Constraint::BEND:
+      return new BendConstraint(body, elements, stiffness, damping);
 
-  while(true) {
-    VtArray<int> blockElements(allElements.begin()+first, allElements.begin()+last);
-    switch (type) {
-      case Constraint::ATTACH:
-        group->constraints.push_back(new AttachConstraint(body, blockElements, stiffness, damping));
-        break;
+    case Constraint::DIHEDRAL:
+      return new DihedralConstraint(body, elements, stiffness, damping);
+  }
+  return NULL;
+}
 
-      case Constraint::PIN:
-        group->constraints.push_back(new PinConstraint(body, blockElements, (Geometry*)data, stiffness, damping));
-        break;
+// greedy graph coloring of the constraint elements :
+// elements sharing a particle never end up with the same color.
+// colored elements are written sorted by color, offsets store 
+// the start of each color in the sorted array (plus the end).
+static size_t _ColorElements(const VtArray<int>& allElements, size_t elementSize,
+  VtArray<int>& sorted, std::vector<size_t>& offsets)
+{
+  const size_t numElements = allElements.size() / elementSize;
+  int maxIndex = 0;
+  for(const auto& index: allElements)
+    maxIndex = GfMax(maxIndex, index);
+
+  std::vector<int> stamps(maxIndex + 1, -1);
+  std::vector<int> remaining(numElements);
+  std::vector<int> conflicting;
+  for(size_t elem = 0; elem < numElements; ++elem)
+    remaining[elem] = elem;
+
+  sorted.reserve(allElements.size());
+  offsets.clear();
+
+  int color = 0;
+  while(remaining.size()) {
+    offsets.push_back(sorted.size());
+    conflicting.clear();
+    for(const auto& elem: remaining) {
+      const int* indices = &allElements[elem * elementSize];
+      bool available = true;
+      for(size_t i = 0; i < elementSize; ++i)
+        if(stamps[indices[i]] == color) {available = false; break;}
+
+      if(!available) {
+        conflicting.push_back(elem);
+        continue;
+      }
+      for(size_t i = 0; i < elementSize; ++i) {
+        stamps[indices[i]] = color;
+        sorted.push_back(indices[i]);
+      }
+    }
+    std::swap(remaining, conflicting);
+    color++;
+  }
+  offsets.push_back(sorted.size());
+  return color;
+}
 
-      case Constraint::STRETCH: 
-        group->constraints.push_back(new StretchConstraint(body, blockElements, stiffness, damping));
-        break;
+ConstraintsGroup* CreateConstraintsGroup(Body* body, const TfToken& name, short type, 
+  const VtArray<int>& allElements, size_t elementSize, size_t blockSize, void* data)
+{
 
-      case Constraint::SHEAR: 
-        group->constraints.push_back(new ShearConstraint(body, blockElements, stiffness, damping));
-        break;
+  ConstraintsGroup* group = body->AddConstraintsGroup(name, type);
 
-      case Constraint::BEND:
-        group->constraints.push_back(new BendConstraint(body, blockElements, stiffness, damping));
-        break;
+  // elements come in geometry points order
+  VtArray<int> elements(allElements);
+  if(body->HasOrder()) {
+    const size_t offset = body->GetOffset();
+    for(auto& elem: elements)
+      elem = offset + body->GetParticle(elem - offset);
+  }
 
-      case Constraint::DIHEDRAL:
-        group->constraints.push_back(new DihedralConstraint(body, blockElements, stiffness, damping));
-        break;
+  float stiffness = 100000.f;
+  float damping = 0.1;
 
+  // blocks never straddle two colors so that every constraint 
+  // of a given color can be solved and applied concurrently,
+  // colors appended to an existing group follow its own ones
+  VtArray<int> sortedElements;
+  std::vector<size_t> colorOffsets;
+  const size_t numColors = _ColorElements(elements, elementSize, sortedElements, colorOffsets);
+
+  for(size_t color = 0; color < numColors; ++color) {
+    size_t first = colorOffsets[color];
+    const size_t end = colorOffsets[color + 1];
+
+    while(first < end) {
+      const size_t last = GfMin(first + blockSize * elementSize, end);
+      VtArray<int> blockElements(sortedElements.begin()+first, sortedElements.begin()+last);
+      Constraint* constraint = 
+        _CreateConstraint(body, type, blockElements, stiffness, damping, data);
+      if(!constraint)return group;
+
+      constraint->SetGraphColor(group->numColors + color);
+      group->constraints.push_back(constraint);
+      first = last;
     }
-    
-    first += blockSize * elementSize;
-    if(first >= numElements)break;
-    last = GfMin(last + blockSize * elementSize, numElements);
-    numBlocks++;
   }
+  group->numColors += numColors;
 
   return group;
 }
@@ -271,6 +336,102 @@ ConstraintsGroup* CreatePinConstraints(Body* body, Geometry* target, float stiff
 
 }
 
+//-----------------------------------------------------------------------------------------
+//   DISTANCE KERNEL (shared by stretch and bend constraints)
+//-----------------------------------------------------------------------------------------
+// endpoints and rest lengths are stored as structure of arrays on the
+// constraint, a block only gathers the particles into lanes and the solve
+// loop is branch free so the compiler can vectorize it for the target
+// instruction set (sse/avx on x86, neon on arm).
+void DistanceEndpoints::Set(const VtArray<int>& elements, size_t elementSize,
+  size_t firstOffset, size_t secondOffset)
+{
+  const size_t numElements = elements.size() / elementSize;
+  first.resize(numElements);
+  second.resize(numElements);
+  for(size_t elem = 0; elem < numElements; ++elem) {
+    first[elem] = elements[elem * elementSize + firstOffset];
+    second[elem] = elements[elem * elementSize + secondOffset];
+  }
+}
+
+struct _DistanceLanes {
+  float ax[Constraint::BlockSize], ay[Constraint::BlockSize], az[Constraint::BlockSize];
+  float bx[Constraint::BlockSize], by[Constraint::BlockSize], bz[Constraint::BlockSize];
+  float vx[Constraint::BlockSize], vy[Constraint::BlockSize], vz[Constraint::BlockSize];
+  float wa[Constraint::BlockSize], wb[Constraint::BlockSize];
+  float cx[Constraint::BlockSize], cy[Constraint::BlockSize], cz[Constraint::BlockSize];
+};
+
+// first and second are the offsets of the two constrained points inside an element,
+// when NormalizedDamp is false damping is projected on the unnormalized gradient (bend)
+template<bool NormalizedDamp>
+static void _SolveDistanceBlock(Particles* particles, const DistanceEndpoints& endpoints,
+  size_t elementSize, size_t first, size_t second, const VtArray<float>& rest,
+  float alpha, float damping, float dt, VtArray<GfVec3f>& corrections)
+{
+  _DistanceLanes lanes;
+  const GfVec3f* predicted = &particles->predicted[0];
+  const GfVec3f* velocity = &particles->velocity[0];
+  const float* invMass = &particles->invMass[0];
+  const int* firsts = endpoints.first.cdata();
+  const int* seconds = endpoints.second.cdata();
+  const float* rests = rest.cdata();
+
+  const size_t numElements = endpoints.first.size();
+  const float dt2 = dt * dt;
+
+  for(size_t begin = 0; begin < numElements; begin += Constraint::BlockSize) {
+    const size_t n = GfMin(numElements - begin, Constraint::BlockSize);
+    const int* a = firsts + begin;
+    const int* b = seconds + begin;
+    const float* r = rests + begin;
+
+    // gather
+    for(size_t i = 0; i < n; ++i) {
+      lanes.ax[i] = predicted[a[i]][0]; lanes.ay[i] = predicted[a[i]][1]; lanes.az[i] = predicted[a[i]][2];
+      lanes.bx[i] = predicted[b[i]][0]; lanes.by[i] = predicted[b[i]][1]; lanes.bz[i] = predicted[b[i]][2];
+      const GfVec3f v = NormalizedDamp ? (velocity[a[i]] + velocity[b[i]]) * 0.5f : velocity[a[i]];
+      lanes.vx[i] = v[0]; lanes.vy[i] = v[1]; lanes.vz[i] = v[2];
+      lanes.wa[i] = invMass[a[i]];
+      lanes.wb[i] = invMass[b[i]];
+    }
+
+    // solve
+    for(size_t i = 0; i < n; ++i) {
+      const float gx = lanes.ax[i] - lanes.bx[i];
+      const float gy = lanes.ay[i] - lanes.by[i];
+      const float gz = lanes.az[i] - lanes.bz[i];
+      const float length2 = gx * gx + gy * gy + gz * gz;
+      const float length = std::sqrt(length2);
+      const float W = lanes.wa[i] + lanes.wb[i];
+      const bool valid = (W >= 1e-6f) && (length >= 1e-6f);
+
+      const float invLength = valid ? 1.f / length : 0.f;
+      const float C = length - r[i];
+      const float s = valid ? -C / (W * length2 + alpha) : 0.f;
+
+      const float dx = NormalizedDamp ? gx * invLength : gx;
+      const float dy = NormalizedDamp ? gy * invLength : gy;
+      const float dz = NormalizedDamp ? gz * invLength : gz;
+      const float d = (lanes.vx[i] * dx + lanes.vy[i] * dy + lanes.vz[i] * dz) * dt2 * damping;
+      const float mask = valid ? 1.f : 0.f;
+
+      lanes.cx[i] = (s * gx - d * dx) * mask;
+      lanes.cy[i] = (s * gy - d * dy) * mask;
+      lanes.cz[i] = (s * gz - d * dz) * mask;
+    }
+
+    // scatter
+    for(size_t i = 0; i < n; ++i) {
+      const size_t elem = begin + i;
+      const GfVec3f correction(lanes.cx[i], lanes.cy[i], lanes.cz[i]);
+      corrections[elem * elementSize + first] += lanes.wa[i] * correction;
+      corrections[elem * elementSize + second] -= lanes.wb[i] * correction;
+    }
+  }
+}
+
 //-----------------------------------------------------------------------------------------
 //   STRETCH CONSTRAINT
 //-----------------------------------------------------------------------------------------
@@ -286,6 +447,7 @@ StretchConstraint::StretchConstraint(Body* body, const VtArray<int>& elems,
     // TODO add warning message here
     return;
   }
+  _endpoints.Set(_elements, ELEM_SIZE, 0, 1);
   const size_t offset = body->GetOffset();
   const GfMatrix4d& m = geometry->GetMatrix();
   const GfVec3f* positions = ((Deformable*)geometry)->GetPositionsCPtr();
@@ -293,11 +455,17 @@ StretchConstraint::StretchConstraint(Body* body, const VtArray<int>& elems,
   _rest.resize(numElements);
   for(size_t elemIdx = 0; elemIdx < numElements; ++elemIdx) {
     _rest[elemIdx] = 
-      (m.Transform(positions[_elements[elemIdx * ELEM_SIZE + 1] - offset]) - 
-       m.Transform(positions[_elements[elemIdx * ELEM_SIZE] - offset])).GetLength();
+      (m.Transform(positions[body->GetPoint(_elements[elemIdx * ELEM_SIZE + 1] - offset)]) - 
+       m.Transform(positions[body->GetPoint(_elements[elemIdx * ELEM_SIZE] - offset)])).GetLength();
   }
 }
 
+void StretchConstraint::SetElements(const VtArray<int>& elements)
+{
+  Constraint::SetElements(elements);
+  _endpoints.Set(_elements, ELEM_SIZE, 0, 1);
+}
+
 void StretchConstraint::Reset(Particles* particles)
 {
   Constraint::Reset(particles);
@@ -310,43 +478,11 @@ void StretchConstraint::Reset(Particles* particles)
 
 void StretchConstraint::SolvePosition(Particles* particles, float dt)
 {
-
   _ResetCorrection();
 
-  const size_t numElements = _elements.size() / ELEM_SIZE;
-
   const float alpha =  _compliance / (dt * dt);
-  size_t a, b;
-  float w0, w1, W, C, length;
-  GfVec3f gradient, normal, correction, damp;
-
-  const GfVec3f* predicted = &particles->predicted[0];
-  const GfVec3f* velocity = &particles->velocity[0];
-  const float* invMass = &particles->invMass[0];
-  
-  for(size_t elem = 0; elem  < numElements; ++elem) {
-    a = _elements[elem * ELEM_SIZE + 0];
-    b = _elements[elem * ELEM_SIZE + 1];
-
-    w0 = invMass[a];
-    w1 = invMass[b];
-
-    W = w0 + w1;
-    if(W < 1e-6f) continue;
-
-    gradient = predicted[a] - predicted[b];
-    length = gradient.GetLength();
-    if(length<1e-6f)continue;
-
-    normal = gradient.GetNormalized();
-
-    C = length - _rest[elem];
-
-    damp = GfDot((velocity[a] + velocity[b]) * 0.5f * dt * dt,  normal) * normal * _damp;
-    correction = -C / (W * length * length + alpha) * gradient - damp;
-    _correction[elem * ELEM_SIZE + 0] += w0 * correction;
-    _correction[elem * ELEM_SIZE + 1] -= w1 * correction;
-  }
+  _SolveDistanceBlock<true>(particles, _endpoints, ELEM_SIZE, 0, 1, 
+    _rest, alpha, _damp, dt, _correction);
 }
 
 void StretchConstraint::GetPoints(Particles* particles, VtArray<GfVec3f>& positions, 
@@ -438,6 +574,7 @@ BendConstraint::BendConstraint(Body* body, const VtArray<int>& elems,
     // TODO add warning message here
     return;
   }
+  _endpoints.Set(_elements, ELEM_SIZE, 0, 2);
   const GfVec3f* positions = ((Deformable*)geometry)->GetPositionsCPtr();
   const GfMatrix4d& m = geometry->GetMatrix();
 
@@ -451,81 +588,58 @@ BendConstraint::BendConstraint(Body* body, const VtArray<int>& elems,
           m.Transform(positions[_elements[elemIdx * ELEM_SIZE + 2] - offset])) / 3.f;
     _rest[elemIdx] = (center - m.Transform(positions[_elements[elemIdx * ELEM_SIZE + 1]])).GetLength();
     */
-    _rest[elemIdx] = (m.Transform(positions[_elements[elemIdx * ELEM_SIZE + 2] - offset]) - 
-      m.Transform(positions[_elements[elemIdx * ELEM_SIZE + 0] - offset])).GetLength();
+    _rest[elemIdx] = (m.Transform(positions[body->GetPoint(_elements[elemIdx * ELEM_SIZE + 2] - offset)]) - 
+      m.Transform(positions[body->GetPoint(_elements[elemIdx * ELEM_SIZE + 0] - offset)])).GetLength();
       
   }
 }
 
+void BendConstraint::SetElements(const VtArray<int>& elements)
+{
+  Constraint::SetElements(elements);
+  _endpoints.Set(_elements, ELEM_SIZE, 0, 2);
+}
+
 void BendConstraint::SolvePosition(Particles* particles, float dt)
 {
   _ResetCorrection();
 
-  const size_t numElements = _elements.size() / ELEM_SIZE;
   const float alpha = _compliance / (dt * dt);
 
-  GfVec3f x0, x1, x2, center, h, correction, damp;
-  float w0, w1, w2, W, hL, C;
-  size_t a, b, c;
-
-  const GfVec3f* predicted = &particles->predicted[0];
-  const GfVec3f* velocity = &particles->velocity[0];
-  const float* invMass = &particles->invMass[0];
-  
-  for(size_t elem = 0; elem  < numElements; ++elem) {
-    /*
-    // wip not working
-    a = _elements[elem * ELEM_SIZE + 0];
-    b = _elements[elem * ELEM_SIZE + 1];
-    c = _elements[elem * ELEM_SIZE + 2];
-   
-    x0 = particles->predicted[a];
-    x1 = particles->predicted[b];
-    x2 = particles->predicted[c];
-
-    w0 =  particles->invMass[a];
-    w1 =  particles->invMass[b];
-    w2 =  particles->invMass[c];  
-
-    W = w0 + 2.f * w1 + w2;
-
-    center = (x0 + x1 + x2) / 3.f;
-    h = x1 - center;
-    hL = h.GetLength();
-
-
-    if(hL > 1e-6f)C = 1.f - (_rest[elem]/hL);
-    else C = 0.f;
+  /*
+  // wip not working
+  a = _elements[elem * ELEM_SIZE + 0];
+  b = _elements[elem * ELEM_SIZE + 1];
+  c = _elements[elem * ELEM_SIZE + 2];
+ 
+  x0 = particles->predicted[a];
+  x1 = particles->predicted[b];
+  x2 = particles->predicted[c];
 
-	  correction = -C / (W + alpha) * h;
+  w0 =  particles->invMass[a];
+  w1 =  particles->invMass[b];
+  w2 =  particles->invMass[c];  
 
-    _correction[elem * ELEM_SIZE + 0] += w0 * correction;
-    _correction[elem * ELEM_SIZE + 1] -= 2.f * w1 * correction;
-    _correction[elem * ELEM_SIZE + 2] += w2 * correction;
-    */
-    
-   // easy solution stretch constraint on base edge :
-    a = _elements[elem * ELEM_SIZE + 0];
-    b = _elements[elem * ELEM_SIZE + 2];
+  W = w0 + 2.f * w1 + w2;
 
-    w0 = invMass[a];
-    w1 = invMass[b];
+  center = (x0 + x1 + x2) / 3.f;
+  h = x1 - center;
+  hL = h.GetLength();
 
-    W = w0 + w1;
-    if(W < 1e-6f) continue;
 
-    h = predicted[a] - predicted[b];
-    hL = h.GetLength();
+  if(hL > 1e-6f)C = 1.f - (_rest[elem]/hL);
+  else C = 0.f;
 
-    C = hL - _rest[elem];
+  correction = -C / (W + alpha) * h;
 
-    damp = GfDot(velocity[a] * dt * dt,  h) * h * _damp;
-    correction = -C / (hL * hL * W + alpha) * h - damp;
+  _correction[elem * ELEM_SIZE + 0] += w0 * correction;
+  _correction[elem * ELEM_SIZE + 1] -= 2.f * w1 * correction;
+  _correction[elem * ELEM_SIZE + 2] += w2 * correction;
+  */
 
-    _correction[elem * ELEM_SIZE + 0] += w0 * correction;
-    _correction[elem * ELEM_SIZE + 2] -= w1 * correction;
-
-  }
+  // easy solution stretch constraint on base edge :
+  _SolveDistanceBlock<false>(particles, _endpoints, ELEM_SIZE, 0, 2, 
+    _rest, alpha, _damp, dt, _correction);
 }
 
 void BendConstraint::GetPoints(Particles* particles, VtArray<GfVec3f>& positions, 
@@ -768,10 +882,10 @@ DihedralConstraint::DihedralConstraint(Body* body, const VtArray<int>& elems,
   const size_t numElements = _elements.size() / ELEM_SIZE;
   _rest.resize(numElements);
   for(size_t elemIdx = 0; elemIdx < numElements; ++elemIdx) {
-    const GfVec3f x0(m.Transform(positions[_elements[elemIdx * ELEM_SIZE + 0] - offset]));
-    const GfVec3f x1(m.Transform(positions[_elements[elemIdx * ELEM_SIZE + 1] - offset]));
-    const GfVec3f x2(m.Transform(positions[_elements[elemIdx * ELEM_SIZE + 2] - offset]));
-    const GfVec3f x3(m.Transform(positions[_elements[elemIdx * ELEM_SIZE + 3] - offset]));
+    const GfVec3f x0(m.Transform(positions[body->GetPoint(_elements[elemIdx * ELEM_SIZE + 0] - offset)]));
+    const GfVec3f x1(m.Transform(positions[body->GetPoint(_elements[elemIdx * ELEM_SIZE + 1] - offset)]));
+    const GfVec3f x2(m.Transform(positions[body->GetPoint(_elements[elemIdx * ELEM_SIZE + 2] - offset)]));
+    const GfVec3f x3(m.Transform(positions[body->GetPoint(_elements[elemIdx * ELEM_SIZE + 3] - offset)]));
 
     GfVec3f n1 = GfCross(x1 - x0, x2 - x0).GetNormalized();
     GfVec3f n2 = GfCross(x1 - x0, x3 - x0).GetNormalized();
@@ -957,7 +1071,10 @@ void CollisionConstraint::_SolvePositionGeom(Particles* particles, float dt)
 
     float d = _collision->GetContactDepth(index);
 
-    if(particles->mass[index] < 1e-9 || d > 0.f) continue;
+    if(particles->mass[index] < 1e-9 || d > 0.f) {
+      _collision->SetContactLambda(index, 0.f);
+      continue;
+    }
 
     particles->color[index] = GfVec3f(0.75, 0.75, 0.5);
     
@@ -965,8 +1082,14 @@ void CollisionConstraint::_SolvePositionGeom(Particles* particles, float dt)
       d += GfMax(-_collision->GetContactInitDepth(index) - 
       _collision->GetMaxSeparationVelocity() * dt, 0.f);
 
-    const float lagrange = -d / (particles->invMass[index] + alpha);
-    const GfVec3f correction = lagrange * particles->invMass[index] * normal;
+    // warm start from the carried multiplier, then solve the depth left 
+    // once it is applied, the contact can only push
+    const float w = particles->invMass[index];
+    const float carried = _collision->GetContactLambda(index);
+    const float remaining = d + carried * w;
+    const float lagrange = GfMax(carried - remaining / (w + alpha), 0.f);
+    _collision->SetContactLambda(index, lagrange);
+    const GfVec3f correction = lagrange * w * normal;
 
     //const GfVec3f correction = -d * normal;
     damp = GfDot(correction, normal) * normal * _collision->GetDamp();
@@ -1151,9 +1274,14 @@ ContactConstraint::ContactConstraint(Body* body, const VtArray<int>& elems, Coll
   const GfVec3f* positions = ((Deformable*)geometry)->GetPositionsCPtr();
   size_t numElements = _elements.size() / ELEM_SIZE;
 
-  for(auto& contact: contacts)
-    _contacts.push_back(*contact);
+  SetContacts(contacts);
+}
 
+void ContactConstraint::SetContacts(const VtArray<Contact*>& contacts)
+{
+  _contacts.resize(contacts.size());
+  for(size_t c = 0; c < contacts.size(); ++c)
+    _contacts[c] = *contacts[c];
 }
 
 void ContactConstraint::SolvePosition(Particles* particles, float dt)
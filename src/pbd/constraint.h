@@ -36,6 +36,7 @@ struct ConstraintsGroup {
   TfToken               name;
   short                      type;
   VtArray<Constraint*>  constraints;
+  size_t                numColors;
 };
 
 class Constraint: public Element
@@ -73,8 +74,14 @@ public:
   virtual void SetStiffness(float stiffness);
   virtual void SetDamp(float damp);
   virtual void SetActive(bool active){_active=active;};
+  float GetStiffness() const {return _compliance > 0.0 ? 1.f / _compliance : 0.f;};
+  float GetDamp() const {return _damp;};
 
   bool IsActive() {return _active;};
+
+  // graph color : constraints of the same group and color never share a particle
+  void SetGraphColor(int color){_graphColor = color;};
+  int GetGraphColor() const {return _graphColor;};
   
   virtual void Reset(Particles* particles);
   virtual void SolvePosition(Particles* particles, float dt) = 0;
@@ -99,6 +106,7 @@ protected:
   float               _damp;
   TfToken             _key;
   GfVec3f             _color;
+  int                 _graphColor;
 };
 
 
@@ -139,6 +147,7 @@ public:
 
   size_t GetTypeId() const override { return TYPE_ID; };
   size_t GetElementSize() const override { return ELEM_SIZE; };
+  Geometry* GetTarget() const { return _target; };
 
   void GetPoints(Particles* particles, VtArray<GfVec3f>& results,
     VtArray<float>& radius, VtArray<GfVec3f>& colors) override;
@@ -158,6 +167,16 @@ ConstraintsGroup* CreatePinConstraints(Body* body, Geometry* target, float stiff
   const VtArray<int> *elements=nullptr);
 
 
+// endpoints of distance elements stored as structure of arrays, set with
+// the elements so that the solve gathers the particles straight from them
+struct DistanceEndpoints {
+  VtArray<int>                  first;
+  VtArray<int>                  second;
+
+  void Set(const VtArray<int>& elements, size_t elementSize, 
+    size_t firstOffset, size_t secondOffset);
+};
+
 class StretchConstraint : public Constraint
 {
 public:
@@ -170,6 +189,7 @@ public:
   void GetPoints(Particles* particles, VtArray<GfVec3f>& results,
     VtArray<float>& radius, VtArray<GfVec3f>& colors) override;
 
+  void SetElements(const VtArray<int>& elements) override;
   void Reset(Particles* particles) override;
   void SolvePosition(Particles* particles, float dt) override;
 
@@ -177,6 +197,7 @@ public:
 
 protected:
   static size_t                 TYPE_ID;
+  DistanceEndpoints             _endpoints;
   VtArray<float>           _rest;
 };
 
@@ -209,12 +230,14 @@ public:
   void GetPoints(Particles* particles, VtArray<GfVec3f>& results, 
     VtArray<float>& radius, VtArray<GfVec3f>& colors) override;
 
+  void SetElements(const VtArray<int>& elements) override;
   void SolvePosition(Particles* particles, float dt) override;
 
   static size_t                 ELEM_SIZE;
 
 protected:
   static size_t                 TYPE_ID;
+  DistanceEndpoints             _endpoints;
   VtArray<float>           _rest;
 };
 
@@ -305,6 +328,8 @@ public:
   size_t GetTypeId() const override { return TYPE_ID; };
   size_t GetElementSize() const override { return ELEM_SIZE; };
 
+  void SetContacts(const VtArray<Contact*>& contacts);
+
   void GetPoints(Particles* particles, VtArray<GfVec3f>& results,
     VtArray<float>& radius, VtArray<GfVec3f>& colors) override;
 
@@ -25,14 +25,19 @@ void Contact::Update(const GfVec3f &normal, const GfVec3f &velocity, const float
 
 
 void Contacts::Resize(size_t N, size_t M) {
-  if(data && n == N && m == M){ResetAllUsed(); return;}
-  else if(data) {delete [] data; data=nullptr; delete [] used; used=nullptr;}
+  if(data && n == N && m == M) return;
+  else if(data) {
+    delete [] data; data=nullptr; 
+    delete [] used; used=nullptr;
+    delete [] previous; previous=nullptr;
+  }
 
   if(N) {
     n = N;
     m = M;
     data = new Contact[n * m];
     used = new int[n];
+    previous = new int[n];
     ResetAllUsed();
   }
 
@@ -46,6 +51,13 @@ void Contacts::ResetUsed(size_t index)
 void 
 Contacts::ResetAllUsed() { 
   memset(&used[0], 0, n * sizeof(int));
+  memset(&previous[0], 0, n * sizeof(int));
+};
+
+void 
+Contacts::Persist() { 
+  memcpy(&previous[0], &used[0], n * sizeof(int));
+  memset(&used[0], 0, n * sizeof(int));
 };
 
 Contact* 
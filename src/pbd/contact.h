@@ -15,7 +15,7 @@ class SelfCollision;
 
 class Contact : public Location {
 public:
-  Contact(){};
+  Contact() : _lambda(0.f), _touching(false){};
   virtual ~Contact(){};
 
   void Init(const GfVec3f &normal, const GfVec3f &velocity, const float depth);
@@ -28,12 +28,17 @@ public:
   float GetDepth() const {return _depth;};
   float GetInitDepth() const {return _initDepth;};
 
+  // normal multiplier accumulated by the solver, carried across frames
+  float GetLambda() const {return _lambda;};
+  void SetLambda(float lambda){_lambda = lambda;};
+
 private:
   GfVec3f      _normal;   // contact normal
   GfVec3f      _velocity; // relative velocity
 
   float             _initDepth;// start frame penetration depth
   float             _depth;    // current substep penetration depth
+  float             _lambda;   // accumulated normal multiplier
 
   bool              _active;
   bool              _touching;
@@ -45,8 +50,8 @@ static const size_t PARTICLE_MAX_CONTACTS = 32;
 class Contacts {
 
 public:
-  Contacts() : n(0), m(1), data(NULL), used(NULL){};
-  virtual ~Contacts() { delete[] data; delete[] used;};
+  Contacts() : n(0), m(1), data(NULL), used(NULL), previous(NULL){};
+  virtual ~Contacts() { delete[] data; delete[] used; delete[] previous;};
 
   Contact* Get(size_t index, size_t second=0) const {
     return &data[index * m + second];
@@ -55,8 +60,11 @@ public:
   void Resize(size_t n, size_t m=PARTICLE_MAX_CONTACTS);
   void ResetUsed(size_t index);
   void ResetAllUsed();
+  // keep the used counts of the last frame and start a new one
+  void Persist();
 
   bool IsUsed(size_t index){return used[index] > 0;};
+  bool WasUsed(size_t index, size_t second=0) const {return previous[index] > (int)second;};
 
   Contact* Use(size_t index);
   Contact* LastUsed(size_t index);
@@ -68,6 +76,7 @@ private:
   size_t                m;
   int*                  used;
   Contact*              data;
+  int*                  previous;
 };
 
 
@@ -69,7 +69,7 @@ void Particles::AddBody(Body* item, const GfMatrix4d& matrix)
   size_t idx;
   for (size_t idx = base; idx < size; ++idx) {
     
-    pos = GfVec3f(matrix.Transform(points[idx - base]));
+    pos = GfVec3f(matrix.Transform(points[item->GetPoint(idx - base)]));
     float bY = float(idx) / float(size);
     state[idx] = ACTIVE;
     body[idx] = item;
@@ -145,6 +145,11 @@ void Particles::SetBodyState(Body* item, short s)
   }
 }
 
+void Particles::SetAllCounter(float value, size_t c)
+{
+  for (size_t p=0; p< num; ++p)counter[p][c] = value;
+}
+
 void Particles::ResetCounter(const std::vector<Constraint*>& constraints, size_t c)
 {
   for (size_t p=0; p< num; ++p)counter[p][c] = 0.f;
@@ -162,6 +167,15 @@ Body::~Body()
   delete _smoothKernel;
 }
 
+void
+Body::SetOrder(const std::vector<int>& order)
+{
+  _order = order;
+  _rank.resize(_order.size());
+  for(size_t i = 0; i < _order.size(); ++i)
+    _rank[_order[i]] = i;
+}
+
 void 
 Body::_InitSmoothKernel()
 {
@@ -193,12 +207,12 @@ Body::SmoothVelocities(Particles* particles, size_t iterations)
       const GfVec3f* velocities = &particles->velocity[0];
 
       for(size_t i = 0; i < _numPoints; ++i) {
-        _smoothKernel->SetDatas(i, velocities[i + _offset]);
+        _smoothKernel->SetDatas(i, velocities[GetParticle(i) + _offset]);
       }
       _smoothKernel->Compute(iterations);
 
       for(size_t i = 0; i < _numPoints; ++i) {
-        particles->velocity[i + _offset] = _smoothKernel->GetDatas(i);
+        particles->velocity[GetParticle(i) + _offset] = _smoothKernel->GetDatas(i);
       }
       
     }
@@ -258,7 +272,7 @@ Body::AddConstraintsGroup(const TfToken& name, short type)
 {
   if(_constraints.find(name) != _constraints.end())
     return _constraints[name];
-  _constraints[name] = new ConstraintsGroup({_geometry->GetPrim(), name, type, {}}); 
+  _constraints[name] = new ConstraintsGroup({_geometry->GetPrim(), name, type, {}, 0}); 
   return _constraints[name];
 }
 
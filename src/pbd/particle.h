@@ -47,6 +47,7 @@ public:
 
   void SetOffset(size_t offset){_offset = offset;};
   void SetNumPoints(size_t numPoints){_numPoints = numPoints;};
+  void SetOrder(const std::vector<int>& order);
 
   void SetVelocity(const GfVec3f& velocity){_velocity=velocity;};
   void SetTorque(const GfVec3f& torque){_torque=torque;};
@@ -61,6 +62,12 @@ public:
   GfVec3f GetVelocity() const {return _velocity;};
   GfVec3f GetTorque() const {return _torque;};
 
+  // particles order (local particle -> geometry point), empty means identity
+  bool HasOrder() const {return _order.size() > 0;};
+  const std::vector<int>& GetOrder() const {return _order;};
+  size_t GetPoint(size_t particle) const {return _order.size() ? _order[particle] : particle;};
+  size_t GetParticle(size_t point) const {return _rank.size() ? _rank[point] : point;};
+
   bool GetSelfCollisionEnabled() const {return _selfCollisionEnabled;};
   float GetSelfCollisionRadius() const {return _selfCollisionRadius;};
   float GetSelfCollisionFriction() const {return _selfCollisionFriction;};
@@ -72,6 +79,7 @@ public:
   size_t GetNumConstraintsGroup();
   ConstraintsGroup* AddConstraintsGroup(const TfToken& group, short type);
   ConstraintsGroup* GetConstraintsGroup(const TfToken& group);
+  const std::map<TfToken, ConstraintsGroup*>& GetConstraintsGroups() const {return _constraints;};
 
   void SmoothVelocities(Particles* particles, size_t iterations);
 
@@ -99,6 +107,9 @@ protected:
   GfVec3f                              _torque;
   std::map<TfToken, ConstraintsGroup*> _constraints;
 
+  std::vector<int>                          _order;
+  std::vector<int>                          _rank;
+
   std::vector<int>                          _connexions;
   std::vector<int>                          _connexionsCounts;
   std::vector<int>                          _connexionsOffsets;
@@ -134,6 +145,7 @@ struct Particles
   void SetAllState(short state);
   void SetBodyState(Body* body, short state);
 
+  void SetAllCounter(float value, size_t c);
   void ResetCounter(const std::vector<Constraint*>& constraints, size_t c);
 
   void _EnsureDataSize(size_t size);
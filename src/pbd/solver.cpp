@@ -1,6 +1,11 @@
 #include <iostream>
+#include <algorithm>
+#include <memory>
+#include <set>
+#include <unordered_map>
 
 #include <pxr/base/work/loops.h>
+#include <pxr/base/work/sort.h>
 
 #include <usdPbd/solver.h>
 #include <usdPbd/bodyAPI.h>
@@ -8,9 +13,11 @@
 #include "../utils/color.h"
 #include "../acceleration/bvh.h"
 #include "../acceleration/hashGrid.h"
+#include "../acceleration/morton.h"
 #include "../geometry/location.h"
 #include "../geometry/geometry.h"
 #include "../geometry/mesh.h"
+#include "../geometry/utils.h"
 #include "../geometry/points.h"
 #include "../geometry/voxels.h"
 #include "../geometry/curve.h"
@@ -42,7 +49,11 @@ Solver::Solver(Scene* scene, UsdPrim& prim)
   , _selfCollisions(nullptr)
   , _subSteps(5)
   , _sleepThreshold(0.001f)
+  , _sleepSubSteps(0)
   , _paused(true)
+  , _graphColoring(false)
+  , _constraintsDirty(true)
+  , _reorderParticles(false)
   , _startTime(1.f)
   , _solverId(prim.GetPath())
   , _gravity(nullptr)
@@ -71,7 +82,6 @@ Solver::Solver(Scene* scene, UsdPrim& prim)
 Solver::~Solver()
 {
   for (auto& constraint : _constraints)delete constraint;
-  for (auto& contact : _contacts)delete contact;
   for (auto& body : _bodies)delete body;
   for (auto& collision: _collisions)delete collision;
   for (auto& force : _forces)delete force;
@@ -181,6 +191,7 @@ Body* Solver::CreateBody(Geometry* geom, const GfMatrix4d& matrix,
 void Solver::AddBody(Body* body)
 {
   _bodies.push_back(body);
+  _constraintsDirty = true;
 }
 
 void Solver::RemoveBody(Geometry* geom)
@@ -193,6 +204,7 @@ void Solver::RemoveBody(Geometry* geom)
 
   _bodies.erase(_bodies.begin() + index);
   delete body;
+  _constraintsDirty = true;
 }
 
 void Solver::SetBodyVelocity(Body* body, const GfVec3f& velocity)
@@ -248,6 +260,7 @@ void Solver::CreateConstraints(Body* body, short type, float stiffness, float da
 void Solver::AddConstraint(Constraint* constraint) 
 { 
   _constraints.push_back(constraint); 
+  _constraintsDirty = true;
 };
 
 void Solver::GetConstraintsByType(short type, std::vector<Constraint*>& results)
@@ -261,8 +274,9 @@ void Solver::LockPoints(Body* body, VtArray<int>& elements)
 {
   const size_t offset = body->GetOffset();
   for(size_t i = 0; i < elements.size(); ++i) {
-    _particles.mass[elements[i] + offset] = 0.f;
-    _particles.invMass[elements[i] + offset] = 0.f;
+    const size_t index = body->GetParticle(elements[i]) + offset;
+    _particles.mass[index] = 0.f;
+    _particles.invMass[index] = 0.f;
   }
 }
 
@@ -366,7 +380,7 @@ void Solver::WeightBoundaries(Body* body)
     const VtArray<bool>& boundaries = graph->GetBoundaries();
     for(size_t p = 0; p < boundaries.size(); ++p){
       if(boundaries[p]) {
-        size_t index = p + offset;
+        size_t index = body->GetParticle(p) + offset;
         
         if(_particles.mass[index] > 0.f) {
           _particles.mass[index] *= 1.2f;
@@ -380,16 +394,18 @@ void Solver::WeightBoundaries(Body* body)
 void Solver::_PrepareContacts()
 {
   _timer->Start(0);
-  for (auto& contact: _contacts)
-    delete contact;
-
+  // contact constraints are owned and recycled by the collisions
   _contacts.clear();
 
+  _WakeIslandsFromCollisions();
+
   for (auto& collision : _collisions)
     collision->FindContacts(&_particles, _bodies, _contacts, _frameTime);
 
-  if(_selfCollisions)
+  if(_selfCollisions) {
     _selfCollisions->FindContacts(&_particles, _bodies, _contacts, _frameTime);
+    _WakeIslandsFromContacts(_selfCollisions);
+  }
 
   _particles.ResetCounter(_contacts, 1);
   _timer->Stop();
@@ -421,9 +437,9 @@ void Solver::_IntegrateParticles(size_t begin, size_t end)
     force->Apply(begin, end, &_particles, _stepTime);
 
   for (size_t index = begin; index < end; ++index) {
+    // sleeping particles are woken by their island
     if(_particles.state[index] == Particles::IDLE)
-      if((predicted[index] - position[index]).GetLength() > _sleepThreshold )
-        _particles.state[index] = Particles::ACTIVE;
+      velocity[index] = GfVec3f(0.f);
 
     if(_particles.state[index] != Particles::ACTIVE)continue;
 
@@ -481,17 +497,101 @@ Solver::_SolveConstraints(std::vector<Constraint*>& constraints)
   // solve constraints
   WorkParallelForEach(constraints.begin(), constraints.end(),
     [&](Constraint* constraint) {
-      if(constraint->IsActive())
+      if(constraint->IsActive() && !_IsAsleep(constraint))
         constraint->SolvePosition(&_particles, _stepTime); 
     });
   
   // apply constraint serially
   for (auto& constraint : constraints)
-    if(constraint->IsActive())
+    if(constraint->IsActive() && !_IsAsleep(constraint))
       constraint->ApplyPosition(&_particles);
 
 }
 
+// constraints of the same type and color never share a particle,
+// whatever body they belong to, so they are merged in the same batch,
+// groups of the same type on one body get their own colors range
+void 
+Solver::_BuildConstraintsColors()
+{
+  // batches are laid out by type, each type spanning the colors
+  // of the body whose groups of that type have the most colors
+  std::vector<size_t> typeOffsets(Constraint::LAST + 1, 0);
+  for(auto& body: _bodies) {
+    std::vector<size_t> bodyColors(Constraint::LAST, 0);
+    for(auto& groupIt: body->GetConstraintsGroups()) {
+      const ConstraintsGroup* group = groupIt.second;
+      if(group->type > 0 && group->type < Constraint::LAST)
+        bodyColors[group->type] += group->numColors;
+    }
+    for(size_t t = 1; t < Constraint::LAST; ++t)
+      typeOffsets[t + 1] = GfMax(typeOffsets[t + 1], bodyColors[t]);
+  }
+  for(size_t t = 1; t <= Constraint::LAST; ++t)
+    typeOffsets[t] += typeOffsets[t - 1];
+
+  // first batch of every group
+  std::unordered_map<const Constraint*, size_t> groupOffsets;
+  for(auto& body: _bodies) {
+    std::vector<size_t> bodyColors(Constraint::LAST, 0);
+    for(auto& groupIt: body->GetConstraintsGroups()) {
+      const ConstraintsGroup* group = groupIt.second;
+      if(group->type <= 0 || group->type >= Constraint::LAST)continue;
+      const size_t offset = typeOffsets[group->type] + bodyColors[group->type];
+      for(const Constraint* constraint: group->constraints)
+        groupOffsets[constraint] = offset;
+      bodyColors[group->type] += group->numColors;
+    }
+  }
+
+  _colors.clear();
+  _colors.resize(typeOffsets[Constraint::LAST]);
+  for(auto& constraint: _constraints) {
+    const size_t type = constraint->GetTypeId();
+    const int color = constraint->GetGraphColor();
+    const auto it = groupOffsets.find(constraint);
+    if(it != groupOffsets.end() && color >= 0 && 
+      it->second + color < typeOffsets[type + 1]) {
+      _colors[it->second + color].push_back(constraint);
+    } else {
+      // uncolored constraints get a batch of their own
+      _colors.push_back({constraint});
+    }
+  }
+
+  _colors.erase(std::remove_if(_colors.begin(), _colors.end(), 
+    [](const std::vector<Constraint*>& color) {return color.empty();}), _colors.end());
+}
+
+// particles counter must follow the constraints set and the solve mode
+void 
+Solver::_UpdateConstraintsCounter()
+{
+  if(_graphColoring) {
+    // no averaging, a particle is moved by a single constraint per color
+    _BuildConstraintsColors();
+    _particles.SetAllCounter(1.f, 0);
+  } else {
+    _colors.clear();
+    _particles.ResetCounter(_constraints, 0);
+  }
+  _constraintsDirty = false;
+}
+
+void 
+Solver::_SolveColoredConstraints()
+{
+  // solve and apply constraint in place, one color after the other
+  for(auto& color: _colors)
+    WorkParallelForEach(color.begin(), color.end(),
+      [&](Constraint* constraint) {
+        if(constraint->IsActive() && !_IsAsleep(constraint)) {
+          constraint->SolvePosition(&_particles, _stepTime); 
+          constraint->ApplyPosition(&_particles);
+        }
+      });
+}
+
 void 
 Solver::_SolveVelocities(std::vector<Constraint*>& constraints)
 {
@@ -513,6 +613,326 @@ Solver::_SolveVelocities(std::vector<Constraint*>& constraints)
 }
 
 
+//-----------------------------------------------------------------------------------------
+//   ISLANDS
+//-----------------------------------------------------------------------------------------
+void 
+Solver::_BuildIslands()
+{
+  const size_t numParticles = _particles.GetNumParticles();
+
+  // union find over the constraints elements, a constraint block 
+  // is never split so all its particles share the same island
+  std::vector<int> parents(numParticles);
+  for(size_t p = 0; p < numParticles; ++p)
+    parents[p] = p;
+
+  auto findRoot = [&](int p) {
+    while(parents[p] != p) {
+      parents[p] = parents[parents[p]];
+      p = parents[p];
+    }
+    return p;
+  };
+
+  for(auto& constraint: _constraints) {
+    const VtArray<int>& elements = constraint->GetElements();
+    if(!elements.size())continue;
+    const int root = findRoot(elements[0]);
+    for(const auto& elem: elements) {
+      const int other = findRoot(elem);
+      if(other != root)parents[other] = root;
+    }
+  }
+
+  // island index per particle
+  std::vector<int> roots(numParticles, -1);
+  _particlesIsland.resize(numParticles);
+  size_t numIslands = 0;
+  for(size_t p = 0; p < numParticles; ++p) {
+    const int root = findRoot(p);
+    if(roots[root] < 0)roots[root] = numIslands++;
+    _particlesIsland[p] = roots[root];
+  }
+
+  // particles sorted by island
+  _islandsOffsets.assign(numIslands + 1, 0);
+  for(size_t p = 0; p < numParticles; ++p)
+    _islandsOffsets[_particlesIsland[p] + 1]++;
+  for(size_t i = 0; i < numIslands; ++i)
+    _islandsOffsets[i + 1] += _islandsOffsets[i];
+
+  std::vector<int> cursors(_islandsOffsets.begin(), _islandsOffsets.end() - 1);
+  _islandsParticles.resize(numParticles);
+  for(size_t p = 0; p < numParticles; ++p)
+    _islandsParticles[cursors[_particlesIsland[p]]++] = p;
+
+  // islands start awake, so do the particles they held asleep
+  _islands.assign(numIslands, {GfRange3f(), 0, false});
+  for(size_t p = 0; p < numParticles; ++p)
+    if(_particles.state[p] == Particles::IDLE)
+      _particles.state[p] = Particles::ACTIVE;
+
+  _collisionsBounds.clear();
+  for(auto& collision: _collisions) {
+    Geometry* collider = collision->GetGeometry();
+    _collisionsBounds.push_back(collider ? 
+      collider->GetBoundingBox().ComputeAlignedRange() : GfRange3d());
+  }
+}
+
+// a block only skips its solve once all its particles sleep
+bool 
+Solver::_IsAsleep(Constraint* constraint)
+{
+  const VtArray<int>& elements = constraint->GetElements();
+  if(!elements.size())return false;
+  for(const auto& elem: elements)
+    if(_particles.state[elem] != Particles::IDLE)return false;
+  return true;
+}
+
+void 
+Solver::_WakeIsland(size_t index)
+{
+  _Island& island = _islands[index];
+  island.asleep = false;
+  island.numCalm = 0;
+  for(int i = _islandsOffsets[index]; i < _islandsOffsets[index + 1]; ++i) {
+    const int p = _islandsParticles[i];
+    if(_particles.state[p] == Particles::IDLE)
+      _particles.state[p] = Particles::ACTIVE;
+  }
+}
+
+// islands never share a particle so flagged ones are woken concurrently
+void 
+Solver::_WakeIslands(const std::atomic<bool>* wake)
+{
+  WorkParallelForN(_islands.size(), [&](size_t begin, size_t end) {
+    for(size_t i = begin; i < end; ++i)
+      if(wake[i])_WakeIsland(i);
+  });
+}
+
+// a collider that moved or deformed since last frame 
+// wakes the sleeping islands its bounds overlap 
+void 
+Solver::_WakeIslandsFromCollisions()
+{
+  if(!_sleepSubSteps || _collisionsBounds.size() != _collisions.size())return;
+
+  std::vector<std::pair<GfRange3d, double>> swepts;
+  for(size_t c = 0; c < _collisions.size(); ++c) {
+    Geometry* collider = _collisions[c]->GetGeometry();
+    if(!collider)continue;
+
+    const GfRange3d bounds = collider->GetBoundingBox().ComputeAlignedRange();
+    if(bounds == _collisionsBounds[c])continue;
+
+    GfRange3d swept(bounds);
+    swept.UnionWith(_collisionsBounds[c]);
+    _collisionsBounds[c] = bounds;
+    swepts.push_back(std::make_pair(swept, (double)_collisions[c]->GetMargin()));
+  }
+  if(!swepts.size())return;
+
+  WorkParallelForN(_islands.size(), [&](size_t begin, size_t end) {
+    for(size_t i = begin; i < end; ++i) {
+      if(!_islands[i].asleep)continue;
+      const GfRange3f& island = _islands[i].bounds;
+      for(const auto& swept: swepts) {
+        const GfRange3d expanded(
+          GfVec3d(island.GetMin()) - GfVec3d(swept.second),
+          GfVec3d(island.GetMax()) + GfVec3d(swept.second));
+        if(!GfRange3d::GetIntersection(swept.first, expanded).IsEmpty()) {
+          _WakeIsland(i);
+          break;
+        }
+      }
+    }
+  });
+}
+
+// a contact between an awake and a sleeping particle wakes both islands
+void 
+Solver::_WakeIslandsFromContacts(Collision* collision)
+{
+  const size_t numParticles = _particles.GetNumParticles();
+  if(!_sleepSubSteps || _particlesIsland.size() != numParticles)return;
+
+  std::unique_ptr<std::atomic<bool>[]> wake(new std::atomic<bool>[_islands.size()]());
+  std::atomic<bool> any(false);
+
+  WorkParallelForN(numParticles, [&](size_t begin, size_t end) {
+    for(size_t index = begin; index < end; ++index) {
+      if(_particles.state[index] == Particles::MUTE)continue;
+      const bool idle = _particles.state[index] == Particles::IDLE;
+      for(size_t c = 0; c < collision->GetNumContacts(index); ++c) {
+        const size_t other = collision->GetContactComponent(index, c);
+        if(other >= numParticles || _particles.state[other] == Particles::MUTE)continue;
+        if(idle == (_particles.state[other] == Particles::IDLE))continue;
+        wake[_particlesIsland[index]] = true;
+        wake[_particlesIsland[other]] = true;
+        any = true;
+      }
+    }
+  });
+
+  if(any)_WakeIslands(wake.get());
+}
+
+void 
+Solver::_UpdateIslands(size_t begin, size_t end)
+{
+  const GfVec3f* velocity = &_particles.velocity[0];
+  const float* mass = &_particles.mass[0];
+  const float threshold = 0.5f * _sleepThreshold * _sleepThreshold;
+
+  for(size_t index = begin; index < end; ++index) {
+    _Island& island = _islands[index];
+    if(island.asleep)continue;
+
+    const int first = _islandsOffsets[index];
+    const int last = _islandsOffsets[index + 1];
+
+    // kinetic energy per unit mass of the dynamic particles
+    float energy = 0.f, total = 0.f;
+    for(int i = first; i < last; ++i) {
+      const int p = _islandsParticles[i];
+      if(_particles.state[p] != Particles::ACTIVE || _particles.invMass[p] == 0.f)continue;
+      energy += 0.5f * mass[p] * velocity[p].GetLengthSq();
+      total += mass[p];
+    }
+    if(total == 0.f)continue;
+
+    if(energy < threshold * total) island.numCalm++;
+    else island.numCalm = 0;
+
+    if(island.numCalm < _sleepSubSteps)continue;
+
+    island.asleep = true;
+    island.bounds = GfRange3f();
+    for(int i = first; i < last; ++i) {
+      const int p = _islandsParticles[i];
+      if(_particles.state[p] != Particles::ACTIVE)continue;
+      _particles.state[p] = Particles::IDLE;
+      _particles.velocity[p] = GfVec3f(0.f);
+      _particles.predicted[p] = _particles.position[p];
+      island.bounds.UnionWith(_particles.position[p]);
+    }
+  }
+}
+
+// drop the body constraints, keeping what is needed to create them again
+void Solver::_RemoveConstraints(Body* body, std::vector<_Rebuild>& rebuilds)
+{
+  std::set<Constraint*> removed;
+  for(auto& groupIt: body->GetConstraintsGroups()) {
+    ConstraintsGroup* group = groupIt.second;
+    if(!group->constraints.size())continue;
+    _Rebuild rebuild = {body, group->type, 
+      group->constraints[0]->GetStiffness(), group->constraints[0]->GetDamp(), NULL};
+
+    // pins only hold some points, kept in geometry order with their target
+    if(group->type == Constraint::PIN) {
+      const size_t offset = body->GetOffset();
+      rebuild.target = ((PinConstraint*)group->constraints[0])->GetTarget();
+      for(auto& constraint: group->constraints)
+        for(const auto& elem: constraint->GetElements())
+          rebuild.points.push_back(body->GetPoint(elem - offset));
+    }
+    rebuilds.push_back(rebuild);
+
+    for(auto& constraint: group->constraints)
+      removed.insert(constraint);
+    group->constraints.clear();
+    group->numColors = 0;
+  }
+  if(!removed.size())return;
+
+  _constraints.erase(std::remove_if(_constraints.begin(), _constraints.end(),
+    [&](Constraint* constraint) {return removed.count(constraint) > 0;}), _constraints.end());
+  for(auto& constraint: removed)
+    delete constraint;
+  _constraintsDirty = true;
+}
+
+//-----------------------------------------------------------------------------------
+//   REORDER
+//-----------------------------------------------------------------------------------
+// sort each body particles along the morton curve of their rest positions so that
+// particles close in space are close in memory, constraints elements are remapped
+// and geometries keep their original points order (see UpdateInputs/UpdateGeometries)
+void Solver::_ReorderParticles(std::vector<_Rebuild>& rebuilds)
+{
+  bool haveOrder = false;
+  for(auto& body: _bodies)
+    haveOrder |= body->HasOrder();
+  if(!_reorderParticles && !haveOrder) return;
+
+  const size_t numParticles = _particles.GetNumParticles();
+  std::vector<int> remap(numParticles);
+  for(size_t p = 0; p < numParticles; ++p)
+    remap[p] = p;
+
+  size_t offset = 0;
+  for(auto& body: _bodies) {
+    Geometry* geometry = body->GetGeometry();
+    if(geometry->GetType() < Geometry::POINT) continue;
+
+    Deformable* deformable = (Deformable*)geometry;
+    const GfVec3f* positions = deformable->GetPositionsCPtr();
+    const size_t numPoints = deformable->GetNumPoints();
+
+    std::vector<int> order;
+    if(_reorderParticles) {
+      GfRange3d range;
+      for(size_t p = 0; p < numPoints; ++p)
+        range.UnionWith(GfVec3d(positions[p]));
+
+      std::vector<Morton> mortons(numPoints);
+      for(size_t p = 0; p < numPoints; ++p) {
+        mortons[p].code = MortonEncode3D(WorldToMorton(range, GfVec3d(positions[p])));
+        mortons[p].data = p;
+      }
+      WorkParallelSort(&mortons);
+
+      order.resize(numPoints);
+      for(size_t p = 0; p < numPoints; ++p)
+        order[p] = mortons[p].data;
+    }
+
+    // topology changed, constraints can't be remapped and are 
+    // created again once the body particles are added back
+    if(body->GetOffset() + body->GetNumPoints() > numParticles || 
+      body->GetNumPoints() != numPoints) {
+      _RemoveConstraints(body, rebuilds);
+      body->SetOrder(order);
+      offset += numPoints;
+      continue;
+    }
+
+    // old particle -> point -> new particle
+    const size_t previous = body->GetOffset();
+    std::vector<int> rank(numPoints);
+    for(size_t p = 0; p < numPoints; ++p)
+      rank[order.size() ? order[p] : p] = p;
+    for(size_t p = 0; p < numPoints; ++p)
+      remap[previous + p] = offset + rank[body->GetPoint(p)];
+
+    body->SetOrder(order);
+    offset += numPoints;
+  }
+
+  for(auto& constraint: _constraints) {
+    VtArray<int> elements = constraint->GetElements();
+    for(auto& elem: elements)
+      if(elem >= 0 && static_cast<size_t>(elem) < numParticles) elem = remap[elem];
+    constraint->SetElements(elements);
+  }
+}
+
 void Solver::Update(UsdStageRefPtr& stage, float time)
 {
   size_t numParticles = _particles.GetNumParticles();
@@ -538,6 +958,8 @@ void Solver::Reset(UsdStageRefPtr& stage)
   UpdateCollisions(stage, _startTime);
 
   // reset
+  std::vector<_Rebuild> rebuilds;
+  _ReorderParticles(rebuilds);
   _particles.RemoveAllBodies();
 
   for (size_t b = 0; b < _bodies.size(); ++b) {
@@ -545,7 +967,26 @@ void Solver::Reset(UsdStageRefPtr& stage)
     _particles.AddBody(_bodies[b], matrix);
   }
 
-  _particles.ResetCounter(_constraints, 0);
+  for(auto& rebuild: rebuilds) {
+    if(rebuild.type != Constraint::PIN) {
+      CreateConstraints(rebuild.body, rebuild.type, rebuild.stiffness, rebuild.damp);
+      continue;
+    }
+    // points removed with the topology change are dropped from the pin
+    VtArray<int> points;
+    const size_t numPoints = rebuild.body->GetGeometry()->GetNumPoints();
+    for(const auto& point: rebuild.points)
+      if(static_cast<size_t>(point) < numPoints) points.push_back(point);
+    if(!points.size())continue;
+
+    ConstraintsGroup* group = CreatePinConstraints(rebuild.body, rebuild.target, 
+      rebuild.stiffness, rebuild.damp, &points);
+    if(group != NULL)
+      for(auto& constraint: group->constraints)
+        AddConstraint(constraint);
+  }
+
+  _UpdateConstraintsCounter();
   
   size_t nL = 5;
   for (size_t b = 0; b < _bodies.size(); ++b) {
@@ -570,12 +1011,15 @@ void Solver::Reset(UsdStageRefPtr& stage)
 
   _particles.SetAllState(Particles::ACTIVE);
 
+  _contacts.clear();
   if(_selfCollisions)delete _selfCollisions;
   _selfCollisions = new SelfCollision(&_particles, 
     GetPrim().GetPath().AppendProperty(TfToken("selfCollide")), 0.5f, 0.5f);
 
   for(auto& constraint: _constraints)
     constraint->Reset(&_particles);
+
+  _BuildIslands();
   
   if(_selfCollisions)
     _selfCollisions->Reset();
@@ -595,6 +1039,12 @@ void Solver::Step(UsdStageRefPtr& stage, float time)
   const size_t numParticles = _particles.GetNumParticles();
   if (!numParticles)return;
 
+  // bodies or constraints changed, islands are built again with the counters
+  if(_constraintsDirty) {
+    _UpdateConstraintsCounter();
+    _BuildIslands();
+  }
+
   size_t numThreads = WorkGetConcurrencyLimit();
 
   size_t packetSize = numParticles / (numThreads > 1 ? numThreads - 1 : 1);
@@ -613,7 +1063,10 @@ void Solver::Step(UsdStageRefPtr& stage, float time)
 
     _timer->Next();
     // solve and apply constraint
-    _SolveConstraints(_constraints);
+    if(_graphColoring)
+      _SolveColoredConstraints();
+    else
+      _SolveConstraints(_constraints);
 
     _timer->Next();
      _UpdateContacts();
@@ -628,6 +1081,13 @@ void Solver::Step(UsdStageRefPtr& stage, float time)
       numParticles,
       std::bind(&Solver::_UpdateParticles, this,
         std::placeholders::_1, std::placeholders::_2), packetSize);
+
+    // put calm islands to sleep
+    if(_sleepSubSteps)
+      WorkParallelForN(
+        _islands.size(),
+        std::bind(&Solver::_UpdateIslands, this,
+          std::placeholders::_1, std::placeholders::_2));
     _timer->Stop();
 
   }
@@ -639,22 +1099,54 @@ void Solver::Step(UsdStageRefPtr& stage, float time)
 
 void Solver::UpdateInputs(UsdStageRefPtr& stage, float time)
 {
-  for(size_t i = 0; i < _bodies.size(); ++i){
-    UsdPrim prim = _bodies[i]->GetGeometry()->GetPrim();
-    if(!prim.IsValid())continue;
-
-    if (prim.IsA<UsdGeomMesh>()) {
-      UsdGeomMesh mesh(prim);
-      VtArray<GfVec3f> inputs;
-      mesh.GetPointsAttr().Get(&inputs, time);
-
-      const GfMatrix4d& matrix = _bodies[i]->GetGeometry()->GetMatrix();
+  const size_t numParticles = _particles.GetNumParticles();
+  const bool haveIslands = _sleepSubSteps > 0 && 
+    _particlesIsland.size() == numParticles;
 
-      for (size_t p = 0; p < inputs.size(); ++p)
-        _particles.input[_bodies[i]->GetOffset() + p] = GfVec3f(matrix.Transform(inputs[p]));
+  std::unique_ptr<std::atomic<bool>[]> wake;
+  std::atomic<bool> any(false);
+  if(haveIslands)
+    wake.reset(new std::atomic<bool>[_islands.size()]());
 
+  for(size_t i = 0; i < _bodies.size(); ++i){
+    Body* body = _bodies[i];
+    Geometry* geometry = body->GetGeometry();
+    if(geometry->GetType() < Geometry::POINT)continue;
+
+    // the scene sync already read the points, outputs written back by
+    // the solver leave the inputs unchanged
+    Deformable* deformable = (Deformable*)geometry;
+    if(!deformable->ArePositionsSynced())continue;
+
+    const GfMatrix4d& matrix = geometry->GetMatrix();
+    const size_t offset = body->GetOffset();
+    const size_t numPoints = GfMin(deformable->GetNumPoints(), body->GetNumPoints());
+    const GfVec3f* inputs = deformable->GetPositionsCPtr();
+
+    // in order without islands the batch lands straight in the particles
+    if(!haveIslands && !body->HasOrder()) {
+      TransformPoints(matrix, inputs, &_particles.input[offset], numPoints);
+      continue;
     }
+
+    _inputs.resize(numPoints);
+    TransformPoints(matrix, inputs, &_inputs[0], numPoints);
+
+    // an input change wakes the island it belongs to
+    WorkParallelForN(numPoints, [&](size_t begin, size_t end) {
+      for (size_t p = begin; p < end; ++p) {
+        const size_t index = offset + body->GetParticle(p);
+        if(haveIslands && _particles.state[index] == Particles::IDLE &&
+          (_inputs[p] - _particles.input[index]).GetLength() > _sleepThreshold) {
+          wake[_particlesIsland[index]] = true;
+          any = true;
+        }
+        _particles.input[index] = _inputs[p];
+      }
+    });
   }
+
+  if(any)_WakeIslands(wake.get());
 }
 
 void Solver::UpdateCollisions(UsdStageRefPtr& stage, float time)
@@ -681,15 +1173,26 @@ void Solver::UpdateGeometries()
       Geometry* geometry = it->second.second;
       if(geometry->GetType() >= Geometry::POINT) {
         Deformable* deformable = (Deformable*)geometry;
-        size_t numPoints = body->GetNumPoints();
-        GfVec3f* output = deformable->GetPositionsPtr();
-        size_t offset = body->GetOffset();
+        const size_t numPoints = body->GetNumPoints();
+        if(numPoints != deformable->GetNumPoints())continue;
+
+        const size_t offset = body->GetOffset();
+        const GfMatrix4d& inverse = deformable->GetInverseMatrix();
+
+        // back to the geometry points order in local space
+        _outputs.resize(numPoints);
+        WorkParallelForN(numPoints, [&](size_t begin, size_t end) {
+          for (size_t p = begin; p < end; ++p)
+            _outputs[body->GetPoint(p)] = 
+              GfVec3f(inverse.Transform(positions[offset + p]));
+        });
+
         GfRange3f range;
-        for (size_t p = 0; p < numPoints; ++p) {
-          const GfVec3f local(deformable->GetInverseMatrix().Transform(positions[offset + p]));
-          range.UnionWith(local);
-          output[p] = local;
-        }
+        for (size_t p = 0; p < numPoints; ++p)
+          range.UnionWith(_outputs[p]);
+
+        // keeps the previous points and the normals in sync
+        deformable->SetPositions(&_outputs[0], numPoints);
         deformable->SetBoundingBox(range);
 
         _scene->MarkPrimDirty(id, HdChangeTracker::DirtyPoints);
@@ -4,8 +4,11 @@
 #include <string>
 #include <limits>
 #include <map>
+#include <atomic>
 #include <pxr/base/gf/matrix4f.h>
 #include <pxr/base/gf/rotation.h>
+#include <pxr/base/gf/range3f.h>
+#include <pxr/base/gf/range3d.h>
 #include <pxr/base/vt/array.h>
 #include <pxr/base/tf/callContext.h>
 #include <pxr/base/tf/warning.h>
@@ -48,14 +51,25 @@ public:
   // attributes
   float GetSleepThreshold() { return _sleepThreshold; };
   void SetSleepThreshold(float threshold) { _sleepThreshold = threshold; };
+  // calm substeps before an island sleeps, zero disables sleeping
+  size_t GetSleepSubSteps() { return _sleepSubSteps; };
+  void SetSleepSubSteps(size_t subSteps) { _sleepSubSteps = subSteps; };
   float GetStartTime() { return _startTime; };
   void SetStartTime(float startFrame) { _startTime = startFrame; };
+  // graph coloring mode is picked up on next step
+  bool GetGraphColoring() { return _graphColoring; };
+  void SetGraphColoring(bool graphColoring) { 
+    _graphColoring = graphColoring; _constraintsDirty = true; };
+  // morton sort of the particles is picked up on next reset
+  bool GetReorderParticles() { return _reorderParticles; };
+  void SetReorderParticles(bool reorder) { _reorderParticles = reorder; };
 
   // system
   size_t GetNumParticles() { return _particles.GetNumParticles(); };
   size_t GetNumConstraints() { return _constraints.size(); };
   size_t GetNumForces() { return _forces.size(); };
   size_t GetNumCollisions() { return _collisions.size(); };
+  size_t GetNumIslands() { return _islands.size(); };
 
   // bodies
   std::vector<Body*> GetBodies(){return _bodies;};
@@ -123,10 +137,41 @@ public:
   const _ElementMap& GetElements(){return _elements;};
 
 private:
+  // connected component of the constraint graph put to sleep as a whole
+  struct _Island {
+    GfRange3f                         bounds;   // particles bounds while asleep
+    size_t                            numCalm;  // consecutive substeps under sleep threshold
+    bool                              asleep;
+  };
+
+  // constraints dropped on a topology change, created again on reset
+  struct _Rebuild {
+    Body*                             body;
+    short                             type;
+    float                             stiffness;
+    float                             damp;
+    Geometry*                         target;   // pin only
+    VtArray<int>                      points;   // pin only, geometry points
+  };
+
+  void _ReorderParticles(std::vector<_Rebuild>& rebuilds);
+  void _RemoveConstraints(Body* body, std::vector<_Rebuild>& rebuilds);
+
+  void _BuildIslands();
+  void _UpdateIslands(size_t begin, size_t end);
+  void _WakeIsland(size_t island);
+  void _WakeIslands(const std::atomic<bool>* wake);
+  void _WakeIslandsFromCollisions();
+  void _WakeIslandsFromContacts(Collision* collision);
+  bool _IsAsleep(Constraint* constraint);
+
   void _PrepareContacts();
   void _UpdateContacts();
 
+  void _BuildConstraintsColors();
+  void _UpdateConstraintsCounter();
   void _SolveConstraints(std::vector<Constraint*>& constraints);
+  void _SolveColoredConstraints();
   void _SolveVelocities(std::vector<Constraint*>& constraints);
 
   void _IntegrateParticles(size_t begin, size_t end);
@@ -134,16 +179,21 @@ private:
 
   int                                 _subSteps;
   float                               _sleepThreshold;
+  size_t                              _sleepSubSteps;
   float                               _startTime;
   float                               _frameTime;
   float                               _stepTime;
 
   bool                                _initialized;
   bool                                _paused;	
+  bool                                _graphColoring;
+  bool                                _constraintsDirty;
+  bool                                _reorderParticles;
 
   // system
   Particles                           _particles;
   std::vector<Constraint*>            _constraints; // static
+  std::vector<std::vector<Constraint*>> _colors;    // static by color
   std::vector<Constraint*>            _contacts;    // dynamic
   std::vector<Collision*>             _collisions;
   Collision*                          _selfCollisions;
@@ -152,6 +202,18 @@ private:
   GravityForce*                       _gravity;
   DampForce*                          _damp;
 
+  // islands
+  std::vector<_Island>                _islands;
+  std::vector<int>                    _particlesIsland;
+  std::vector<int>                    _islandsParticles;
+  std::vector<int>                    _islandsOffsets;
+  std::vector<GfRange3d>              _collisionsBounds;
+
+  // inputs transformed to world space before their scatter
+  std::vector<GfVec3f>                _inputs;
+  // outputs back in the geometries points order before their write
+  std::vector<GfVec3f>                _outputs;
+
   // scene
   _ElementMap                         _elements;
   Scene*                              _scene;
@@ -60,17 +60,14 @@ void TestRaycast::_UpdateRays()
 }
 
 // thread task
-void TestRaycast::_FindHits(size_t begin, size_t end, const GfVec3f* positions, 
+void TestRaycast::_FindHits(size_t begin, size_t end, const Location* locations, 
   GfVec3f* results, bool* hits)
 {
   for (size_t index = begin; index < end; ++index) {
-    GfRay ray(positions[index*2], positions[index*2+1] - positions[index*2]);
-    double minDistance = DBL_MAX;
-    Location hit;
-    Deformable* deformable;
+    const Location& hit = locations[index];
     hits[index] = false;
 
-    if (_bvh.Raycast(ray, &hit, DBL_MAX, &minDistance)) {
+    if (hit.IsValid()) {
 
       const Geometry* collided = _bvh.GetGeometry(hit.GetGeometryIndex());
       const GfMatrix4d& matrix = collided->GetMatrix();
@@ -99,20 +96,25 @@ void TestRaycast::_FindHits(size_t begin, size_t end, const GfVec3f* positions,
   }
 }
 
-// parallelize raycast
+// batch raycast then resolve hit positions in parallel
 void TestRaycast::_UpdateHits()
 {
   const GfVec3f* positions = _rays->GetPositionsCPtr();
   size_t numRays = _rays->GetNumPoints() >> 1;
 
+  std::vector<GfRay> rays(numRays);
+  for(size_t r = 0; r < numRays; ++r)
+    rays[r] = GfRay(positions[r*2], positions[r*2+1] - positions[r*2]);
+
+  std::vector<Location> locations(numRays);
+  _bvh.RaycastBatch(rays.data(), numRays, locations.data());
+
   VtArray<GfVec3f> points(numRays);
   VtArray<bool> hits(numRays, false);
 
-  hits.resize(numRays, false);
-
-  WorkParallelForN(_rays->GetNumCurves(),
+  WorkParallelForN(numRays,
     std::bind(&TestRaycast::_FindHits, this, std::placeholders::_1, 
-      std::placeholders::_2, positions, &points[0], &hits[0]), 32);
+      std::placeholders::_2, locations.data(), points.data(), hits.data()), 32);
 
   // need accumulate result
   VtArray<GfVec3f> result;
@@ -1,7 +1,7 @@
 #ifndef JVR_TEST_RAYCAST_H
 #define JVR_TEST_RAYCAST_H
 
-#include "../acceleration/bvh.h"
+#include "../acceleration/wideBvh.h"
 #include "../exec/execution.h"
 
 JVR_NAMESPACE_OPEN_SCOPE
@@ -10,7 +10,6 @@ JVR_NAMESPACE_OPEN_SCOPE
 class Curve;
 class Mesh;
 class Points;
-class BVH;
 
 class TestRaycast : public Execution {
 public:
@@ -22,7 +21,7 @@ public:
 
 protected:
   void _UpdateRays() ;
-  void _FindHits(size_t begin, size_t end, const GfVec3f* positions, 
+  void _FindHits(size_t begin, size_t end, const Location* locations, 
     GfVec3f* results, bool* hits);
   void _UpdateHits();
   void _TraverseStageFindingMeshes(UsdStageRefPtr& stage);
@@ -33,7 +32,7 @@ private:
   Mesh*                     _mesh;
   Curve*                    _rays;
   Points*                   _hits;
-  BVH                       _bvh;
+  BVH4                      _bvh;
 
   std::vector<SdfPath> _subjectsId;
   SdfPath              _meshId;
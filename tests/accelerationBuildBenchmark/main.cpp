@@ -22,6 +22,8 @@
 #include "../../src/utils/timer.h"
 #include "../../src/acceleration/intersector.h"
 #include "../../src/acceleration/bvh.h"
+#include "../../src/acceleration/wideBvh.h"
+#include "../../src/acceleration/twoLevelBvh.h"
 #include "../../src/acceleration/grid3d.h"
 #include "../../src/acceleration/octree.h"
 #include "../../src/geometry/mesh.h"
@@ -47,15 +49,13 @@ void _TraverseStageFindingMeshes(pxr::UsdStageRefPtr& stage)
 }
 
 // thread task
-void _FindHits(size_t begin, size_t end, const pxr::GfVec3f* positions, 
+void _FindHits(size_t begin, size_t end, const Location* locations, 
   pxr::GfVec3f* results, bool* hits, Intersector* intersector)
 {
   for (size_t index = begin; index < end; ++index) {
-    pxr::GfRay ray(positions[index * 2], positions[index * 2 + 1] - positions[index * 2]);
-    double minDistance = DBL_MAX;
-    Location hit;
+    const Location& hit = locations[index];
     hits[index] = false;
-    if (intersector->Raycast(ray, &hit, DBL_MAX, &minDistance)) {
+    if (hit.IsValid()) {
       Geometry* collided = intersector->GetGeometry(hit.GetGeometryIndex());
       const pxr::GfMatrix4d& matrix = collided->GetMatrix();
       switch (collided->GetType()) {
@@ -71,21 +71,24 @@ void _FindHits(size_t begin, size_t end, const pxr::GfVec3f* positions,
   }
 }
 
-
-
 void _Raycast(const pxr::GfVec3f* positions, Intersector* intersector, const char* title)
 {
   std::cout << title << " raycast  " << _numRays << " random rays..." << std::endl;
   uint64_t sT = ArchGetTickTime();
 
+  std::vector<pxr::GfRay> rays(_numRays);
+  for(size_t r = 0; r < _numRays; ++r)
+    rays[r] = pxr::GfRay(positions[r * 2], positions[r * 2 + 1] - positions[r * 2]);
+
+  std::vector<Location> locations(_numRays);
+  intersector->RaycastBatch(rays.data(), _numRays, locations.data());
+
   pxr::VtArray<pxr::GfVec3f> points(_numRays);
   pxr::VtArray<bool> hits(_numRays, false);
 
-  hits.resize(_numRays, false);
-
   pxr::WorkParallelForN(_numRays,
     std::bind(&_FindHits, std::placeholders::_1, 
-      std::placeholders::_2, positions, &points[0], &hits[0], intersector));
+      std::placeholders::_2, locations.data(), &points[0], &hits[0], intersector));
 
   // need accumulate result
   pxr::VtArray<pxr::GfVec3f> result;
@@ -104,6 +107,17 @@ void _Raycast(const pxr::GfVec3f* positions, Intersector* intersector, const cha
 
 }
 
+void _Closest(const pxr::GfVec3f* positions, Intersector* intersector, const char* title)
+{
+  std::cout << title << " closest  " << _numRays << " random points..." << std::endl;
+  uint64_t sT = ArchGetTickTime();
+
+  std::vector<Location> locations(_numRays);
+  size_t numHits = intersector->ClosestBatch(positions, _numRays, locations.data());
+
+  std::cout << title << " time : " << ((double)(ArchGetTickTime() - sT) *1e-9) << "seconds" << std::endl;
+  std::cout << title << " hits : " << numHits << std::endl;
+}
 
 int main (int argc, char *argv[])
 {
@@ -135,8 +149,43 @@ int main (int argc, char *argv[])
     BVH bvh;
     bvh.Init({_meshes});
     std::cout << "bvh build took " << ((double)(ArchGetTickTime() - sT) *1e-9) << "seconds" << std::endl;
+    std::cout << "bvh nodes : " << bvh.GetNumNodes() << " (" << 
+      (bvh.GetNumNodes() * sizeof(BVH::Node)) << " bytes)" << std::endl;
 
     _Raycast(&rays[0], &bvh, "bvh");
+    _Closest(&rays[0], &bvh, "bvh");
+
+    sT = ArchGetTickTime();
+    bvh.Update();
+    std::cout << "bvh update took " << ((double)(ArchGetTickTime() - sT) *1e-9) << "seconds" << std::endl;
+
+    sT = ArchGetTickTime();
+    BVH4 bvh4;
+    bvh4.Init({_meshes});
+    std::cout << "bvh4 build took " << ((double)(ArchGetTickTime() - sT) *1e-9) << "seconds" << std::endl;
+
+    _Raycast(&rays[0], &bvh4, "bvh4");
+    _Closest(&rays[0], &bvh4, "bvh4");
+
+    sT = ArchGetTickTime();
+    BVH8 bvh8;
+    bvh8.Init({_meshes});
+    std::cout << "bvh8 build took " << ((double)(ArchGetTickTime() - sT) *1e-9) << "seconds" << std::endl;
+
+    _Raycast(&rays[0], &bvh8, "bvh8");
+    _Closest(&rays[0], &bvh8, "bvh8");
+
+    sT = ArchGetTickTime();
+    TwoLevelBVH tlas;
+    tlas.Init({_meshes});
+    std::cout << "two level build took " << ((double)(ArchGetTickTime() - sT) *1e-9) << "seconds" << std::endl;
+
+    _Raycast(&rays[0], &tlas, "two level");
+    _Closest(&rays[0], &tlas, "two level");
+
+    sT = ArchGetTickTime();
+    tlas.Update();
+    std::cout << "two level update took " << ((double)(ArchGetTickTime() - sT) *1e-9) << "seconds" << std::endl;
 
     sT = ArchGetTickTime();
     Grid3D grid;
@@ -0,0 +1,100 @@
+#include <iostream>
+#include <map>
+
+#include <pxr/pxr.h>
+#include <pxr/base/gf/vec3f.h>
+#include <pxr/base/vt/array.h>
+
+#include "../../src/common.h"
+#include "../../src/geometry/halfEdge.h"
+#include "../../src/geometry/mesh.h"
+
+
+JVR_NAMESPACE_USING_DIRECTIVE
+
+// every half-edge twin against a map of the directed vertex pairs, and the
+// boundary vertices against the half-edges without twin
+bool _CheckTwins(Mesh* mesh, const char* title)
+{
+  HalfEdgeGraph graph;
+  graph.ComputeGraph(mesh);
+
+  const pxr::VtArray<HalfEdge>& edges = graph.GetEdges();
+  const pxr::VtArray<int>& faceCounts = mesh->GetFaceCounts();
+  if (edges.size() != mesh->GetFaceConnects().size()) {
+    std::cout << title << " : " << edges.size() << " half-edges for " <<
+      mesh->GetFaceConnects().size() << " face vertices" << std::endl;
+    return false;
+  }
+
+  std::map<std::pair<int, int>, int> directed;
+  for (size_t e = 0; e < edges.size(); ++e)
+    directed[{ edges[e].vertex, edges[edges[e].next].vertex }] = e;
+
+  std::vector<bool> boundary(mesh->GetNumPoints(), false);
+  size_t numTwins = 0;
+  for (size_t e = 0; e < edges.size(); ++e) {
+    const HalfEdge& edge = edges[e];
+    const int end = edges[edge.next].vertex;
+    if (edges[edge.prev].next != (int)e) {
+      std::cout << title << " : half-edge " << e << " broken face loop" << std::endl;
+      return false;
+    }
+
+    const auto it = directed.find({ end, edge.vertex });
+    const int expected = it != directed.end() ? it->second : HalfEdge::INVALID_INDEX;
+    if (edge.twin != expected) {
+      std::cout << title << " : half-edge " << e << " twin " << edge.twin <<
+        ", expected " << expected << std::endl;
+      return false;
+    }
+    if (expected == HalfEdge::INVALID_INDEX) {
+      boundary[edge.vertex] = boundary[end] = true;
+      continue;
+    }
+    if (edges[edge.twin].twin != (int)e) {
+      std::cout << title << " : half-edge " << e << " twin is not symmetric" << std::endl;
+      return false;
+    }
+    numTwins++;
+  }
+
+  const pxr::VtArray<bool>& boundaries = graph.GetBoundaries();
+  for (size_t p = 0; p < boundary.size(); ++p)
+    if (boundaries[p] != boundary[p]) {
+      std::cout << title << " : vertex " << p << " boundary " << boundaries[p] <<
+        ", expected " << boundary[p] << std::endl;
+      return false;
+    }
+
+  std::cout << title << " : " << faceCounts.size() << " faces, " << edges.size() <<
+    " half-edges, " << numTwins << " with twin" << std::endl;
+  return true;
+}
+
+int main (int argc, char *argv[])
+{
+  srand(7);
+  size_t failed = 0;
+
+  // closed, every half-edge has a twin
+  Mesh* cube = new Mesh();
+  cube->Cube();
+  if (!_CheckTwins(cube, "cube")) failed++;
+
+  // open, keys packed on more than 32 bits
+  Mesh* grid = new Mesh();
+  grid->RegularGrid2D(300, 300, 10.f, 10.f);
+  if (!_CheckTwins(grid, "grid")) failed++;
+
+  // disconnected triangles, no twin at all
+  Mesh* soup = new Mesh();
+  soup->PolygonSoup(1024);
+  if (!_CheckTwins(soup, "soup")) failed++;
+
+  delete soup;
+  delete grid;
+  delete cube;
+
+  return failed ? 1 : 0;
+}
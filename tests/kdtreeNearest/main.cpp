@@ -0,0 +1,134 @@
+#include <iostream>
+#include <algorithm>
+#include <cmath>
+#include <map>
+
+#include <pxr/pxr.h>
+#include <pxr/base/gf/vec3f.h>
+#include <pxr/base/gf/matrix4d.h>
+
+#include "../../src/common.h"
+#include "../../src/acceleration/kdtree.h"
+#include "../../src/geometry/mesh.h"
+
+
+JVR_NAMESPACE_USING_DIRECTIVE
+
+size_t _numPolygons = 2048;
+size_t _numQueries = 512;
+size_t _k = 16;
+float _radius = 1.f;
+
+// world points by the global index the tree reports
+std::map<size_t, pxr::GfVec3f> _points;
+
+void _GatherPoints(const KDTree& tree, const std::vector<Geometry*>& geometries)
+{
+  for (size_t g = 0; g < geometries.size(); ++g) {
+    const Mesh* mesh = (const Mesh*)geometries[g];
+    const size_t offset = tree.GetGeometryCellsStartIndex(g);
+    for (size_t p = 0; p < mesh->GetNumPoints(); ++p)
+      _points[offset + p] =
+        pxr::GfVec3f(mesh->GetMatrix().Transform(mesh->GetPositionsCPtr()[p]));
+  }
+}
+
+// squared distances to every point, sorted
+void _BruteForce(const pxr::GfVec3f& query, std::vector<KDTree::IndexDistance>& sorted)
+{
+  sorted.clear();
+  for (const auto& point: _points)
+    sorted.push_back({ point.first, (query - point.second).GetLengthSq() });
+  std::sort(sorted.begin(), sorted.end(),
+    [](const KDTree::IndexDistance& lhs, const KDTree::IndexDistance& rhs) {
+      return lhs.second < rhs.second; });
+}
+
+// ties may come in any order, so the distances are compared in order and
+// each returned index must sit at its reported distance
+bool _CheckNearest(const pxr::GfVec3f& query, const KDTree::IndexDistance* neighbors,
+  size_t found, const std::vector<KDTree::IndexDistance>& sorted)
+{
+  if (found != std::min(_k, sorted.size())) {
+    std::cout << "knn : found " << found << " neighbors, expected " <<
+      std::min(_k, sorted.size()) << std::endl;
+    return false;
+  }
+  for (size_t n = 0; n < found; ++n) {
+    const auto it = _points.find(neighbors[n].first);
+    if (it == _points.end() ||
+      std::abs(neighbors[n].second - sorted[n].second) > 1e-4f ||
+      std::abs(neighbors[n].second - (query - it->second).GetLengthSq()) > 1e-4f) {
+      std::cout << "knn : neighbor " << n << " index " << neighbors[n].first <<
+        " distance " << neighbors[n].second << ", expected " << sorted[n].second << std::endl;
+      return false;
+    }
+  }
+  return true;
+}
+
+bool _CheckRadius(const std::vector<KDTree::IndexDistance>& neighbors,
+  const std::vector<KDTree::IndexDistance>& sorted)
+{
+  std::vector<size_t> found, expected;
+  for (const auto& neighbor: neighbors) found.push_back(neighbor.first);
+  for (const auto& neighbor: sorted)
+    if (neighbor.second <= _radius * _radius) expected.push_back(neighbor.first);
+  std::sort(found.begin(), found.end());
+  std::sort(expected.begin(), expected.end());
+  if (found != expected) {
+    std::cout << "radius : found " << found.size() << " neighbors, expected " <<
+      expected.size() << std::endl;
+    return false;
+  }
+  return true;
+}
+
+int main (int argc, char *argv[])
+{
+  srand(7);
+
+  // two geometries, the second one moved so indices and matrices both count
+  Mesh* first = new Mesh();
+  first->PolygonSoup(_numPolygons, pxr::GfVec3f(-5.f), pxr::GfVec3f(5.f));
+  pxr::GfMatrix4d matrix(1.0);
+  matrix.SetTranslate(pxr::GfVec3d(4.0, 0.0, 0.0));
+  Mesh* second = new Mesh(matrix);
+  second->PolygonSoup(_numPolygons, pxr::GfVec3f(-5.f), pxr::GfVec3f(5.f));
+
+  std::vector<Geometry*> geometries = { first, second };
+  KDTree tree;
+  tree.Init(geometries);
+  _GatherPoints(tree, geometries);
+
+  std::vector<pxr::GfVec3f> queries(_numQueries);
+  for (auto& query: queries)
+    query = pxr::GfVec3f(
+      RANDOM_LO_HI(-7.f, 11.f), RANDOM_LO_HI(-7.f, 7.f), RANDOM_LO_HI(-7.f, 7.f));
+
+  std::vector<KDTree::IndexDistance> batch(_numQueries * _k);
+  tree.KNearestBatch(&queries[0], _numQueries, _k, &batch[0]);
+
+  size_t failed = 0;
+  std::vector<KDTree::IndexDistance> sorted, neighbors(_k), inRadius;
+  for (size_t q = 0; q < _numQueries; ++q) {
+    _BruteForce(queries[q], sorted);
+
+    const size_t found = tree.KNearest(queries[q], _k, &neighbors[0]);
+    if (!_CheckNearest(queries[q], &neighbors[0], found, sorted) ||
+      !_CheckNearest(queries[q], &batch[q * _k], _k, sorted)) {
+      failed++;
+      continue;
+    }
+
+    tree.RadiusSearch(queries[q], _radius, inRadius);
+    if (!_CheckRadius(inRadius, sorted)) failed++;
+  }
+
+  delete second;
+  delete first;
+
+  std::cout << "kdtree nearest : " << failed << " failed queries over " <<
+    _numQueries << std::endl;
+  return failed ? 1 : 0;
+}
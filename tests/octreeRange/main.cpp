@@ -0,0 +1,104 @@
+#include <iostream>
+#include <algorithm>
+
+#include <pxr/pxr.h>
+#include <pxr/base/gf/vec3f.h>
+#include <pxr/base/gf/range3d.h>
+#include <pxr/base/gf/range3f.h>
+
+#include "../../src/common.h"
+#include "../../src/acceleration/octree.h"
+#include "../../src/geometry/component.h"
+#include "../../src/geometry/mesh.h"
+
+
+JVR_NAMESPACE_USING_DIRECTIVE
+
+size_t _numPolygons = 4096;
+size_t _numQueries = 256;
+
+// overlap queries against a brute force test of every component bounds,
+// centroids in range are compared away from the morton quantization
+bool _CheckRange(const Octree& octree, const Mesh* mesh, const pxr::GfRange3d& range)
+{
+  const float epsilon = 1e-3f;
+  std::vector<size_t> expected, found;
+  for (size_t c = 0; c < octree.GetNumComponents(); ++c) {
+    const pxr::GfRange3f bounds = octree.GetComponent(c)->GetBoundingBox(
+      mesh->GetPositionsCPtr(), mesh->GetMatrix());
+    if (!pxr::GfRange3d::GetIntersection(range, pxr::GfRange3d(bounds)).IsEmpty())
+      expected.push_back(c);
+  }
+  octree.Overlap(range, found);
+  std::sort(found.begin(), found.end());
+  if (found != expected) {
+    std::cout << "overlap box : found " << found.size() <<
+      " components, expected " << expected.size() << std::endl;
+    return false;
+  }
+
+  found.clear();
+  octree.GetCentroidsInRange(range, found);
+  std::sort(found.begin(), found.end());
+  const pxr::GfVec3d pad(epsilon);
+  const pxr::GfRange3d inner(range.GetMin() + pad, range.GetMax() - pad);
+  const pxr::GfRange3d outer(range.GetMin() - pad, range.GetMax() + pad);
+  for (size_t c = 0; c < octree.GetNumComponents(); ++c) {
+    const pxr::GfVec3d centroid(octree.GetComponent(c)->GetBoundingBox(
+      mesh->GetPositionsCPtr(), mesh->GetMatrix()).GetMidpoint());
+    const bool isFound = std::binary_search(found.begin(), found.end(), c);
+    if (!inner.IsEmpty() && inner.Contains(centroid) && !isFound) {
+      std::cout << "centroids in range : missed component " << c << std::endl;
+      return false;
+    }
+    if (isFound && !outer.Contains(centroid)) {
+      std::cout << "centroids in range : component " << c << " out of range" << std::endl;
+      return false;
+    }
+  }
+  return true;
+}
+
+int main (int argc, char *argv[])
+{
+  srand(7);
+  Mesh* mesh = new Mesh();
+  mesh->PolygonSoup(_numPolygons, pxr::GfVec3f(-10.f), pxr::GfVec3f(10.f));
+
+  Octree octree;
+  octree.Init({ mesh });
+  if (octree.GetNumComponents() != mesh->GetNumTriangles()) {
+    std::cout << "octree : " << octree.GetNumComponents() << " components for " <<
+      mesh->GetNumTriangles() << " triangles" << std::endl;
+    return 1;
+  }
+
+  size_t failed = 0;
+  for (size_t q = 0; q < _numQueries; ++q) {
+    const pxr::GfVec3d center(
+      RANDOM_LO_HI(-12.f, 12.f), RANDOM_LO_HI(-12.f, 12.f), RANDOM_LO_HI(-12.f, 12.f));
+    const pxr::GfVec3d extent(
+      RANDOM_LO_HI(0.f, 4.f), RANDOM_LO_HI(0.f, 4.f), RANDOM_LO_HI(0.f, 4.f));
+    if (!_CheckRange(octree, mesh, pxr::GfRange3d(center - extent, center + extent)))
+      failed++;
+  }
+
+  // flat geometry, the degenerate axis is padded
+  Mesh* flat = new Mesh();
+  flat->RegularGrid2D(32, 32, 10.f, 10.f);
+  Octree flatOctree;
+  flatOctree.Init({ flat });
+  for (size_t q = 0; q < _numQueries; ++q) {
+    const pxr::GfVec3d center(RANDOM_LO_HI(-6.f, 6.f), 0.0, RANDOM_LO_HI(-6.f, 6.f));
+    const pxr::GfVec3d extent(RANDOM_LO_HI(0.f, 2.f), 0.1, RANDOM_LO_HI(0.f, 2.f));
+    if (!_CheckRange(flatOctree, flat, pxr::GfRange3d(center - extent, center + extent)))
+      failed++;
+  }
+
+  delete flat;
+  delete mesh;
+
+  std::cout << "octree range : " << failed << " failed queries over " <<
+    _numQueries * 2 << std::endl;
+  return failed ? 1 : 0;
+}
@@ -0,0 +1,90 @@
+#include <iostream>
+#include <cstring>
+
+#include <pxr/pxr.h>
+#include <pxr/base/gf/vec3f.h>
+#include <pxr/base/vt/array.h>
+#include <pxr/usd/sdf/path.h>
+#include <pxr/usd/usd/stage.h>
+#include <pxr/usd/usdGeom/mesh.h>
+#include <pxr/imaging/hd/changeTracker.h>
+
+#include "../../src/common.h"
+#include "../../src/geometry/mesh.h"
+#include "../../src/geometry/scene.h"
+
+
+JVR_NAMESPACE_USING_DIRECTIVE
+
+bool _CheckBits(Scene& scene, const pxr::SdfPath& path, pxr::HdDirtyBits expected,
+  const char* title)
+{
+  const pxr::HdDirtyBits bits = scene.GetPrim(path)->bits;
+  if (bits != expected) {
+    std::cout << title << " : bits " << bits << ", expected " << expected << std::endl;
+    return false;
+  }
+  return true;
+}
+
+int main (int argc, char *argv[])
+{
+  Mesh cube;
+  cube.Cube();
+
+  pxr::UsdStageRefPtr stage = pxr::UsdStage::CreateInMemory();
+  const pxr::SdfPath path("/cube");
+  pxr::UsdGeomMesh usdMesh = pxr::UsdGeomMesh::Define(stage, path);
+  usdMesh.CreatePointsAttr().Set(cube.GetPositions());
+  usdMesh.CreateFaceVertexCountsAttr().Set(cube.GetFaceCounts());
+  usdMesh.CreateFaceVertexIndicesAttr().Set(cube.GetFaceConnects());
+
+  Scene scene;
+  scene.AddGeometry(path, new Mesh(usdMesh, pxr::GfMatrix4d(1.0)));
+
+  size_t failed = 0;
+  const pxr::HdDirtyBits points = pxr::HdChangeTracker::DirtyPoints;
+  const pxr::HdDirtyBits transform = pxr::HdChangeTracker::DirtyTransform;
+
+  // marks in the same frame accumulate
+  scene.MarkPrimDirty(path, points);
+  scene.MarkPrimDirty(path, transform);
+  if (!_CheckBits(scene, path, points | transform, "mark twice")) failed++;
+  scene.GetPrim(path)->bits = pxr::HdChangeTracker::Clean;
+
+  // a sync that reads the same points leaves the prim clean
+  scene.Sync(stage);
+  if (!_CheckBits(scene, path, pxr::HdChangeTracker::Clean, "unchanged sync")) failed++;
+
+  // edited points are marked by the sync, on top of a previous mark
+  pxr::VtArray<pxr::GfVec3f> moved = cube.GetPositions();
+  for (auto& position: moved) position *= 2.f;
+  usdMesh.GetPointsAttr().Set(moved);
+  scene.MarkPrimDirty(path, transform);
+  scene.Sync(stage);
+  const pxr::HdDirtyBits bits = scene.GetPrim(path)->bits;
+  if (!(bits & points) || !(bits & transform)) {
+    std::cout << "edited sync : bits " << bits << ", expected points and transform" << std::endl;
+    failed++;
+  }
+  scene.GetPrim(path)->bits = pxr::HdChangeTracker::Clean;
+
+  // nothing changed since, the prim is skipped
+  scene.Sync(stage);
+  if (!_CheckBits(scene, path, pxr::HdChangeTracker::Clean, "skipped sync")) failed++;
+
+  // points written from code are read back from the stage
+  Mesh* mesh = (Mesh*)scene.GetPrim(path)->geom;
+  pxr::VtArray<pxr::GfVec3f> written = cube.GetPositions();
+  mesh->SetPositions(written);
+  scene.Sync(stage);
+  if (!mesh->ArePositionsSynced() || !(scene.GetPrim(path)->bits & points) ||
+    memcmp(mesh->GetPositionsCPtr(), moved.cdata(), moved.size() * sizeof(pxr::GfVec3f))) {
+    std::cout << "written sync : points not read back from the stage" << std::endl;
+    failed++;
+  }
+  scene.GetPrim(path)->bits = pxr::HdChangeTracker::Clean;
+
+  std::cout << "scene dirty bits : " << failed << " failed checks" << std::endl;
+  return failed ? 1 : 0;
+}